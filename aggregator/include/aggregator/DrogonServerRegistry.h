@@ -1,25 +1,62 @@
 #pragma once
 
 #include <drogon/WebSocketConnection.h>
+#include <common/utils/snapshot.h>
 
 namespace aggregator {
 
 class DrogonServerRegistry {
 public:
+    struct ServerEntry {
+        drogon::WebSocketConnectionPtr conn;
+        chat::ServerNodeInfo info;
+    };
+
+    // Consistent-hash ring with virtual nodes; depends only on the set of hosts
+    struct Ring {
+        std::vector<std::string> hosts; // sorted
+        std::vector<std::pair<uint64_t, std::size_t>> points; // hash and index into hosts, ordered by hash
+    };
+
+    // Immutable; replaced as a whole whenever a server is added, removed or reports its load.
+    struct Directory {
+        std::vector<ServerEntry> servers; // ordered by headroom, best first
+        std::string serialized_servers_response; // Envelope with the matching GetServerNodesResponse
+        std::shared_ptr<const Ring> ring; // shared between snapshots until a host joins or leaves
+    };
+    using DirectoryPtr = common::Snapshot<Directory>::Ptr;
+
     static DrogonServerRegistry& instance();
 
     void AddConnection(const drogon::WebSocketConnectionPtr& conn);
     void AddServer(const drogon::WebSocketConnectionPtr& conn);
     void RemoveConnection(const drogon::WebSocketConnectionPtr& conn);  
-    std::vector<std::string> GetServers();
+    void UpdateLoad(const drogon::WebSocketConnectionPtr& conn, const chat::ServerLoad& load);
+    void Touch(const drogon::WebSocketConnectionPtr& conn);
+    void RemoveStaleServers(std::chrono::steady_clock::duration max_silence);
+    void ProbeServers(int max_failures);
+    void RecordPong(const drogon::WebSocketConnectionPtr& conn, uint64_t nonce);
+    std::size_t GetClientCount() const;
+    DirectoryPtr GetDirectory() const;
+    std::optional<chat::ServerNodeInfo> Locate(std::string_view key) const;
+    void SendServerList(const drogon::WebSocketConnectionPtr& conn) const;
     void SendToClients(const chat::Envelope& env) const;
 
 private:
-    void SendToClients_unsafe(const chat::Envelope& env) const;
+    DrogonServerRegistry();
+
+    template <typename Mutator>
+    common::Snapshot<Directory>::Transition UpdateDirectory(Mutator&& mutator);
+    template <typename Predicate>
+    void RemoveServersIf(Predicate&& pred, std::string_view reason);
+
+    common::Snapshot<Directory> m_directory;
+
+    // Connections that are not registered servers
+    std::unordered_set<drogon::WebSocketConnectionPtr> m_clients;
+    mutable std::shared_mutex m_clients_mutex;
 
-    std::unordered_set<drogon::WebSocketConnectionPtr> m_conns;
-    std::unordered_map<std::string, drogon::WebSocketConnectionPtr> m_host_id_to_conn;
-    mutable std::shared_mutex m_mutex;
+    std::atomic<uint64_t> m_next_ping_nonce{1};
 };
 
 } // namespace aggregator
@@ -8,7 +8,11 @@ public:
     virtual void AddConnection() = 0;
     virtual void AddServer() = 0;
     virtual void RemoveConnection() = 0;
-    virtual std::vector<std::string> GetServers() = 0;
+    virtual void UpdateLoad(const chat::ServerLoad& load) = 0;
+    virtual void Touch() = 0;
+    virtual void RecordPong(uint64_t nonce) = 0;
+    virtual void SendServerList() const = 0;
+    virtual std::optional<chat::ServerNodeInfo> Locate(std::string_view key) const = 0;
     virtual void SendToClients(const chat::Envelope& env) const = 0;
 };
 
@@ -10,7 +10,11 @@ struct WsData;
 class MessageHandlers {
 public:
     drogon::Task<chat::RegisterServerResponse> handleServerRegister(const std::shared_ptr<WsData>& wsData, const chat::RegisterServerRequest& req, IServerRegistry& registry) const;
-    drogon::Task<chat::GetServerNodesResponse> handleGetServers(const std::shared_ptr<WsData>& wsData, const chat::GetServerNodesRequest& req, IServerRegistry& registry) const;
+    drogon::Task<> handleGetServers(const std::shared_ptr<WsData>& wsData, const chat::GetServerNodesRequest& req, IServerRegistry& registry) const;
+    drogon::Task<chat::HeartbeatResponse> handleHeartbeat(const std::shared_ptr<WsData>& wsData, const chat::HeartbeatRequest& req, IServerRegistry& registry) const;
+    drogon::Task<> handleServerLoadReport(const std::shared_ptr<WsData>& wsData, const chat::ServerLoadReport& req, IServerRegistry& registry) const;
+    drogon::Task<chat::LocateResponse> handleLocate(const std::shared_ptr<WsData>& wsData, const chat::LocateRequest& req, IServerRegistry& registry) const;
+    drogon::Task<> handlePingResponse(const std::shared_ptr<WsData>& wsData, const chat::PingResponse& resp, IServerRegistry& registry) const;
 };
 
 } // namespace aggregator
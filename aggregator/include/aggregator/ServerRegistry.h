@@ -11,7 +11,11 @@ public:
     void AddConnection() override;
     void AddServer() override;
     void RemoveConnection() override;
-    std::vector<std::string> GetServers() override;
+    void UpdateLoad(const chat::ServerLoad& load) override;
+    void Touch() override;
+    void RecordPong(uint64_t nonce) override;
+    void SendServerList() const override;
+    std::optional<chat::ServerNodeInfo> Locate(std::string_view key) const override;
     void SendToClients(const chat::Envelope& env) const override;
 
 private:
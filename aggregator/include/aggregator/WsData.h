@@ -2,8 +2,21 @@
 
 namespace aggregator {
 
+struct ProbeState {
+    uint64_t pendingNonce = 0; // 0 if no ping is outstanding
+    std::chrono::steady_clock::time_point pendingSentAt;
+    std::optional<double> srttMs;
+    double errorRate = 0.0;
+    int consecutiveFailures = 0;
+};
+
 struct WsData {
     std::optional<std::string> serverHost;
+    // steady_clock ticks of the last heartbeat or load report; written and read from different loops
+    std::atomic<int64_t> lastSeen{0};
+    // pings are sent from the main loop and answered on the connection's loop
+    std::mutex probeMutex;
+    ProbeState probe;
 };
 
 } // namespace aggregator
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <drogon/HttpController.h>
+
+namespace aggregator {
+
+class HttpController : public drogon::HttpController<HttpController> {
+public:
+    drogon::Task<drogon::HttpResponsePtr> metrics(drogon::HttpRequestPtr req) const;
+
+    METHOD_LIST_BEGIN
+        ADD_METHOD_TO(HttpController::metrics, "/metrics", drogon::Get);
+    METHOD_LIST_END
+};
+
+} // namespace aggregator
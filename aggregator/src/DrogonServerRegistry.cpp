@@ -4,60 +4,336 @@
 
 namespace aggregator {
 
+// A server is considered full when any of these is reached.
+static constexpr double CONNECTION_BUDGET = 10000.0;
+static constexpr double LOOP_LAG_BUDGET_MS = 100.0;
+static constexpr double HANDLER_P99_BUDGET_MS = 250.0;
+
+// Weight of a new sample in the smoothed RTT (as in TCP's SRTT) and in the error rate.
+static constexpr double RTT_SMOOTHING = 0.125;
+static constexpr double ERROR_RATE_SMOOTHING = 0.2;
+
+static double Headroom(const chat::ServerNodeInfo& info) {
+    const auto& load = info.load();
+    const double utilization = std::max({
+        load.connections() / CONNECTION_BUDGET,
+        load.loop_lag_ms() / LOOP_LAG_BUDGET_MS,
+        load.p99_handler_latency_ms() / HANDLER_P99_BUDGET_MS});
+    return std::clamp(1.0 - utilization, 0.0, 1.0) * (1.0 - info.error_rate());
+}
+
+// Virtual nodes per server; more of them even out the share of keys each server gets.
+static constexpr int RING_VIRTUAL_NODES = 128;
+
+// FNV-1a followed by the splitmix64 finalizer: stable across processes and
+// platforms, unlike std::hash, and well mixed for short similar keys.
+static uint64_t RingHash(std::string_view key) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for(unsigned char c : key) {
+        h = (h ^ c) * 0x100000001b3ULL;
+    }
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+    return h ^ (h >> 31);
+}
+
+static int64_t Now() {
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+}
+
+static void MarkSeen(const drogon::WebSocketConnectionPtr& conn) {
+    conn->getContextRef<WsData>().lastSeen.store(Now(), std::memory_order_relaxed);
+}
+
+// Keeps the list ordered and the serialized response in sync with it.
+static void Reindex(DrogonServerRegistry::Directory& dir) {
+    std::ranges::sort(dir.servers, [](const DrogonServerRegistry::ServerEntry& a, const DrogonServerRegistry::ServerEntry& b) {
+        if(a.info.headroom() != b.info.headroom()) {
+            return a.info.headroom() > b.info.headroom();
+        }
+        return a.info.load().connections() < b.info.load().connections();
+    });
+
+    chat::Envelope env;
+    auto* resp = env.mutable_get_servers_response();
+    for(const auto& server : dir.servers) {
+        *resp->add_servers() = server.info;
+    }
+    common::setStatus(*resp, chat::STATUS_SUCCESS);
+    dir.serialized_servers_response = env.SerializeAsString();
+
+    std::vector<std::string> hosts;
+    hosts.reserve(dir.servers.size());
+    for(const auto& server : dir.servers) {
+        hosts.push_back(server.info.host());
+    }
+    std::ranges::sort(hosts);
+    if(dir.ring && dir.ring->hosts == hosts) {
+        return;
+    }
+
+    // Points are derived from host names only, so a server joining or leaving
+    // moves just the keys adjacent to its own points.
+    auto ring = std::make_shared<DrogonServerRegistry::Ring>();
+    ring->points.reserve(hosts.size() * RING_VIRTUAL_NODES);
+    for(std::size_t i = 0; i < hosts.size(); ++i) {
+        for(int v = 0; v < RING_VIRTUAL_NODES; ++v) {
+            ring->points.emplace_back(RingHash(hosts[i] + "#" + std::to_string(v)), i);
+        }
+    }
+    std::ranges::sort(ring->points);
+    ring->hosts = std::move(hosts);
+    dir.ring = std::move(ring);
+}
+
 DrogonServerRegistry& DrogonServerRegistry::instance() {
     static DrogonServerRegistry inst;
     return inst;
 }
 
+DrogonServerRegistry::DrogonServerRegistry() {
+    UpdateDirectory([](Directory&) { return true; });
+}
+
+template <typename Mutator>
+common::Snapshot<DrogonServerRegistry::Directory>::Transition DrogonServerRegistry::UpdateDirectory(Mutator&& mutator) {
+    return m_directory.update([&mutator](Directory& dir) {
+        if(!mutator(dir)) {
+            return false;
+        }
+        Reindex(dir);
+        return true;
+    });
+}
+
 void DrogonServerRegistry::AddConnection(const drogon::WebSocketConnectionPtr& conn) {
-    std::unique_lock lock(m_mutex);
-    m_conns.insert(conn);
+    std::unique_lock lock(m_clients_mutex);
+    m_clients.insert(conn);
 }
 
 void DrogonServerRegistry::AddServer(const drogon::WebSocketConnectionPtr& conn) {
-    std::unique_lock lock(m_mutex);
-    auto& ws_data = conn->getContextRef<WsData>();
-    m_host_id_to_conn[*ws_data.serverHost] = conn;
+    {
+        std::unique_lock lock(m_clients_mutex);
+        m_clients.erase(conn);
+    }
+    MarkSeen(conn);
+
+    chat::ServerNodeInfo info;
+    info.set_host(*conn->getContextRef<WsData>().serverHost);
+    info.set_headroom(1.0);
+
+    UpdateDirectory([&conn, &info](Directory& dir) {
+        std::erase_if(dir.servers, [&info](const ServerEntry& s) { return s.info.host() == info.host(); });
+        dir.servers.push_back(ServerEntry{conn, info});
+        return true;
+    });
+
+    chat::Envelope env;
+    *env.mutable_server_added()->mutable_server() = std::move(info);
+    SendToClients(env);
+}
+
+void DrogonServerRegistry::UpdateLoad(const drogon::WebSocketConnectionPtr& conn, const chat::ServerLoad& load) {
+    MarkSeen(conn);
+
+    chat::ServerNodeInfo updated;
+    auto transition = UpdateDirectory([&conn, &load, &updated](Directory& dir) {
+        auto it = std::ranges::find(dir.servers, conn, &ServerEntry::conn);
+        if(it == dir.servers.end()) {
+            return false;
+        }
+        *it->info.mutable_load() = load;
+        it->info.set_headroom(Headroom(it->info));
+        updated = it->info;
+        return true;
+    });
+    if(!transition) {
+        return;
+    }
 
     chat::Envelope env;
-    env.mutable_server_added()->mutable_server()->set_host(*ws_data.serverHost);
-    SendToClients_unsafe(env);
+    *env.mutable_server_added()->mutable_server() = std::move(updated);
+    SendToClients(env);
+}
+
+void DrogonServerRegistry::Touch(const drogon::WebSocketConnectionPtr& conn) {
+    MarkSeen(conn);
 }
 
 void DrogonServerRegistry::RemoveConnection(const drogon::WebSocketConnectionPtr& conn) {
-    std::unique_lock lock(m_mutex);
+    {
+        std::unique_lock lock(m_clients_mutex);
+        if(m_clients.erase(conn)) {
+            return;
+        }
+    }
+
+    std::string host;
+    auto transition = UpdateDirectory([&conn, &host](Directory& dir) {
+        auto it = std::ranges::find(dir.servers, conn, &ServerEntry::conn);
+        if(it == dir.servers.end()) {
+            return false;
+        }
+        host = it->info.host();
+        dir.servers.erase(it);
+        return true;
+    });
+    if(!transition) {
+        return;
+    }
+
+    chat::Envelope env;
+    env.mutable_server_removed()->mutable_server()->set_host(host);
+    SendToClients(env);
+}
+
+void DrogonServerRegistry::RemoveStaleServers(std::chrono::steady_clock::duration max_silence) {
+    const auto cutoff = Now() - max_silence.count();
+    RemoveServersIf([cutoff](const ServerEntry& s) {
+        return s.conn->getContextRef<WsData>().lastSeen.load(std::memory_order_relaxed) < cutoff;
+    }, "missed its heartbeats");
+}
+
+void DrogonServerRegistry::ProbeServers(int max_failures) {
+    const auto dir = GetDirectory();
+    const auto now = std::chrono::steady_clock::now();
+    bool any_timeouts = false;
+
+    for(const auto& server : dir->servers) {
+        auto& ws_data = server.conn->getContextRef<WsData>();
+        chat::Envelope env;
+        {
+            std::lock_guard lock(ws_data.probeMutex);
+            auto& probe = ws_data.probe;
+            if(probe.pendingNonce != 0) {
+                probe.errorRate += ERROR_RATE_SMOOTHING * (1.0 - probe.errorRate);
+                ++probe.consecutiveFailures;
+                any_timeouts = true;
+            }
+            probe.pendingNonce = m_next_ping_nonce.fetch_add(1, std::memory_order_relaxed);
+            probe.pendingSentAt = now;
+            env.mutable_ping_request()->set_nonce(probe.pendingNonce);
+        }
+        common::sendEnvelope(server.conn, env);
+    }
+
+    if(!any_timeouts) {
+        return;
+    }
+    RemoveServersIf([max_failures](const ServerEntry& s) {
+        auto& ws_data = s.conn->getContextRef<WsData>();
+        std::lock_guard lock(ws_data.probeMutex);
+        return ws_data.probe.consecutiveFailures >= max_failures;
+    }, "stopped answering pings");
+
+    UpdateDirectory([](Directory& dir) {
+        for(auto& server : dir.servers) {
+            auto& ws_data = server.conn->getContextRef<WsData>();
+            std::lock_guard lock(ws_data.probeMutex);
+            server.info.set_error_rate(ws_data.probe.errorRate);
+            server.info.set_headroom(Headroom(server.info));
+        }
+        return true;
+    });
+}
+
+void DrogonServerRegistry::RecordPong(const drogon::WebSocketConnectionPtr& conn, uint64_t nonce) {
     auto& ws_data = conn->getContextRef<WsData>();
-    m_conns.erase(conn);
-    if(ws_data.serverHost) {
-        m_host_id_to_conn.erase(*ws_data.serverHost);
+    double srtt_ms = 0.0;
+    double error_rate = 0.0;
+    {
+        std::lock_guard lock(ws_data.probeMutex);
+        auto& probe = ws_data.probe;
+        if(nonce == 0 || nonce != probe.pendingNonce) {
+            return;
+        }
+        const double sample_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - probe.pendingSentAt).count();
+        probe.srttMs = probe.srttMs ? *probe.srttMs + RTT_SMOOTHING * (sample_ms - *probe.srttMs) : sample_ms;
+        probe.errorRate -= ERROR_RATE_SMOOTHING * probe.errorRate;
+        probe.consecutiveFailures = 0;
+        probe.pendingNonce = 0;
+        srtt_ms = *probe.srttMs;
+        error_rate = probe.errorRate;
+    }
+
+    UpdateDirectory([&conn, srtt_ms, error_rate](Directory& dir) {
+        auto it = std::ranges::find(dir.servers, conn, &ServerEntry::conn);
+        if(it == dir.servers.end()) {
+            return false;
+        }
+        it->info.set_rtt_ms(srtt_ms);
+        it->info.set_error_rate(error_rate);
+        it->info.set_headroom(Headroom(it->info));
+        return true;
+    });
+}
+
+template <typename Predicate>
+void DrogonServerRegistry::RemoveServersIf(Predicate&& pred, std::string_view reason) {
+    if(std::ranges::none_of(GetDirectory()->servers, pred)) {
+        return;
+    }
+
+    std::vector<ServerEntry> removed;
+    UpdateDirectory([&](Directory& dir) {
+        removed.clear();
+        for(auto it = dir.servers.begin(); it != dir.servers.end();) {
+            if(pred(*it)) {
+                removed.push_back(std::move(*it));
+                it = dir.servers.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        return !removed.empty();
+    });
+
+    // The server will reconnect and register again once it notices the closed link.
+    for(const auto& server : removed) {
+        LOG_WARN << "Server " << server.info.host() << " " << reason << ", removing it";
         chat::Envelope env;
-        env.mutable_server_removed()->mutable_server()->set_host(*ws_data.serverHost);
-        SendToClients_unsafe(env);
+        env.mutable_server_removed()->mutable_server()->set_host(server.info.host());
+        SendToClients(env);
+        server.conn->forceClose();
     }
 }
 
-std::vector<std::string> DrogonServerRegistry::GetServers() {
-    std::shared_lock lock(m_mutex);
-    std::vector<std::string> resp;
-    resp.reserve(m_host_id_to_conn.size());
-    for(const auto& p : m_host_id_to_conn) {
-        resp.emplace_back(p.first);
+std::size_t DrogonServerRegistry::GetClientCount() const {
+    std::shared_lock lock(m_clients_mutex);
+    return m_clients.size();
+}
+
+std::optional<chat::ServerNodeInfo> DrogonServerRegistry::Locate(std::string_view key) const {
+    const auto dir = GetDirectory();
+    const auto& points = dir->ring->points;
+    if(points.empty()) {
+        return std::nullopt;
     }
-    return resp;
+    auto it = std::ranges::lower_bound(points, RingHash(key), {}, &std::pair<uint64_t, std::size_t>::first);
+    if(it == points.end()) {
+        it = points.begin();
+    }
+    const auto& host = dir->ring->hosts[it->second];
+    auto server = std::ranges::find(dir->servers, host, [](const ServerEntry& s) -> const std::string& { return s.info.host(); });
+    return server->info;
 }
 
-void DrogonServerRegistry::SendToClients(const chat::Envelope& env) const {
-    std::shared_lock lock(m_mutex);
-    SendToClients_unsafe(env);
+DrogonServerRegistry::DirectoryPtr DrogonServerRegistry::GetDirectory() const {
+    return m_directory.load();
 }
 
-void DrogonServerRegistry::SendToClients_unsafe(const chat::Envelope& env) const {
-    for(const auto& conn : m_conns) {
-        auto& ws_data = conn->getContextRef<WsData>();
-        if(ws_data.serverHost) {
-            continue;
+void DrogonServerRegistry::SendServerList(const drogon::WebSocketConnectionPtr& conn) const {
+    const auto dir = m_directory.load();
+    conn->send(dir->serialized_servers_response, drogon::WebSocketMessageType::Binary);
+}
+
+void DrogonServerRegistry::SendToClients(const chat::Envelope& env) const {
+    const std::string bytes = env.SerializeAsString();
+    std::shared_lock lock(m_clients_mutex);
+    for(const auto& conn : m_clients) {
+        if(conn->connected()) {
+            conn->send(bytes, drogon::WebSocketMessageType::Binary);
         }
-        common::sendEnvelope(conn, env);
     }
 }
 
@@ -17,7 +17,24 @@ drogon::Task<chat::Envelope> MessageHandlerService::processMessage(const std::sh
             break;
         }
         case chat::Envelope::kGetServersRequest: {
-            *respEnv.mutable_get_servers_response() = co_await m_handlers->handleGetServers(wsData, env.get_servers_request(), registry);
+            co_await m_handlers->handleGetServers(wsData, env.get_servers_request(), registry);
+            break;
+        }
+        case chat::Envelope::kHeartbeatRequest: {
+            *respEnv.mutable_heartbeat_response() = co_await m_handlers->handleHeartbeat(wsData, env.heartbeat_request(), registry);
+            break;
+        }
+        case chat::Envelope::kServerLoadReport: {
+            // Reports are not answered; an empty envelope is not sent.
+            co_await m_handlers->handleServerLoadReport(wsData, env.server_load_report(), registry);
+            break;
+        }
+        case chat::Envelope::kLocateRequest: {
+            *respEnv.mutable_locate_response() = co_await m_handlers->handleLocate(wsData, env.locate_request(), registry);
+            break;
+        }
+        case chat::Envelope::kPingResponse: {
+            co_await m_handlers->handlePingResponse(wsData, env.ping_response(), registry);
             break;
         }
         default: {
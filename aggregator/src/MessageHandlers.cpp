@@ -13,16 +13,63 @@ drogon::Task<chat::RegisterServerResponse> MessageHandlers::handleServerRegister
     co_return resp;
 }
 
-drogon::Task<chat::GetServerNodesResponse> MessageHandlers::handleGetServers([[maybe_unused]] const std::shared_ptr<WsData>& wsData, [[maybe_unused]] const chat::GetServerNodesRequest& req, IServerRegistry& registry) const {
-    chat::GetServerNodesResponse resp;
+drogon::Task<> MessageHandlers::handleGetServers([[maybe_unused]] const std::shared_ptr<WsData>& wsData, [[maybe_unused]] const chat::GetServerNodesRequest& req, IServerRegistry& registry) const {
+    // The response is kept pre-serialized in the directory snapshot
+    registry.SendServerList();
+    co_return;
+}
 
-    for(const auto& server : registry.GetServers()) {
-        auto* server_info = resp.add_servers();
-        server_info->set_host(server);
+drogon::Task<chat::HeartbeatResponse> MessageHandlers::handleHeartbeat(const std::shared_ptr<WsData>& wsData, [[maybe_unused]] const chat::HeartbeatRequest& req, IServerRegistry& registry) const {
+    chat::HeartbeatResponse resp;
+    if(!wsData->serverHost) {
+        common::setStatus(resp, chat::STATUS_UNAUTHORIZED, "Not a registered server");
+        co_return resp;
     }
+    registry.Touch();
+    common::setStatus(resp, chat::STATUS_SUCCESS);
+    co_return resp;
+}
+
+drogon::Task<> MessageHandlers::handleServerLoadReport(const std::shared_ptr<WsData>& wsData, const chat::ServerLoadReport& req, IServerRegistry& registry) const {
+    if(!wsData->serverHost) {
+        co_return;
+    }
+    registry.UpdateLoad(req.load());
+}
 
+drogon::Task<chat::LocateResponse> MessageHandlers::handleLocate([[maybe_unused]] const std::shared_ptr<WsData>& wsData, const chat::LocateRequest& req, IServerRegistry& registry) const {
+    chat::LocateResponse resp;
+    std::string key;
+    switch(req.key_case()) {
+        case chat::LocateRequest::kRoomId: {
+            key = "room:" + std::to_string(req.room_id());
+            break;
+        }
+        case chat::LocateRequest::kUserId: {
+            key = "user:" + std::to_string(req.user_id());
+            break;
+        }
+        default: {
+            common::setStatus(resp, chat::STATUS_FAILURE, "No key to locate");
+            co_return resp;
+        }
+    }
+
+    auto server = registry.Locate(key);
+    if(!server) {
+        common::setStatus(resp, chat::STATUS_NOT_FOUND, "No servers registered");
+        co_return resp;
+    }
+    *resp.mutable_server() = std::move(*server);
     common::setStatus(resp, chat::STATUS_SUCCESS);
     co_return resp;
 }
 
+drogon::Task<> MessageHandlers::handlePingResponse(const std::shared_ptr<WsData>& wsData, const chat::PingResponse& resp, IServerRegistry& registry) const {
+    if(!wsData->serverHost || resp.status().code() != chat::STATUS_SUCCESS) {
+        co_return;
+    }
+    registry.RecordPong(resp.nonce());
+}
+
 } // namespace aggregator
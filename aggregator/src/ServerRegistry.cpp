@@ -19,8 +19,24 @@ void ServerRegistry::RemoveConnection() {
     DrogonServerRegistry::instance().RemoveConnection(m_conn);
 }
 
-std::vector<std::string> ServerRegistry::GetServers() {
-    return DrogonServerRegistry::instance().GetServers();
+void ServerRegistry::UpdateLoad(const chat::ServerLoad& load) {
+    DrogonServerRegistry::instance().UpdateLoad(m_conn, load);
+}
+
+void ServerRegistry::Touch() {
+    DrogonServerRegistry::instance().Touch(m_conn);
+}
+
+void ServerRegistry::RecordPong(uint64_t nonce) {
+    DrogonServerRegistry::instance().RecordPong(m_conn, nonce);
+}
+
+void ServerRegistry::SendServerList() const {
+    DrogonServerRegistry::instance().SendServerList(m_conn);
+}
+
+std::optional<chat::ServerNodeInfo> ServerRegistry::Locate(std::string_view key) const {
+    return DrogonServerRegistry::instance().Locate(key);
 }
 
 void ServerRegistry::SendToClients(const chat::Envelope& env) const {
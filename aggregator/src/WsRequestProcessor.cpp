@@ -20,7 +20,10 @@ drogon::Task<> WsRequestProcessor::handleIncomingMessage(drogon::WebSocketConnec
         }
         bytes.resize(0);
         ServerRegistry registry{conn};
-        common::sendEnvelope(conn, co_await m_dispatcher->processMessage(conn->getContext<WsData>(), env, registry));
+        auto respEnv = co_await m_dispatcher->processMessage(conn->getContext<WsData>(), env, registry);
+        if(respEnv.payload_case() != chat::Envelope::PAYLOAD_NOT_SET) {
+            common::sendEnvelope(conn, respEnv);
+        }
     } catch(const std::exception& e) {
         LOG_ERROR << "Critical error in WsRequestProcessor::handleIncomingMessage: " << e.what();
         common::sendEnvelope(conn, common::makeGenericErrorEnvelope("Critical server error during message handling."));
@@ -0,0 +1,34 @@
+#include <aggregator/controller/HttpController.h>
+#include <aggregator/DrogonServerRegistry.h>
+
+namespace aggregator {
+
+drogon::Task<drogon::HttpResponsePtr> HttpController::metrics([[maybe_unused]] drogon::HttpRequestPtr req) const {
+    const auto& registry = DrogonServerRegistry::instance();
+    const auto dir = registry.GetDirectory();
+
+    std::ostringstream body;
+    body << "# TYPE aggregator_clients gauge\n"
+         << "aggregator_clients " << registry.GetClientCount() << "\n"
+         << "# TYPE aggregator_servers gauge\n"
+         << "aggregator_servers " << dir->servers.size() << "\n";
+
+    auto per_server = [&](std::string_view name, auto value) {
+        body << "# TYPE " << name << " gauge\n";
+        for(const auto& server : dir->servers) {
+            body << name << "{host=\"" << server.info.host() << "\"} " << value(server.info) << "\n";
+        }
+    };
+    per_server("aggregator_server_rtt_ms", [](const chat::ServerNodeInfo& info) { return info.rtt_ms(); });
+    per_server("aggregator_server_error_rate", [](const chat::ServerNodeInfo& info) { return info.error_rate(); });
+    per_server("aggregator_server_headroom", [](const chat::ServerNodeInfo& info) { return info.headroom(); });
+    per_server("aggregator_server_connections", [](const chat::ServerNodeInfo& info) { return info.load().connections(); });
+
+    auto resp = drogon::HttpResponse::newHttpResponse();
+    resp->setStatusCode(drogon::k200OK);
+    resp->setContentTypeCode(drogon::CT_TEXT_PLAIN);
+    resp->setBody(body.str());
+    co_return resp;
+}
+
+} // namespace aggregator
@@ -1,9 +1,25 @@
 #include <aggregator/controller/WsController.h>
+#include <aggregator/DrogonServerRegistry.h>
+
+// Servers send a heartbeat every 2 seconds; three missed ones mark a server stale.
+static constexpr auto SERVER_MAX_SILENCE = std::chrono::seconds(6);
+static constexpr double STALE_SWEEP_INTERVAL_SEC = 1.0;
+// An unanswered ping counts as a failure once the next one is due.
+static constexpr double PING_INTERVAL_SEC = 2.0;
+static constexpr int PING_MAX_FAILURES = 3;
 
 int main() {
     std::filesystem::create_directory("logs");
     LOG_INFO << "Starting Drogon application...";
     drogon::app().loadConfigFile("config.json");
+    drogon::app().registerBeginningAdvice([]() {
+        drogon::app().getLoop()->runEvery(STALE_SWEEP_INTERVAL_SEC, []() {
+            aggregator::DrogonServerRegistry::instance().RemoveStaleServers(SERVER_MAX_SILENCE);
+        });
+        drogon::app().getLoop()->runEvery(PING_INTERVAL_SEC, []() {
+            aggregator::DrogonServerRegistry::instance().ProbeServers(PING_MAX_FAILURES);
+        });
+    });
     LOG_INFO << "Entering main loop...";
     drogon::app().run();
     LOG_INFO << "Drogon stopped.";
@@ -38,6 +38,8 @@ public:
     void UserJoin(const User& user);
     void UserLeft(const User& user);
     void UpdateUsername(int32_t userId, const wxString& newUsername);
+    // Puts the text of a message the server rejected back into the input, before anything typed since
+    void RestoreInput(const wxString& text);
 
     UserListPanel* m_userListPanel = nullptr;
     MessageView* m_messageView = nullptr;
@@ -11,6 +11,7 @@ struct Room : public wxClientData {
     int32_t room_id;
     wxString room_name;
     bool is_member;
+    int32_t unread = 0;
 
     Room(int32_t id, const wxString& name, bool member)
         : room_id(id), room_name(name), is_member(member) {}
@@ -24,6 +25,8 @@ public:
     void RemoveRoom(int32_t room_id);
     void RenameRoom(int32_t room_id, const wxString& name);
     std::optional<Room> GetSelectedRoom();
+    bool SelectRoom(int32_t room_id);
+    void SetUnreadCount(int32_t room_id, int32_t unread);
     void OnJoinRoom();
     void OnBecameMember();
 
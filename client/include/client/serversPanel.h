@@ -10,7 +10,9 @@ class ServersPanel : public wxPanel {
 public:
     ServersPanel(MainWidget* parent);
 
-    void SetServers(const std::vector<std::string>& servers);
+    void SetServers(const std::vector<chat::ServerNodeInfo>& servers);
+    void UpsertServer(const chat::ServerNodeInfo& server);
+    void RemoveServer(const std::string& host);
 private:
     // --- Event Handlers ---
     void OnConnect(wxCommandEvent& event);
@@ -19,9 +21,15 @@ private:
 
     // --- Helper function to manage button states ---
     void UpdateButtonsState();
+    // --- Re-sorts m_servers by headroom and rebuilds the list, keeping the selection ---
+    void RefreshList();
 
     MainWidget* m_parent = nullptr;
 
+    // Kept in the same order as the list box items
+    std::vector<chat::ServerNodeInfo> m_servers;
+    std::string m_selectedHost;
+
     // --- Controls ---
     wxListBox* m_listBox;
     wxButton* m_connectButton;
@@ -5,6 +5,8 @@
 #include <wx/longlong.h>
 #include <drogon/WebSocketClient.h>
 #include <optional>
+#include <atomic>
+#include <deque>
 
 namespace client {
 
@@ -27,7 +29,7 @@ public:
     void createRoom(const std::string& roomName);
     void joinRoom(int32_t room_id);
     void leaveRoom();
-    void sendMessage(const std::string& message);
+    bool sendMessage(const std::string& message);
     void getMessages(int32_t limit, int64_t offset_ts);
     void logout();
     void getServers();
@@ -47,6 +49,13 @@ public:
 private:
     void sendEnvelope(const chat::Envelope& env);
     void handleMessage(const std::string& msg);
+    void handleEnvelope(chat::Envelope env);
+    bool acceptRoomEvent(int64_t seq);
+    void requestRoomSync();
+    void startRoomNumbering(const chat::JoinRoomResponse& response);
+    void resumeSession();
+    void onLoggedIn(const chat::UserInfo& user_info, const google::protobuf::RepeatedPtrField<chat::RoomInfo>& proto_rooms, bool show_rooms = true);
+    void showJoinedRoom(const chat::JoinRoomResponse& response);
 
     // UI helpers
     void showError(const wxString& msg);
@@ -61,7 +70,9 @@ private:
     void showAuth();
     void showServers();
     void showInitial();
-    void SetServers(const std::vector<std::string> &servers);
+    void SetServers(const std::vector<chat::ServerNodeInfo> &servers);
+    void upsertServer(const chat::ServerNodeInfo& server);
+    void removeServer(const std::string& host);
     void updateUserRole(int32_t userId, chat::UserRights newRole);
     void removeMessageFromView(int32_t messageId);
     void addRoom(Room* room);
@@ -71,6 +82,28 @@ private:
     MainWidget* ui;
     std::shared_ptr<drogon::WebSocketConnection> conn;
     drogon::WebSocketClientPtr client;
+
+    // Session resumption state, only touched on the network loop
+    std::string address;
+    std::string sessionAddress; // server that issued sessionToken
+    std::string sessionToken;
+    std::optional<int32_t> pendingRoomId;
+    std::optional<int32_t> currentRoomId;
+
+    // Event numbering of the current room, only touched on the network loop.
+    // An empty epoch means the numbers are unknown (no room, or a join in flight).
+    std::string roomEpoch;
+    int64_t roomSeq = 0;
+    bool roomSyncPending = false;
+    // The highest event number dropped while a join was in flight
+    int64_t roomSeqSkipped = 0;
+
+    // Texts of sent messages awaiting their SendMessageResponse, in send order; network loop only
+    std::deque<std::string> unconfirmedMessages;
+
+    // Rate limit backoff (steady clock ms), set from the network loop and read from the UI
+    std::atomic<int64_t> sendBlockedUntilMs{0};
+    std::atomic<int64_t> typingBlockedUntilMs{0};
 };
 
 } // namespace client
@@ -164,9 +164,19 @@ void ChatPanel::OnSend(wxCommandEvent&) {
             m_isTyping = false;
             m_parent->wsClient->sendTypingStop();
         }
-        m_parent->wsClient->sendMessage(m_input_ctrl->GetValue().utf8_string());
-        m_input_ctrl->Clear();
+        if (m_parent->wsClient->sendMessage(m_input_ctrl->GetValue().utf8_string())) {
+            m_input_ctrl->Clear();
+        }
+    }
+}
+
+void ChatPanel::RestoreInput(const wxString& text) {
+    if (m_input_ctrl->IsEmpty()) {
+        m_input_ctrl->SetValue(text);
+    } else {
+        m_input_ctrl->SetValue(text + "\n" + m_input_ctrl->GetValue());
     }
+    m_input_ctrl->SetInsertionPointEnd();
 }
 
 void ChatPanel::OnLeave(wxCommandEvent&) {
@@ -28,6 +28,17 @@ wxBEGIN_EVENT_TABLE(RoomsPanel, wxPanel)
     EVT_BUTTON(ID_ACCOUNT, RoomsPanel::OnAccount)
 wxEND_EVENT_TABLE()
 
+// The list entry of a room: its name, followed by the unread count if there is one
+static wxString RoomLabel(const Room& room) {
+    if (room.unread <= 0) {
+        return room.room_name;
+    }
+    if (room.unread >= common::limits::MAX_UNREAD_COUNT) {
+        return wxString::Format("%s (%d+)", room.room_name, common::limits::MAX_UNREAD_COUNT - 1);
+    }
+    return wxString::Format("%s (%d)", room.room_name, room.unread);
+}
+
 RoomsPanel::RoomsPanel(wxWindow* parent) : wxPanel(parent), mainWin(static_cast<MainWidget*>(parent->GetParent())) {
     auto* sizer = new wxBoxSizer(wxVERTICAL);
 
@@ -90,7 +101,7 @@ void RoomsPanel::UpdateRoomList(const std::vector<Room*>& rooms) {
     m_publicRoomsList->Clear();
     for (auto* room : rooms){
         if (room->is_member) {
-            m_myRoomsList->Append(room->room_name, room);
+            m_myRoomsList->Append(RoomLabel(*room), room);
         }
         else {
             m_publicRoomsList->Append(room->room_name, room);
@@ -100,7 +111,7 @@ void RoomsPanel::UpdateRoomList(const std::vector<Room*>& rooms) {
 
 void RoomsPanel::AddRoom(Room* room) {
     if (room->is_member) {
-        int newIndex = m_myRoomsList->Append(room->room_name, room);
+        int newIndex = m_myRoomsList->Append(RoomLabel(*room), room);
         m_myRoomsList->SetSelection(newIndex);
         m_notebook->SetSelection(0);
     }
@@ -131,7 +142,7 @@ void RoomsPanel::RenameRoom(int32_t room_id, const wxString& name) {
         Room* roomData = dynamic_cast<Room*>(m_myRoomsList->GetClientObject(i));
         if (roomData && roomData->room_id == room_id) {
             roomData->room_name = name;
-            m_myRoomsList->SetString(i, name);
+            m_myRoomsList->SetString(i, RoomLabel(*roomData));
             break;
         }
     }
@@ -164,6 +175,31 @@ std::optional<Room> RoomsPanel::GetSelectedRoom() {
     return std::nullopt;
 }
 
+bool RoomsPanel::SelectRoom(int32_t room_id) {
+    for (unsigned int i = 0; i < m_myRoomsList->GetCount(); ++i) {
+        Room* roomData = dynamic_cast<Room*>(m_myRoomsList->GetClientObject(i));
+        if (roomData && roomData->room_id == room_id) {
+            m_notebook->SetSelection(0);
+            m_myRoomsList->SetSelection(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+void RoomsPanel::SetUnreadCount(int32_t room_id, int32_t unread) {
+    for (unsigned int i = 0; i < m_myRoomsList->GetCount(); ++i) {
+        Room* roomData = dynamic_cast<Room*>(m_myRoomsList->GetClientObject(i));
+        if (roomData && roomData->room_id == room_id) {
+            if (roomData->unread != unread) {
+                roomData->unread = unread;
+                m_myRoomsList->SetString(i, RoomLabel(*roomData));
+            }
+            return;
+        }
+    }
+}
+
 void RoomsPanel::OnJoinRoom() {
     auto selectedRoomOpt = GetSelectedRoom();
     if (!selectedRoomOpt.has_value()) {
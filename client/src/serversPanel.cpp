@@ -36,8 +36,7 @@ ServersPanel::ServersPanel(MainWidget* parent)
 void ServersPanel::OnConnect([[maybe_unused]] wxCommandEvent& event) {
     int selection = m_listBox->GetSelection();
     if (selection != wxNOT_FOUND) {
-        wxString selectedItem = m_listBox->GetString(selection);
-        m_parent->wsClient->start(selectedItem.utf8_string());
+        m_parent->wsClient->start(m_servers[selection].host());
     }
 }
 
@@ -46,6 +45,8 @@ void ServersPanel::OnBack([[maybe_unused]] wxCommandEvent& event) {
 }
 
 void ServersPanel::OnListSelect([[maybe_unused]] wxCommandEvent& event) {
+    int selection = m_listBox->GetSelection();
+    m_selectedHost = selection != wxNOT_FOUND ? m_servers[selection].host() : std::string{};
     // Whenever the selection changes, update the button states
     UpdateButtonsState();
 }
@@ -58,11 +59,44 @@ void ServersPanel::UpdateButtonsState() {
     m_connectButton->Enable(isItemSelected);
 }
 
-void ServersPanel::SetServers(const std::vector<std::string>& servers) {
+void ServersPanel::SetServers(const std::vector<chat::ServerNodeInfo>& servers) {
+    m_servers = servers;
+    RefreshList();
+}
+
+void ServersPanel::UpsertServer(const chat::ServerNodeInfo& server) {
+    auto it = std::ranges::find(m_servers, server.host(), &chat::ServerNodeInfo::host);
+    if(it != m_servers.end()) {
+        *it = server;
+    } else {
+        m_servers.push_back(server);
+    }
+    RefreshList();
+}
+
+void ServersPanel::RemoveServer(const std::string& host) {
+    std::erase_if(m_servers, [&host](const chat::ServerNodeInfo& s) { return s.host() == host; });
+    RefreshList();
+}
+
+void ServersPanel::RefreshList() {
+    // Least loaded servers first; servers that have not reported yet count as idle
+    std::ranges::stable_sort(m_servers, std::greater{}, [](const chat::ServerNodeInfo& s) { return s.has_headroom() ? s.headroom() : 1.0; });
+
     m_listBox->Clear();
-    for(const auto& server : servers) {
-        m_listBox->Append(wxString(server));
+    for(const auto& server : m_servers) {
+        wxString label = wxString::FromUTF8(server.host());
+        if(server.has_load()) {
+            label += wxString::Format("  (%d online, load %d%%)",
+                server.load().connections(),
+                static_cast<int>(std::lround((1.0 - server.headroom()) * 100.0)));
+        }
+        int idx = m_listBox->Append(label);
+        if(server.host() == m_selectedHost) {
+            m_listBox->SetSelection(idx);
+        }
     }
+    UpdateButtonsState();
 }
 
 } // namespace client
@@ -16,11 +16,25 @@
 #include <drogon/HttpAppFramework.h>
 #include <ada.h>
 #include <time.h>
+#include <random>
+#include <wx/filename.h>
 
 namespace client {
 
 WebSocketClient::WebSocketClient(MainWidget* ui_) : ui(ui_) {}
 
+// The displayed text of a message: its text, followed by a line per attachment
+static wxString messageText(const chat::MessageInfo& mi) {
+    wxString text = wxString::FromUTF8(mi.message());
+    for(const auto& attachment : mi.attachments()) {
+        if(!text.empty()) {
+            text += "\n";
+        }
+        text += wxString::Format("[%s, %s]", wxString::FromUTF8(attachment.file_name()), wxFileName::GetHumanReadableSize(wxULongLong(static_cast<wxULongLong_t>(attachment.size()))));
+    }
+    return text;
+}
+
 void WebSocketClient::stop() {
     drogon::app().getLoop()->runInLoop([this]{
         LOG_INFO << "WebSocketClient::stop()";
@@ -35,6 +49,7 @@ void WebSocketClient::start(const std::string& address) {
     drogon::app().getLoop()->runInLoop([this, address]{
 
         LOG_INFO << "WebSocketClient::start()";
+        this->address = address;
 
         auto result = ada::parse<ada::url_aggregator>(address);
 
@@ -111,6 +126,11 @@ void WebSocketClient::createRoom(const std::string& roomName) {
 }
 
 void WebSocketClient::joinRoom(int32_t room_id) {
+    drogon::app().getLoop()->runInLoop([this, room_id]{
+        pendingRoomId = room_id;
+        roomEpoch.clear();
+        roomSeqSkipped = 0;
+    });
     chat::Envelope env;
     env.mutable_join_room_request()->set_room_id(room_id);
     sendEnvelope(env);
@@ -122,10 +142,22 @@ void WebSocketClient::leaveRoom() {
     sendEnvelope(env);
 }
 
-void WebSocketClient::sendMessage(const std::string& message) {
+static int64_t steadyNowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool WebSocketClient::sendMessage(const std::string& message) {
+    if(const auto wait = sendBlockedUntilMs.load() - steadyNowMs(); wait > 0) {
+        showError(wxString::Format("You are sending messages too fast, try again in %lld s", static_cast<long long>((wait + 999) / 1000)));
+        return false;
+    }
+    drogon::app().getLoop()->runInLoop([this, message]{
+        unconfirmedMessages.push_back(message);
+    });
     chat::Envelope env;
     env.mutable_send_message_request()->set_message(message);
     sendEnvelope(env);
+    return true;
 }
 
 void WebSocketClient::sendEnvelope(const chat::Envelope& env) {
@@ -152,11 +184,31 @@ void WebSocketClient::getMessages(int32_t limit, int64_t offset_ts) {
 }
 
 void WebSocketClient::logout() {
+    drogon::app().getLoop()->runInLoop([this]{
+        sessionToken.clear();
+        currentRoomId.reset();
+        roomEpoch.clear();
+    });
     chat::Envelope env;
     env.mutable_logout_request();
     sendEnvelope(env);
 }
 
+void WebSocketClient::resumeSession() {
+    chat::Envelope env;
+    auto* request = env.mutable_resume_session_request();
+    request->set_session_token(sessionToken);
+    if (currentRoomId) {
+        request->set_room_id(*currentRoomId);
+        // Lets the server send just the missed events; roomSeq is kept to continue from there
+        request->set_since_seq(roomSeq);
+        request->set_room_epoch(roomEpoch);
+    }
+    roomEpoch.clear();
+    roomSeqSkipped = 0;
+    sendEnvelope(env);
+}
+
 void WebSocketClient::getServers() {
     chat::Envelope env;
     env.mutable_get_servers_request();
@@ -195,6 +247,9 @@ void WebSocketClient::deleteMessage(int32_t messageId) {
 }
 
 void WebSocketClient::sendTypingStart() {
+    if(typingBlockedUntilMs.load() > steadyNowMs()) {
+        return;
+    }
     chat::Envelope env;
     env.mutable_user_typing_start_request();
     sendEnvelope(env);
@@ -240,51 +295,182 @@ void WebSocketClient::handleMessage(const std::string& msg) {
         showError("Invalid protobuf message received!");
         return;
     }
+    handleEnvelope(std::move(env));
+}
+
+// Room events are numbered per room. Returns whether an event is the next one and should be shown;
+// on a gap the missed events are requested, and this one arrives again with them.
+bool WebSocketClient::acceptRoomEvent(int64_t seq) {
+    if(roomEpoch.empty()) {
+        // A join is in flight: the event may still be from the room being left, so it is held back
+        // until the join response tells where the new room's numbering starts
+        roomSeqSkipped = std::max(roomSeqSkipped, seq);
+        return false;
+    }
+    if(seq == roomSeq + 1) {
+        roomSeq = seq;
+        return true;
+    }
+    if(seq > roomSeq && !roomSyncPending) {
+        requestRoomSync();
+    }
+    return false;
+}
+
+void WebSocketClient::requestRoomSync() {
+    roomSyncPending = true;
+    chat::Envelope env;
+    auto* request = env.mutable_sync_room_request();
+    request->set_since_seq(roomSeq);
+    request->set_room_epoch(roomEpoch);
+    sendEnvelope(env);
+}
+
+void WebSocketClient::startRoomNumbering(const chat::JoinRoomResponse& response) {
+    roomEpoch = response.room_epoch();
+    roomSeq = response.room_seq();
+    roomSyncPending = false;
+    // Events of the new room that arrived before the response were dropped; fetch them again
+    if(roomSeqSkipped > roomSeq) {
+        requestRoomSync();
+    }
+    roomSeqSkipped = 0;
+}
+
+void WebSocketClient::handleEnvelope(chat::Envelope env) {
+    if(env.room_seq() != 0 && !acceptRoomEvent(env.room_seq())) {
+        return;
+    }
     using SC = chat::StatusCode;
     auto statusOk = [](const chat::Status& s) { return s.code() == SC::STATUS_SUCCESS; };
 
     switch(env.payload_case()) {
         case chat::Envelope::kServerHello: {
+            // Responses to sends on a previous connection will never arrive
+            unconfirmedMessages.clear();
             //wxTheApp->CallAfter([this] { ui->authPanel->SetButtonsEnabled(true); });
             //showInfo("Connected!");
 
-            if(env.server_hello().protocol_version() != common::version::PROTOCOL_VERSION) {
+            if(env.server_hello().has_retry_after_ms()) {
+                // The server is admitting too many connections at once. Wait the hinted
+                // time plus a random share of it, so refused clients do not return together.
+                const int64_t hint = std::max(env.server_hello().retry_after_ms(), 1);
+                static thread_local std::mt19937 rng{std::random_device{}()};
+                const auto delay_ms = hint + std::uniform_int_distribution<int64_t>{0, hint}(rng);
+                LOG_INFO << "Server is busy, reconnecting in " << delay_ms << " ms";
+                drogon::app().getLoop()->runAfter(static_cast<double>(delay_ms) / 1000.0, [this, retryAddress = address] {
+                    // Skip if the user has connected somewhere else meanwhile
+                    if(address == retryAddress) {
+                        start(retryAddress);
+                    }
+                });
+            } else if(env.server_hello().protocol_version() != common::version::PROTOCOL_VERSION) {
                 showError("Version mismatch, update your client");
                 showInitial();
             } else if(env.server_hello().type() == chat::ServerType::TYPE_AGGREGATOR) {
                 LOG_TRACE << "Aggregator, getting initial list of servers";
                 getServers();
                 showServers();
+            } else if(!sessionToken.empty() && sessionAddress == address) {
+                // Reconnected to the server we were logged in to, skip the two-phase auth
+                resumeSession();
             } else {
                 showAuth();
             }
             break;
         }
+        case chat::Envelope::kResumeSessionResponse: {
+            auto& response = *env.mutable_resume_session_response();
+            if(!statusOk(response.status())) {
+                LOG_INFO << "Session could not be resumed: " << response.status().message();
+                sessionToken.clear();
+                currentRoomId.reset();
+                showAuth();
+                break;
+            }
+            sessionToken = response.session_token();
+            const bool caught_up = response.has_joined_room() && statusOk(response.joined_room().status())
+                && response.has_room_sync() && statusOk(response.room_sync().status());
+            // Caught up on the current room, the chat stays open with its history and only gets the missed events
+            onLoggedIn(response.authenticated_user(), response.rooms(), !caught_up);
+            if(caught_up) {
+                auto& sync = *response.mutable_room_sync();
+                roomEpoch = sync.room_epoch();
+                roomSyncPending = false;
+                for(auto& event : *sync.mutable_events()) {
+                    handleEnvelope(std::move(event));
+                }
+                roomSeq = std::max(roomSeq, sync.room_seq());
+                if(roomSeqSkipped > roomSeq) {
+                    requestRoomSync();
+                }
+                roomSeqSkipped = 0;
+                wxTheApp->CallAfter([this, room_id = *currentRoomId] {
+                    ui->chatInterface->m_roomsPanel->SetUnreadCount(room_id, 0);
+                    if(!ui->chatInterface->m_roomsPanel->SelectRoom(room_id)) {
+                        ui->ShowRooms();
+                    }
+                });
+            } else if(response.has_joined_room() && statusOk(response.joined_room().status())) {
+                startRoomNumbering(response.joined_room());
+                const int32_t room_id = *currentRoomId;
+                wxTheApp->CallAfter([this, room_id, joined = response.joined_room()] {
+                    ui->chatInterface->m_roomsPanel->SetUnreadCount(room_id, 0);
+                    if(ui->chatInterface->m_roomsPanel->SelectRoom(room_id)) {
+                        showJoinedRoom(joined);
+                    }
+                });
+            } else {
+                currentRoomId.reset();
+            }
+            break;
+        }
+        case chat::Envelope::kUnreadCountUpdate: {
+            const auto& update = env.unread_count_update();
+            wxTheApp->CallAfter([this, room_id = update.room_id(), unread = update.unread_count()] {
+                ui->chatInterface->m_roomsPanel->SetUnreadCount(room_id, unread);
+            });
+            break;
+        }
         case chat::Envelope::kRoomMessage: {
             showRoomMessage(env.room_message().message());
             break;
         }
         case chat::Envelope::kJoinRoomResponse: {
             if (statusOk(env.join_room_response().status())) {
-                std::vector<User> all_users;
-                all_users.reserve(env.join_room_response().all_users().size());
-                
-                for (const auto& user : env.join_room_response().all_users()) {
-                    all_users.emplace_back(user.user_id(), wxString::FromUTF8(user.user_name()), user.user_room_rights());
-                }
-                wxTheApp->CallAfter([this] {
+                currentRoomId = pendingRoomId;
+                startRoomNumbering(env.join_room_response());
+                wxTheApp->CallAfter([this, room_id = currentRoomId] {
+                    if (room_id) {
+                        ui->chatInterface->m_roomsPanel->SetUnreadCount(*room_id, 0);
+                    }
                     ui->chatInterface->m_roomsPanel->OnJoinRoom();
                 });
-                showChat(std::move(all_users));
-
-                for (const auto& user : env.join_room_response().active_users()) {
-                    addUser({ user.user_id(), wxString::FromUTF8(user.user_name()), user.user_room_rights() });
-                }
+                showJoinedRoom(env.join_room_response());
             } else {
                 showError("Failed to join room.");
             }
             break;
         }
+        case chat::Envelope::kSyncRoomResponse: {
+            auto& response = *env.mutable_sync_room_response();
+            roomSyncPending = false;
+            if(!statusOk(response.status()) || roomEpoch.empty()) {
+                break;
+            }
+            if(response.full_reload()) {
+                // Too far behind: start the room over, which also reloads its history
+                roomEpoch = response.room_epoch();
+                roomSeq = response.room_seq();
+                showJoinedRoom(response.room());
+                break;
+            }
+            for(auto& event : *response.mutable_events()) {
+                handleEnvelope(std::move(event));
+            }
+            roomSeq = std::max(roomSeq, response.room_seq());
+            break;
+        }
         case chat::Envelope::kUserJoined: {
             addUser({env.user_joined().user().user_id(), wxString::FromUTF8(env.user_joined().user().user_name()), env.user_joined().user().user_room_rights()});
             break;
@@ -295,6 +481,8 @@ void WebSocketClient::handleMessage(const std::string& msg) {
         }
         case chat::Envelope::kLeaveRoomResponse: {
             if(statusOk(env.leave_room_response().status())) {
+                currentRoomId.reset();
+                roomEpoch.clear();
                 showRooms();
             } else {
                 showError("Failed to leave room.");
@@ -343,20 +531,10 @@ void WebSocketClient::handleMessage(const std::string& msg) {
         case chat::Envelope::kAuthResponse: {
             if(statusOk(env.auth_response().status())) {
                 showInfo("Login successful!");
-                std::vector<Room*> rooms;
-                for (const auto& proto_room : env.auth_response().rooms()){
-                    rooms.emplace_back(new Room{proto_room.room_id(), wxString::FromUTF8(proto_room.room_name()), proto_room.is_joined()});
-                }
-                client::User user;
-                user.id = env.auth_response().authenticated_user().user_id();
-                user.username = wxString::FromUTF8(env.auth_response().authenticated_user().user_name());
-                user.role = chat::UserRights::REGULAR;
-                wxTheApp->CallAfter([this, user]() {
-                    ui->chatInterface->m_chatPanel->SetCurrentUser(user);
-                    ui->accountSettingsPanel->UpdateCurrentUsername(user.username);
-                });
-                updateRoomsPanel(rooms);
-                showRooms();
+                sessionToken = env.auth_response().session_token();
+                sessionAddress = address;
+                currentRoomId.reset();
+                onLoggedIn(env.auth_response().authenticated_user(), env.auth_response().rooms());
             } else {
                 showError("Login failed! " + wxString(env.auth_response().status().message()));
             }
@@ -371,22 +549,45 @@ void WebSocketClient::handleMessage(const std::string& msg) {
             break;
         }
         case chat::Envelope::kSendMessageResponse: {
-            if(!statusOk(env.send_message_response().status())) {
+            const auto& status = env.send_message_response().status();
+            std::string text;
+            if(!unconfirmedMessages.empty()) {
+                text = std::move(unconfirmedMessages.front());
+                unconfirmedMessages.pop_front();
+            }
+            if(!statusOk(status) && !text.empty()) {
+                // The input was cleared on send; give the rejected text back so it is not lost
+                wxTheApp->CallAfter([this, text = std::move(text)] {
+                    ui->chatInterface->m_chatPanel->RestoreInput(wxString::FromUTF8(text));
+                });
+            }
+            if(status.code() == SC::STATUS_RATE_LIMITED) {
+                sendBlockedUntilMs = steadyNowMs() + status.retry_after_ms();
+                showError("You are sending messages too fast, the last one was not sent.");
+            } else if(!statusOk(status)) {
                 showError("Failed to send message!");
             }
             break;
         }
         case chat::Envelope::kGetServersResponse: {
-            std::vector<std::string> servers;
+            std::vector<chat::ServerNodeInfo> servers;
 
             LOG_TRACE << "got servers resp";
             for(const auto& server : env.get_servers_response().servers()) {
                 LOG_TRACE << server.host();
-                servers.emplace_back(server.host());
+                servers.emplace_back(server);
             }
             SetServers(servers);
             break;
         }
+        case chat::Envelope::kServerAdded: {
+            upsertServer(env.server_added().server());
+            break;
+        }
+        case chat::Envelope::kServerRemoved: {
+            removeServer(env.server_removed().server().host());
+            break;
+        }
         case chat::Envelope::kGenericError: {
             showError(wxString::Format("Server error: %s",
                 wxString(env.generic_error().status().message().c_str(), wxConvUTF8)));
@@ -400,7 +601,7 @@ void WebSocketClient::handleMessage(const std::string& msg) {
             for(const auto& proto_message : env.get_messages_response().message()) {
                 messages.emplace_back(Message{wxString::FromUTF8(proto_message.from().user_name())
                     , proto_message.from().user_id()
-                    , wxString::FromUTF8(proto_message.message())
+                    , messageText(proto_message)
                     , proto_message.timestamp()
                     , proto_message.message_id()});
             }
@@ -475,7 +676,10 @@ void WebSocketClient::handleMessage(const std::string& msg) {
             break;
         }
         case chat::Envelope::kUserTypingStartResponse: {
-            if (!statusOk(env.user_typing_start_response().status())) {
+            const auto& status = env.user_typing_start_response().status();
+            if (status.code() == SC::STATUS_RATE_LIMITED) {
+                typingBlockedUntilMs = steadyNowMs() + status.retry_after_ms();
+            } else if (!statusOk(status)) {
                 showError("Error when requesting \"User typing start\": " + wxString(env.user_typing_start_response().status().message()));
             }
             break;
@@ -565,6 +769,40 @@ void WebSocketClient::showInfo(const wxString& msg) {
     wxTheApp->CallAfter([this, msg] { ui->ShowPopup(msg, wxICON_INFORMATION); });
 }
 
+void WebSocketClient::onLoggedIn(const chat::UserInfo& user_info, const google::protobuf::RepeatedPtrField<chat::RoomInfo>& proto_rooms, bool show_rooms) {
+    std::vector<Room*> rooms;
+    for (const auto& proto_room : proto_rooms){
+        auto* room = rooms.emplace_back(new Room{proto_room.room_id(), wxString::FromUTF8(proto_room.room_name()), proto_room.is_joined()});
+        room->unread = proto_room.unread_count();
+    }
+    client::User user;
+    user.id = user_info.user_id();
+    user.username = wxString::FromUTF8(user_info.user_name());
+    user.role = chat::UserRights::REGULAR;
+    wxTheApp->CallAfter([this, user]() {
+        ui->chatInterface->m_chatPanel->SetCurrentUser(user);
+        ui->accountSettingsPanel->UpdateCurrentUsername(user.username);
+    });
+    updateRoomsPanel(rooms);
+    if (show_rooms) {
+        showRooms();
+    }
+}
+
+void WebSocketClient::showJoinedRoom(const chat::JoinRoomResponse& response) {
+    std::vector<User> all_users;
+    all_users.reserve(response.all_users().size());
+
+    for (const auto& user : response.all_users()) {
+        all_users.emplace_back(user.user_id(), wxString::FromUTF8(user.user_name()), user.user_room_rights());
+    }
+    showChat(std::move(all_users));
+
+    for (const auto& user : response.active_users()) {
+        addUser({ user.user_id(), wxString::FromUTF8(user.user_name()), user.user_room_rights() });
+    }
+}
+
 void WebSocketClient::updateRoomsPanel(const std::vector<Room*> &rooms)
 {
     wxTheApp->CallAfter([this, rooms] { ui->chatInterface->m_roomsPanel->UpdateRoomList(rooms); });
@@ -606,7 +844,7 @@ void WebSocketClient::showRoomMessage(const chat::MessageInfo& mi) {
     std::vector<Message> messages;
     messages.emplace_back(Message{wxString::FromUTF8(mi.from().user_name())
         , mi.from().user_id()
-        , wxString::FromUTF8(mi.message())
+        , messageText(mi)
         , mi.timestamp()
         , mi.message_id()});
 
@@ -625,10 +863,18 @@ void WebSocketClient::showMessageHistory(const std::vector<Message> &messages) {
     });
 }
 
-void WebSocketClient::SetServers(const std::vector<std::string> &servers) {
+void WebSocketClient::SetServers(const std::vector<chat::ServerNodeInfo> &servers) {
     wxTheApp->CallAfter([this, servers] {ui->serversPanel->SetServers(servers);});
 }
 
+void WebSocketClient::upsertServer(const chat::ServerNodeInfo& server) {
+    wxTheApp->CallAfter([this, server] {ui->serversPanel->UpsertServer(server);});
+}
+
+void WebSocketClient::removeServer(const std::string& host) {
+    wxTheApp->CallAfter([this, host] {ui->serversPanel->RemoveServer(host);});
+}
+
 void WebSocketClient::updateUserRole(int32_t userId, chat::UserRights newRole) {
     wxTheApp->CallAfter([this, userId, newRole] {
         ui->chatInterface->m_chatPanel->m_userListPanel->UpdateUserRole(userId, newRole);
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <google/protobuf/arena.h>
+#include <google/protobuf/message_lite.h>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace common {
+
+/**
+ * @file arena.h
+ * @brief Defines PooledArena, a protobuf arena leased from a per-thread pool.
+ */
+
+/**
+ * @class PooledArena
+ * @brief A protobuf arena for the messages of one request, recycled across
+ *        requests on the same IO thread.
+ *
+ * @details Messages created on the arena allocate their strings and submessages
+ * by bumping a pointer, and are all freed at once when the lease ends. Each arena
+ * starts with an `INITIAL_BLOCK_SIZE` block that survives `Reset()`, so a typical
+ * request and its response are built without any heap allocation once the pool
+ * has warmed up. Larger requests grow the arena with heap blocks, which are
+ * released when it is returned to the pool.
+ *
+ * A coroutine may hold the lease across suspension points. Leases are returned to
+ * the pool of the thread that ends them, so the pools need no synchronization.
+ *
+ * @note Messages created on the arena must not outlive the lease, and moving them
+ *       into heap-allocated messages copies them.
+ */
+class PooledArena {
+public:
+    PooledArena() : m_slot(takeSlot()) {}
+
+    ~PooledArena() {
+        m_slot->arena.Reset();
+        auto& pool = freeSlots();
+        if(pool.size() < MAX_POOLED_ARENAS) {
+            pool.push_back(std::move(m_slot));
+        }
+    }
+
+    PooledArena(const PooledArena&) = delete;
+    PooledArena& operator=(const PooledArena&) = delete;
+
+    /// @brief Returns the underlying arena.
+    google::protobuf::Arena* get() noexcept { return &m_slot->arena; }
+
+    /**
+     * @brief Creates a message (or any other object) on the arena.
+     * @tparam T The type to create.
+     * @return A pointer owned by the arena, valid until the lease ends.
+     */
+    template <typename T>
+    T* create() {
+        if constexpr(std::is_base_of_v<google::protobuf::MessageLite, T>) {
+            // Older protobuf releases' Arena::Create places a message on the arena without
+            // passing it the arena, so its strings and submessages would go to the heap
+            return static_cast<T*>(T::default_instance().New(get()));
+        } else {
+            return google::protobuf::Arena::Create<T>(get());
+        }
+    }
+
+private:
+    /// @brief The size of the block every arena keeps between requests.
+    static constexpr std::size_t INITIAL_BLOCK_SIZE = 16 * 1024;
+    /// @brief How many idle arenas a thread keeps.
+    static constexpr std::size_t MAX_POOLED_ARENAS = 64;
+
+    struct Slot {
+        Slot() : arena(options()) {}
+
+        google::protobuf::ArenaOptions options() {
+            google::protobuf::ArenaOptions opts;
+            opts.initial_block = block.get();
+            opts.initial_block_size = INITIAL_BLOCK_SIZE;
+            return opts;
+        }
+
+        std::unique_ptr<char[]> block = std::make_unique_for_overwrite<char[]>(INITIAL_BLOCK_SIZE);
+        google::protobuf::Arena arena;
+    };
+
+    static std::vector<std::unique_ptr<Slot>>& freeSlots() {
+        thread_local std::vector<std::unique_ptr<Slot>> pool;
+        return pool;
+    }
+
+    static std::unique_ptr<Slot> takeSlot() {
+        auto& pool = freeSlots();
+        if(pool.empty()) {
+            return std::make_unique<Slot>();
+        }
+        auto slot = std::move(pool.back());
+        pool.pop_back();
+        return slot;
+    }
+
+    std::unique_ptr<Slot> m_slot;
+};
+
+} // namespace common
@@ -3,7 +3,7 @@
 #include <drogon/drogon.h>
 #include <atomic>
 #include <coroutine>
-#include <memory>
+#include <utility>
 
 namespace common {
 
@@ -14,7 +14,7 @@ namespace common {
 
 /**
  * @class AsyncSharedMutex
- * @brief An asynchronous, lifetime-safe, coroutine-based reader-writer mutex.
+ * @brief An asynchronous, coroutine-based reader-writer mutex.
  *
  * @details This class provides a foundational mechanism to protect a shared resource in an
  * asynchronous environment, such as a Drogon application, without blocking the
@@ -30,24 +30,22 @@ namespace common {
  * This implementation ensures that a coroutine always resumes on the same IO
  * event loop thread it was suspended on, preserving thread affinity.
  *
- * @note This mutex must be created via the static `create()` factory method.
+ * The mutex is a single atomic meant to be embedded in the object it protects.
+ * Awaitables and guards refer to it by raw pointer, so taking or releasing a lock
+ * involves no allocation or reference counting.
+ *
+ * @note The mutex must outlive every pending lock awaitable and every guard,
+ *       which is why it is neither copyable nor movable.
  */
-class AsyncSharedMutex : public std::enable_shared_from_this<AsyncSharedMutex> {
+class AsyncSharedMutex {
 private:
     /// @brief The atomic state of the mutex. (0=free, -1=unique, >0=shared count)
     std::atomic<int> state_{0};
 
-    /// @brief Private constructor to enforce creation via the `create()` factory method.
-    AsyncSharedMutex() = default;
-
 public:
-    /**
-     * @brief Factory method to create a new lifetime-safe AsyncSharedMutex instance.
-     * @return A `std::shared_ptr<AsyncSharedMutex>` managing the new instance.
-     */
-    static std::shared_ptr<AsyncSharedMutex> create() {
-        return std::shared_ptr<AsyncSharedMutex>(new AsyncSharedMutex());
-    }
+    AsyncSharedMutex() = default;
+    AsyncSharedMutex(const AsyncSharedMutex&) = delete;
+    AsyncSharedMutex& operator=(const AsyncSharedMutex&) = delete;
 
     /**
      * @class SharedLockGuard
@@ -55,7 +53,7 @@ public:
      */
     class SharedLockGuard {
         friend class AsyncSharedMutex;
-        explicit SharedLockGuard(std::shared_ptr<AsyncSharedMutex> mutex) noexcept : mutex_(std::move(mutex)) {}
+        explicit SharedLockGuard(AsyncSharedMutex* mutex) noexcept : mutex_(mutex) {}
     public:
         ~SharedLockGuard() {
             if (mutex_) {
@@ -64,10 +62,10 @@ public:
         }
         SharedLockGuard(const SharedLockGuard&) = delete;
         SharedLockGuard& operator=(const SharedLockGuard&) = delete;
-        SharedLockGuard(SharedLockGuard&&) noexcept = default;
+        SharedLockGuard(SharedLockGuard&& other) noexcept : mutex_(std::exchange(other.mutex_, nullptr)) {}
         SharedLockGuard& operator=(SharedLockGuard&&) = delete;
     private:
-        std::shared_ptr<AsyncSharedMutex> mutex_;
+        AsyncSharedMutex* mutex_;
     };
     
     /**
@@ -76,7 +74,7 @@ public:
      */
     class UniqueLockGuard {
         friend class AsyncSharedMutex;
-        explicit UniqueLockGuard(std::shared_ptr<AsyncSharedMutex> mutex) noexcept : mutex_(std::move(mutex)) {}
+        explicit UniqueLockGuard(AsyncSharedMutex* mutex) noexcept : mutex_(mutex) {}
     public:
         ~UniqueLockGuard() {
             if (mutex_) {
@@ -85,17 +83,17 @@ public:
         }
         UniqueLockGuard(const UniqueLockGuard&) = delete;
         UniqueLockGuard& operator=(const UniqueLockGuard&) = delete;
-        UniqueLockGuard(UniqueLockGuard&&) noexcept = default;
+        UniqueLockGuard(UniqueLockGuard&& other) noexcept : mutex_(std::exchange(other.mutex_, nullptr)) {}
         UniqueLockGuard& operator=(UniqueLockGuard&&) = delete;
     private:
-        std::shared_ptr<AsyncSharedMutex> mutex_;
+        AsyncSharedMutex* mutex_;
     };
 
     /**
      * @brief An awaitable object for acquiring a shared lock.
      */
     struct SharedLockAwaitable {
-        std::shared_ptr<AsyncSharedMutex> mutex;
+        AsyncSharedMutex* mutex;
         std::coroutine_handle<> handle_ = nullptr;
 
         bool await_ready() noexcept {
@@ -108,7 +106,7 @@ public:
         }
 
         SharedLockGuard await_resume() noexcept {
-            return SharedLockGuard{std::move(mutex)};
+            return SharedLockGuard{mutex};
         }
 
     private:
@@ -135,7 +133,7 @@ public:
      * @brief An awaitable object for acquiring a unique lock.
      */
     struct UniqueLockAwaitable {
-        std::shared_ptr<AsyncSharedMutex> mutex;
+        AsyncSharedMutex* mutex;
         std::coroutine_handle<> handle_ = nullptr;
 
         bool await_ready() noexcept {
@@ -148,7 +146,7 @@ public:
         }
 
         UniqueLockGuard await_resume() noexcept {
-            return UniqueLockGuard{std::move(mutex)};
+            return UniqueLockGuard{mutex};
         }
 
     private:
@@ -172,16 +170,16 @@ public:
      * @brief Creates an awaitable to acquire a shared (reader) lock.
      * @return A `SharedLockAwaitable` object to be used with `co_await`.
      */
-    [[nodiscard]] SharedLockAwaitable lock_shared() {
-        return {shared_from_this()};
+    [[nodiscard]] SharedLockAwaitable lock_shared() noexcept {
+        return {this};
     }
 
     /**
      * @brief Creates an awaitable to acquire a unique (writer) lock.
      * @return A `UniqueLockAwaitable` object to be used with `co_await`.
      */
-    [[nodiscard]] UniqueLockAwaitable lock_unique() {
-        return {shared_from_this()};
+    [[nodiscard]] UniqueLockAwaitable lock_unique() noexcept {
+        return {this};
     }
 };
 
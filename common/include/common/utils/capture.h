@@ -0,0 +1,115 @@
+#pragma once
+
+#include <drogon/WebSocketConnection.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace common {
+
+/**
+ * @file capture.h
+ * @brief Defines EnvelopeCapture, a binary log of the envelopes exchanged over WebSocket connections.
+ */
+
+/**
+ * @class EnvelopeCapture
+ * @brief Records every inbound and outbound `chat::Envelope`, so that production
+ *        traffic can be replayed against a local server.
+ *
+ * @details The log starts with `MAGIC` and is followed by records of the form
+ * (all integers little-endian):
+ *
+ * | field        | type   | meaning                                                   |
+ * |--------------|--------|-----------------------------------------------------------|
+ * | timestamp_us | int64  | steady clock time since the capture was opened            |
+ * | connection   | uint64 | identifies the connection between its `Open` and `Close`  |
+ * | event        | uint8  | an `Event`                                                |
+ * | size         | uint32 | payload size                                              |
+ * | payload      | bytes  | the serialized envelope, empty for `Open` and `Close`     |
+ *
+ * Passwords, password hashes, salts and session tokens are blanked before an
+ * envelope is written (see `redact()`), so captures can be shared. Recording
+ * costs one atomic load while the capture is off. When it is on, records are
+ * appended to a buffered file under a mutex and flushed every second.
+ */
+class EnvelopeCapture {
+public:
+    enum class Event : uint8_t {
+        Open = 0,
+        Close = 1,
+        Inbound = 2,
+        Outbound = 3,
+    };
+
+    /// @brief One record, as returned by `read()`.
+    struct Record {
+        int64_t timestamp_us = 0;
+        uint64_t connection = 0;
+        Event event = Event::Open;
+        std::string payload;
+    };
+
+    /// @brief The first bytes of every capture file.
+    static constexpr std::string_view MAGIC{"SPCCAP1\n", 8};
+
+    /**
+     * @brief Gets the singleton instance of EnvelopeCapture.
+     * @return A reference to the single EnvelopeCapture instance.
+     */
+    static EnvelopeCapture& instance();
+
+    /**
+     * @brief Starts recording to a new file.
+     * @param path The capture file, overwritten if it exists.
+     * @return True if the file was opened.
+     */
+    bool open(const std::filesystem::path& path);
+
+    /// @brief Returns whether envelopes are being recorded.
+    bool enabled() const noexcept { return m_enabled.load(std::memory_order_relaxed); }
+
+    /// @brief Records a connection being opened or closed.
+    void recordConnection(const drogon::WebSocketConnectionPtr& conn, Event event);
+
+    /**
+     * @brief Records an envelope received or sent on a connection.
+     * @param conn The connection.
+     * @param direction `Event::Inbound` or `Event::Outbound`.
+     * @param env The envelope, used for redaction.
+     * @param serialized The envelope as sent over the wire, written as is when nothing needs redacting.
+     */
+    void recordEnvelope(const drogon::WebSocketConnectionPtr& conn, Event direction, const chat::Envelope& env, std::string_view serialized);
+
+    /// @brief Writes the buffered records to the file.
+    void flush();
+
+    /**
+     * @brief Blanks the credentials in an envelope.
+     * @param env The envelope to redact in place.
+     * @return True if the envelope carries credentials and was changed.
+     */
+    static bool redact(chat::Envelope& env);
+
+    /**
+     * @brief Reads the next record of a capture file.
+     * @param in A stream positioned after `MAGIC` or after the previous record.
+     * @return The record, or std::nullopt at the end of the file or on a truncated record.
+     */
+    static std::optional<Record> read(std::istream& in);
+
+private:
+    EnvelopeCapture() = default;
+    EnvelopeCapture(const EnvelopeCapture&) = delete;
+    EnvelopeCapture& operator=(const EnvelopeCapture&) = delete;
+
+    void write(const drogon::WebSocketConnectionPtr& conn, Event event, std::string_view payload);
+
+    std::atomic<bool> m_enabled{false};
+    std::chrono::steady_clock::time_point m_started;
+    std::vector<char> m_buffer;
+    std::ofstream m_file;
+    std::mutex m_mutex;
+};
+
+} // namespace common
@@ -22,6 +22,10 @@ namespace common {
  * This design ensures that the data can never be accessed without first acquiring
  * the appropriate lock.
  *
+ * The mutex is embedded next to the data, so a `Guarded` object is a single
+ * allocation (or none, as a member) and locking touches no reference counts.
+ * For the same reason it is neither copyable nor movable: pending lock
+ * awaitables and proxies point into it.
  */
 template <typename T>
 class Guarded {
@@ -75,14 +79,11 @@ public:
      */
     template <typename... Args>
     explicit Guarded(Args&&... args)
-        : mutex_(AsyncSharedMutex::create()),
-          data_(std::forward<Args>(args)...) {}
+        : data_(std::forward<Args>(args)...) {}
 
-    // A guarded object is a unique resource: non-copyable, but movable.
+    // Lock awaitables and proxies hold raw pointers into this object: non-copyable, non-movable.
     Guarded(const Guarded&) = delete;
     Guarded& operator=(const Guarded&) = delete;
-    Guarded(Guarded&&) noexcept = default;
-    Guarded& operator=(Guarded&&) noexcept = default;
 
 private:
     /// @brief Internal awaitable that combines the mutex awaitable with proxy creation.
@@ -115,7 +116,7 @@ public:
      * @return An awaitable that, upon success, resolves to a `SharedProxy` object.
      */
     SharedAwaitable lock_shared() {
-        return {this, mutex_->lock_shared()};
+        return {this, mutex_.lock_shared()};
     }
 
     /**
@@ -123,7 +124,7 @@ public:
      * @return An awaitable that, upon success, resolves to a `UniqueProxy` object.
      */
     UniqueAwaitable lock_unique() {
-        return {this, mutex_->lock_unique()};
+        return {this, mutex_.lock_unique()};
     }
 
     /**
@@ -142,7 +143,7 @@ public:
     }
 
 private:
-    std::shared_ptr<AsyncSharedMutex> mutex_;
+    AsyncSharedMutex mutex_;
     T data_;
 };
 
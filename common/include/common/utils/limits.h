@@ -7,6 +7,11 @@ namespace limits {
 	constexpr std::size_t MAX_USERNAME_LENGTH = 16;
 	constexpr std::size_t MAX_MESSAGE_LENGTH = 512;
 	constexpr std::size_t MAX_ROOMNAME_LENGTH = 32;
+	constexpr std::size_t MAX_SEARCH_QUERY_LENGTH = 256;
+	constexpr int32_t MAX_SEARCH_PAGE = 50;
+	constexpr int32_t MAX_UNREAD_COUNT = 100;
+	constexpr int MAX_MESSAGE_ATTACHMENTS = 10;
+	constexpr std::size_t MAX_ATTACHMENT_NAME_LENGTH = 255;
 
 } // namespace limits
 
@@ -3,7 +3,7 @@
 #include <string>
 #include <stdint.h>
 
-namespace client {
+namespace common {
 
 namespace password {
 
@@ -20,4 +20,4 @@ std::string generate_salt();
 
 } // namespace password
 
-} // namespace client
+} // namespace common
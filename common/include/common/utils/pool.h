@@ -0,0 +1,138 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <utility>
+
+namespace common {
+
+/**
+ * @file pool.h
+ * @brief Defines PoolAllocator, an allocator recycling fixed-size blocks through per-thread free lists.
+ */
+
+namespace detail {
+
+/**
+ * @brief A thread-local free list of blocks of one size.
+ * @details Freed blocks are kept for reuse by the freeing thread, up to
+ * `MAX_FREE_BLOCKS`; beyond that they go back to the global heap. A block
+ * allocated on one thread and freed on another simply migrates, so the lists
+ * need no synchronization.
+ */
+template <std::size_t Size>
+class FreeList {
+public:
+    /// @brief Takes a block from the calling thread's list, or from the heap if it is empty.
+    static void* allocate() {
+        if(auto* list = local()) {
+            return list->pop();
+        }
+        return ::operator new(BLOCK_SIZE);
+    }
+
+    /// @brief Returns a block to the calling thread's list, or to the heap if it is full.
+    static void release(void* p) noexcept {
+        if(auto* list = local()) {
+            list->push(p);
+            return;
+        }
+        ::operator delete(p);
+    }
+
+    ~FreeList() {
+        // Blocks freed by later thread-exit destructors go straight to the heap.
+        destroyed_ = true;
+        while(head_) {
+            ::operator delete(std::exchange(head_, head_->next));
+        }
+    }
+
+private:
+    struct Node {
+        Node* next;
+    };
+
+    static constexpr std::size_t BLOCK_SIZE = Size < sizeof(Node) ? sizeof(Node) : Size;
+    /// @brief How many free blocks a thread keeps before returning them to the heap.
+    static constexpr std::size_t MAX_FREE_BLOCKS = 4096;
+
+    /// @brief The calling thread's list, or null once it has been destroyed at thread exit.
+    static FreeList* local() noexcept {
+        if(destroyed_) {
+            return nullptr;
+        }
+        thread_local FreeList list;
+        return &list;
+    }
+
+    void* pop() {
+        if(head_) {
+            Node* node = head_;
+            head_ = node->next;
+            --count_;
+            return node;
+        }
+        return ::operator new(BLOCK_SIZE);
+    }
+
+    void push(void* p) noexcept {
+        if(count_ >= MAX_FREE_BLOCKS) {
+            ::operator delete(p);
+            return;
+        }
+        head_ = new (p) Node{head_};
+        ++count_;
+    }
+
+    /// @brief Set when the thread's list is destroyed; trivially destructible, so it stays readable after that.
+    static inline thread_local bool destroyed_ = false;
+
+    Node* head_ = nullptr;
+    std::size_t count_ = 0;
+};
+
+} // namespace detail
+
+/**
+ * @class PoolAllocator
+ * @brief A stateless allocator serving single objects from per-thread free lists.
+ * @tparam T The allocated type.
+ *
+ * @details Meant for small objects that are created and destroyed at a high rate
+ * on the IO threads, such as per-connection state and its versions. Used with
+ * `std::allocate_shared`, the object and its control block share one pooled block.
+ * Each IO loop runs on its own thread, so each loop recycles its own blocks
+ * without locking. Array allocations bypass the pool.
+ */
+template <typename T>
+class PoolAllocator {
+public:
+    using value_type = T;
+
+    static_assert(alignof(T) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__, "PoolAllocator does not support over-aligned types");
+
+    PoolAllocator() noexcept = default;
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>&) noexcept {}
+
+    T* allocate(std::size_t n) {
+        if(n != 1) {
+            return static_cast<T*>(::operator new(n * sizeof(T)));
+        }
+        return static_cast<T*>(detail::FreeList<sizeof(T)>::allocate());
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept {
+        if(n != 1) {
+            ::operator delete(p);
+            return;
+        }
+        detail::FreeList<sizeof(T)>::release(p);
+    }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U>&) const noexcept { return true; }
+};
+
+} // namespace common
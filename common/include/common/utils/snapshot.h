@@ -0,0 +1,115 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <utility>
+
+namespace common {
+
+/**
+ * @file snapshot.h
+ * @brief Defines the Snapshot class, a read-mostly container published as immutable versions.
+ */
+
+/**
+ * @class Snapshot
+ * @brief Holds an immutable, atomically replaceable version of a value of type T.
+ * @tparam T The type of the published value. Must be copy-constructible.
+ * @tparam Alloc The allocator used for new versions, e.g. a `PoolAllocator`.
+ *
+ * @details This is the read-mostly counterpart of `Guarded`. Instead of protecting
+ * a single mutable object with a lock, it publishes the value as a series of
+ * immutable versions behind an atomic `std::shared_ptr`.
+ *
+ * - **Readers** call `load()` and receive a `shared_ptr` to the current version.
+ *   This never suspends or blocks, and the returned version stays valid and
+ *   unchanged for as long as the reader keeps the pointer, even across `co_await`s
+ *   and even if newer versions are published in the meantime.
+ * - **Writers** call `update()`. It copies the current version, applies a mutator
+ *   to the private copy and publishes it with a compare-and-swap. If another
+ *   writer published first, the mutator is re-applied to the newer version.
+ *
+ * Because a mutator may run more than once, it must only depend on the value it
+ * is given (plus captured inputs) and must not have side effects. Slow work such
+ * as database queries belongs *before* the `update()` call, with the mutator
+ * re-validating whatever preconditions it relies on.
+ */
+template <typename T, typename Alloc = std::allocator<T>>
+class Snapshot {
+public:
+    /// @brief A shared pointer to one immutable published version.
+    using Ptr = std::shared_ptr<const T>;
+
+    /**
+     * @struct Transition
+     * @brief The outcome of an `update()` call.
+     * @details `before` is the version the mutator was applied to. `after` is the
+     * newly published version, or null if the mutator rejected the change.
+     */
+    struct Transition {
+        Ptr before;
+        Ptr after;
+
+        /// @brief Returns `true` if a new version was published.
+        explicit operator bool() const noexcept { return static_cast<bool>(after); }
+    };
+
+    /**
+     * @brief Constructs the Snapshot, perfectly forwarding arguments
+     *        to the constructor of the initial version.
+     * @param args Arguments to be forwarded to T's constructor.
+     */
+    template <typename... Args>
+    explicit Snapshot(Args&&... args)
+        : m_current(std::allocate_shared<const T>(Alloc{}, std::forward<Args>(args)...)) {}
+
+    /**
+     * @brief Constructs the Snapshot with an existing version as the initial one.
+     * @details Versions are immutable, so many snapshots may start from one shared
+     *          default version instead of allocating their own.
+     * @param initial The initial version. Must not be null.
+     */
+    explicit Snapshot(std::in_place_t, Ptr initial) noexcept
+        : m_current(std::move(initial)) {}
+
+    // A snapshot is an identity (other threads hold a pointer to it): non-copyable, non-movable.
+    Snapshot(const Snapshot&) = delete;
+    Snapshot& operator=(const Snapshot&) = delete;
+
+    /**
+     * @brief Returns the current version without locking.
+     * @return A shared pointer to an immutable version of the value.
+     */
+    [[nodiscard]] Ptr load() const noexcept {
+        return m_current.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief Publishes a new version derived from the current one.
+     *
+     * @param mutator A callable `bool(T&)`. It receives a private copy of the
+     *        current version and returns `true` to publish it, or `false` to
+     *        abandon the update (e.g., a precondition no longer holds).
+     * @return A `Transition` describing the versions before and after the update.
+     */
+    template <typename Mutator>
+    Transition update(Mutator&& mutator) {
+        Ptr expected = m_current.load(std::memory_order_acquire);
+        for(;;) {
+            auto next = std::allocate_shared<T>(Alloc{}, *expected);
+            if(!mutator(*next)) {
+                return {std::move(expected), nullptr};
+            }
+            Ptr desired = std::move(next);
+            // On success `expected` still holds the previous version; on failure it is refreshed.
+            if(m_current.compare_exchange_weak(expected, desired, std::memory_order_acq_rel, std::memory_order_acquire)) {
+                return {std::move(expected), std::move(desired)};
+            }
+        }
+    }
+
+private:
+    std::atomic<Ptr> m_current;
+};
+
+} // namespace common
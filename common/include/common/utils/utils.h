@@ -17,6 +17,8 @@ void setStatus(Response& resp, chat::StatusCode code, const std::string& msg) {
 
 chat::Envelope makeGenericErrorEnvelope(const std::string& msg);
 void sendEnvelope(const drogon::WebSocketConnectionPtr& conn, const chat::Envelope& env);
+/// @brief Sends an envelope already serialized to `out`, e.g. on the worker pool.
+void sendSerialized(const drogon::WebSocketConnectionPtr& conn, const chat::Envelope& env, const std::string& out);
 std::string getEnvVar(const std::string& name);
 std::pair<std::string, std::string> splitUrl(const std::string& url);
 
@@ -0,0 +1,165 @@
+#include <common/utils/capture.h>
+
+namespace common {
+
+static constexpr std::size_t HEADER_SIZE = 8 + 8 + 1 + 4;
+static constexpr std::size_t FILE_BUFFER_SIZE = 1 << 20;
+static constexpr double FLUSH_INTERVAL_SEC = 1.0;
+
+static void putLittleEndian(char* out, uint64_t value, std::size_t bytes) {
+    for(std::size_t i = 0; i < bytes; ++i) {
+        out[i] = static_cast<char>(value >> (8 * i));
+    }
+}
+
+static uint64_t getLittleEndian(const char* in, std::size_t bytes) {
+    uint64_t value = 0;
+    for(std::size_t i = 0; i < bytes; ++i) {
+        value |= static_cast<uint64_t>(static_cast<unsigned char>(in[i])) << (8 * i);
+    }
+    return value;
+}
+
+static bool carriesCredentials(chat::Envelope::PayloadCase payload) {
+    switch(payload) {
+        case chat::Envelope::kInitialAuthResponse:
+        case chat::Envelope::kAuthRequest:
+        case chat::Envelope::kAuthResponse:
+        case chat::Envelope::kRegisterRequest:
+        case chat::Envelope::kResumeSessionRequest:
+        case chat::Envelope::kResumeSessionResponse:
+        case chat::Envelope::kGetMySaltResponse:
+        case chat::Envelope::kChangePasswordRequest:
+            return true;
+        default:
+            return false;
+    }
+}
+
+EnvelopeCapture& EnvelopeCapture::instance() {
+    static EnvelopeCapture inst;
+    return inst;
+}
+
+bool EnvelopeCapture::open(const std::filesystem::path& path) {
+    std::lock_guard lock(m_mutex);
+    // Records are small, so they are batched in a large buffer between flushes
+    m_buffer.resize(FILE_BUFFER_SIZE);
+    m_file.rdbuf()->pubsetbuf(m_buffer.data(), static_cast<std::streamsize>(m_buffer.size()));
+    m_file.open(path, std::ios::binary | std::ios::trunc);
+    if(!m_file) {
+        LOG_ERROR << "Cannot open capture file " << path;
+        return false;
+    }
+    m_file.write(MAGIC.data(), static_cast<std::streamsize>(MAGIC.size()));
+    m_started = std::chrono::steady_clock::now();
+    m_enabled.store(true, std::memory_order_relaxed);
+
+    drogon::app().getLoop()->runEvery(FLUSH_INTERVAL_SEC, [this]() { flush(); });
+    LOG_INFO << "Capturing envelopes to " << path;
+    return true;
+}
+
+void EnvelopeCapture::recordConnection(const drogon::WebSocketConnectionPtr& conn, Event event) {
+    if(!enabled()) {
+        return;
+    }
+    write(conn, event, {});
+}
+
+void EnvelopeCapture::recordEnvelope(const drogon::WebSocketConnectionPtr& conn, Event direction, const chat::Envelope& env, std::string_view serialized) {
+    if(!enabled()) {
+        return;
+    }
+    if(!carriesCredentials(env.payload_case())) {
+        write(conn, direction, serialized);
+        return;
+    }
+    chat::Envelope redacted = env;
+    redact(redacted);
+    write(conn, direction, redacted.SerializeAsString());
+}
+
+void EnvelopeCapture::write(const drogon::WebSocketConnectionPtr& conn, Event event, std::string_view payload) {
+    const auto timestamp = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_started).count();
+
+    char header[HEADER_SIZE];
+    putLittleEndian(header, static_cast<uint64_t>(timestamp), 8);
+    putLittleEndian(header + 8, reinterpret_cast<uintptr_t>(conn.get()), 8);
+    header[16] = static_cast<char>(event);
+    putLittleEndian(header + 17, payload.size(), 4);
+
+    std::lock_guard lock(m_mutex);
+    m_file.write(header, HEADER_SIZE);
+    m_file.write(payload.data(), static_cast<std::streamsize>(payload.size()));
+}
+
+void EnvelopeCapture::flush() {
+    std::lock_guard lock(m_mutex);
+    m_file.flush();
+}
+
+bool EnvelopeCapture::redact(chat::Envelope& env) {
+    switch(env.payload_case()) {
+        case chat::Envelope::kInitialAuthResponse: {
+            env.mutable_initial_auth_response()->clear_salt();
+            return true;
+        }
+        case chat::Envelope::kAuthRequest: {
+            auto* req = env.mutable_auth_request();
+            req->clear_hash();
+            req->clear_password();
+            req->clear_salt();
+            return true;
+        }
+        case chat::Envelope::kAuthResponse: {
+            env.mutable_auth_response()->clear_session_token();
+            return true;
+        }
+        case chat::Envelope::kRegisterRequest: {
+            env.mutable_register_request()->clear_hash();
+            env.mutable_register_request()->clear_salt();
+            return true;
+        }
+        case chat::Envelope::kResumeSessionRequest: {
+            env.mutable_resume_session_request()->clear_session_token();
+            return true;
+        }
+        case chat::Envelope::kResumeSessionResponse: {
+            env.mutable_resume_session_response()->clear_session_token();
+            return true;
+        }
+        case chat::Envelope::kGetMySaltResponse: {
+            env.mutable_get_my_salt_response()->clear_salt();
+            return true;
+        }
+        case chat::Envelope::kChangePasswordRequest: {
+            auto* req = env.mutable_change_password_request();
+            req->clear_old_password_hash();
+            req->clear_new_password_hash();
+            req->clear_new_salt();
+            return true;
+        }
+        default: {
+            return false;
+        }
+    }
+}
+
+std::optional<EnvelopeCapture::Record> EnvelopeCapture::read(std::istream& in) {
+    char header[HEADER_SIZE];
+    if(!in.read(header, HEADER_SIZE)) {
+        return std::nullopt;
+    }
+    Record record;
+    record.timestamp_us = static_cast<int64_t>(getLittleEndian(header, 8));
+    record.connection = getLittleEndian(header + 8, 8);
+    record.event = static_cast<Event>(header[16]);
+    record.payload.resize(getLittleEndian(header + 17, 4));
+    if(!in.read(record.payload.data(), static_cast<std::streamsize>(record.payload.size()))) {
+        return std::nullopt;
+    }
+    return record;
+}
+
+} // namespace common
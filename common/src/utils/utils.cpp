@@ -1,5 +1,6 @@
 #include <cstdlib>
 #include <common/utils/utils.h>
+#include <common/utils/capture.h>
 
 namespace common {
 
@@ -14,7 +15,7 @@ void sendEnvelope(const drogon::WebSocketConnectionPtr& conn, const chat::Envelo
     if (conn && conn->connected()) {
         std::string out;
         if (env.SerializeToString(&out)) {
-            conn->send(out, drogon::WebSocketMessageType::Binary);
+            sendSerialized(conn, env, out);
         } else {
             sendEnvelope(conn, makeGenericErrorEnvelope("Response serialization error"));
         }
@@ -23,6 +24,15 @@ void sendEnvelope(const drogon::WebSocketConnectionPtr& conn, const chat::Envelo
     }
 }
 
+void sendSerialized(const drogon::WebSocketConnectionPtr& conn, const chat::Envelope& env, const std::string& out) {
+    if (conn && conn->connected()) {
+        EnvelopeCapture::instance().recordEnvelope(conn, EnvelopeCapture::Event::Outbound, env, out);
+        conn->send(out, drogon::WebSocketMessageType::Binary);
+    } else {
+        LOG_WARN << "WS connection closed before response could be sent";
+    }
+}
+
 #ifdef _MSC_VER
 #pragma warning(push)
 #pragma warning(disable : 4996)
@@ -0,0 +1,41 @@
+-- Convert messages to declarative range partitioning on created_at (microseconds since the epoch).
+-- Existing rows stay in a single legacy partition. Monthly partitions after it are created
+-- ahead of time by the server (PartitionManager), which also applies the retention policy.
+
+-- 1. Move the old heap aside. The partition key has to be part of the primary key.
+ALTER TABLE messages RENAME TO messages_legacy;
+
+ALTER INDEX idx_messages_room_id_desc_time RENAME TO messages_legacy_room_id_created_at_idx;
+
+UPDATE messages_legacy SET created_at = 0 WHERE created_at IS NULL;
+
+ALTER TABLE messages_legacy ALTER COLUMN created_at SET NOT NULL;
+
+ALTER TABLE messages_legacy DROP CONSTRAINT messages_pkey;
+
+-- message_id alone is no longer unique in the database: a unique constraint on a partitioned table
+-- must include the partition key. Ids stay unique because they all come from messages_message_id_seq,
+-- and writers that retry an insert match on the full (message_id, created_at) key.
+ALTER TABLE messages_legacy ADD CONSTRAINT messages_legacy_pkey PRIMARY KEY (message_id, created_at);
+
+-- 2. Create the partitioned table, reusing the existing id sequence. As above, the primary key only
+-- makes (message_id, created_at) unique, not message_id by itself.
+CREATE TABLE messages (
+    message_id INTEGER NOT NULL DEFAULT nextval('messages_message_id_seq'),
+    room_id INTEGER NOT NULL REFERENCES rooms(room_id) ON DELETE CASCADE,
+    user_id INTEGER NOT NULL REFERENCES users(user_id) ON DELETE CASCADE,
+    message_text TEXT NOT NULL,
+    created_at BIGINT NOT NULL DEFAULT (EXTRACT(EPOCH FROM NOW()) * 1000000)::bigint,
+    CONSTRAINT messages_pkey PRIMARY KEY (message_id, created_at)
+) PARTITION BY RANGE (created_at);
+
+ALTER SEQUENCE messages_message_id_seq OWNED BY messages.message_id;
+
+CREATE INDEX idx_messages_room_id_desc_time ON messages (room_id, created_at DESC);
+
+-- 3. The legacy rows cover everything up to the start of next month, monthly partitions take over from there.
+ALTER TABLE messages ATTACH PARTITION messages_legacy
+    FOR VALUES FROM (MINVALUE) TO ((EXTRACT(EPOCH FROM date_trunc('month', NOW()) + INTERVAL '1 month') * 1000000)::bigint);
+
+-- 4. Catches rows outside every range, e.g. if the server was down when a partition was due. Normally empty.
+CREATE TABLE messages_default PARTITION OF messages DEFAULT;
@@ -0,0 +1,6 @@
+-- Full-text search over message text. The 'simple' configuration does no stemming,
+-- which keeps mixed Russian and English messages searchable word for word.
+ALTER TABLE messages
+ADD COLUMN search_vector tsvector GENERATED ALWAYS AS (to_tsvector('simple', message_text)) STORED;
+
+CREATE INDEX idx_messages_search ON messages USING GIN (search_vector);
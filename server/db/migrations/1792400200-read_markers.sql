@@ -0,0 +1,20 @@
+-- The newest message each user has read in each room, used to count unread messages.
+-- Rows are written by the server in batches and only ever move forward.
+CREATE TABLE public.read_markers (
+    user_id INTEGER NOT NULL,
+    room_id INTEGER NOT NULL,
+    last_read_message_id INTEGER NOT NULL DEFAULT 0,
+
+    CONSTRAINT read_markers_pkey PRIMARY KEY (user_id, room_id),
+    CONSTRAINT read_markers_user_id_fkey FOREIGN KEY (user_id) REFERENCES public.users(user_id) ON DELETE CASCADE,
+    CONSTRAINT read_markers_room_id_fkey FOREIGN KEY (room_id) REFERENCES public.rooms(room_id) ON DELETE CASCADE
+);
+
+-- Unread counts and room heads scan messages by id within a room.
+CREATE INDEX idx_messages_room_message_id ON messages (room_id, message_id);
+
+-- Existing members start with everything read, instead of a full room of unread history.
+INSERT INTO public.read_markers (user_id, room_id, last_read_message_id)
+SELECT rm.user_id, rm.room_id, COALESCE((SELECT max(m.message_id) FROM messages m WHERE m.room_id = rm.room_id), 0)
+FROM public.room_membership rm
+WHERE rm.membership_status = 'JOINED';
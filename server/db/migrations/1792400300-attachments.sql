@@ -0,0 +1,37 @@
+-- Uploaded files. The content is stored on disk under its SHA-256, so identical files share one copy.
+CREATE TABLE public.attachments (
+    attachment_id SERIAL PRIMARY KEY,
+    sha256 CHAR(64) NOT NULL,
+    size_bytes BIGINT NOT NULL,
+    file_name VARCHAR(255) NOT NULL,
+    content_type VARCHAR(127) NOT NULL,
+    uploader_id INTEGER REFERENCES public.users(user_id) ON DELETE SET NULL,
+    created_at BIGINT NOT NULL DEFAULT (EXTRACT(EPOCH FROM NOW()) * 1000000)::bigint
+);
+
+-- Uploads in progress. The bytes received so far are in the upload's part file.
+CREATE TABLE public.attachment_uploads (
+    upload_id CHAR(32) PRIMARY KEY,
+    user_id INTEGER NOT NULL REFERENCES public.users(user_id) ON DELETE CASCADE,
+    size_bytes BIGINT NOT NULL,
+    file_name VARCHAR(255) NOT NULL,
+    content_type VARCHAR(127) NOT NULL,
+    created_at BIGINT NOT NULL DEFAULT (EXTRACT(EPOCH FROM NOW()) * 1000000)::bigint
+);
+
+CREATE INDEX idx_attachment_uploads_user ON attachment_uploads (user_id);
+CREATE INDEX idx_attachment_uploads_created_at ON attachment_uploads (created_at);
+
+-- Attachments of messages. message_id is not a foreign key: archived messages leave
+-- the messages table but keep their attachments.
+CREATE TABLE public.message_attachments (
+    message_id INTEGER NOT NULL,
+    room_id INTEGER NOT NULL,
+    attachment_id INTEGER NOT NULL,
+
+    CONSTRAINT message_attachments_pkey PRIMARY KEY (message_id, attachment_id),
+    CONSTRAINT message_attachments_room_id_fkey FOREIGN KEY (room_id) REFERENCES public.rooms(room_id) ON DELETE CASCADE,
+    CONSTRAINT message_attachments_attachment_id_fkey FOREIGN KEY (attachment_id) REFERENCES public.attachments(attachment_id) ON DELETE CASCADE
+);
+
+CREATE INDEX idx_message_attachments_attachment ON message_attachments (attachment_id);
@@ -20,8 +20,21 @@ namespace server {
  * the aggregator by sending its publicly accessible host address. This allows
  * the aggregator to maintain a list of active server nodes.
  *
- * The implementation includes basic connection logic and handlers for the
- * connection lifecycle events, such as a successful connection or a closure.
+ * While registered, the client sends a `ServerLoadReport` once per metrics
+ * window, so the aggregator can direct new clients to the least loaded server.
+ *
+ * The link is kept alive for the lifetime of the process:
+ * - A `HeartbeatRequest` is sent every `HEARTBEAT_INTERVAL`. If no
+ *   `HeartbeatResponse` arrives for `MISSED_HEARTBEATS_LIMIT` intervals, the
+ *   link is considered dead and closed, without waiting for TCP to notice.
+ * - After the link closes or a connection attempt fails, the client reconnects
+ *   with exponential backoff and full jitter, so that many servers do not
+ *   reconnect in lockstep after an aggregator restart.
+ * - Every new connection registers the server again.
+ * - `PingRequest` probes from the aggregator are answered immediately, so the
+ *   aggregator can track the round-trip time to this server.
+ *
+ * All state is only touched from the application's main event loop.
  *
  * @note The aggregator address is typically provided via an environment
  * variable. If the address is empty, the client will not attempt to connect.
@@ -29,70 +42,70 @@ namespace server {
 class WsClient {
 public:
     /**
-     * @brief Initiates the WebSocket connection to the aggregator service.
+     * @brief Starts maintaining the WebSocket connection to the aggregator service.
      *
-     * @details This method parses the provided address, creates a new Drogon
-     * WebSocket client, and attempts to connect. If the connection is
-     * successful, it sends a `RegisterServerRequest` message containing this
-     * server's own publicly accessible address. It also sets up placeholder
-     * handlers for incoming messages and connection closure events.
-     *
-     * If the provided address is empty, the connection attempt is skipped, and a
-     * trace log is generated.
+     * @details If the provided address is empty, the connection attempt is
+     * skipped, and an info log is generated.
      *
      * @param address The full WebSocket URL of the aggregator service
      *                (e.g., "ws://aggregator:8080/register").
      */
-    void start(const std::string& address) {
-        if(address.empty()) {
-            LOG_INFO << "Not starting connection to aggregator";
-            return;
-        }
-
-        LOG_INFO << "Starting connection to aggregator: " << address;
-        // TODO: Replace with ada-url parser
-        auto [server, path] = common::splitUrl(address);
-
-        client = drogon::WebSocketClient::newWebSocketClient(server);
-        auto req = drogon::HttpRequest::newHttpRequest();
-        req->setPath(path);
-
-        // TODO: Implement message handling logic from the aggregator.
-        client->setMessageHandler([this](const std::string&,
-                                          const drogon::WebSocketClientPtr&,
-                                          const drogon::WebSocketMessageType&) {
-        });
-
-        // TODO: Implement reconnection logic or other cleanup.
-        client->setConnectionClosedHandler([this](const drogon::WebSocketClientPtr&) {
-        });
-
-        LOG_INFO << "Connecting to WebSocket at " << server;
-        client->connectToServer(
-            req,
-            [this](drogon::ReqResult r,
-                   const drogon::HttpResponsePtr&,
-                   const drogon::WebSocketClientPtr& wsPtr) {
-                if (r != drogon::ReqResult::Ok) {
-                    conn.reset();
-                    LOG_ERROR << "Failed to connect to aggregator service.";
-                    return;
-                }
-                conn = wsPtr->getConnection();
-
-                chat::Envelope env;
-                auto host = common::getEnvVar("SERVER_HOST") + "/ws";
-                LOG_INFO << "Sending host to aggregator: " << host;
-                env.mutable_register_server_request()->set_host(host);
-                common::sendEnvelope(conn, env);
-            });
-    }
+    void start(const std::string& address);
 
 private:
+    /// @brief Creates a fresh Drogon client and attempts to connect.
+    void connect();
+
+    /// @brief Registers the server and starts the periodic timers on a new connection.
+    void onConnected(const drogon::WebSocketConnectionPtr& newConn);
+
+    /// @brief Handles a message from the aggregator.
+    void onMessage(const std::string& message);
+
+    /// @brief Stops the periodic timers and schedules a reconnection.
+    void onDisconnected();
+
+    /// @brief Schedules the next connection attempt after a jittered backoff delay.
+    void scheduleReconnect();
+
+    /// @brief Sends a heartbeat, or closes the link if too many were missed.
+    void heartbeat();
+
+    /// @brief Sends the current load figures to the aggregator.
+    void sendLoadReport();
+
+    /// @brief Stops the heartbeat and load report timers, if running.
+    void stopTimers();
+
+    /// @brief How often a heartbeat is sent.
+    static constexpr std::chrono::seconds HEARTBEAT_INTERVAL{2};
+    /// @brief How many heartbeat intervals may pass without a response before the link is closed.
+    static constexpr int MISSED_HEARTBEATS_LIMIT = 3;
+    /// @brief The backoff delay cap for the first reconnection attempt.
+    static constexpr std::chrono::milliseconds RECONNECT_BASE_DELAY{500};
+    /// @brief The maximum backoff delay cap.
+    static constexpr std::chrono::milliseconds RECONNECT_MAX_DELAY{30000};
+
+    /// @brief The aggregator's scheme and authority (e.g., "ws://aggregator:8848").
+    std::string server;
+    /// @brief The WebSocket path on the aggregator (e.g., "/ws").
+    std::string path;
     /// @brief The active WebSocket connection to the aggregator, once established.
     std::shared_ptr<drogon::WebSocketConnection> conn;
     /// @brief The Drogon WebSocket client instance used to manage the connection.
     drogon::WebSocketClientPtr client;
+
+    /// @brief The number of connection attempts since the last successful registration.
+    int reconnectAttempt = 0;
+    /// @brief Whether a connection attempt is already scheduled or in progress.
+    bool reconnectPending = false;
+    /// @brief When the aggregator last answered a heartbeat (or the link was established).
+    std::chrono::steady_clock::time_point lastHeartbeatAck;
+
+    /// @brief The timer sending heartbeats while connected.
+    std::optional<trantor::TimerId> heartbeatTimer;
+    /// @brief The timer sending periodic load reports while connected.
+    std::optional<trantor::TimerId> reportTimer;
 };
 
 } // namespace server
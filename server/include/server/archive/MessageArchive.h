@@ -0,0 +1,163 @@
+#pragma once
+
+#include <drogon/orm/DbClient.h>
+#include <list>
+#include <map>
+
+/**
+ * @file MessageArchive.h
+ * @brief Defines the singleton moving cold history out of the database into
+ *        compressed segment files.
+ */
+
+namespace server {
+
+/**
+ * @class MessageArchive
+ * @brief Keeps messages past an age threshold in compressed, per-room,
+ *        append-only segment files instead of the `messages` table.
+ *
+ * @details Each room has two files in the archive directory:
+ * - `room_<id>.seg`: gzip-compressed `chat::ArchivedBlock`s, appended one
+ *   after another, each holding up to `BLOCK_MESSAGES` messages in
+ *   `(created_at, message_id)` order.
+ * - `room_<id>.idx`: one fixed-size `BlockIndex` record per block, giving its
+ *   time and id range and its position in the segment file.
+ *
+ * The archival job queries from the main loop and compresses and writes blocks
+ * on the worker pool. For every room with old messages it appends a block to
+ * the segment, then the index record, syncs both (and, for a new room, the
+ * directory) to disk, and only then deletes the rows from the database. After a crash the leftover rows are recognised by
+ * the last indexed `(created_at, message_id)` and deleted without being
+ * archived twice; a segment tail without an index record is simply never read.
+ *
+ * Reads look blocks up in the in-memory index and serve them from an LRU cache
+ * of decompressed blocks. A process that does not archive itself checks the
+ * size of the `.idx` file on each read and loads the records appended since,
+ * so blocks archived by another process become visible right away. Block data is read with plain file reads rather than
+ * memory-mapped, to stay portable to the Windows build.
+ *
+ * Archived messages keep the author name they had at archival time.
+ *
+ * @note The files are local to the process. With several processes sharing a
+ *       database, enable archiving on one of them and share the directory.
+ */
+class MessageArchive {
+public:
+    /// @brief Settings read from `custom_config.archive`.
+    struct Config {
+        std::filesystem::path dir = "archive";
+        /// @brief Messages older than this are archived.
+        std::chrono::days max_age{365};
+        /// @brief How often the archival job runs.
+        std::chrono::seconds interval{86400};
+        /// @brief How many decompressed blocks are kept in memory.
+        std::size_t cache_blocks = 256;
+        /// @brief Whether this process runs the archival job; reads are always served.
+        bool archiving = false;
+    };
+
+    /**
+     * @brief Gets the singleton instance of MessageArchive.
+     * @return A reference to the single MessageArchive instance.
+     */
+    static MessageArchive& instance();
+
+    /**
+     * @brief Applies the configuration and, if enabled, schedules the archival job.
+     * @note Must be called once, after migrations have been applied.
+     * @param db The primary database client.
+     * @param config The archive settings.
+     */
+    void start(drogon::orm::DbClientPtr db, Config config);
+
+    /**
+     * @brief Reads archived messages of a room older than a timestamp.
+     * @param room_id The room.
+     * @param before_ts Only messages with `created_at < before_ts` are returned.
+     * @param count The maximum number of messages.
+     * @return Up to `count` messages, newest first.
+     */
+    std::vector<chat::MessageInfo> readBefore(int32_t room_id, int64_t before_ts, std::size_t count);
+
+    /**
+     * @brief Reads archived messages of a room newer than a timestamp.
+     * @param room_id The room.
+     * @param after_ts Only messages with `created_at > after_ts` are returned.
+     * @param count The maximum number of messages.
+     * @return Up to `count` messages, oldest first.
+     */
+    std::vector<chat::MessageInfo> readAfter(int32_t room_id, int64_t after_ts, std::size_t count);
+
+    /**
+     * @brief Gets the timestamp of a room's newest archived message.
+     * @return The timestamp, or `std::nullopt` if nothing of the room is archived.
+     */
+    std::optional<int64_t> newestTimestamp(int32_t room_id);
+
+private:
+    MessageArchive() = default;
+    MessageArchive(const MessageArchive&) = delete;
+    MessageArchive& operator=(const MessageArchive&) = delete;
+
+    /// @brief An index record, stored as-is in the `.idx` file.
+    struct BlockIndex {
+        int64_t first_ts;
+        int64_t last_ts;
+        int64_t offset;         ///< Position of the compressed block in the `.seg` file.
+        int64_t length;         ///< Size of the compressed block.
+        int32_t first_id;
+        int32_t last_id;
+        int32_t count;
+        int32_t reserved = 0;
+    };
+    using Blocks = std::shared_ptr<const std::vector<BlockIndex>>;
+    using CachedBlock = std::shared_ptr<const chat::ArchivedBlock>;
+
+    /// @brief Messages per block; about a page of scrollback.
+    static constexpr int BLOCK_MESSAGES = 256;
+
+    /// @brief Archives every room's messages older than `max_age`.
+    drogon::Task<> archiveOldMessages();
+
+    /// @brief Archives one room's old messages, block by block.
+    drogon::Task<> archiveRoom(int32_t room_id, int64_t cutoff);
+
+    /**
+     * @brief Archives a batch of a room's oldest rows not archived yet; runs on the worker pool.
+     * @return Whether the rows may be deleted from the database.
+     */
+    bool storeRows(int32_t room_id, const drogon::orm::Result& rows);
+
+    /// @brief Appends a block to a room's segment and index files and syncs them to disk.
+    bool appendBlock(int32_t room_id, const chat::ArchivedBlock& block);
+
+    /// @brief Returns a room's block index, loading it from disk on first use
+    ///        and, unless this process archives, whenever the index file has grown.
+    Blocks blocks(int32_t room_id);
+
+    /// @brief Returns a decompressed block, from the cache if possible.
+    CachedBlock loadBlock(int32_t room_id, const BlockIndex& index);
+
+    std::filesystem::path segmentPath(int32_t room_id) const;
+    std::filesystem::path indexPath(int32_t room_id) const;
+
+    drogon::orm::DbClientPtr m_db;
+    Config m_config;
+    std::atomic<bool> m_running{false};
+
+    /// @brief A loaded block index and how many bytes of the index file it covers.
+    struct LoadedIndex {
+        Blocks blocks;
+        std::uintmax_t bytes = 0;
+    };
+    std::unordered_map<int32_t, LoadedIndex> m_blocks;
+    std::shared_mutex m_blocks_mutex;
+
+    /// @brief LRU of decompressed blocks keyed by room and segment offset, most recent first.
+    std::list<std::pair<std::pair<int32_t, int64_t>, CachedBlock>> m_cache;
+    std::map<std::pair<int32_t, int64_t>, decltype(m_cache)::iterator> m_cache_lookup;
+    std::mutex m_cache_mutex;
+};
+
+} // namespace server
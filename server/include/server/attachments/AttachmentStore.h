@@ -0,0 +1,131 @@
+#pragma once
+
+#include <drogon/orm/DbClient.h>
+
+/**
+ * @file AttachmentStore.h
+ * @brief Defines the singleton keeping uploaded files in a content-addressed directory.
+ */
+
+namespace server {
+
+/**
+ * @class AttachmentStore
+ * @brief Stores the contents of attachments on the local disk, named by their SHA-256.
+ *
+ * @details The store directory has two parts:
+ * - `uploads/<upload_id>.part`: the bytes of an upload received so far. Chunks
+ *   are written at their offset, so a retried chunk simply overwrites itself.
+ * - `objects/<aa>/<sha256>`: completed files, where `<aa>` is the first two hex
+ *   digits of the hash. Completing an upload hashes the part file and moves it
+ *   here, or drops it if the same content is already stored.
+ *
+ * Only the file contents live here. Upload sessions and attachment metadata are
+ * rows in `attachment_uploads` and `attachments`, which the HTTP controller
+ * manages. Uploads left unfinished for longer than `upload_ttl` are removed by a
+ * periodic job.
+ *
+ * The file operations are synchronous and bounded by the chunk size, except
+ * `commit()`, which reads the whole upload once.
+ *
+ * @note Several processes may share the directory and the database.
+ */
+class AttachmentStore {
+public:
+    /// @brief Settings read from `custom_config.attachments`.
+    struct Config {
+        std::filesystem::path dir = "attachments";
+        /// @brief The largest accepted file.
+        int64_t max_file_size = 25 * 1024 * 1024;
+        /// @brief The largest accepted chunk; must fit into drogon's `client_max_body_size`.
+        std::size_t max_chunk_size = 512 * 1024;
+        /// @brief How many unfinished uploads a user may have at once.
+        int32_t max_open_uploads = 8;
+        /// @brief How long an unfinished upload is kept.
+        std::chrono::seconds upload_ttl{3600};
+    };
+
+    /**
+     * @brief Gets the singleton instance of AttachmentStore.
+     * @return A reference to the single AttachmentStore instance.
+     */
+    static AttachmentStore& instance();
+
+    /**
+     * @brief Applies the configuration, creates the directories and schedules the removal of stale uploads.
+     * @note Must be called once, after migrations have been applied.
+     * @param db The primary database client.
+     * @param config The attachment settings.
+     */
+    void start(drogon::orm::DbClientPtr db, Config config);
+
+    /// @brief Returns the active settings.
+    const Config& config() const noexcept { return m_config; }
+
+    /// @brief Checks that an upload id has the generated form and is safe to use as a file name.
+    static bool isValidUploadId(std::string_view upload_id) noexcept;
+
+    /// @brief Generates a new random upload id.
+    static std::string newUploadId();
+
+    /**
+     * @brief Creates the empty part file of a new upload.
+     * @return True if the file was created.
+     */
+    bool createPart(std::string_view upload_id);
+
+    /**
+     * @brief Returns how many bytes of an upload have been received.
+     * @return The size of the part file, or std::nullopt if it does not exist.
+     */
+    std::optional<int64_t> receivedBytes(std::string_view upload_id) const;
+
+    /**
+     * @brief Writes a chunk of an upload at its offset.
+     * @param upload_id The upload.
+     * @param offset Where the chunk starts; must not be past the received bytes.
+     * @param data The chunk.
+     * @return True if the chunk was written.
+     */
+    bool writeChunk(std::string_view upload_id, int64_t offset, std::string_view data);
+
+    /**
+     * @brief Hashes a complete upload and moves it into the object directory.
+     * @param upload_id The upload.
+     * @return The hex SHA-256 of the content, or std::nullopt if the part file is
+     *         missing or could not be stored.
+     */
+    std::optional<std::string> commit(std::string_view upload_id);
+
+    /// @brief Removes the part file of an abandoned upload.
+    void discard(std::string_view upload_id);
+
+    /// @brief Returns the path of a stored file.
+    std::filesystem::path objectPath(std::string_view sha256) const;
+
+    /**
+     * @brief Removes stored files that no attachment refers to any more.
+     * @details A file stored or reused within `OBJECT_GRACE` is kept: an upload of
+     *          the same content may be about to record an attachment for it.
+     * @param sha256s The files whose attachments were deleted.
+     */
+    drogon::Task<> removeUnreferenced(std::vector<std::string> sha256s);
+
+private:
+    AttachmentStore() = default;
+    AttachmentStore(const AttachmentStore&) = delete;
+    AttachmentStore& operator=(const AttachmentStore&) = delete;
+
+    /// @brief How long a file is kept after being stored or reused, even if unreferenced.
+    static constexpr std::chrono::minutes OBJECT_GRACE{1};
+
+    /// @brief Deletes the uploads older than `upload_ttl` and their part files.
+    drogon::Task<> removeStaleUploads();
+
+    std::filesystem::path partPath(std::string_view upload_id) const;
+
+    drogon::orm::DbClientPtr m_db;
+    Config m_config;
+};
+
+} // namespace server
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <optional>
+
+/**
+ * @file SessionTokens.h
+ * @brief Defines the singleton issuing and verifying signed session tokens.
+ */
+
+namespace server {
+
+/**
+ * @class SessionTokens
+ * @brief Issues and verifies the session tokens that let a client skip the
+ *        two-phase login when it reconnects.
+ *
+ * @details A token has the form `<user_id>.<expires_at>.<password_tag>.<mac>`:
+ * - `expires_at` is in Unix seconds.
+ * - `password_tag` is a short digest of the user's stored password hash, so
+ *   changing the password invalidates every outstanding token.
+ * - `mac` is the hex HMAC-SHA256 of the rest, keyed with the server secret.
+ *
+ * The secret comes from the `SESSION_SECRET` environment variable. Without it,
+ * a random key is created in a key file once and reused. Processes behind one
+ * host must share the secret to accept each other's tokens.
+ *
+ * Tokens are stateless. A token stays valid until it expires or the password
+ * changes; logging out does not revoke it.
+ */
+class SessionTokens {
+public:
+    /// @brief The claims of a verified token.
+    struct Claims {
+        int32_t user_id;
+        std::string password_tag;
+    };
+
+    /**
+     * @brief Gets the singleton instance of SessionTokens.
+     * @return A reference to the single SessionTokens instance.
+     */
+    static SessionTokens& instance();
+
+    /**
+     * @brief Loads or creates the signing key.
+     * @note Must be called once, before serving requests.
+     * @param key_file Where the key is kept when `SESSION_SECRET` is not set.
+     * @param ttl How long issued tokens stay valid.
+     * @return `false` if no key could be obtained; resuming is then disabled.
+     */
+    bool configure(const std::filesystem::path& key_file, std::chrono::seconds ttl);
+
+    /**
+     * @brief Issues a token for a user.
+     * @param user_id The authenticated user.
+     * @param password_hash The user's currently stored password hash.
+     * @return The token, or an empty string if resuming is disabled.
+     */
+    std::string issue(int32_t user_id, std::string_view password_hash) const;
+
+    /**
+     * @brief Checks a token's signature and expiry.
+     * @return The token's claims, or `std::nullopt` if it is invalid or expired.
+     */
+    std::optional<Claims> verify(std::string_view token) const;
+
+    /// @brief Computes the tag binding a token to a password hash.
+    static std::string passwordTag(std::string_view password_hash);
+
+private:
+    SessionTokens() = default;
+    SessionTokens(const SessionTokens&) = delete;
+    SessionTokens& operator=(const SessionTokens&) = delete;
+
+    std::string m_key;
+    std::chrono::seconds m_ttl{0};
+};
+
+} // namespace server
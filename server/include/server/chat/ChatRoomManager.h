@@ -2,6 +2,9 @@
 
 #include <drogon/WebSocketConnection.h>
 #include <server/chat/WsData.h>
+#include <server/chat/IEventBus.h>
+#include <server/chat/RoomEventLog.h>
+#include <common/utils/guarded.h>
 
 /**
  * @file ChatRoomManager.h
@@ -17,7 +20,24 @@ namespace server {
  * @details This class is the central authority for tracking active WebSocket
  * connections, user-to-connection mappings, and room memberships. It provides
  * asynchronous, coroutine-based methods to modify this state and to broadcast
- * messages to specific rooms or to all connected users.
+ * messages to the connections interested in them.
+ *
+ * Broadcasts are routed by topic, each backed by a recipient set that is kept
+ * up to date as connections change state:
+ * - **Room directory**: every authenticated connection, for room creation,
+ *   renaming and deletion.
+ * - **Room members**: the connections currently in a room.
+ * - **User peers**: a user's own connections plus every connection sharing a
+ *   room with one of them, for changes to the user's profile.
+ *
+ * Room broadcasts other than typing notifications are room events: they are
+ * stamped with the room's next sequence number by a `RoomEventLog`, which
+ * keeps the recent ones so a client that missed some can catch up with
+ * `roomEventsSince()` instead of reloading the room.
+ *
+ * The manager only knows the connections of its own process. When several
+ * processes share one database, an `IEventBus` carries broadcasts and state
+ * changes between them; see `setEventBus()` and `applyRemoteEvent()`.
  *
  * All public methods are asynchronous and thread-safe, returning a `drogon::Task`
  * that must be `co_await`ed. Access to the internal data structures is
@@ -33,64 +53,111 @@ public:
      * @return A reference to the single ChatRoomManager instance.
      */
     static ChatRoomManager& instance();
-    
+
     /**
-     * @brief Registers a new connection for an authenticated user.
-     * @param user_id The ID of the authenticated user.
-     * @param conn The user's WebSocket connection pointer.
-     * @return A drogon::Task<void> to be awaited.
+     * @brief Connects this process to the other server processes.
+     * @details Subscribes to the bus and applies received events with
+     * `applyRemoteEvent()`. Must be called before the server starts accepting
+     * connections; without a bus, the manager only serves its own process.
+     * @param bus The event bus to publish to and receive from.
      */
-    drogon::Task<void> registerConnection(int32_t user_id, const drogon::WebSocketConnectionPtr& conn);
+    void setEventBus(std::shared_ptr<IEventBus> bus);
 
     /**
-     * @brief Unregisters a connection entirely from the manager.
-     *
-     * @details This is typically called when a WebSocket connection is closed. It
-     * ensures the connection is removed from its current room (if any) and from
-     * the global user-to-connection map.
-     *
-     * @param conn The WebSocket connection that is closing.
-     * @param locked_data A reference to the connection's WsData, which is assumed
-     *        to be already locked by the caller. This provides access to user
-     *        and room details without causing a deadlock.
+     * @brief Publishes an event to the other server processes, if an event bus is set.
+     * @param event The event to publish.
      * @return A drogon::Task<void> to be awaited.
      */
-    drogon::Task<void> unregisterConnection(const drogon::WebSocketConnectionPtr& conn, const WsData& locked_data);
+    drogon::Task<void> publish(chat::BusEvent event) const;
 
     /**
-     * @brief Adds an existing connection to a specific chat room.
-     * @param room_id The ID of the room to join.
-     * @param conn The user's WebSocket connection pointer.
+     * @brief Applies an event published by another server process to this process's connections.
+     * @details The event is never re-published.
+     * @param event The received event.
      * @return A drogon::Task<void> to be awaited.
      */
-    drogon::Task<void> addConnectionToRoom(int32_t room_id, const drogon::WebSocketConnectionPtr& conn);
+    drogon::Task<void> applyRemoteEvent(const chat::BusEvent& event);
+    
+    /**
+     * @brief Applies a state transition to a connection and updates room and user membership to match.
+     *
+     * @details This is the single entry point for every change that affects
+     * membership: login, logout, joining and leaving rooms, and connection
+     * closure. The new `WsData` version is derived and published while the
+     * manager's unique lock is held, so the swap and the corresponding
+     * membership changes are observed by other connections as one step. No
+     * database work happens under the lock.
+     *
+     * The manager compares the previous and the new version:
+     * - If the connection left its previous room (or its user changed), it is
+     *   removed from that room and a "user left" notification is broadcast,
+     *   here and, once the lock is released, to the other processes.
+     * - If the authenticated user changed, the connection is moved between
+     *   user entries.
+     * - If the connection entered a new room, it is added to that room.
+     *
+     * @param conn The WebSocket connection whose state is being changed.
+     * @param mutator The transition to apply. Returning `false` rejects it.
+     * @return A drogon::Task resolving to the newly published `WsData` version,
+     *         or `nullptr` if the mutator rejected the transition.
+     */
+    drogon::Task<WsDataView> updateConnection(const drogon::WebSocketConnectionPtr& conn, const WsDataMutator& mutator);
 
     /**
-     * @brief Removes a connection from its current chat room.
+     * @brief Unregisters a connection entirely from the manager.
      *
-     * @details This method broadcasts a "user left" notification to the room
-     * before removing the connection from the room's membership list.
+     * @details This is typically called when a WebSocket connection is closed. It
+     * resets the connection's state, which removes it from its current room
+     * (if any) and from the global user-to-connection map.
      *
-     * @param conn The WebSocket connection leaving the room.
-     * @param locked_data A reference to the connection's WsData, assumed to be
-     *        locked by the caller, to access room and user information.
+     * @param conn The WebSocket connection that is closing.
      * @return A drogon::Task<void> to be awaited.
      */
-    drogon::Task<void> removeConnectionFromRoom(const drogon::WebSocketConnectionPtr& conn, const WsData& locked_data);
+    drogon::Task<void> unregisterConnection(const drogon::WebSocketConnectionPtr& conn);
 
     /**
      * @brief Asynchronously retrieves a list of all users currently in a room.
+     * @details The list is a copy of the room's presence roster, which is kept
+     * up to date on join, leave, rename and role change. Each user appears
+     * once, regardless of how many connections they have in the room.
      * @param room_id The ID of the room to query.
-     * @param locked_data A reference to the calling connection's locked
-     *        WsData. This is a crucial optimization to prevent deadlocking when
-     *        the caller is a member of the room it is querying.
      * @return A drogon::Task resolving to a std::vector of UserInfo objects.
      */
-    drogon::Task<std::vector<chat::UserInfo>> getUsersInRoom(
-        int32_t room_id, const WsData& locked_data) const;
+    drogon::Task<std::vector<chat::UserInfo>> getUsersInRoom(int32_t room_id) const;
+
+    /**
+     * @brief Checks whether a user has at least one connection in a room.
+     * @param room_id The ID of the room to query.
+     * @param user_id The ID of the user to look for.
+     * @return A drogon::Task resolving to `true` if the user is present in the room.
+     */
+    drogon::Task<bool> isUserPresent(int32_t room_id, int32_t user_id) const;
+
+    /**
+     * @brief Lists the rooms in which a user has at least one connection.
+     * @param userId The ID of the user.
+     * @return A drogon::Task resolving to the IDs of the rooms.
+     */
+    drogon::Task<std::vector<int32_t>> getUserRooms(int32_t userId) const;
+
+    /**
+     * @brief Counts the rooms with at least one connection in them.
+     * @return A drogon::Task resolving to the number of active rooms.
+     */
+    drogon::Task<std::size_t> getActiveRoomCount() const;
+
+    /**
+     * @brief Publishes a user's new name to all of their connections and room rosters.
+     * @param userId The ID of the renamed user.
+     * @param newName The user's new name.
+     * @return A drogon::Task<void> to be awaited.
+     */
+    drogon::Task<void> updateUsername(int32_t userId, const std::string& newName);
     
     /**
      * @brief Sends a Protobuf message to all users in a specific room.
+     * @details A `RoomMessage` is also counted as unread for the room's online
+     *          members who do not have it open (see `UnreadTracker`).
      * @param room_id The target room's ID.
      * @param message The Protobuf Envelope to send.
      * @return A drogon::Task<void> to be awaited.
@@ -98,16 +165,62 @@ public:
     drogon::Task<void> sendToRoom(int32_t room_id, const chat::Envelope& message) const;
 
     /**
-     * @brief Sends a Protobuf message to all authenticated users on the server.
+     * @brief Sets how many recent events are kept per room for `roomEventsSince()`.
+     * @param size The number of events.
+     */
+    void setEventLogSize(std::size_t size) noexcept { m_event_log.setCapacity(size); }
+
+    /**
+     * @brief Periodically drops the event history of rooms without events for `idle_ttl`.
+     * @note Must be called once, from the beginning advice.
+     * @param idle_ttl How long a room's history is kept after its last event.
+     */
+    void startEventLogEviction(std::chrono::seconds idle_ttl);
+
+    /**
+     * @brief Gets the id of this process's room event sequences.
+     * @return A random id, different in every process and after every restart.
+     */
+    const std::string& eventEpoch() const noexcept { return m_event_log.epoch(); }
+
+    /**
+     * @brief Gets a room's latest event sequence number.
+     * @param room_id The ID of the room.
+     * @return A drogon::Task resolving to the sequence number, 0 if the room has had no events.
+     */
+    drogon::Task<int64_t> roomEventSeq(int32_t room_id) const;
+
+    /**
+     * @brief Gets a room's events after a sequence number, for a client catching up.
+     * @param room_id The ID of the room.
+     * @param since_seq The last event the client has seen.
+     * @return A drogon::Task resolving to the events, or an incomplete result if they are no longer kept.
+     */
+    drogon::Task<RoomEvents> roomEventsSince(int32_t room_id, int64_t since_seq) const;
+
+    /**
+     * @brief Sends a Protobuf message to every connection watching the room directory.
+     * @param message The Protobuf Envelope to send.
+     * @return A drogon::Task<void> to be awaited.
+     */
+    drogon::Task<void> sendToRoomDirectory(const chat::Envelope& message) const;
+
+    /**
+     * @brief Sends a Protobuf message to a user's connections and to everyone sharing a room with them.
+     * @details Each recipient receives the message once, even if it shares
+     * several rooms with the user.
+     * @param userId The ID of the user the message is about.
      * @param message The Protobuf Envelope to send.
+     * @param extra_rooms Additional rooms whose connections receive the message,
+     *        e.g. the rooms the user is a member of or is in on another process.
      * @return A drogon::Task<void> to be awaited.
      */
-    drogon::Task<void> sendToAll(const chat::Envelope& message) const;
+    drogon::Task<void> sendToUserPeers(int32_t userId, const chat::Envelope& message, const std::vector<int32_t>& extra_rooms = {}) const;
     
     /**
      * @brief Handles the server-side cleanup when a room is deleted.
      * @details This function removes the room from the internal state and broadcasts
-     * a `RoomDeleted` notification to all connected clients.
+     * a `RoomDeleted` notification to the room directory watchers.
      * @param room_id The ID of the room that was deleted.
      * @return A drogon::Task<void> to be awaited.
      */
@@ -118,10 +231,9 @@ public:
      * @param userId The ID of the user whose rights are being updated.
      * @param roomId The ID of the room where the rights changed.
      * @param newRights The new rights for the user in that room.
-     * @param locked_data A reference to the calling connection's locked `WsData`.
      * @return A drogon::Task<void> to be awaited.
      */
-    drogon::Task<void> updateUserRoomRights(int32_t userId, int32_t roomId, chat::UserRights newRights, WsData& locked_data);
+    drogon::Task<void> updateUserRoomRights(int32_t userId, int32_t roomId, chat::UserRights newRights);
     
 private:
     ChatRoomManager() = default;
@@ -130,15 +242,52 @@ private:
 
     /**
      * @brief Sends a message to a room without acquiring a lock.
+     * @details Room events are stamped with the room's next sequence number and recorded first.
      * @note This is an internal helper and assumes the caller holds a lock on `m_manager_mutex`.
      */
     void sendToRoom_unsafe(int32_t room_id, const chat::Envelope& message) const;
     
     /**
-     * @brief Sends a message to all users without acquiring a lock.
+     * @brief Counts a new room message as unread for the online members who are elsewhere,
+     *        and pushes their new counts.
      * @note This is an internal helper and assumes the caller holds a lock on `m_manager_mutex`.
+     * @param room_id The room the message was posted in.
+     * @param message_id The id of the new message.
      */
-    void sendToAll_unsafe(const chat::Envelope& message) const;
+    void countUnread_unsafe(int32_t room_id, int32_t message_id) const;
+
+    /**
+     * @brief Removes a connection from a room and notifies the remaining members.
+     * @details The "user left" notification is only sent once the user's last
+     * connection has left the room.
+     * @note This is an internal helper and assumes the caller holds a unique lock on `m_manager_mutex`.
+     * @param conn The connection leaving the room.
+     * @param data The connection's state as it was while in the room.
+     * @param[out] remote_events Receives the notification, to be published to the other
+     *             processes after the lock is released.
+     */
+    void removeFromRoom_unsafe(const drogon::WebSocketConnectionPtr& conn, const WsData& data,
+                               std::vector<chat::BusEvent>& remote_events);
+
+    /**
+     * @brief Adds a connection to a room and counts it in the room's presence roster.
+     * @note This is an internal helper and assumes the caller holds a unique lock on `m_manager_mutex`.
+     * @param conn The connection entering the room.
+     * @param data The connection's state after entering the room.
+     */
+    void addToRoom_unsafe(const drogon::WebSocketConnectionPtr& conn, const WsData& data);
+
+    /**
+     * @brief Sends a message to the room directory watchers without acquiring a lock.
+     * @note This is an internal helper and assumes the caller holds a lock on `m_manager_mutex`.
+     */
+    void sendToRoomDirectory_unsafe(const chat::Envelope& message) const;
+
+    /// @brief The bus connecting this process to the other server processes, if any.
+    std::shared_ptr<IEventBus> m_event_bus;
+
+    /// @brief Sequences and recent history of room events, with its own locking.
+    mutable RoomEventLog m_event_log;
 
     /// @brief An asynchronous mutex protecting all internal data structures.
     mutable common::Guarded<int> m_manager_mutex{0};
@@ -146,8 +295,23 @@ private:
     /// @brief Maps a user's ID to the set of their active WebSocket connections.
     std::unordered_map<int32_t, std::unordered_set<drogon::WebSocketConnectionPtr>> m_user_id_to_conns;
     
+    /// @brief The authenticated connections, which receive room directory updates.
+    std::unordered_set<drogon::WebSocketConnectionPtr> m_directory_watchers;
+
     /// @brief Maps a room's ID to the set of WebSocket connections currently in that room.
     std::unordered_map<int32_t, std::unordered_set<drogon::WebSocketConnectionPtr>> m_room_to_conns;
+
+    /**
+     * @struct PresenceEntry
+     * @brief One user's presence in a room, aggregated over all of their connections in it.
+     */
+    struct PresenceEntry {
+        chat::UserInfo info;        ///< The user's ID, name and rights in the room, as sent to clients.
+        std::size_t connections = 0; ///< How many of the user's connections are in the room.
+    };
+
+    /// @brief Maps a room's ID to its presence roster, keyed by user ID.
+    std::unordered_map<int32_t, std::unordered_map<int32_t, PresenceEntry>> m_room_presence;
 };
 
 } // namespace server
@@ -22,6 +22,10 @@ namespace server {
  * This design allows the core business logic to depend on the `IChatRoomService`
  * abstraction, while this class handles the specific task of communicating with
  * the ChatRoomManager singleton, making the system more modular and testable.
+ *
+ * Broadcasts and shared state changes are applied to the local `ChatRoomManager`
+ * first and then published on the event bus, if one is configured, so that
+ * connections held by other server processes receive them as well.
  */
 class DrogonRoomService : public IChatRoomService {
 public:
@@ -32,32 +36,49 @@ public:
     explicit DrogonRoomService(const drogon::WebSocketConnectionPtr& conn);
 
     /** @see IChatRoomService::login */
-    drogon::Task<void> login(const WsData& locked_data) override;
+    drogon::Task<WsDataView> login(const User& user) override;
 
     /** @see IChatRoomService::logout */
-    drogon::Task<void> logout(const WsData& locked_data) override;
+    drogon::Task<WsDataView> logout() override;
 
     /** @see IChatRoomService::joinRoom */
-    drogon::Task<void> joinRoom(const WsData& locked_data) override;
+    drogon::Task<WsDataView> joinRoom(const CurrentRoom& room) override;
 
     /** @see IChatRoomService::leaveCurrentRoom */
-    drogon::Task<void> leaveCurrentRoom(const WsData& locked_data) override;
+    drogon::Task<WsDataView> leaveCurrentRoom() override;
 
     /** @see IChatRoomService::getUsersInRoom */
-    drogon::Task<std::vector<chat::UserInfo>> getUsersInRoom(
-        int32_t room_id, const WsData& locked_data) const override;
+    drogon::Task<std::vector<chat::UserInfo>> getUsersInRoom(int32_t room_id) const override;
+
+    /** @see IChatRoomService::isUserPresent */
+    drogon::Task<bool> isUserPresent(int32_t room_id, int32_t user_id) const override;
 
     /** @see IChatRoomService::sendToRoom */
     drogon::Task<void> sendToRoom(int32_t room_id, const chat::Envelope& message) const override;
 
-    /** @see IChatRoomService::sendToAll */
-    drogon::Task<void> sendToAll(const chat::Envelope& message) const override;
+    /** @see IChatRoomService::sendToRoomDirectory */
+    drogon::Task<void> sendToRoomDirectory(const chat::Envelope& message) const override;
+
+    /** @see IChatRoomService::sendToUserPeers */
+    drogon::Task<void> sendToUserPeers(int32_t userId, const chat::Envelope& message, const std::vector<int32_t>& member_rooms) const override;
 
     /** @see IChatRoomService::onRoomDeleted */
     drogon::Task<void> onRoomDeleted(int32_t room_id) override;
 
     /** @see IChatRoomService::updateUserRoomRights */
-    drogon::Task<void> updateUserRoomRights(int32_t userId, int32_t roomId, chat::UserRights newRights, WsData& locked_data) override;
+    drogon::Task<void> updateUserRoomRights(int32_t userId, int32_t roomId, chat::UserRights newRights) override;
+
+    /** @see IChatRoomService::updateUsername */
+    drogon::Task<void> updateUsername(int32_t userId, const std::string& newName) override;
+
+    /** @see IChatRoomService::roomEventEpoch */
+    const std::string& roomEventEpoch() const override;
+
+    /** @see IChatRoomService::roomEventSeq */
+    drogon::Task<int64_t> roomEventSeq(int32_t room_id) const override;
+
+    /** @see IChatRoomService::roomEventsSince */
+    drogon::Task<RoomEvents> roomEventsSince(int32_t room_id, int64_t since_seq) const override;
 
 private:
     /// @brief The specific WebSocket connection this service instance operates on.
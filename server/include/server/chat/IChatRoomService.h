@@ -1,6 +1,7 @@
 #pragma once
 
 #include <server/chat/WsData.h>
+#include <server/chat/RoomEventLog.h>
 
 /**
  * @file IChatRoomService.h
@@ -30,43 +31,51 @@ public:
     virtual ~IChatRoomService() = default;
 
     /**
-     * @brief Handles the state change when a user logs in.
-     * @param locked_data The already-locked WsData of the logging-in user.
-     * @return A drogon::Task<void> to be awaited.
+     * @brief Completes authentication and registers the user as online.
+     * @details Publishes the authenticated state only if the connection is still
+     * in the `Authenticating` phase for the same username.
+     * @param user The authenticated user, with its database ID filled in.
+     * @return A drogon::Task resolving to the new `WsData` version, or `nullptr`
+     *         if the connection is no longer authenticating as this user.
      */
-    virtual drogon::Task<void> login(const WsData& locked_data) = 0;
+    virtual drogon::Task<WsDataView> login(const User& user) = 0;
 
     /**
-     * @brief Handles the state change when a user logs out or disconnects.
-     * @param locked_data The already-locked WsData of the logging-out user.
-     * @return A drogon::Task<void> to be awaited.
+     * @brief Handles the state change when a user logs out.
+     * @return A drogon::Task resolving to the new `WsData` version, or `nullptr`
+     *         if the connection was not authenticated.
      */
-    virtual drogon::Task<void> logout(const WsData& locked_data) = 0;
+    virtual drogon::Task<WsDataView> logout() = 0;
 
     /**
      * @brief Handles the state change when a user joins a room.
-     * @param locked_data The user's locked WsData, containing the target room info.
-     * @return A drogon::Task<void> to be awaited.
+     * @param room The room being joined together with the user's rights in it.
+     * @return A drogon::Task resolving to the new `WsData` version, or `nullptr`
+     *         if the connection is not authenticated.
      */
-    virtual drogon::Task<void> joinRoom(const WsData& locked_data) = 0;
+    virtual drogon::Task<WsDataView> joinRoom(const CurrentRoom& room) = 0;
 
     /**
      * @brief Handles the state change when a user leaves their current room.
-     * @param locked_data The user's locked WsData.
-     * @return A drogon::Task<void> to be awaited.
+     * @return A drogon::Task resolving to the new `WsData` version, or `nullptr`
+     *         if the user was not in a room.
      */
-    virtual drogon::Task<void> leaveCurrentRoom(const WsData& locked_data) = 0;
+    virtual drogon::Task<WsDataView> leaveCurrentRoom() = 0;
 
     /**
      * @brief Asynchronously retrieves a list of all users currently in a room.
      * @param room_id The ID of the room to query.
-     * @param locked_data A reference to the calling connection's locked
-     *        WsData. This is a crucial optimization to prevent deadlocking when
-     *        the caller is a member of the room it is querying.
      * @return A drogon::Task resolving to a std::vector of UserInfo objects.
      */
-    virtual drogon::Task<std::vector<chat::UserInfo>> getUsersInRoom(
-        int32_t room_id, const WsData& locked_data) const = 0;
+    virtual drogon::Task<std::vector<chat::UserInfo>> getUsersInRoom(int32_t room_id) const = 0;
+
+    /**
+     * @brief Checks whether a user has at least one connection in a room.
+     * @param room_id The ID of the room to query.
+     * @param user_id The ID of the user to look for.
+     * @return A drogon::Task resolving to `true` if the user is present in the room.
+     */
+    virtual drogon::Task<bool> isUserPresent(int32_t room_id, int32_t user_id) const = 0;
     
     /*
      * @brief Sends a Protobuf message to all users in a specific room.
@@ -77,11 +86,23 @@ public:
     virtual drogon::Task<void> sendToRoom(int32_t room_id, const chat::Envelope& message) const = 0;
 
     /**
-     * @brief Sends a Protobuf message to all authenticated users on the server.
+     * @brief Sends a Protobuf message to every connection watching the room directory.
+     * @details Used for room creation, renaming and deletion.
+     * @param message The Protobuf Envelope to send.
+     * @return A drogon::Task<void> to be awaited.
+     */
+    virtual drogon::Task<void> sendToRoomDirectory(const chat::Envelope& message) const = 0;
+
+    /**
+     * @brief Sends a Protobuf message to a user's connections and to everyone sharing a room with them.
+     * @details Used for changes to a user's profile, such as a new username.
+     * @param userId The ID of the user the message is about.
      * @param message The Protobuf Envelope to send.
+     * @param member_rooms The rooms the user is a member of, whose connections also receive the
+     *        message, since they list the user even while the user is elsewhere.
      * @return A drogon::Task<void> to be awaited.
      */
-    virtual drogon::Task<void> sendToAll(const chat::Envelope& message) const = 0;
+    virtual drogon::Task<void> sendToUserPeers(int32_t userId, const chat::Envelope& message, const std::vector<int32_t>& member_rooms) const = 0;
     
     /**
      * @brief Handles the server-side state cleanup when a room is deleted.
@@ -95,10 +116,38 @@ public:
      * @param userId The ID of the user whose rights are being updated.
      * @param roomId The ID of the room where the rights changed.
      * @param newRights The new rights for the user in that room.
-     * @param locked_data A reference to the calling connection's locked `WsData`.
      * @return A drogon::Task<void> to be awaited.
      */
-    virtual drogon::Task<void> updateUserRoomRights(int32_t userId, int32_t roomId, chat::UserRights newRights, WsData& locked_data) = 0;
+    virtual drogon::Task<void> updateUserRoomRights(int32_t userId, int32_t roomId, chat::UserRights newRights) = 0;
+
+    /**
+     * @brief Updates the in-memory name of a user on all of their connections.
+     * @param userId The ID of the renamed user.
+     * @param newName The user's new name.
+     * @return A drogon::Task<void> to be awaited.
+     */
+    virtual drogon::Task<void> updateUsername(int32_t userId, const std::string& newName) = 0;
+
+    /**
+     * @brief Gets the id under which room event sequence numbers are comparable.
+     * @return The epoch, which changes when the sequences start over.
+     */
+    virtual const std::string& roomEventEpoch() const = 0;
+
+    /**
+     * @brief Gets a room's latest event sequence number.
+     * @param room_id The ID of the room.
+     * @return A drogon::Task resolving to the sequence number.
+     */
+    virtual drogon::Task<int64_t> roomEventSeq(int32_t room_id) const = 0;
+
+    /**
+     * @brief Gets a room's events after a sequence number.
+     * @param room_id The ID of the room.
+     * @param since_seq The last event the client has seen.
+     * @return A drogon::Task resolving to the events, or an incomplete result if they are no longer kept.
+     */
+    virtual drogon::Task<RoomEvents> roomEventsSince(int32_t room_id, int64_t since_seq) const = 0;
 };
 
 } // namespace server
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <functional>
+
+/**
+ * @file IEventBus.h
+ * @brief Defines the abstract interface for exchanging chat events between server processes.
+ */
+
+namespace server {
+
+/**
+ * @class IEventBus
+ * @brief An abstract, fire-and-forget channel connecting the server processes
+ *        that share one database.
+ *
+ * @details Each process keeps its own `ChatRoomManager` with the connections it
+ * accepted. Whenever a handler broadcasts to a room, changes a user's rights or
+ * otherwise touches state that other processes mirror, the change is applied
+ * locally first and then published on the bus. Every other process receives the
+ * event and applies it to its own connections.
+ *
+ * Delivery is best effort: events published while a process is disconnected
+ * from the bus are not replayed.
+ */
+class IEventBus {
+public:
+    /// @brief Invoked for every event published by another process.
+    using EventHandler = std::function<void(chat::BusEvent event)>;
+
+    virtual ~IEventBus() = default;
+
+    /**
+     * @brief Starts receiving events from other processes.
+     * @param handler Called for each received event. Events published by this
+     *        process are filtered out before the handler is invoked.
+     */
+    virtual void subscribe(EventHandler handler) = 0;
+
+    /**
+     * @brief Publishes an event to every other process.
+     * @details The `origin` field is filled in by the bus.
+     * @param event The event to publish.
+     * @return A drogon::Task<void> to be awaited.
+     */
+    virtual drogon::Task<void> publish(chat::BusEvent event) = 0;
+};
+
+} // namespace server
@@ -22,7 +22,7 @@ class IChatRoomService;
  * `MessageHandlers` class.
  *
  * It holds an instance of `MessageHandlers` (containing the business logic) and
- * orchestrates the flow of data, passing the connection state (`WsDataGuarded`), the
+ * orchestrates the flow of data, passing the connection state (`WsDataSnapshot`), the
  * request payload, and the necessary service dependencies (like `IChatRoomService`)
  * to the handler methods.
  */
@@ -47,10 +47,12 @@ public:
      * @param env The incoming request encapsulated in a Protobuf `Envelope`.
      * @param room_service A reference to the chat room service, used for any
      *        real-time state changes or broadcasts.
-     * @return A drogon::Task that resolves to a response `Envelope`, ready to
-     *         be sent back to the client.
+     * @param respEnv The response to fill, ready to be sent back to the client.
+     *        It is usually created on the request's arena, so the large responses
+     *        are built in place rather than copied into it.
+     * @return A drogon::Task that completes once `respEnv` is filled.
      */
-    drogon::Task<chat::Envelope> processMessage(const WsDataPtr& wsData, const chat::Envelope& env, IChatRoomService& room_service) const;
+    drogon::Task<void> processMessage(const WsDataPtr& wsData, const chat::Envelope& env, IChatRoomService& room_service, chat::Envelope& respEnv) const;
 
 private:
     /// @brief The owned instance containing the business logic implementations for each message type.
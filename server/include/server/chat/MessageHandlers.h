@@ -1,21 +1,13 @@
 #pragma once
 
-#include <drogon/orm/DbClient.h>
 #include <server/chat/WsData.h>
-#include <server/utils/scoped_coro_transaction.h>
+#include <server/storage/IStorage.h>
 
 /**
  * @file MessageHandlers.h
  * @brief Defines the class containing all core business logic for chat operations.
  */
 
-// Forward declaration for Drogon model to avoid including the full model header.
-namespace drogon_model {
-namespace drogon_test {
-    class Rooms;
-}
-}
-
 namespace server {
 
 class IChatRoomService;
@@ -29,7 +21,7 @@ class IChatRoomService;
  * `handleSendMessage`). These methods are responsible for:
  *
  * - Validating incoming data (e.g., checking for empty fields, valid UTF-8).
- * - Interacting with the database via the Drogon ORM for data persistence.
+ * - Reading and writing persistent state through an `IStorage` backend.
  * - Calling the `IChatRoomService` to perform real-time actions like
  *   broadcasting messages or updating room membership.
  * - Modifying the connection's state (`WsData`).
@@ -41,10 +33,10 @@ class IChatRoomService;
 class MessageHandlers {
 public:
     /**
-     * @brief Constructs the handlers with a database client.
-     * @param dbClient A shared pointer to the Drogon database client, used for all ORM operations.
+     * @brief Constructs the handlers with a storage backend.
+     * @param storage The store of users, rooms and messages, shared by all handlers.
      */
-    explicit MessageHandlers(drogon::orm::DbClientPtr dbClient);
+    explicit MessageHandlers(std::shared_ptr<IStorage> storage);
 
     /** @brief Handles the first step of user authentication (salt retrieval). */
     drogon::Task<chat::InitialAuthResponse> handleAuthInitial(const WsDataPtr& wsDataGuarded, const chat::InitialAuthRequest& req) const;
@@ -54,6 +46,9 @@ public:
     
     /** @brief Handles the final step of user authentication (hash verification). */
     drogon::Task<chat::AuthResponse> handleAuth(const WsDataPtr& wsDataGuarded, const chat::AuthRequest& req, IChatRoomService& room_service) const;
+
+    /** @brief Handles a login with a session token from an earlier `AuthResponse`, optionally rejoining a room. */
+    drogon::Task<chat::ResumeSessionResponse> handleResumeSession(const WsDataPtr& wsDataGuarded, const chat::ResumeSessionRequest& req, IChatRoomService& room_service) const;
     
     /** @brief Handles the final step of user registration (storing user credentials). */
     drogon::Task<chat::RegisterResponse> handleRegister(const WsDataPtr& wsDataGuarded, const chat::RegisterRequest& req) const;
@@ -61,8 +56,8 @@ public:
     /** @brief Handles a request to send a message to the user's current room. */
     drogon::Task<chat::SendMessageResponse> handleSendMessage(const WsDataPtr& wsDataGuarded, const chat::SendMessageRequest& req, IChatRoomService& room_service) const;
     
-    /** @brief Handles a request for a user to join a chat room. */
-    drogon::Task<chat::JoinRoomResponse> handleJoinRoom(const WsDataPtr& wsDataGuarded, const chat::JoinRoomRequest& req, IChatRoomService& room_service) const;
+    /** @brief Handles a request for a user to join a chat room, filling `resp` in place (it may live on an arena). */
+    drogon::Task<void> handleJoinRoom(const WsDataPtr& wsDataGuarded, const chat::JoinRoomRequest& req, IChatRoomService& room_service, chat::JoinRoomResponse& resp) const;
     
     /** @brief Handles a request for a user to leave their current chat room. */
     drogon::Task<chat::LeaveRoomResponse> handleLeaveRoom(const WsDataPtr& wsDataGuarded, const chat::LeaveRoomRequest&, IChatRoomService& room_service) const;
@@ -70,8 +65,14 @@ public:
     /** @brief Handles a request from a user to create a new chat room. */
     drogon::Task<chat::CreateRoomResponse> handleCreateRoom(const WsDataPtr& wsDataGuarded, const chat::CreateRoomRequest& req, IChatRoomService& room_service) const;
     
-    /** @brief Handles a request to retrieve a batch of historical messages from the user's current room. */
-    drogon::Task<chat::GetMessagesResponse> handleGetMessages(const WsDataPtr& wsDataGuarded, const chat::GetMessagesRequest& req) const;
+    /** @brief Handles a request to retrieve a batch of historical messages from the user's current room, filling `resp` in place. */
+    drogon::Task<void> handleGetMessages(const WsDataPtr& wsDataGuarded, const chat::GetMessagesRequest& req, chat::GetMessagesResponse& resp) const;
+
+    /** @brief Handles a request for the current room's events missed since a sequence number, filling `resp` in place. */
+    drogon::Task<void> handleSyncRoom(const WsDataPtr& wsDataGuarded, const chat::SyncRoomRequest& req, IChatRoomService& room_service, chat::SyncRoomResponse& resp) const;
+
+    /** @brief Handles a full-text search over the messages of all rooms the user may read, filling `resp` in place. */
+    drogon::Task<void> handleSearchMessages(const WsDataPtr& wsDataGuarded, const chat::SearchMessagesRequest& req, chat::SearchMessagesResponse& resp) const;
     
     /** @brief Handles a user's request to log out. */
     drogon::Task<chat::LogoutResponse> handleLogoutUser(const WsDataPtr& wsDataGuarded, IChatRoomService& room_service) const;
@@ -107,7 +108,7 @@ public:
 
 private:
     /**
-     * @brief Validates a string for valid UTF-8 encoding and maximum length.
+     * @brief Validates a string for valid UTF-8 encoding, maximum length and the absence of NUL characters.
      * @param textToValidate The string to check.
      * @param maxLength The maximum allowed number of UTF-8 characters.
      * @param fieldName The name of the field being validated (for error messages).
@@ -115,43 +116,8 @@ private:
      */
     std::optional<std::string> validateUtf8String(const std::string_view& textToValidate, size_t maxLength, const std::string_view& fieldName) const;
 
-    /**
-     * @brief Determines a user's rights (e.g., ADMIN, OWNER) for a specific room.
-     * @param db DbClientPtr
-     * @param user_id The ID of the user.
-     * @param room_id The ID of the room.
-     * @return A task resolving to an optional UserRights enum. Returns nullopt if the user has no specific role.
-     */
-    drogon::Task<std::optional<chat::UserRights>> getUserRights(const drogon::orm::DbClientPtr& db, int32_t user_id, int32_t room_id) const;
-
-    /**
-     * @brief Overload of getUserRights that accepts a pre-fetched room object to avoid an extra DB query.
-     * @param db DbClientPtr
-     * @param user_id The ID of the user.
-     * @param room_id The ID of the room.
-     * @param room A pre-fetched room model object.
-     * @return A task resolving to an optional UserRights enum.
-     */
-    drogon::Task<std::optional<chat::UserRights>> getUserRights(const drogon::orm::DbClientPtr& db, int32_t user_id, int32_t room_id, const drogon_model::drogon_test::Rooms& room) const;
-
-    /**
-     * @brief Helper to query the `user_room_roles` table for an explicit role assignment.
-     * @param db DbClientPtr
-     * @param user_id The ID of the user.
-     * @param room_id The ID of the room.
-     * @return A task resolving to an optional UserRights enum if a role is found.
-     */
-    drogon::Task<std::optional<chat::UserRights>> findStoredUserRole(const drogon::orm::DbClientPtr& db, int32_t user_id, int32_t room_id) const;
-
-    /** @brief Updates or creates a user's role entry in the UserRoomData table within a transaction. */
-    static drogon::Task<ScopedTransactionResult> updateUserRoleInDb(const std::shared_ptr<drogon::orm::Transaction>& tx, int32_t userId, int32_t roomId, chat::UserRights newRole);
-
-    static drogon::Task<std::optional<chat::MembershipStatus>> getUserMembershipStatus(const drogon::orm::DbClientPtr& db, int32_t user_id, int32_t room_id);
-    static drogon::Task<ScopedTransactionResult> setUserMembershipStatus(const drogon::orm::DbClientPtr& db, int32_t user_id, int32_t room_id, chat::MembershipStatus status);
-
-
-    /// @brief The shared database client for all ORM operations.
-    drogon::orm::DbClientPtr m_dbClient;
+    /// @brief The storage backend for all persistent state.
+    std::shared_ptr<IStorage> m_storage;
 };
 
 } // namespace server
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <server/chat/IEventBus.h>
+#include <drogon/orm/DbListener.h>
+
+/**
+ * @file PgEventBus.h
+ * @brief Defines an `IEventBus` backed by PostgreSQL LISTEN/NOTIFY.
+ */
+
+namespace server {
+
+/**
+ * @class PgEventBus
+ * @brief Exchanges events between server processes through a PostgreSQL notification channel.
+ *
+ * @details Events are serialized, base64-encoded and sent with `pg_notify` on the
+ * regular database client. A dedicated `DbListener` connection receives the
+ * notifications of all processes.
+ *
+ * @note PostgreSQL limits a notification payload to 8000 bytes. Larger events
+ * are dropped with an error in the log. With the current message size limits
+ * this is never reached.
+ */
+class PgEventBus : public IEventBus {
+public:
+    /**
+     * @brief Constructs the bus.
+     * @param dbClient The client used to publish notifications. Its connection
+     *        info is reused for the listening connection.
+     * @param channel The notification channel shared by all processes.
+     */
+    PgEventBus(drogon::orm::DbClientPtr dbClient, std::string channel);
+
+    /** @see IEventBus::subscribe */
+    void subscribe(EventHandler handler) override;
+
+    /** @see IEventBus::publish */
+    drogon::Task<void> publish(chat::BusEvent event) override;
+
+private:
+    /// @brief The client used to publish notifications.
+    drogon::orm::DbClientPtr m_dbClient;
+    /// @brief The dedicated connection receiving notifications.
+    drogon::orm::DbListenerPtr m_listener;
+    /// @brief The notification channel shared by all processes.
+    std::string m_channel;
+    /// @brief A unique ID of this process, used to skip its own notifications.
+    std::string m_origin;
+};
+
+} // namespace server
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <array>
+#include <deque>
+#include <mutex>
+
+/**
+ * @file RoomEventLog.h
+ * @brief Defines the per-room sequence numbers and recent history of room events.
+ */
+
+namespace server {
+
+/// @brief A room's events after a given sequence number.
+struct RoomEvents {
+    /// @brief The room's latest sequence number; 0 if it has had no events.
+    int64_t seq = 0;
+    /// @brief False if the log no longer holds every event after the requested one,
+    ///        or the requested one was never issued; the client must then reload the room.
+    bool complete = false;
+    /// @brief The events in sequence order, each with its `room_seq` set.
+    std::vector<chat::Envelope> events;
+};
+
+/**
+ * @class RoomEventLog
+ * @brief Stamps room events with a per-room, gap-free sequence number and keeps
+ *        the most recent ones, so a client can tell what it missed and catch up.
+ *
+ * @details The stamped event is delivered while the room's order is held, so
+ * every connection receives a room's events in sequence order, even though the
+ * handlers publishing them run concurrently. Rooms are independent: each has
+ * its own lock, sequence and history of up to `capacity` events, and rooms are
+ * looked up in one of `SHARDS` maps with their own locks.
+ *
+ * A room without events for a while loses its history (see `evictIdle()`) but
+ * keeps its sequence number, so clients that saw its last event stay in sync
+ * and the others reload the room.
+ *
+ * Sequence numbers start over when the process restarts and differ between
+ * processes, so they are only comparable within one `epoch()`.
+ */
+class RoomEventLog {
+public:
+    /// @param capacity How many recent events are kept per room.
+    explicit RoomEventLog(std::size_t capacity = 1024);
+
+    /// @brief Changes how many recent events are kept per room, from the next event on.
+    void setCapacity(std::size_t capacity) noexcept { m_capacity.store(std::max<std::size_t>(capacity, 1)); }
+
+    /// @brief A random id of this log, changing on every start of the process.
+    const std::string& epoch() const noexcept { return m_epoch; }
+
+    /**
+     * @brief Stamps the room's next sequence number on an event, records it and delivers it.
+     * @param room_id The room of the event.
+     * @param event The event to record; a copy is stamped.
+     * @param deliver Called with the stamped event before another event of the room is stamped.
+     */
+    template<typename Deliver>
+    void publish(int32_t room_id, const chat::Envelope& event, Deliver&& deliver) {
+        auto room = find(room_id, true);
+        std::lock_guard lock(room->mutex);
+        room->last_event = std::chrono::steady_clock::now();
+        auto& stamped = room->events.emplace_back(event);
+        stamped.set_room_seq(++room->seq);
+        if(room->events.size() > m_capacity.load(std::memory_order_relaxed)) {
+            room->events.pop_front();
+        }
+        const auto& recorded = room->events.back();
+        deliver(recorded);
+    }
+
+    /// @brief Gets a room's latest sequence number; 0 if it has had no events.
+    int64_t seq(int32_t room_id) const;
+
+    /**
+     * @brief Gets a room's events after a sequence number.
+     * @param room_id The room.
+     * @param since_seq The last event the client has seen.
+     */
+    RoomEvents since(int32_t room_id, int64_t since_seq) const;
+
+    /// @brief Drops a deleted room's sequence and history.
+    void forget(int32_t room_id);
+
+    /**
+     * @brief Drops the history of rooms without events for `idle_ttl`, keeping only their sequence numbers.
+     * @return How many rooms were evicted.
+     */
+    std::size_t evictIdle(std::chrono::steady_clock::duration idle_ttl);
+
+private:
+    /// @brief The number of room map shards; a power of two.
+    static constexpr std::size_t SHARDS = 64;
+
+    struct Room {
+        std::mutex mutex;
+        int64_t seq = 0;
+        std::chrono::steady_clock::time_point last_event;
+        std::deque<chat::Envelope> events;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<int32_t, std::shared_ptr<Room>> rooms;
+        /// @brief The sequence numbers of evicted rooms, taken up again by their next event.
+        std::unordered_map<int32_t, int64_t> idle_seqs;
+    };
+
+    Shard& shard(int32_t room_id) const noexcept { return m_shards[static_cast<uint32_t>(room_id) & (SHARDS - 1)]; }
+
+    /**
+     * @brief Looks a room up, creating it if asked to.
+     * @param[out] idle_seq Receives an evicted room's sequence number if it is not created.
+     */
+    std::shared_ptr<Room> find(int32_t room_id, bool create, int64_t* idle_seq = nullptr) const;
+
+    const std::string m_epoch;
+    std::atomic<std::size_t> m_capacity;
+
+    mutable std::array<Shard, SHARDS> m_shards;
+};
+
+} // namespace server
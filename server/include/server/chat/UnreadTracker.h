@@ -0,0 +1,119 @@
+#pragma once
+
+#include <drogon/orm/DbClient.h>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * @file UnreadTracker.h
+ * @brief Defines the singleton tracking read markers and unread counts of online users.
+ */
+
+namespace server {
+
+/**
+ * @class UnreadTracker
+ * @brief Keeps the unread message counts of the joined rooms of every user
+ *        connected to this process, and persists how far each user has read.
+ *
+ * @details The `read_markers` table stores the newest message id each user has
+ * read in each room. The tracker works on an in-memory copy for online users:
+ *
+ * - On login, `load()` reads the user's markers and unread counts (capped at
+ *   `MAX_UNREAD_COUNT`) in one query and puts them into the room list.
+ * - Every room message delivered by `ChatRoomManager` goes through
+ *   `onRoomMessage()`. Users viewing the room have read it. Everyone else gets
+ *   their count incremented and is sent an `UnreadCountUpdate`.
+ * - Joining a room marks it read up to its head, the newest message id known to
+ *   this process.
+ *
+ * Marker changes are only recorded in memory and written in one batched upsert
+ * per flush interval, so reading never adds a query to the message path. A
+ * marker never moves backwards, and at most one interval of progress is lost if
+ * the process dies.
+ *
+ * Until `start()` is called, e.g. with the in-memory storage backend, no user
+ * is tracked and `load()` and `markRead()` do nothing.
+ *
+ * All methods are thread-safe. The in-memory state is guarded by a plain mutex
+ * that is never held across a `co_await`.
+ */
+class UnreadTracker {
+public:
+    /**
+     * @brief Gets the singleton instance of UnreadTracker.
+     * @return A reference to the single UnreadTracker instance.
+     */
+    static UnreadTracker& instance();
+
+    /**
+     * @brief Schedules the periodic flush of read markers on the main loop.
+     * @note Must be called once, after migrations have been applied.
+     * @param db The primary database client.
+     * @param flush_interval How often changed markers are written.
+     */
+    void start(drogon::orm::DbClientPtr db, std::chrono::milliseconds flush_interval);
+
+    /**
+     * @brief Loads a user's unread counts and starts tracking them.
+     * @param user_id The user who just logged in.
+     * @param rooms The room list sent to the user. `unread_count` is set on the joined rooms.
+     * @return A drogon::Task<void> to be awaited.
+     */
+    drogon::Task<void> load(int32_t user_id, google::protobuf::RepeatedPtrField<chat::RoomInfo>& rooms);
+
+    /**
+     * @brief Marks a room as read up to its newest message.
+     * @param user_id The user who joined the room.
+     * @param room_id The joined room.
+     * @return A drogon::Task<void> to be awaited.
+     */
+    drogon::Task<void> markRead(int32_t user_id, int32_t room_id);
+
+    /**
+     * @brief Counts a new room message for the online members of the room.
+     * @param room_id The room the message was posted in.
+     * @param message_id The id of the new message.
+     * @param is_viewing Whether a user currently has the room open.
+     * @return The `(user_id, unread_count)` pairs whose count changed and must be pushed.
+     */
+    std::vector<std::pair<int32_t, int32_t>> onRoomMessage(int32_t room_id, int32_t message_id, const std::function<bool(int32_t)>& is_viewing);
+
+    /// @brief Stops tracking a user whose last connection has closed.
+    void forget(int32_t user_id);
+
+private:
+    UnreadTracker() = default;
+    UnreadTracker(const UnreadTracker&) = delete;
+    UnreadTracker& operator=(const UnreadTracker&) = delete;
+
+    struct RoomCounter {
+        int32_t last_read = 0;
+        int32_t unread = 0;
+    };
+
+    /// @brief Writes the changed markers in one batch.
+    drogon::Task<> flush();
+
+    /// @brief Advances a marker and queues it for the next flush.
+    /// @note Assumes the caller holds `m_mutex`.
+    void advance_unsafe(int32_t user_id, int32_t room_id, RoomCounter& counter, int32_t message_id);
+
+    drogon::orm::DbClientPtr m_db;
+
+    /// @brief The unread counters of each online user, by room.
+    std::unordered_map<int32_t, std::unordered_map<int32_t, RoomCounter>> m_users;
+    /// @brief The tracked online users of each room.
+    std::unordered_map<int32_t, std::unordered_set<int32_t>> m_room_users;
+    /// @brief The newest message id seen in each room.
+    std::unordered_map<int32_t, int32_t> m_heads;
+    /// @brief Markers changed since the last flush, by `(user_id, room_id)`.
+    std::map<std::pair<int32_t, int32_t>, int32_t> m_dirty;
+    std::mutex m_mutex;
+};
+
+} // namespace server
@@ -1,6 +1,8 @@
 #pragma once
 
-#include <common/utils/guarded.h>
+#include <common/utils/snapshot.h>
+#include <common/utils/pool.h>
+#include <functional>
 
 /**
  * @file WsData.h
@@ -50,10 +52,12 @@ struct CurrentRoom {
  * @struct WsData
  * @brief A container for all state information associated with a single WebSocket connection.
  *
- * @details This structure is the primary state object for a client session. An
- * instance of this struct (wrapped in a `common::Guarded` object for thread
- * safety) is attached to each `drogon::WebSocketConnection`'s context. It tracks
- * everything from the user's authentication status to their current room membership.
+ * @details This structure is the primary state object for a client session. It
+ * is published through a `common::Snapshot` attached to each
+ * `drogon::WebSocketConnection`'s context: readers take an immutable version
+ * without locking, writers derive a new version and swap it in atomically. It
+ * tracks everything from the user's authentication status to their current
+ * room membership.
  */
 struct WsData {
     /// @brief Holds the authenticated user's information. Contains a value only if `status` is `Authenticated`.
@@ -64,14 +68,27 @@ struct WsData {
     USER_STATUS status = USER_STATUS::Unauthenticated;
 };
 
-/// @brief A type alias for `WsData` protected by a `common::Guarded` wrapper for thread-safe access.
-using WsDataGuarded = common::Guarded<WsData>;
-/// @brief A type alias for a shared pointer to a `WsDataGuarded` object, as stored in the connection context.
-using WsDataPtr = std::shared_ptr<WsDataGuarded>;
+/// @brief A type alias for `WsData` published as atomically swapped immutable versions,
+///        allocated from the IO thread's pool.
+using WsDataSnapshot = common::Snapshot<WsData, common::PoolAllocator<WsData>>;
+/// @brief A type alias for a shared pointer to a `WsDataSnapshot` object, as stored in the connection context.
+using WsDataPtr = std::shared_ptr<WsDataSnapshot>;
 
-/// @brief A type alias for the read-only proxy returned by `lock_shared()` on a `WsDataGuarded` object.
-using WsDataSharedProxy = WsDataGuarded::SharedProxy;
-/// @brief A type alias for the read-write proxy returned by `lock_unique()` on a `WsDataGuarded` object.
-using WsDataUniqueProxy = WsDataGuarded::UniqueProxy;
+/// @brief A type alias for one immutable version of a connection's `WsData`, as returned by `load()`.
+using WsDataView = WsDataSnapshot::Ptr;
+/// @brief A state transition applied to a private copy of `WsData`. Returns `false` to reject the change.
+using WsDataMutator = std::function<bool(WsData&)>;
+
+/**
+ * @brief Creates the state of a new connection.
+ * @details The snapshot and its control block take a single pooled block, and
+ * start from a version shared by all fresh connections, so an idle connection
+ * that never logs in costs one small recycled allocation.
+ * @return The new connection state, ready to be set as the connection context.
+ */
+inline WsDataPtr makeWsData() {
+    static const WsDataView initial = std::make_shared<const WsData>();
+    return std::allocate_shared<WsDataSnapshot>(common::PoolAllocator<WsDataSnapshot>{}, std::in_place, initial);
+}
 
 } // namespace server
@@ -38,11 +38,96 @@ public:
      * @param callback The function to call to send the HTTP response.
      */
     void healthCheck(const HttpRequestPtr& req, std::function<void(const HttpResponsePtr&)>&& callback) const;
+
+    /**
+     * @brief Handles a request to the /metrics endpoint.
+     *
+     * @details Responds with the server's current load figures (the same ones
+     * reported to the aggregator) in the Prometheus text exposition format.
+     *
+     * @param req The incoming HTTP request pointer.
+     * @return A drogon::Task resolving to the HTTP response.
+     */
+    Task<HttpResponsePtr> metrics(HttpRequestPtr req) const;
+
+    /**
+     * @brief Handles a request to POST /attachments/uploads.
+     *
+     * @details Starts a chunked upload. The JSON body gives the `file_name`,
+     * `content_type` and `size` of the file. Responds with the `upload_id` and the
+     * largest accepted `chunk_size`.
+     *
+     * Like all attachment endpoints, it requires an `Authorization: Bearer <token>`
+     * header with the session token received on login.
+     *
+     * @param req The incoming HTTP request pointer.
+     * @return A drogon::Task resolving to the HTTP response.
+     */
+    Task<HttpResponsePtr> beginUpload(HttpRequestPtr req) const;
+
+    /**
+     * @brief Handles a request to GET /attachments/uploads/{upload_id}.
+     *
+     * @details Responds with how many bytes of the upload were `received`, so an
+     * interrupted upload can continue from there.
+     *
+     * @param req The incoming HTTP request pointer.
+     * @param upload_id The upload.
+     * @return A drogon::Task resolving to the HTTP response.
+     */
+    Task<HttpResponsePtr> uploadStatus(HttpRequestPtr req, std::string upload_id) const;
+
+    /**
+     * @brief Handles a request to PUT /attachments/uploads/{upload_id}?offset=N.
+     *
+     * @details Writes the body at `offset`. The offset may not be past the bytes
+     * received so far, so chunks are sent in order and a failed chunk can be sent
+     * again. Responds with the `received` byte count, or with `409 Conflict` and
+     * the current count if the offset does not fit.
+     *
+     * @param req The incoming HTTP request pointer.
+     * @param upload_id The upload.
+     * @return A drogon::Task resolving to the HTTP response.
+     */
+    Task<HttpResponsePtr> uploadChunk(HttpRequestPtr req, std::string upload_id) const;
+
+    /**
+     * @brief Handles a request to POST /attachments/uploads/{upload_id}/complete.
+     *
+     * @details Once all bytes have been received, stores the file and responds
+     * with its `attachment_id`, which can then be sent in `SendMessageRequest`.
+     *
+     * @param req The incoming HTTP request pointer.
+     * @param upload_id The upload.
+     * @return A drogon::Task resolving to the HTTP response.
+     */
+    Task<HttpResponsePtr> completeUpload(HttpRequestPtr req, std::string upload_id) const;
+
+    /**
+     * @brief Handles a request to GET /attachments/{attachment_id}.
+     *
+     * @details Sends the file to its uploader or to anyone who can read a room it
+     * was posted in. The file is sent from disk with `sendfile`, supports a single
+     * `Range` and is cached by its hash through `ETag`.
+     *
+     * @param req The incoming HTTP request pointer.
+     * @param attachment_id The attachment.
+     * @return A drogon::Task resolving to the HTTP response.
+     */
+    Task<HttpResponsePtr> download(HttpRequestPtr req, int32_t attachment_id) const;
     
     // --- Drogon's Macro-based Method and Path Mapping ---
     METHOD_LIST_BEGIN
         /// Maps the GET /health URL path to the healthCheck method.
         ADD_METHOD_TO(HttpController::healthCheck, "/health", Get);
+        /// Maps the GET /metrics URL path to the metrics method.
+        ADD_METHOD_TO(HttpController::metrics, "/metrics", Get);
+        /// Maps the attachment upload and download paths.
+        ADD_METHOD_TO(HttpController::beginUpload, "/attachments/uploads", Post);
+        ADD_METHOD_TO(HttpController::uploadStatus, "/attachments/uploads/{1}", Get);
+        ADD_METHOD_TO(HttpController::uploadChunk, "/attachments/uploads/{1}", Put);
+        ADD_METHOD_TO(HttpController::completeUpload, "/attachments/uploads/{1}/complete", Post);
+        ADD_METHOD_TO(HttpController::download, "/attachments/{1}", Get);
     METHOD_LIST_END    
 };
 
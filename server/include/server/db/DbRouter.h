@@ -0,0 +1,94 @@
+#pragma once
+
+#include <drogon/orm/DbClient.h>
+#include <atomic>
+
+/**
+ * @file DbRouter.h
+ * @brief Defines the singleton routing read-only queries to an optional replica.
+ */
+
+namespace server {
+
+/**
+ * @class DbRouter
+ * @brief Routes read-only queries to a read replica while it is healthy, and
+ *        everything else to the primary.
+ *
+ * @details The replica is an optional second `db_clients` entry named in
+ * `custom_config.read_replica.client`. A health check runs on the main loop
+ * and asks the replica how far its replay is behind. The replica is used only
+ * while that lag is within the configured limit. A replica query that fails
+ * marks the replica unhealthy until the next successful check, and the query
+ * is retried on the primary.
+ *
+ * Reads that must observe the caller's own writes (e.g., a room created a
+ * moment ago) should keep using the primary.
+ *
+ * All methods are safe to call from any thread.
+ */
+class DbRouter {
+public:
+    /**
+     * @brief Gets the singleton instance of DbRouter.
+     * @return A reference to the single DbRouter instance.
+     */
+    static DbRouter& instance();
+
+    /**
+     * @brief Sets up routing and starts the replica health checks.
+     * @note Must be called once, before serving requests (e.g., from a beginning advice).
+     * @param primary The client that receives all writes.
+     * @param replica The read-only client, or `nullptr` to route everything to the primary.
+     * @param max_lag The replay lag above which the replica is skipped.
+     * @param check_interval How often the replica's lag is checked.
+     */
+    void start(drogon::orm::DbClientPtr primary,
+               drogon::orm::DbClientPtr replica,
+               std::chrono::milliseconds max_lag,
+               std::chrono::milliseconds check_interval);
+
+    /// @brief Returns whether read-only queries currently go to the replica.
+    bool replicaHealthy() const noexcept { return m_replica_healthy.load(std::memory_order_acquire); }
+
+    /**
+     * @brief Runs a read-only query on the replica if it is healthy, otherwise on the primary.
+     *
+     * @details If the query fails on the replica with a database error, the
+     * replica is marked unhealthy and the query is run again on the primary.
+     *
+     * @param primary The client to use when the replica is not available.
+     * @param query A callable taking a `drogon::orm::DbClientPtr` and returning a `drogon::Task<T>`.
+     * @return A drogon::Task resolving to the query's result.
+     */
+    template <typename Query>
+    auto read(drogon::orm::DbClientPtr primary, Query query) -> decltype(query(primary)) {
+        if(replicaHealthy()) {
+            bool replica_failed = false;
+            try {
+                co_return co_await query(m_replica);
+            } catch(const drogon::orm::DrogonDbException& e) {
+                LOG_WARN << "Read replica query failed, using the primary: " << e.base().what();
+                replica_failed = true;
+            }
+            if(replica_failed) {
+                m_replica_healthy.store(false, std::memory_order_release);
+            }
+        }
+        co_return co_await query(std::move(primary));
+    }
+
+private:
+    DbRouter() = default;
+    DbRouter(const DbRouter&) = delete;
+    DbRouter& operator=(const DbRouter&) = delete;
+
+    /// @brief Measures the replica's replay lag and updates its health.
+    drogon::Task<> checkReplica();
+
+    drogon::orm::DbClientPtr m_replica;
+    std::chrono::milliseconds m_max_lag{5000};
+    std::atomic<bool> m_replica_healthy{false};
+};
+
+} // namespace server
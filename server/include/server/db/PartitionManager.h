@@ -0,0 +1,88 @@
+#pragma once
+
+#include <drogon/orm/DbClient.h>
+#include <server/utils/scoped_coro_transaction.h>
+
+/**
+ * @file PartitionManager.h
+ * @brief Defines the singleton maintaining the partitions of the `messages` table.
+ */
+
+namespace server {
+
+/**
+ * @class PartitionManager
+ * @brief Creates future monthly partitions of `messages` ahead of time and
+ *        retires expired ones.
+ *
+ * @details `messages` is range-partitioned on `created_at` (microseconds since
+ * the epoch, UTC). The migration attaches all pre-existing rows as
+ * `messages_legacy` plus a `messages_default` catch-all. Each maintenance pass:
+ *
+ * - Creates `messages_pYYYYMM` partitions from the end of the last existing
+ *   range up to `months_ahead` months past the current one, so inserts never
+ *   land in the default partition. Rows that did land there, e.g. while the
+ *   server was down, are moved into the new partition as it is created.
+ * - Retires partitions whose whole range is older than `retention_months`.
+ *   They are either dropped or only detached, leaving a standalone table for
+ *   archival.
+ *
+ * A pass runs once at startup and then every check interval on the main loop.
+ * Each statement is idempotent against the catalog state it was derived from,
+ * so several processes sharing a database may run passes concurrently; the
+ * loser of a race just logs the error and catches up on its next pass.
+ */
+class PartitionManager {
+public:
+    /// @brief What happens to a partition that falls out of the retention window.
+    enum class RetentionAction {
+        Detach, ///< Detach it from `messages` but keep the table.
+        Drop,   ///< Detach and drop it.
+    };
+
+    /// @brief The maintenance policy, read from `custom_config.partitions`.
+    struct Policy {
+        /// @brief How many months past the current one must already have a partition.
+        int months_ahead = 3;
+        /// @brief How many whole months of history to keep; 0 keeps everything.
+        int retention_months = 0;
+        RetentionAction retention_action = RetentionAction::Detach;
+        std::chrono::seconds check_interval{3600};
+    };
+
+    /**
+     * @brief Gets the singleton instance of PartitionManager.
+     * @return A reference to the single PartitionManager instance.
+     */
+    static PartitionManager& instance();
+
+    /**
+     * @brief Runs a first maintenance pass and schedules the following ones.
+     * @note Must be called once, after migrations have been applied.
+     * @param db The primary database client.
+     * @param policy The maintenance policy.
+     */
+    void start(drogon::orm::DbClientPtr db, Policy policy);
+
+private:
+    PartitionManager() = default;
+    PartitionManager(const PartitionManager&) = delete;
+    PartitionManager& operator=(const PartitionManager&) = delete;
+
+    /// @brief Creates missing future partitions and retires expired ones.
+    drogon::Task<> maintain();
+
+    /**
+     * @brief Creates the partition for `[from, to)`, moving the rows of that range
+     *        out of the default partition first if there are any.
+     * @return An error message if the partition could not be created.
+     */
+    drogon::Task<ScopedTransactionResult> createPartition(const std::string& name, int64_t from, int64_t to);
+
+    drogon::orm::DbClientPtr m_db;
+    Policy m_policy;
+    /// @brief Set while a pass is running, so slow passes do not pile up.
+    std::atomic<bool> m_running{false};
+};
+
+} // namespace server
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <drogon/WebSocketConnection.h>
+#include <mutex>
+
+/**
+ * @file AdmissionControl.h
+ * @brief Defines the singleton limiting how many new connections are admitted at once.
+ */
+
+namespace server {
+
+/**
+ * @class AdmissionControl
+ * @brief Bounds the number of connections that are still logging in, and the
+ *        rate of new connections per client IP.
+ *
+ * @details A connection holds a handshake slot from the moment it is accepted
+ * until it authenticates, closes, or exceeds the handshake timeout. A timed out
+ * connection stays open, so a user idling on the login screen can still log in
+ * later; it just no longer blocks a slot. The auth queries of connections right
+ * after a reconnect storm therefore never exceed `max_handshakes`.
+ *
+ * Each client IP also has a token bucket refilled at `per_ip_rate` connections
+ * per second, up to `per_ip_burst`.
+ *
+ * A rejected connection receives a `ServerHello` with `retry_after_ms` and is
+ * closed. Clients wait that long plus a random jitter before reconnecting, so a
+ * restart turns into a bounded, steady warm-up instead of a thundering herd.
+ */
+class AdmissionControl {
+public:
+    /// @brief Limits read from `custom_config.admission`.
+    struct Config {
+        std::size_t max_handshakes = 256;
+        std::chrono::seconds handshake_timeout{30};
+        double per_ip_rate = 2.0;
+        double per_ip_burst = 10.0;
+        /// @brief The retry hint given when all handshake slots are taken.
+        std::chrono::milliseconds busy_retry{1000};
+    };
+
+    /**
+     * @brief Gets the singleton instance of AdmissionControl.
+     * @return A reference to the single AdmissionControl instance.
+     */
+    static AdmissionControl& instance();
+
+    /// @brief Applies the limits. Must be called before serving requests.
+    void configure(Config config);
+
+    /**
+     * @brief Decides whether to admit a new connection.
+     * @details An admitted connection takes a handshake slot, which is freed
+     *          after the handshake timeout if it still holds it.
+     * @param conn The new connection.
+     * @return `std::nullopt` if admitted, otherwise how long the client should wait.
+     */
+    std::optional<std::chrono::milliseconds> admit(const drogon::WebSocketConnectionPtr& conn);
+
+    /// @brief Frees the connection's handshake slot, if it holds one.
+    void release(const drogon::WebSocketConnectionPtr& conn);
+
+private:
+    AdmissionControl() = default;
+    AdmissionControl(const AdmissionControl&) = delete;
+    AdmissionControl& operator=(const AdmissionControl&) = delete;
+
+    struct Bucket {
+        double tokens;
+        std::chrono::steady_clock::time_point updated;
+    };
+
+    /// @brief Takes a token from the IP's bucket, or returns the time until one is available.
+    std::optional<std::chrono::milliseconds> takeToken(const std::string& ip);
+
+    Config m_config;
+
+    std::unordered_set<drogon::WebSocketConnectionPtr> m_handshaking;
+    std::unordered_map<std::string, Bucket> m_buckets;
+    std::mutex m_mutex;
+};
+
+} // namespace server
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <limits>
+
+/**
+ * @file RateLimiter.h
+ * @brief Defines a lock-free, keyed rate limiter.
+ */
+
+namespace server {
+
+/**
+ * @class RateLimiter
+ * @brief Limits the rate of events per integer key (e.g., a user or room id)
+ *        without taking any lock.
+ *
+ * @details Each key is a token bucket of `burst` tokens refilled at `rate`
+ * tokens per second, implemented as the generic cell rate algorithm: the whole
+ * bucket state is one "theoretical arrival time" (TAT), advanced with a single
+ * compare-and-swap per admitted event.
+ *
+ * Buckets live in a fixed-size open-addressing table of atomic slots. A slot
+ * whose TAT lies in the past belongs to a full bucket, which is the same as a
+ * bucket that was never used, so such slots are taken over by new keys instead
+ * of ever being freed. While the table is full of active keys, unknown keys are
+ * not limited. Two threads racing on a slot takeover may briefly share or split
+ * a bucket, which costs at most a token or two.
+ */
+class RateLimiter {
+public:
+    /**
+     * @brief Constructs a limiter that admits everything until configured.
+     * @param capacity The number of slots, rounded up to a power of two. Bounds
+     *        how many keys can be limited at the same time.
+     */
+    explicit RateLimiter(std::size_t capacity = 1 << 16);
+
+    /**
+     * @brief Sets the limit for all keys.
+     * @note Must be called before the limiter is used concurrently.
+     * @param rate Sustained events per second. Zero or less disables the limit.
+     * @param burst How many events may be admitted back to back.
+     */
+    void configure(double rate, double burst);
+
+    /**
+     * @brief Admits one event for `key`, if its bucket has a token.
+     * @param key The key to charge.
+     * @return `std::nullopt` if admitted, otherwise how long until a token is available.
+     */
+    std::optional<std::chrono::microseconds> acquire(int64_t key) noexcept;
+
+    /**
+     * @brief Tells whether `key` has a token, without taking it.
+     * @param key The key to check.
+     * @return `std::nullopt` if a token is available, otherwise how long until one is.
+     */
+    std::optional<std::chrono::microseconds> peek(int64_t key) noexcept;
+
+    /// @brief Gives back a token taken by `acquire`, when the event was not admitted after all.
+    void refund(int64_t key) noexcept;
+
+private:
+    /// @brief The key of a slot that has never been used.
+    static constexpr int64_t EMPTY_KEY = std::numeric_limits<int64_t>::min();
+
+    struct Slot {
+        std::atomic<int64_t> key{EMPTY_KEY};
+        /// @brief The theoretical arrival time in steady-clock microseconds.
+        std::atomic<int64_t> tat{0};
+    };
+
+    /// @brief Finds or takes over the slot of `key`, or returns null if none is available.
+    Slot* find(int64_t key, int64_t now) noexcept;
+
+    /// @brief How many slots are probed from a key's home slot.
+    static constexpr std::size_t MAX_PROBES = 16;
+
+    std::unique_ptr<Slot[]> m_slots;
+    std::size_t m_mask;
+    /// @brief Microseconds per token, or zero when the limit is disabled.
+    int64_t m_interval = 0;
+    /// @brief How far the TAT may run ahead of now, i.e. `(burst - 1)` tokens.
+    int64_t m_tolerance = 0;
+};
+
+} // namespace server
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <server/limits/RateLimiter.h>
+#include <server/chat/WsData.h>
+
+/**
+ * @file RequestRateLimits.h
+ * @brief Defines the singleton limiting how often users may send messages and typing notifications.
+ */
+
+namespace server {
+
+/**
+ * @class RequestRateLimits
+ * @brief Per-user and per-room rate limits for the requests that fan out to a room.
+ *
+ * @details `MessageHandlerService` checks these before dispatching, i.e. before
+ * any lock is taken or query is run:
+ * - `SendMessageRequest` is charged to the sender and to the current room, so
+ *   neither one spammer nor many users together can flood a room. It is only
+ *   charged if both have a token, so a rejected message costs neither.
+ * - `UserTypingStartRequest` is charged to the sender.
+ *
+ * Requests that are not yet authenticated or not in a room are not charged; their
+ * handlers reject them anyway. A rejected request is answered with
+ * `STATUS_RATE_LIMITED` and `retry_after_ms`.
+ */
+class RequestRateLimits {
+public:
+    /// @brief Limits read from `custom_config.rate_limits`. A rate of zero disables that limit.
+    struct Config {
+        double user_messages_per_sec = 2.0;
+        double user_messages_burst = 10.0;
+        double room_messages_per_sec = 50.0;
+        double room_messages_burst = 200.0;
+        double user_typing_per_sec = 1.0;
+        double user_typing_burst = 5.0;
+    };
+
+    /**
+     * @brief Gets the singleton instance of RequestRateLimits.
+     * @return A reference to the single RequestRateLimits instance.
+     */
+    static RequestRateLimits& instance();
+
+    /// @brief Applies the limits. Must be called before serving requests.
+    void configure(const Config& config);
+
+    /**
+     * @brief Charges a request against the limits that apply to it.
+     * @param data The sender's connection state.
+     * @param request The kind of request.
+     * @return `std::nullopt` if the request may proceed, otherwise how long the client should wait.
+     */
+    std::optional<std::chrono::milliseconds> check(const WsData& data, chat::Envelope::PayloadCase request) noexcept;
+
+private:
+    RequestRateLimits() = default;
+    RequestRateLimits(const RequestRateLimits&) = delete;
+    RequestRateLimits& operator=(const RequestRateLimits&) = delete;
+
+    RateLimiter m_user_messages;
+    RateLimiter m_room_messages;
+    RateLimiter m_user_typing;
+};
+
+} // namespace server
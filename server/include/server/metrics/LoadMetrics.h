@@ -0,0 +1,94 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+
+/**
+ * @file LoadMetrics.h
+ * @brief Defines the singleton collecting this server's load figures.
+ */
+
+namespace server {
+
+/**
+ * @class LoadMetrics
+ * @brief A thread-safe singleton collecting the load figures reported to the
+ *        aggregator and exposed on `/metrics`.
+ *
+ * @details Figures are collected over fixed windows. At the end of each window
+ * the worst event-loop lag and the p99 handler latency of that window are
+ * published, and collection starts over. The published figures are what
+ * `currentLoad()` returns, so every consumer sees the same numbers for the
+ * duration of a window.
+ *
+ * - **Event-loop lag** is measured by a probe timer on every IO loop: the
+ *   amount by which a tick fires later than scheduled.
+ * - **Handler latency** is recorded by `WsRequestProcessor` into a lock-free
+ *   histogram with power-of-two microsecond buckets, so the p99 is accurate
+ *   to within a factor of two.
+ *
+ * All recording methods are lock-free and safe to call from any thread.
+ */
+class LoadMetrics {
+public:
+    /**
+     * @brief Gets the singleton instance of LoadMetrics.
+     * @return A reference to the single LoadMetrics instance.
+     */
+    static LoadMetrics& instance();
+
+    /**
+     * @brief Installs the lag probes on all IO loops and starts rolling windows.
+     * @note Must be called once, after the IO loops have been created (e.g.,
+     *       from a beginning advice).
+     * @param window The length of a collection window.
+     */
+    void start(std::chrono::milliseconds window);
+
+    /// @brief Returns the length of a collection window.
+    std::chrono::milliseconds window() const noexcept { return m_window; }
+
+    /// @brief Counts a newly accepted WebSocket connection.
+    void connectionOpened() noexcept;
+
+    /// @brief Counts a closed WebSocket connection.
+    void connectionClosed() noexcept;
+
+    /**
+     * @brief Records how long a single request took to handle.
+     * @param latency The time from receiving the request to sending the response.
+     */
+    void recordHandlerLatency(std::chrono::microseconds latency) noexcept;
+
+    /**
+     * @brief Gathers the current load figures.
+     * @return A drogon::Task resolving to the live connection and room counts
+     *         together with the figures of the last completed window.
+     */
+    drogon::Task<chat::ServerLoad> currentLoad() const;
+
+private:
+    LoadMetrics() = default;
+    LoadMetrics(const LoadMetrics&) = delete;
+    LoadMetrics& operator=(const LoadMetrics&) = delete;
+
+    /// @brief Publishes the figures of the window that just ended and resets the collectors.
+    void rollWindow();
+
+    /// @brief Records one lag probe sample, keeping the worst one of the window.
+    void recordLoopLag(std::chrono::microseconds lag) noexcept;
+
+    /// @brief Number of histogram buckets; bucket `i` covers `[2^i, 2^(i+1))` microseconds.
+    static constexpr std::size_t LATENCY_BUCKETS = 32;
+
+    std::chrono::milliseconds m_window{5000};
+
+    std::array<std::atomic<uint64_t>, LATENCY_BUCKETS> m_latency_buckets{};
+    std::atomic<int64_t> m_max_lag_us{0};
+    std::atomic<int32_t> m_connections{0};
+
+    std::atomic<double> m_last_p99_ms{0.0};
+    std::atomic<double> m_last_lag_ms{0.0};
+};
+
+} // namespace server
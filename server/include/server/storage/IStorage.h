@@ -0,0 +1,206 @@
+#pragma once
+
+#include <server/utils/scoped_coro_transaction.h>
+#include <google/protobuf/repeated_ptr_field.h>
+#include <functional>
+
+/**
+ * @file IStorage.h
+ * @brief Defines the abstract interface to the persistent state used by the chat handlers.
+ */
+
+namespace server {
+
+/// @brief A user account as stored.
+struct UserRecord {
+    int32_t id = 0;
+    std::string name;
+    std::string hash_password;
+    /// @brief Empty for accounts that have not been migrated to salted hashes yet.
+    std::string salt;
+    bool is_admin = false;
+};
+
+/// @brief A room as stored.
+struct RoomRecord {
+    int32_t id = 0;
+    std::string name;
+    /// @brief Zero if the room has no owner.
+    int32_t owner_id = 0;
+    bool is_private = false;
+};
+
+/// @brief The result of a role change, needed to notify the previous owner of a room.
+struct RoleChange {
+    /// @brief The previous owner if ownership was transferred, otherwise zero.
+    int32_t old_owner_id = 0;
+    /// @brief The previous owner's rights after the transfer.
+    std::optional<chat::UserRights> old_owner_rights;
+};
+
+/**
+ * @class IStorage
+ * @brief An abstract store of users, rooms, membership, messages and per-room user data.
+ *
+ * @details `MessageHandlers` reaches the database only through this interface, so
+ * the handler, locking and fan-out layers can be run and benchmarked against an
+ * in-memory backend as well as against PostgreSQL.
+ *
+ * Each method is one atomic operation: a backend that needs a transaction opens
+ * and commits it inside the call. Operations that can fail for a reason the user
+ * should see return a `ScopedTransactionResult` with the message; infrastructure
+ * errors may also be thrown and are handled by the callers as before.
+ *
+ * All methods resume on the IO loop they were called from.
+ */
+class IStorage {
+public:
+    using RoomInfos = google::protobuf::RepeatedPtrField<chat::RoomInfo>;
+    using Messages = google::protobuf::RepeatedPtrField<chat::MessageInfo>;
+    /// @brief Decides inside a role change whether it is allowed, given the target's current rights.
+    using RoleCheck = std::function<ScopedTransactionResult(chat::UserRights current)>;
+
+    /// @brief Ranking reads every candidate, so only the newest matches are ranked. This bounds
+    ///        the cost of very common words in huge rooms, at the price of older matches.
+    static constexpr int32_t SEARCH_RANK_CANDIDATES = 1000;
+
+    virtual ~IStorage() = default;
+
+    // ---- Users ----
+
+    /**
+     * @brief Looks up a user by name.
+     * @param name The username.
+     * @param may_be_stale Whether the answer may come from a lagging replica.
+     */
+    virtual drogon::Task<std::optional<UserRecord>> findUserByName(std::string name, bool may_be_stale = false) = 0;
+
+    /// @brief Looks up a user by id.
+    virtual drogon::Task<std::optional<UserRecord>> findUserById(int32_t user_id) = 0;
+
+    /**
+     * @brief Creates a user.
+     * @return "Username already exists." if the name is taken.
+     */
+    virtual drogon::Task<ScopedTransactionResult> createUser(std::string name, std::string hash, std::string salt) = 0;
+
+    /// @brief Replaces a user's password hash and salt.
+    virtual drogon::Task<ScopedTransactionResult> setPassword(int32_t user_id, std::string hash, std::string salt) = 0;
+
+    /**
+     * @brief Replaces a user's password hash and salt if the old hash matches.
+     * @return An error if the user does not exist, is not migrated, or the old hash differs.
+     */
+    virtual drogon::Task<ScopedTransactionResult> changePassword(int32_t user_id, std::string old_hash, std::string new_hash, std::string new_salt) = 0;
+
+    /**
+     * @brief Renames a user.
+     * @return "This username is already taken." if the name is in use.
+     */
+    virtual drogon::Task<ScopedTransactionResult> renameUser(int32_t user_id, std::string new_name) = 0;
+
+    // ---- Rooms ----
+
+    /**
+     * @brief Lists all rooms with the user's membership, as sent after a login.
+     * @details The listing may come from a lagging replica.
+     */
+    virtual drogon::Task<RoomInfos> listRooms(int32_t user_id) = 0;
+
+    /// @brief Looks up a room.
+    virtual drogon::Task<std::optional<RoomRecord>> findRoom(int32_t room_id) = 0;
+
+    /**
+     * @brief Creates a room owned by a user, who becomes a member.
+     * @param[out] room_id The id of the new room.
+     */
+    virtual drogon::Task<ScopedTransactionResult> createRoom(std::string name, int32_t owner_id, int32_t& room_id) = 0;
+
+    /// @brief Renames a room.
+    virtual drogon::Task<ScopedTransactionResult> renameRoom(int32_t room_id, std::string name) = 0;
+
+    /// @brief Deletes a room with its membership, roles and messages.
+    virtual drogon::Task<ScopedTransactionResult> deleteRoom(int32_t room_id) = 0;
+
+    // ---- Membership and roles ----
+
+    /// @brief Gets a user's membership status in a room, or std::nullopt if there is none.
+    virtual drogon::Task<std::optional<chat::MembershipStatus>> membershipStatus(int32_t user_id, int32_t room_id) = 0;
+
+    /// @brief Creates or updates a user's membership in a room.
+    virtual drogon::Task<ScopedTransactionResult> setMembershipStatus(int32_t user_id, int32_t room_id, chat::MembershipStatus status) = 0;
+
+    /**
+     * @brief Lists the members of a room with their names and rights.
+     * @details Members without a special role have no `user_room_rights` set.
+     */
+    virtual drogon::Task<std::vector<chat::UserInfo>> roomMembers(int32_t room_id) = 0;
+
+    /// @brief Lists the rooms whose member list includes a user, i.e. where `roomMembers` returns them.
+    virtual drogon::Task<std::vector<int32_t>> memberRooms(int32_t user_id) = 0;
+
+    /**
+     * @brief Determines a user's rights in a room: ADMIN for global admins, OWNER for
+     *        the room's owner, MODERATOR for an explicit role.
+     * @return The rights, or std::nullopt if the user has no special role.
+     */
+    virtual drogon::Task<std::optional<chat::UserRights>> userRights(int32_t user_id, int32_t room_id) = 0;
+
+    /**
+     * @brief Assigns a role to a user in a room.
+     * @details `check` is called atomically with the change, with the target's
+     * current rights; an error from it aborts the change. Assigning OWNER moves the
+     * room's ownership and leaves the previous owner at least a MODERATOR.
+     * Otherwise only REGULAR and MODERATOR can be assigned.
+     * @param[out] change Describes what happened to the previous owner.
+     */
+    virtual drogon::Task<ScopedTransactionResult> assignRole(int32_t user_id, int32_t room_id, chat::UserRights new_role, RoleCheck check, RoleChange& change) = 0;
+
+    // ---- Messages ----
+
+    /**
+     * @brief Stores a message with the sender's own attachments.
+     * @param[out] message Receives the id, timestamp and attachments of the stored message.
+     * @return "Unknown attachment." if an attachment does not exist or belongs to someone else.
+     */
+    virtual drogon::Task<ScopedTransactionResult> insertMessage(int32_t room_id, int32_t user_id, std::string text,
+                                                               std::vector<int32_t> attachment_ids, chat::MessageInfo& message) = 0;
+
+    /**
+     * @brief Reads a page of a room's stored messages.
+     * @param room_id The room.
+     * @param offset_ts The page starts after (`older == false`) or before (`older == true`) this timestamp.
+     * @param limit The maximum number of messages.
+     * @param older The direction; older pages are returned newest first.
+     * @param[out] out The messages are appended here, so they can go straight to an arena-allocated response.
+     */
+    virtual drogon::Task<void> readMessages(int32_t room_id, int64_t offset_ts, int32_t limit, bool older, Messages& out) = 0;
+
+    /**
+     * @brief Deletes a message of a room.
+     * @details Its attachments go with it in the same transaction, so they are no
+     *          longer downloadable through the room, and stored files no attachment
+     *          refers to any more are removed afterwards.
+     * @return An error if the message does not exist in that room.
+     */
+    virtual drogon::Task<ScopedTransactionResult> deleteMessage(int32_t room_id, int32_t message_id) = 0;
+
+    /**
+     * @brief Adds the attachments of a page of messages.
+     * @param messages The messages, which must have their `message_id` set.
+     */
+    virtual drogon::Task<void> loadAttachments(const std::vector<chat::MessageInfo*>& messages) = 0;
+
+    /**
+     * @brief Searches the messages of all rooms the user may read.
+     * @param user_id The searching user.
+     * @param req The query and filters.
+     * @param limit The page size, already clamped.
+     * @param offset The page offset, already clamped.
+     * @param[out] resp Receives the hits and `has_more`; attachments are not loaded.
+     */
+    virtual drogon::Task<void> searchMessages(int32_t user_id, const chat::SearchMessagesRequest& req, int32_t limit, int32_t offset,
+                                              chat::SearchMessagesResponse& resp) = 0;
+};
+
+} // namespace server
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <server/storage/IStorage.h>
+#include <array>
+#include <atomic>
+#include <shared_mutex>
+
+/**
+ * @file MemoryStorage.h
+ * @brief Defines an `IStorage` that keeps everything in process memory.
+ */
+
+namespace server {
+
+/**
+ * @class MemoryStorage
+ * @brief A lock-striped, in-memory `IStorage` for benchmarks and profiling.
+ *
+ * @details Nothing is persisted: the state lives as long as the process. With
+ * this backend a benchmark of the handlers measures the handler, locking and
+ * fan-out layers alone, without PostgreSQL round trips.
+ *
+ * Rooms, with their membership, roles and messages, are spread over
+ * `ROOM_STRIPES` stripes by room id, each behind its own shared mutex, so
+ * traffic in different rooms rarely contends. Users are behind one shared
+ * mutex, since they are mostly read. When both are needed, the room stripe is
+ * locked first.
+ *
+ * Every call completes synchronously, so callers stay on their IO loop.
+ * Attachments are not supported: uploads are recorded in PostgreSQL by the
+ * HTTP controller, so a message referring to one is rejected. Search is a
+ * case-insensitive substring match ranked by recency.
+ */
+class MemoryStorage : public IStorage {
+public:
+    MemoryStorage() = default;
+
+    drogon::Task<std::optional<UserRecord>> findUserByName(std::string name, bool may_be_stale) override;
+    drogon::Task<std::optional<UserRecord>> findUserById(int32_t user_id) override;
+    drogon::Task<ScopedTransactionResult> createUser(std::string name, std::string hash, std::string salt) override;
+    drogon::Task<ScopedTransactionResult> setPassword(int32_t user_id, std::string hash, std::string salt) override;
+    drogon::Task<ScopedTransactionResult> changePassword(int32_t user_id, std::string old_hash, std::string new_hash, std::string new_salt) override;
+    drogon::Task<ScopedTransactionResult> renameUser(int32_t user_id, std::string new_name) override;
+
+    drogon::Task<RoomInfos> listRooms(int32_t user_id) override;
+    drogon::Task<std::optional<RoomRecord>> findRoom(int32_t room_id) override;
+    drogon::Task<ScopedTransactionResult> createRoom(std::string name, int32_t owner_id, int32_t& room_id) override;
+    drogon::Task<ScopedTransactionResult> renameRoom(int32_t room_id, std::string name) override;
+    drogon::Task<ScopedTransactionResult> deleteRoom(int32_t room_id) override;
+
+    drogon::Task<std::optional<chat::MembershipStatus>> membershipStatus(int32_t user_id, int32_t room_id) override;
+    drogon::Task<ScopedTransactionResult> setMembershipStatus(int32_t user_id, int32_t room_id, chat::MembershipStatus status) override;
+    drogon::Task<std::vector<chat::UserInfo>> roomMembers(int32_t room_id) override;
+    drogon::Task<std::vector<int32_t>> memberRooms(int32_t user_id) override;
+    drogon::Task<std::optional<chat::UserRights>> userRights(int32_t user_id, int32_t room_id) override;
+    drogon::Task<ScopedTransactionResult> assignRole(int32_t user_id, int32_t room_id, chat::UserRights new_role, RoleCheck check, RoleChange& change) override;
+
+    drogon::Task<ScopedTransactionResult> insertMessage(int32_t room_id, int32_t user_id, std::string text,
+                                                       std::vector<int32_t> attachment_ids, chat::MessageInfo& message) override;
+    drogon::Task<void> readMessages(int32_t room_id, int64_t offset_ts, int32_t limit, bool older, Messages& out) override;
+    drogon::Task<ScopedTransactionResult> deleteMessage(int32_t room_id, int32_t message_id) override;
+    drogon::Task<void> loadAttachments(const std::vector<chat::MessageInfo*>& messages) override;
+    drogon::Task<void> searchMessages(int32_t user_id, const chat::SearchMessagesRequest& req, int32_t limit, int32_t offset,
+                                      chat::SearchMessagesResponse& resp) override;
+
+private:
+    /// @brief The number of room stripes; a power of two.
+    static constexpr std::size_t ROOM_STRIPES = 64;
+
+    struct StoredMessage {
+        int32_t message_id;
+        int64_t created_at;
+        int32_t user_id;
+        std::string text;
+    };
+
+    struct Room {
+        RoomRecord record;
+        std::unordered_map<int32_t, chat::MembershipStatus> members;
+        std::unordered_set<int32_t> moderators;
+        /// @brief Ordered by both id and timestamp, which are assigned under the stripe lock.
+        std::vector<StoredMessage> messages;
+    };
+
+    struct Stripe {
+        std::shared_mutex mutex;
+        std::unordered_map<int32_t, Room> rooms;
+    };
+
+    Stripe& stripe(int32_t room_id) noexcept { return m_stripes[static_cast<uint32_t>(room_id) & (ROOM_STRIPES - 1)]; }
+
+    /// @brief Determines a user's rights in a locked room.
+    std::optional<chat::UserRights> rightsIn(const Room& room, int32_t user_id) const;
+
+    /// @brief Returns a user's current name, or an empty string.
+    std::string userName(int32_t user_id) const;
+
+    std::array<Stripe, ROOM_STRIPES> m_stripes;
+    std::atomic<int32_t> m_next_room_id{1};
+    std::atomic<int32_t> m_next_message_id{1};
+
+    mutable std::shared_mutex m_users_mutex;
+    std::unordered_map<int32_t, UserRecord> m_users;
+    std::unordered_map<std::string, int32_t> m_user_ids;
+    int32_t m_next_user_id = 1;
+};
+
+} // namespace server
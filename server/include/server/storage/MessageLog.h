@@ -0,0 +1,184 @@
+#pragma once
+
+#include <drogon/orm/DbClient.h>
+#include <deque>
+#include <thread>
+
+/**
+ * @file MessageLog.h
+ * @brief Defines the singleton write-ahead log that lets a sent message be
+ *        acknowledged before it reaches the database.
+ */
+
+namespace server {
+
+/**
+ * @class MessageLog
+ * @brief Appends sent messages to local segment files and writes them to the
+ *        `messages` table in the background.
+ *
+ * @details A message gets its id from a block reserved in advance from the
+ * `messages_message_id_seq` sequence and its timestamp from the local clock,
+ * is appended to the current segment file and is then acknowledged and
+ * broadcast at once. A flush job on the main loop inserts the pending messages
+ * in batches every `flush_interval`; a segment file is removed once all of its
+ * messages are in the database.
+ *
+ * Every append is written to the OS right away, so it survives a crash of the
+ * process. A background thread syncs the files to disk every `sync_interval`,
+ * so a power loss may lose at most that much of the acknowledged messages.
+ *
+ * On start the segments left by a previous run are replayed: their records are
+ * inserted like any pending message, and the inserts skip ids already in the
+ * database, so a record flushed just before the crash is not duplicated.
+ * Messages whose room or sender was deleted before the flush are dropped; a
+ * message the database rejects outright is moved to `quarantine.log` in the
+ * log directory, so the messages after it keep draining.
+ *
+ * Segment records are a little-endian `uint32` payload size, a `uint32` CRC-32
+ * of the payload and a serialized `chat::WalRecord`. A torn record at the end
+ * of a segment ends its replay.
+ *
+ * @note The files are local to the process, like the archive: every process
+ *       with the log enabled needs its own directory.
+ */
+class MessageLog {
+public:
+    /// @brief Settings read from `custom_config.wal`.
+    struct Config {
+        std::filesystem::path dir = "wal";
+        /// @brief How often appended records are synced to disk.
+        std::chrono::milliseconds sync_interval{5};
+        /// @brief How often pending messages are written to the database.
+        std::chrono::milliseconds flush_interval{50};
+        /// @brief A segment file is closed and a new one started past this size.
+        std::size_t segment_size = 64 * 1024 * 1024;
+        /// @brief How many message ids are reserved from the database at a time.
+        int32_t reserve_ids = 1000;
+    };
+
+    /**
+     * @brief Gets the singleton instance of MessageLog.
+     * @return A reference to the single MessageLog instance.
+     */
+    static MessageLog& instance();
+
+    ~MessageLog();
+
+    /**
+     * @brief Replays the segments of a previous run, reserves the first ids and
+     *        starts the sync thread and the flush job.
+     * @note Must be called once, after migrations have been applied, and before
+     *       the app serves requests: it blocks until the replay is flushed.
+     * @param db The primary database client.
+     * @param config The log settings.
+     * @return Whether the log is running; if not, messages are stored directly.
+     */
+    bool start(drogon::orm::DbClientPtr db, Config config);
+
+    /// @brief Whether `start` succeeded.
+    bool running() const noexcept { return m_running.load(std::memory_order_acquire); }
+
+    /**
+     * @brief Logs a message to be stored in the background.
+     * @param room_id The room of the message.
+     * @param[in,out] message The message with its sender and text; receives its id and timestamp.
+     * @return False if the message was not logged (no reserved ids left, a text
+     *         the database cannot hold, or a write error) and must be stored directly.
+     */
+    bool append(int32_t room_id, chat::MessageInfo& message);
+
+    /**
+     * @brief Gets a room's logged messages that may not be in the database yet.
+     * @param room_id The room.
+     * @param offset_ts Only messages after (`older == false`) or before (`older == true`) this timestamp.
+     * @param older The direction, as in `IStorage::readMessages`.
+     * @return The messages in log order.
+     */
+    std::vector<chat::MessageInfo> pending(int32_t room_id, int64_t offset_ts, bool older) const;
+
+    /// @brief Whether some logged messages are not in the database yet.
+    bool hasPending() const;
+
+    /**
+     * @brief Writes the pending messages to the database now.
+     * @return Whether everything logged before the call is in the database.
+     */
+    drogon::Task<bool> flush();
+
+private:
+    MessageLog() = default;
+    MessageLog(const MessageLog&) = delete;
+    MessageLog& operator=(const MessageLog&) = delete;
+
+    struct Pending {
+        int32_t room_id;
+        uint32_t segment;
+        chat::MessageInfo message;
+    };
+
+    /// @brief A pending message as it is inserted.
+    struct Row {
+        int32_t message_id;
+        int32_t room_id;
+        int32_t user_id;
+        int64_t created_at;
+        std::string text;
+    };
+
+    /// @brief Messages per insert statement.
+    static constexpr std::size_t FLUSH_BATCH = 1000;
+    /// @brief The file in the log directory collecting messages the database rejected.
+    static constexpr const char* QUARANTINE_FILE = "quarantine.log";
+
+    /// @brief Reads a segment left by a previous run into `m_pending`.
+    void replaySegment(uint32_t segment);
+
+    /**
+     * @brief Inserts the oldest pending messages, up to `FLUSH_BATCH`, and removes segments left with none.
+     * @details If the batch fails, its messages are inserted one by one, and those the database
+     *          rejects for their data are quarantined, so a bad record cannot stall the log.
+     * @return Whether every message of the batch was stored or quarantined.
+     */
+    drogon::Task<bool> flushBatch();
+
+    /// @brief Inserts messages in one statement; throws on a database error.
+    drogon::Task<> insertRows(const std::vector<Row>& rows);
+
+    /// @brief Appends a message the database rejected to `QUARANTINE_FILE`, in the segment record format.
+    void quarantine(const Row& row, std::string_view error);
+
+    /// @brief Reserves more message ids unless enough are left or a reservation is running.
+    drogon::Task<> reserveIds();
+
+    /// @brief Opens a new segment file; called with `m_mutex` held.
+    bool openSegment(uint32_t segment);
+
+    /// @brief Syncs the appended records to disk every `sync_interval` until stopped.
+    void syncLoop(std::stop_token stop);
+
+    std::filesystem::path segmentPath(uint32_t segment) const;
+
+    drogon::orm::DbClientPtr m_db;
+    Config m_config;
+    std::atomic<bool> m_running{false};
+
+    mutable std::mutex m_mutex;
+    std::FILE* m_file = nullptr;
+    /// @brief The oldest segment file not removed yet.
+    uint32_t m_first_segment = 1;
+    uint32_t m_segment = 0;
+    std::size_t m_segment_bytes = 0;
+    bool m_dirty = false;
+    /// @brief Closed segments to be synced and closed by the sync thread.
+    std::vector<std::FILE*> m_retired;
+    std::deque<Pending> m_pending;
+    std::deque<int32_t> m_ids;
+    int64_t m_last_ts = 0;
+
+    std::atomic<bool> m_flushing{false};
+    std::atomic<bool> m_reserving{false};
+    std::jthread m_sync_thread;
+};
+
+} // namespace server
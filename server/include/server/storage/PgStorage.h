@@ -0,0 +1,69 @@
+#pragma once
+
+#include <server/storage/IStorage.h>
+#include <drogon/orm/DbClient.h>
+
+/**
+ * @file PgStorage.h
+ * @brief Defines an `IStorage` backed by PostgreSQL.
+ */
+
+namespace server {
+
+/**
+ * @class PgStorage
+ * @brief Stores the chat state in PostgreSQL through the Drogon ORM.
+ *
+ * @details Writes go to the primary, in a transaction when they touch more than
+ * one row. Reads that may be stale (logins, room listings, history pages,
+ * attachments and search) are routed by `DbRouter` to the read replica while it
+ * is healthy.
+ */
+class PgStorage : public IStorage {
+public:
+    /**
+     * @brief Constructs the storage.
+     * @param dbClient The primary database client.
+     */
+    explicit PgStorage(drogon::orm::DbClientPtr dbClient);
+
+    drogon::Task<std::optional<UserRecord>> findUserByName(std::string name, bool may_be_stale) override;
+    drogon::Task<std::optional<UserRecord>> findUserById(int32_t user_id) override;
+    drogon::Task<ScopedTransactionResult> createUser(std::string name, std::string hash, std::string salt) override;
+    drogon::Task<ScopedTransactionResult> setPassword(int32_t user_id, std::string hash, std::string salt) override;
+    drogon::Task<ScopedTransactionResult> changePassword(int32_t user_id, std::string old_hash, std::string new_hash, std::string new_salt) override;
+    drogon::Task<ScopedTransactionResult> renameUser(int32_t user_id, std::string new_name) override;
+
+    drogon::Task<RoomInfos> listRooms(int32_t user_id) override;
+    drogon::Task<std::optional<RoomRecord>> findRoom(int32_t room_id) override;
+    drogon::Task<ScopedTransactionResult> createRoom(std::string name, int32_t owner_id, int32_t& room_id) override;
+    drogon::Task<ScopedTransactionResult> renameRoom(int32_t room_id, std::string name) override;
+    drogon::Task<ScopedTransactionResult> deleteRoom(int32_t room_id) override;
+
+    drogon::Task<std::optional<chat::MembershipStatus>> membershipStatus(int32_t user_id, int32_t room_id) override;
+    drogon::Task<ScopedTransactionResult> setMembershipStatus(int32_t user_id, int32_t room_id, chat::MembershipStatus status) override;
+    drogon::Task<std::vector<chat::UserInfo>> roomMembers(int32_t room_id) override;
+    drogon::Task<std::vector<int32_t>> memberRooms(int32_t user_id) override;
+    drogon::Task<std::optional<chat::UserRights>> userRights(int32_t user_id, int32_t room_id) override;
+    drogon::Task<ScopedTransactionResult> assignRole(int32_t user_id, int32_t room_id, chat::UserRights new_role, RoleCheck check, RoleChange& change) override;
+
+    drogon::Task<ScopedTransactionResult> insertMessage(int32_t room_id, int32_t user_id, std::string text,
+                                                       std::vector<int32_t> attachment_ids, chat::MessageInfo& message) override;
+    drogon::Task<void> readMessages(int32_t room_id, int64_t offset_ts, int32_t limit, bool older, Messages& out) override;
+    drogon::Task<ScopedTransactionResult> deleteMessage(int32_t room_id, int32_t message_id) override;
+    drogon::Task<void> loadAttachments(const std::vector<chat::MessageInfo*>& messages) override;
+    drogon::Task<void> searchMessages(int32_t user_id, const chat::SearchMessagesRequest& req, int32_t limit, int32_t offset,
+                                      chat::SearchMessagesResponse& resp) override;
+
+private:
+    /// @brief Determines a user's rights in a room on a given client or transaction.
+    static drogon::Task<std::optional<chat::UserRights>> userRights(const drogon::orm::DbClientPtr& db, int32_t user_id, int32_t room_id, int32_t owner_id);
+
+    /// @brief Updates or creates a user's role entry in the UserRoomData table within a transaction.
+    static drogon::Task<ScopedTransactionResult> updateUserRole(const std::shared_ptr<drogon::orm::Transaction>& tx, int32_t user_id, int32_t room_id, chat::UserRights new_role);
+
+    /// @brief The primary database client.
+    drogon::orm::DbClientPtr m_dbClient;
+};
+
+} // namespace server
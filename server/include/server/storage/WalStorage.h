@@ -0,0 +1,34 @@
+#pragma once
+
+#include <server/storage/PgStorage.h>
+
+/**
+ * @file WalStorage.h
+ * @brief Defines a PostgreSQL `IStorage` that stores sent messages through the write-ahead log.
+ */
+
+namespace server {
+
+/**
+ * @class WalStorage
+ * @brief A `PgStorage` whose message inserts complete once `MessageLog` has them.
+ *
+ * @details A sent message is acknowledged and broadcast without waiting for the
+ * database. History pages merge in the room's messages that are still pending
+ * in the log, so the sender and everyone else see them on a reload. A deletion
+ * flushes the log first, since the message may not be in the database yet.
+ *
+ * Messages with attachments, and every message while the log is not running or
+ * has no reserved ids, are stored directly by `PgStorage`.
+ */
+class WalStorage : public PgStorage {
+public:
+    using PgStorage::PgStorage;
+
+    drogon::Task<ScopedTransactionResult> insertMessage(int32_t room_id, int32_t user_id, std::string text,
+                                                       std::vector<int32_t> attachment_ids, chat::MessageInfo& message) override;
+    drogon::Task<void> readMessages(int32_t room_id, int64_t offset_ts, int32_t limit, bool older, Messages& out) override;
+    drogon::Task<ScopedTransactionResult> deleteMessage(int32_t room_id, int32_t message_id) override;
+};
+
+} // namespace server
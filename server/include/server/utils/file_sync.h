@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdio>
+#include <filesystem>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/**
+ * @file file_sync.h
+ * @brief Makes written files and newly created directory entries durable.
+ */
+
+namespace server {
+
+/// @brief Syncs a file's written data to disk.
+inline bool syncFile(std::FILE* file) {
+#ifdef _WIN32
+    return _commit(_fileno(file)) == 0;
+#elif defined(__linux__)
+    return fdatasync(fileno(file)) == 0;
+#else
+    return fsync(fileno(file)) == 0;
+#endif
+}
+
+/**
+ * @brief Syncs a directory, so files just created in it survive a power loss.
+ * @note A no-op on Windows, where NTFS journals the directory entry itself.
+ */
+inline bool syncDirectory(const std::filesystem::path& dir) {
+#ifdef _WIN32
+    (void)dir;
+    return true;
+#else
+    const int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(fd < 0) {
+        return false;
+    }
+    const bool synced = ::fsync(fd) == 0;
+    ::close(fd);
+    return synced;
+#endif
+}
+
+} // namespace server
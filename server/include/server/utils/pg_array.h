@@ -0,0 +1,56 @@
+#pragma once
+
+#include <concepts>
+#include <string>
+#include <vector>
+
+/**
+ * @file pg_array.h
+ * @brief Formats values as PostgreSQL array literals, for binding whole lists as one parameter.
+ */
+
+namespace server {
+
+/**
+ * @brief Formats ids as a PostgreSQL array literal, e.g. `{1,2,3}`.
+ * @details Used with `= ANY($1::int[])` and `unnest($1::int[])`, so a batch of
+ * ids costs a single query.
+ */
+template<std::integral T>
+std::string toPgArray(const std::vector<T>& values) {
+    std::string out = "{";
+    for(std::size_t i = 0; i < values.size(); ++i) {
+        if(i > 0) {
+            out += ',';
+        }
+        out += std::to_string(values[i]);
+    }
+    out += '}';
+    return out;
+}
+
+/**
+ * @brief Formats strings as a PostgreSQL array literal, e.g. `{"a","b"}`.
+ * @details Every element is quoted, with quotes and backslashes escaped, so any text is
+ * taken literally. Used with `unnest($1::text[])` for batch inserts.
+ */
+inline std::string toPgArray(const std::vector<std::string>& values) {
+    std::string out = "{";
+    for(std::size_t i = 0; i < values.size(); ++i) {
+        if(i > 0) {
+            out += ',';
+        }
+        out += '"';
+        for(char c : values[i]) {
+            if(c == '"' || c == '\\') {
+                out += '\\';
+            }
+            out += c;
+        }
+        out += '"';
+    }
+    out += '}';
+    return out;
+}
+
+} // namespace server
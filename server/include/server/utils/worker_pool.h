@@ -0,0 +1,128 @@
+#pragma once
+
+#include <trantor/utils/ConcurrentTaskQueue.h>
+#include <coroutine>
+
+/**
+ * @file worker_pool.h
+ * @brief Defines the CPU worker pool and the awaitables that move a coroutine onto it and back.
+ */
+
+namespace server {
+
+/**
+ * @class WorkerPool
+ * @brief A fixed set of threads for CPU-bound work that would otherwise stall an IO loop.
+ *
+ * @details Every socket of an IO loop waits while a handler on it serializes a large
+ * response, decompresses archived history or hashes a file. Such phases are moved here
+ * with `co_await on_worker_pool()` and end with `co_await back_to_io_loop()`.
+ * Until `start()` is called both awaitables complete immediately, so the code runs
+ * inline on the IO loop as before.
+ */
+class WorkerPool {
+public:
+    /**
+     * @brief Gets the singleton instance of WorkerPool.
+     * @return A reference to the single WorkerPool instance.
+     */
+    static WorkerPool& instance() {
+        static WorkerPool inst;
+        return inst;
+    }
+
+    /**
+     * @brief Starts the worker threads.
+     * @note Must be called once, before the IO loops start serving requests.
+     * @param threads The number of threads; 0 uses one per hardware thread.
+     */
+    void start(std::size_t threads) {
+        if(threads == 0) {
+            threads = std::max(std::thread::hardware_concurrency(), 1u);
+        }
+        m_queue = std::make_unique<trantor::ConcurrentTaskQueue>(threads, "worker_pool");
+        LOG_INFO << "Worker pool started with " << threads << " threads";
+    }
+
+    /// @brief Returns whether the pool has been started.
+    bool started() const noexcept { return m_queue != nullptr; }
+
+    /// @brief Queues a task for the next free worker.
+    void post(std::function<void()> task) { m_queue->runTaskInQueue(std::move(task)); }
+
+    /// @brief Returns the number of tasks waiting for a worker.
+    std::size_t queueDepth() const { return m_queue ? m_queue->getTaskCount() : 0; }
+
+private:
+    WorkerPool() = default;
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    std::unique_ptr<trantor::ConcurrentTaskQueue> m_queue;
+};
+
+namespace detail {
+
+/// @brief The IO loop that handed the coroutine running on this worker thread to the pool.
+inline thread_local std::size_t worker_origin_loop = 0;
+
+} // namespace detail
+
+/**
+ * @brief An awaitable that resumes the coroutine on a worker thread.
+ *
+ * @details The IO loop the coroutine was running on is remembered, and
+ * `back_to_io_loop()` returns to it. Between the two only CPU work may be done:
+ * no other `co_await`, no database calls, and no exception may leave the section,
+ * because the handler's error path expects to run on its IO loop.
+ *
+ * @code
+ *   co_await on_worker_pool();
+ *   auto messages = archive.readBefore(room_id, cursor, limit);
+ *   co_await back_to_io_loop();
+ * @endcode
+ */
+inline auto on_worker_pool() noexcept {
+    struct awaiter {
+        bool await_ready() const noexcept {
+            return !WorkerPool::instance().started();
+        }
+
+        void await_suspend(std::coroutine_handle<> handle) const {
+            auto origin = drogon::app().getCurrentThreadIndex();
+            if(origin >= drogon::app().getThreadNum()) {
+                origin = 0; // Fallback to the first IO thread.
+            }
+            WorkerPool::instance().post([handle, origin]() {
+                detail::worker_origin_loop = origin;
+                handle.resume();
+            });
+        }
+
+        void await_resume() const noexcept {}
+    };
+    return awaiter{};
+}
+
+/**
+ * @brief An awaitable that resumes the coroutine on the IO loop it left with `on_worker_pool()`.
+ * @note Completes immediately if the coroutine never left its IO loop.
+ */
+inline auto back_to_io_loop() noexcept {
+    struct awaiter {
+        bool await_ready() const noexcept {
+            return drogon::app().getCurrentThreadIndex() < drogon::app().getThreadNum();
+        }
+
+        void await_suspend(std::coroutine_handle<> handle) const {
+            drogon::app().getIOLoop(detail::worker_origin_loop)->queueInLoop([handle]() {
+                handle.resume();
+            });
+        }
+
+        void await_resume() const noexcept {}
+    };
+    return awaiter{};
+}
+
+} // namespace server
@@ -0,0 +1,177 @@
+#include <server/aggregator/WsClient.h>
+#include <server/metrics/LoadMetrics.h>
+#include <random>
+
+namespace server {
+
+void WsClient::start(const std::string& address) {
+    if(address.empty()) {
+        LOG_INFO << "Not starting connection to aggregator";
+        return;
+    }
+
+    LOG_INFO << "Starting connection to aggregator: " << address;
+    // TODO: Replace with ada-url parser
+    std::tie(server, path) = common::splitUrl(address);
+
+    drogon::app().getLoop()->runInLoop([this]() {
+        reconnectPending = true;
+        connect();
+    });
+}
+
+void WsClient::connect() {
+    client = drogon::WebSocketClient::newWebSocketClient(server, drogon::app().getLoop());
+    auto req = drogon::HttpRequest::newHttpRequest();
+    req->setPath(path);
+
+    client->setMessageHandler([this](const std::string& message,
+                                     const drogon::WebSocketClientPtr&,
+                                     const drogon::WebSocketMessageType& type) {
+        if(type == drogon::WebSocketMessageType::Binary) {
+            onMessage(message);
+        }
+    });
+
+    // Stale clients from earlier attempts must not tear down the current connection.
+    client->setConnectionClosedHandler([this](const drogon::WebSocketClientPtr& closed) {
+        if(closed == client) {
+            onDisconnected();
+        }
+    });
+
+    LOG_INFO << "Connecting to WebSocket at " << server;
+    client->connectToServer(
+        req,
+        [this, attempt = client](drogon::ReqResult r,
+                                 const drogon::HttpResponsePtr&,
+                                 const drogon::WebSocketClientPtr& wsPtr) {
+            if(attempt != client) {
+                return;
+            }
+            reconnectPending = false;
+            if (r != drogon::ReqResult::Ok) {
+                conn.reset();
+                LOG_ERROR << "Failed to connect to aggregator service.";
+                scheduleReconnect();
+                return;
+            }
+            onConnected(wsPtr->getConnection());
+        });
+}
+
+void WsClient::onConnected(const drogon::WebSocketConnectionPtr& newConn) {
+    conn = newConn;
+    lastHeartbeatAck = std::chrono::steady_clock::now();
+
+    chat::Envelope env;
+    auto host = common::getEnvVar("SERVER_HOST") + "/ws";
+    LOG_INFO << "Sending host to aggregator: " << host;
+    env.mutable_register_server_request()->set_host(host);
+    common::sendEnvelope(conn, env);
+
+    stopTimers();
+    auto* loop = drogon::app().getLoop();
+    heartbeatTimer = loop->runEvery(std::chrono::duration<double>(HEARTBEAT_INTERVAL).count(), [this]() {
+        heartbeat();
+    });
+    reportTimer = loop->runEvery(std::chrono::duration<double>(LoadMetrics::instance().window()).count(), [this]() {
+        sendLoadReport();
+    });
+}
+
+void WsClient::onMessage(const std::string& message) {
+    chat::Envelope env;
+    if(!env.ParseFromString(message)) {
+        LOG_WARN << "Malformed message from aggregator";
+        return;
+    }
+    switch(env.payload_case()) {
+        case chat::Envelope::kHeartbeatResponse: {
+            lastHeartbeatAck = std::chrono::steady_clock::now();
+            break;
+        }
+        case chat::Envelope::kPingRequest: {
+            chat::Envelope pong;
+            auto* resp = pong.mutable_ping_response();
+            resp->set_nonce(env.ping_request().nonce());
+            common::setStatus(*resp, chat::STATUS_SUCCESS);
+            common::sendEnvelope(conn, pong);
+            break;
+        }
+        case chat::Envelope::kRegisterServerResponse: {
+            if(env.register_server_response().status().code() == chat::STATUS_SUCCESS) {
+                LOG_INFO << "Registered with aggregator";
+                reconnectAttempt = 0;
+            } else {
+                LOG_ERROR << "Aggregator rejected registration: " << env.register_server_response().status().message();
+            }
+            break;
+        }
+        default: {
+            break;
+        }
+    }
+}
+
+void WsClient::onDisconnected() {
+    LOG_WARN << "Connection to aggregator closed";
+    stopTimers();
+    conn.reset();
+    scheduleReconnect();
+}
+
+void WsClient::scheduleReconnect() {
+    if(reconnectPending) {
+        return;
+    }
+    reconnectPending = true;
+
+    // Full jitter: a uniformly random delay up to an exponentially growing cap.
+    const auto cap = std::min<int64_t>(RECONNECT_MAX_DELAY.count(),
+                                       RECONNECT_BASE_DELAY.count() << std::min(reconnectAttempt, 16));
+    static thread_local std::mt19937 rng{std::random_device{}()};
+    const auto delay = std::chrono::milliseconds(std::uniform_int_distribution<int64_t>{0, cap}(rng));
+    ++reconnectAttempt;
+
+    LOG_INFO << "Reconnecting to aggregator in " << delay.count() << " ms (attempt " << reconnectAttempt << ")";
+    drogon::app().getLoop()->runAfter(std::chrono::duration<double>(delay).count(), [this]() {
+        connect();
+    });
+}
+
+void WsClient::heartbeat() {
+    if(!conn) {
+        return;
+    }
+    if(std::chrono::steady_clock::now() - lastHeartbeatAck > HEARTBEAT_INTERVAL * MISSED_HEARTBEATS_LIMIT) {
+        LOG_WARN << "Aggregator missed " << MISSED_HEARTBEATS_LIMIT << " heartbeats, dropping the link";
+        conn->forceClose();
+        return;
+    }
+    chat::Envelope env;
+    env.mutable_heartbeat_request();
+    common::sendEnvelope(conn, env);
+}
+
+void WsClient::sendLoadReport() {
+    drogon::async_run([aggregator = conn]() -> drogon::Task<> {
+        chat::Envelope env;
+        *env.mutable_server_load_report()->mutable_load() = co_await LoadMetrics::instance().currentLoad();
+        common::sendEnvelope(aggregator, env);
+    });
+}
+
+void WsClient::stopTimers() {
+    auto* loop = drogon::app().getLoop();
+    if(heartbeatTimer) {
+        loop->invalidateTimer(*heartbeatTimer);
+        heartbeatTimer.reset();
+    }
+    if(reportTimer) {
+        loop->invalidateTimer(*reportTimer);
+        reportTimer.reset();
+    }
+}
+
+} // namespace server
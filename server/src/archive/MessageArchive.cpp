@@ -0,0 +1,311 @@
+#include <server/archive/MessageArchive.h>
+#include <server/utils/switch_to_io_loop.h>
+#include <server/utils/worker_pool.h>
+#include <server/utils/file_sync.h>
+
+namespace server {
+
+MessageArchive& MessageArchive::instance() {
+    static MessageArchive inst;
+    return inst;
+}
+
+void MessageArchive::start(drogon::orm::DbClientPtr db, Config config) {
+    m_db = std::move(db);
+    m_config = std::move(config);
+
+    if(!m_config.archiving) {
+        return;
+    }
+    std::error_code ec;
+    std::filesystem::create_directories(m_config.dir, ec);
+    if(ec) {
+        LOG_ERROR << "Cannot create archive directory " << m_config.dir << ": " << ec.message() << ". Archiving disabled.";
+        return;
+    }
+    LOG_INFO << "Archiving messages older than " << m_config.max_age.count() << " days to " << m_config.dir;
+    drogon::app().getLoop()->runEvery(std::chrono::duration<double>(m_config.interval).count(), [this]() {
+        drogon::async_run([this]() { return archiveOldMessages(); });
+    });
+    drogon::async_run([this]() { return archiveOldMessages(); });
+}
+
+std::filesystem::path MessageArchive::segmentPath(int32_t room_id) const {
+    return m_config.dir / ("room_" + std::to_string(room_id) + ".seg");
+}
+
+std::filesystem::path MessageArchive::indexPath(int32_t room_id) const {
+    return m_config.dir / ("room_" + std::to_string(room_id) + ".idx");
+}
+
+drogon::Task<> MessageArchive::archiveOldMessages() {
+    if(m_running.exchange(true)) {
+        co_return;
+    }
+
+    const auto cutoff = std::chrono::duration_cast<std::chrono::microseconds>(
+        (std::chrono::system_clock::now() - m_config.max_age).time_since_epoch()).count();
+    try {
+        auto rooms = co_await switch_to_io_loop(m_db->execSqlCoro(
+            "SELECT DISTINCT room_id FROM messages WHERE created_at < $1", cutoff));
+        for(const auto& row : rooms) {
+            co_await archiveRoom(row["room_id"].as<int32_t>(), cutoff);
+        }
+    } catch(const drogon::orm::DrogonDbException& e) {
+        LOG_ERROR << "Message archival failed: " << e.base().what();
+    }
+
+    m_running.store(false);
+}
+
+drogon::Task<> MessageArchive::archiveRoom(int32_t room_id, int64_t cutoff) {
+    size_t archived = 0;
+    while(true) {
+        auto rows = co_await switch_to_io_loop(m_db->execSqlCoro(
+            "SELECT m.message_id, m.user_id, u.username, m.message_text, m.created_at "
+            "FROM messages m JOIN users u ON u.user_id = m.user_id "
+            "WHERE m.room_id = $1 AND m.created_at < $2 "
+            "ORDER BY m.created_at, m.message_id LIMIT $3",
+            room_id, cutoff, BLOCK_MESSAGES));
+        if(rows.empty()) {
+            break;
+        }
+
+        // Compression and the synced file writes are kept off the IO loop
+        co_await on_worker_pool();
+        const bool stored = storeRows(room_id, rows);
+        co_await back_to_io_loop();
+        if(!stored) {
+            co_return;
+        }
+
+        const auto& last = rows[rows.size() - 1];
+        co_await switch_to_io_loop(m_db->execSqlCoro(
+            "DELETE FROM messages WHERE room_id = $1 AND (created_at, message_id) <= ($2, $3)",
+            room_id, last["created_at"].as<int64_t>(), last["message_id"].as<int32_t>()));
+        archived += rows.size();
+
+        if(rows.size() < static_cast<size_t>(BLOCK_MESSAGES)) {
+            break;
+        }
+    }
+    LOG_INFO << "Archived " << archived << " messages of room " << room_id;
+}
+
+bool MessageArchive::storeRows(int32_t room_id, const drogon::orm::Result& rows) {
+    try {
+        // Rows up to the last indexed one were archived before a crash and only need deleting.
+        const auto existing = blocks(room_id);
+        const auto last_archived = existing->empty()
+            ? std::pair<int64_t, int32_t>{std::numeric_limits<int64_t>::min(), 0}
+            : std::pair<int64_t, int32_t>{existing->back().last_ts, existing->back().last_id};
+
+        chat::ArchivedBlock block;
+        for(const auto& row : rows) {
+            const auto key = std::pair{row["created_at"].as<int64_t>(), row["message_id"].as<int32_t>()};
+            if(key <= last_archived) {
+                continue;
+            }
+            auto* message = block.add_messages();
+            message->set_message_id(key.second);
+            message->set_timestamp(key.first);
+            message->set_message(row["message_text"].as<std::string>());
+            message->mutable_from()->set_user_id(row["user_id"].as<int32_t>());
+            message->mutable_from()->set_user_name(row["username"].as<std::string>());
+        }
+        return block.messages_size() == 0 || appendBlock(room_id, block);
+    } catch(const std::exception& e) {
+        LOG_ERROR << "Failed to archive messages of room " << room_id << ": " << e.what();
+        return false;
+    }
+}
+
+// Appends data to a file and syncs it to disk.
+static bool appendSynced(const std::filesystem::path& path, const char* data, std::size_t size) {
+    auto* file = std::fopen(path.string().c_str(), "ab");
+    if(!file) {
+        return false;
+    }
+    bool written = std::fwrite(data, 1, size, file) == size && std::fflush(file) == 0 && syncFile(file);
+    return std::fclose(file) == 0 && written;
+}
+
+bool MessageArchive::appendBlock(int32_t room_id, const chat::ArchivedBlock& block) {
+    const auto serialized = block.SerializeAsString();
+    const auto compressed = drogon::utils::gzipCompress(serialized.data(), serialized.size());
+    if(compressed.empty()) {
+        LOG_ERROR << "Failed to compress an archive block of room " << room_id;
+        return false;
+    }
+
+    // A torn tail left by a crash is never indexed, so the block goes after it
+    std::error_code ec;
+    const bool created = !std::filesystem::exists(indexPath(room_id), ec);
+    const auto segment_size = std::filesystem::file_size(segmentPath(room_id), ec);
+    const auto offset = ec ? int64_t{0} : static_cast<int64_t>(segment_size);
+    if(!appendSynced(segmentPath(room_id), compressed.data(), compressed.size())) {
+        LOG_ERROR << "Failed to write archive segment of room " << room_id;
+        return false;
+    }
+
+    const auto& first = block.messages(0);
+    const auto& last = block.messages(block.messages_size() - 1);
+    const BlockIndex index{
+        .first_ts = first.timestamp(),
+        .last_ts = last.timestamp(),
+        .offset = offset,
+        .length = static_cast<int64_t>(compressed.size()),
+        .first_id = first.message_id(),
+        .last_id = last.message_id(),
+        .count = block.messages_size(),
+    };
+    if(!appendSynced(indexPath(room_id), reinterpret_cast<const char*>(&index), sizeof(index))) {
+        LOG_ERROR << "Failed to write archive index of room " << room_id;
+        return false;
+    }
+    // The room's first block also adds the files to the directory
+    if(created && !syncDirectory(m_config.dir)) {
+        LOG_ERROR << "Failed to sync archive directory " << m_config.dir;
+        return false;
+    }
+
+    auto current = blocks(room_id);
+    auto updated = std::make_shared<std::vector<BlockIndex>>(*current);
+    updated->push_back(index);
+    std::unique_lock lock(m_blocks_mutex);
+    auto& loaded = m_blocks[room_id];
+    loaded.blocks = std::move(updated);
+    loaded.bytes += sizeof(index);
+    return true;
+}
+
+MessageArchive::Blocks MessageArchive::blocks(int32_t room_id) {
+    std::optional<LoadedIndex> cached;
+    {
+        std::shared_lock lock(m_blocks_mutex);
+        if(auto it = m_blocks.find(room_id); it != m_blocks.end()) {
+            cached = it->second;
+        }
+    }
+    // The archiving process appends through appendBlock, so its index is always current
+    if(cached && m_config.archiving) {
+        return cached->blocks;
+    }
+
+    // A torn record at the end is left for a later read, once it is complete
+    std::error_code ec;
+    const auto file_size = std::filesystem::file_size(indexPath(room_id), ec);
+    const std::uintmax_t on_disk = ec ? 0 : file_size - file_size % sizeof(BlockIndex);
+    if(cached && cached->bytes == on_disk) {
+        return cached->blocks;
+    }
+
+    // The index is append-only, so only the records past the loaded ones need reading
+    auto loaded = std::make_shared<std::vector<BlockIndex>>();
+    std::uintmax_t from = 0;
+    if(cached && cached->bytes < on_disk) {
+        *loaded = *cached->blocks;
+        from = cached->bytes;
+    }
+    std::ifstream index_file(indexPath(room_id), std::ios::binary);
+    index_file.seekg(static_cast<std::streamoff>(from));
+    BlockIndex index;
+    for(auto offset = from; offset < on_disk && index_file.read(reinterpret_cast<char*>(&index), sizeof(index)); offset += sizeof(index)) {
+        loaded->push_back(index);
+    }
+    const auto bytes = loaded->size() * sizeof(BlockIndex);
+
+    std::unique_lock lock(m_blocks_mutex);
+    auto& entry = m_blocks[room_id];
+    // A concurrent read may have loaded as much or more already
+    if(entry.blocks && entry.bytes >= bytes) {
+        return entry.blocks;
+    }
+    entry = LoadedIndex{std::move(loaded), bytes};
+    return entry.blocks;
+}
+
+MessageArchive::CachedBlock MessageArchive::loadBlock(int32_t room_id, const BlockIndex& index) {
+    const auto key = std::pair{room_id, index.offset};
+    {
+        std::lock_guard lock(m_cache_mutex);
+        if(auto it = m_cache_lookup.find(key); it != m_cache_lookup.end()) {
+            m_cache.splice(m_cache.begin(), m_cache, it->second);
+            return it->second->second;
+        }
+    }
+
+    std::string compressed(static_cast<size_t>(index.length), '\0');
+    std::ifstream segment(segmentPath(room_id), std::ios::binary);
+    segment.seekg(index.offset);
+    segment.read(compressed.data(), index.length);
+    auto block = std::make_shared<chat::ArchivedBlock>();
+    const auto serialized = segment ? drogon::utils::gzipDecompress(compressed.data(), compressed.size()) : std::string{};
+    if(serialized.empty() || !block->ParseFromString(serialized)) {
+        LOG_ERROR << "Corrupt archive block at offset " << index.offset << " of room " << room_id;
+        return nullptr;
+    }
+
+    std::lock_guard lock(m_cache_mutex);
+    if(auto it = m_cache_lookup.find(key); it != m_cache_lookup.end()) {
+        return it->second->second;
+    }
+    m_cache.emplace_front(key, block);
+    m_cache_lookup.emplace(key, m_cache.begin());
+    while(m_cache.size() > std::max<size_t>(m_config.cache_blocks, 1)) {
+        m_cache_lookup.erase(m_cache.back().first);
+        m_cache.pop_back();
+    }
+    return block;
+}
+
+std::vector<chat::MessageInfo> MessageArchive::readBefore(int32_t room_id, int64_t before_ts, std::size_t count) {
+    std::vector<chat::MessageInfo> result;
+    const auto index = blocks(room_id);
+    // Blocks starting at or after before_ts cannot contain anything older
+    auto end = std::ranges::lower_bound(*index, before_ts, {}, &BlockIndex::first_ts);
+    for(auto it = std::make_reverse_iterator(end); it != index->rend() && result.size() < count; ++it) {
+        auto block = loadBlock(room_id, *it);
+        if(!block) {
+            break;
+        }
+        for(int i = block->messages_size() - 1; i >= 0 && result.size() < count; --i) {
+            if(block->messages(i).timestamp() < before_ts) {
+                result.push_back(block->messages(i));
+            }
+        }
+    }
+    return result;
+}
+
+std::vector<chat::MessageInfo> MessageArchive::readAfter(int32_t room_id, int64_t after_ts, std::size_t count) {
+    std::vector<chat::MessageInfo> result;
+    const auto index = blocks(room_id);
+    // Blocks ending at or before after_ts cannot contain anything newer
+    auto begin = std::ranges::upper_bound(*index, after_ts, {}, &BlockIndex::last_ts);
+    for(auto it = begin; it != index->end() && result.size() < count; ++it) {
+        auto block = loadBlock(room_id, *it);
+        if(!block) {
+            break;
+        }
+        for(const auto& message : block->messages()) {
+            if(result.size() == count) {
+                break;
+            }
+            if(message.timestamp() > after_ts) {
+                result.push_back(message);
+            }
+        }
+    }
+    return result;
+}
+
+std::optional<int64_t> MessageArchive::newestTimestamp(int32_t room_id) {
+    const auto index = blocks(room_id);
+    if(index->empty()) {
+        return std::nullopt;
+    }
+    return index->back().last_ts;
+}
+
+} // namespace server
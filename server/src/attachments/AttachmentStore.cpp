@@ -0,0 +1,185 @@
+#include <server/attachments/AttachmentStore.h>
+#include <server/utils/switch_to_io_loop.h>
+#include <openssl/evp.h>
+#include <algorithm>
+#include <cctype>
+
+namespace server {
+
+static constexpr std::size_t UPLOAD_ID_LENGTH = 32;
+static constexpr std::size_t HASH_BUFFER_SIZE = 64 * 1024;
+
+// Hashes a file in fixed-size reads, so large uploads are never held in memory.
+static std::optional<std::string> sha256File(const std::filesystem::path& path) {
+    std::ifstream in(path, std::ios::binary);
+    if(!in) {
+        return std::nullopt;
+    }
+    std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> ctx(EVP_MD_CTX_new(), &EVP_MD_CTX_free);
+    if(!ctx || EVP_DigestInit_ex(ctx.get(), EVP_sha256(), nullptr) != 1) {
+        return std::nullopt;
+    }
+    std::vector<char> buffer(HASH_BUFFER_SIZE);
+    while(in) {
+        in.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        if(in.gcount() > 0 && EVP_DigestUpdate(ctx.get(), buffer.data(), static_cast<std::size_t>(in.gcount())) != 1) {
+            return std::nullopt;
+        }
+    }
+    if(in.bad()) {
+        return std::nullopt;
+    }
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_size = 0;
+    if(EVP_DigestFinal_ex(ctx.get(), digest, &digest_size) != 1) {
+        return std::nullopt;
+    }
+
+    static constexpr char HEX[] = "0123456789abcdef";
+    std::string hex;
+    hex.reserve(digest_size * 2);
+    for(unsigned int i = 0; i < digest_size; ++i) {
+        hex += HEX[digest[i] >> 4];
+        hex += HEX[digest[i] & 0x0f];
+    }
+    return hex;
+}
+
+AttachmentStore& AttachmentStore::instance() {
+    static AttachmentStore inst;
+    return inst;
+}
+
+void AttachmentStore::start(drogon::orm::DbClientPtr db, Config config) {
+    m_db = std::move(db);
+    m_config = std::move(config);
+
+    std::error_code ec;
+    std::filesystem::create_directories(m_config.dir / "uploads", ec);
+    if(!ec) {
+        std::filesystem::create_directories(m_config.dir / "objects", ec);
+    }
+    if(ec) {
+        LOG_ERROR << "Cannot create attachment directory " << m_config.dir << ": " << ec.message();
+    }
+
+    const auto interval = std::max(m_config.upload_ttl / 4, std::chrono::seconds(60));
+    drogon::app().getLoop()->runEvery(std::chrono::duration<double>(interval).count(), [this]() {
+        drogon::async_run([this]() { return removeStaleUploads(); });
+    });
+}
+
+bool AttachmentStore::isValidUploadId(std::string_view upload_id) noexcept {
+    return upload_id.size() == UPLOAD_ID_LENGTH
+        && std::ranges::all_of(upload_id, [](char c) { return std::isalnum(static_cast<unsigned char>(c)) != 0; });
+}
+
+std::string AttachmentStore::newUploadId() {
+    return drogon::utils::genRandomString(UPLOAD_ID_LENGTH);
+}
+
+std::filesystem::path AttachmentStore::partPath(std::string_view upload_id) const {
+    return m_config.dir / "uploads" / (std::string(upload_id) + ".part");
+}
+
+std::filesystem::path AttachmentStore::objectPath(std::string_view sha256) const {
+    return m_config.dir / "objects" / std::string(sha256.substr(0, 2)) / std::string(sha256);
+}
+
+bool AttachmentStore::createPart(std::string_view upload_id) {
+    std::ofstream part(partPath(upload_id), std::ios::binary | std::ios::trunc);
+    return static_cast<bool>(part);
+}
+
+std::optional<int64_t> AttachmentStore::receivedBytes(std::string_view upload_id) const {
+    std::error_code ec;
+    const auto size = std::filesystem::file_size(partPath(upload_id), ec);
+    if(ec) {
+        return std::nullopt;
+    }
+    return static_cast<int64_t>(size);
+}
+
+bool AttachmentStore::writeChunk(std::string_view upload_id, int64_t offset, std::string_view data) {
+    // Opened for update rather than append, so a retried chunk lands on the same bytes
+    std::fstream part(partPath(upload_id), std::ios::binary | std::ios::in | std::ios::out);
+    if(!part) {
+        return false;
+    }
+    part.seekp(offset);
+    part.write(data.data(), static_cast<std::streamsize>(data.size()));
+    part.flush();
+    return static_cast<bool>(part);
+}
+
+std::optional<std::string> AttachmentStore::commit(std::string_view upload_id) {
+    const auto part = partPath(upload_id);
+    auto sha256 = sha256File(part);
+    if(!sha256) {
+        return std::nullopt;
+    }
+
+    const auto target = objectPath(*sha256);
+    std::error_code ec;
+    if(std::filesystem::exists(target, ec)) {
+        // Same content already stored; touched so removeUnreferenced() spares it until it is recorded again
+        std::filesystem::last_write_time(target, std::filesystem::file_time_type::clock::now(), ec);
+        std::filesystem::remove(part, ec);
+        return sha256;
+    }
+    std::filesystem::create_directories(target.parent_path(), ec);
+    // A concurrent commit of the same content may replace the file with identical bytes, which is harmless
+    std::filesystem::rename(part, target, ec);
+    if(ec) {
+        LOG_ERROR << "Cannot store attachment " << *sha256 << ": " << ec.message();
+        return std::nullopt;
+    }
+    return sha256;
+}
+
+void AttachmentStore::discard(std::string_view upload_id) {
+    std::error_code ec;
+    std::filesystem::remove(partPath(upload_id), ec);
+}
+
+drogon::Task<> AttachmentStore::removeUnreferenced(std::vector<std::string> sha256s) {
+    if(!m_db) {
+        co_return;
+    }
+    try {
+        for(const auto& sha256 : sha256s) {
+            auto rows = co_await switch_to_io_loop(m_db->execSqlCoro(
+                "SELECT EXISTS (SELECT 1 FROM attachments WHERE sha256 = $1) AS referenced", sha256));
+            if(rows.front()["referenced"].as<bool>()) {
+                continue;
+            }
+            const auto path = objectPath(sha256);
+            std::error_code ec;
+            const auto stored_at = std::filesystem::last_write_time(path, ec);
+            if(!ec && std::filesystem::file_time_type::clock::now() - stored_at >= OBJECT_GRACE) {
+                std::filesystem::remove(path, ec);
+            }
+        }
+    } catch(const drogon::orm::DrogonDbException& e) {
+        LOG_ERROR << "Failed to remove unreferenced attachment files: " << e.base().what();
+    }
+}
+
+drogon::Task<> AttachmentStore::removeStaleUploads() {
+    const auto cutoff = std::chrono::duration_cast<std::chrono::microseconds>(
+        (std::chrono::system_clock::now() - m_config.upload_ttl).time_since_epoch()).count();
+    try {
+        auto rows = co_await switch_to_io_loop(m_db->execSqlCoro(
+            "DELETE FROM attachment_uploads WHERE created_at < $1 RETURNING upload_id", cutoff));
+        for(const auto& row : rows) {
+            discard(row["upload_id"].as<std::string>());
+        }
+        if(!rows.empty()) {
+            LOG_INFO << "Removed " << rows.size() << " stale attachment uploads";
+        }
+    } catch(const drogon::orm::DrogonDbException& e) {
+        LOG_ERROR << "Failed to remove stale attachment uploads: " << e.base().what();
+    }
+}
+
+} // namespace server
@@ -0,0 +1,173 @@
+#include <server/auth/SessionTokens.h>
+#include <common/utils/utils.h>
+#include <charconv>
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace server {
+
+static constexpr std::size_t KEY_BYTES = 32;
+static constexpr std::size_t SHA256_BLOCK = 64;
+
+static std::string fromHex(std::string_view hex) {
+    auto nibble = [](char c) -> int {
+        if(c >= '0' && c <= '9') return c - '0';
+        if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return 0;
+    };
+    std::string out(hex.size() / 2, '\0');
+    for(std::size_t i = 0; i < out.size(); ++i) {
+        out[i] = static_cast<char>(nibble(hex[2 * i]) << 4 | nibble(hex[2 * i + 1]));
+    }
+    return out;
+}
+
+static std::string sha256(std::string_view data) {
+    return fromHex(drogon::utils::getSha256(data.data(), data.size()));
+}
+
+static std::string hmacSha256(std::string_view key, std::string_view message) {
+    std::string block_key = key.size() > SHA256_BLOCK ? sha256(key) : std::string(key);
+    block_key.resize(SHA256_BLOCK, '\0');
+
+    std::string inner(SHA256_BLOCK, '\0');
+    std::string outer(SHA256_BLOCK, '\0');
+    for(std::size_t i = 0; i < SHA256_BLOCK; ++i) {
+        inner[i] = static_cast<char>(block_key[i] ^ 0x36);
+        outer[i] = static_cast<char>(block_key[i] ^ 0x5c);
+    }
+    return sha256(outer + sha256(inner.append(message)));
+}
+
+static std::string toHex(std::string_view bytes) {
+    static constexpr char digits[] = "0123456789abcdef";
+    std::string out;
+    out.reserve(bytes.size() * 2);
+    for(unsigned char c : bytes) {
+        out.push_back(digits[c >> 4]);
+        out.push_back(digits[c & 0xf]);
+    }
+    return out;
+}
+
+static bool constantTimeEquals(std::string_view a, std::string_view b) {
+    if(a.size() != b.size()) {
+        return false;
+    }
+    unsigned char diff = 0;
+    for(std::size_t i = 0; i < a.size(); ++i) {
+        diff |= static_cast<unsigned char>(a[i] ^ b[i]);
+    }
+    return diff == 0;
+}
+
+static int64_t unixNow() {
+    return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+/// @brief Writes the key to a file only its owner can read.
+static bool writeKeyFile(const std::filesystem::path& path, std::string_view key) {
+#ifdef _WIN32
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(key.data(), static_cast<std::streamsize>(key.size()));
+    return static_cast<bool>(out);
+#else
+    // Created with mode 0600, so the key is never readable by others, not even before a chmod
+    const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if(fd < 0) {
+        return false;
+    }
+    // O_CREAT keeps the mode of a file left by an earlier run
+    bool ok = ::fchmod(fd, 0600) == 0;
+    for(std::size_t written = 0; ok && written < key.size();) {
+        const auto n = ::write(fd, key.data() + written, key.size() - written);
+        if(n < 0 && errno != EINTR) {
+            ok = false;
+        } else if(n > 0) {
+            written += static_cast<std::size_t>(n);
+        }
+    }
+    return ::close(fd) == 0 && ok;
+#endif
+}
+
+SessionTokens& SessionTokens::instance() {
+    static SessionTokens inst;
+    return inst;
+}
+
+bool SessionTokens::configure(const std::filesystem::path& key_file, std::chrono::seconds ttl) {
+    m_ttl = ttl;
+
+    if(auto secret = common::getEnvVar("SESSION_SECRET"); !secret.empty()) {
+        m_key = std::move(secret);
+        return true;
+    }
+
+    if(std::ifstream in(key_file, std::ios::binary); in) {
+        m_key.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        if(m_key.size() >= KEY_BYTES) {
+            return true;
+        }
+        LOG_WARN << "Session key file " << key_file << " is too short, generating a new key";
+    }
+
+    m_key.assign(KEY_BYTES, '\0');
+    if(!drogon::utils::secureRandomBytes(m_key.data(), m_key.size())) {
+        LOG_ERROR << "Could not generate a session key, resuming sessions is disabled";
+        m_key.clear();
+        return false;
+    }
+    if(!writeKeyFile(key_file, m_key)) {
+        LOG_WARN << "Could not save the session key to " << key_file << ", sessions will not survive a restart";
+    }
+    return true;
+}
+
+std::string SessionTokens::passwordTag(std::string_view password_hash) {
+    return toHex(sha256(password_hash).substr(0, 8));
+}
+
+std::string SessionTokens::issue(int32_t user_id, std::string_view password_hash) const {
+    if(m_key.empty()) {
+        return {};
+    }
+    const auto body = std::to_string(user_id) + "." + std::to_string(unixNow() + m_ttl.count()) + "." + passwordTag(password_hash);
+    return body + "." + toHex(hmacSha256(m_key, body));
+}
+
+std::optional<SessionTokens::Claims> SessionTokens::verify(std::string_view token) const {
+    if(m_key.empty()) {
+        return std::nullopt;
+    }
+    const auto mac_pos = token.rfind('.');
+    if(mac_pos == std::string_view::npos) {
+        return std::nullopt;
+    }
+    const auto body = token.substr(0, mac_pos);
+    if(!constantTimeEquals(toHex(hmacSha256(m_key, body)), token.substr(mac_pos + 1))) {
+        return std::nullopt;
+    }
+
+    // The body was produced by issue(), so it is well-formed once the MAC matches
+    const auto first = body.find('.');
+    const auto second = body.find('.', first + 1);
+    if(first == std::string_view::npos || second == std::string_view::npos) {
+        return std::nullopt;
+    }
+    int32_t user_id = 0;
+    int64_t expires_at = 0;
+    std::from_chars(body.data(), body.data() + first, user_id);
+    std::from_chars(body.data() + first + 1, body.data() + second, expires_at);
+    if(expires_at < unixNow()) {
+        return std::nullopt;
+    }
+    return Claims{user_id, std::string(body.substr(second + 1))};
+}
+
+} // namespace server
@@ -1,6 +1,7 @@
 #include <server/chat/ChatRoomManager.h>
 #include <common/utils/utils.h>
 #include <server/chat/WsData.h>
+#include <server/chat/UnreadTracker.h>
 
 namespace server {
 
@@ -9,126 +10,256 @@ ChatRoomManager& ChatRoomManager::instance() {
     return inst;
 }
 
-// Helper function to create UserInfo from WsData.
-// This is synchronous because it operates on already-locked data.
-static chat::UserInfo makeUserInfo(const WsData& data) {
-    chat::UserInfo ui;
-    if(data.user) {
-        ui.set_user_id(data.user->id);
-        ui.set_user_name(data.user->name);
-        if(data.room) {
-            ui.set_user_room_rights(data.room->rights);
+void ChatRoomManager::setEventBus(std::shared_ptr<IEventBus> bus) {
+    m_event_bus = std::move(bus);
+    m_event_bus->subscribe([](chat::BusEvent event) {
+        drogon::async_run([event = std::move(event)]() -> drogon::Task<> {
+            co_await ChatRoomManager::instance().applyRemoteEvent(event);
+        });
+    });
+}
+
+drogon::Task<void> ChatRoomManager::publish(chat::BusEvent event) const {
+    if(m_event_bus) {
+        co_await m_event_bus->publish(std::move(event));
+    }
+}
+
+drogon::Task<void> ChatRoomManager::applyRemoteEvent(const chat::BusEvent& event) {
+    switch(event.event_case()) {
+        case chat::BusEvent::kRoomBroadcast:
+            co_await sendToRoom(event.room_broadcast().room_id(), event.room_broadcast().envelope());
+            break;
+        case chat::BusEvent::kRoomDirectory:
+            co_await sendToRoomDirectory(event.room_directory());
+            break;
+        case chat::BusEvent::kUserPeers: {
+            const auto& peers = event.user_peers();
+            co_await sendToUserPeers(peers.user_id(), peers.envelope(), {peers.room_ids().begin(), peers.room_ids().end()});
+            break;
+        }
+        case chat::BusEvent::kRoomDeleted:
+            co_await onRoomDeleted(event.room_deleted());
+            break;
+        case chat::BusEvent::kRightsChanged: {
+            const auto& change = event.rights_changed();
+            co_await updateUserRoomRights(change.user_id(), change.room_id(), change.new_rights());
+            break;
         }
+        case chat::BusEvent::kUsernameChanged:
+            co_await updateUsername(event.username_changed().user_id(), event.username_changed().new_username());
+            break;
+        default:
+            LOG_WARN << "Unknown event bus event: " << event.event_case();
+            break;
+    }
+}
+
+// Returns the user ID a connection is registered under, if any.
+// Users in the middle of authentication carry a placeholder `User` and are not registered.
+static std::optional<int32_t> registeredUserId(const WsData& data) {
+    if(data.status == USER_STATUS::Authenticated && data.user) {
+        return data.user->id;
     }
-    return ui;
+    return std::nullopt;
 }
 
-drogon::Task<std::vector<chat::UserInfo>> ChatRoomManager::getUsersInRoom(
-    int32_t room_id, const WsData& locked_data) const {
+drogon::Task<std::vector<chat::UserInfo>> ChatRoomManager::getUsersInRoom(int32_t room_id) const {
     auto manager_lock = co_await m_manager_mutex.lock_shared();
 
-    auto it = m_room_to_conns.find(room_id);
-    if(it == m_room_to_conns.end()) {
+    auto it = m_room_presence.find(room_id);
+    if(it == m_room_presence.end()) {
         co_return {};
     }
 
     std::vector<chat::UserInfo> user_list;
     user_list.reserve(it->second.size());
 
-    for(const auto& conn : it->second) {
-        auto peer_guarded = conn->getContext<WsDataGuarded>();
-
-        if(peer_guarded->isHolding(locked_data)) {
-            user_list.push_back(makeUserInfo(locked_data));
-        } else {
-            auto peer_proxy = co_await peer_guarded->lock_shared();
-            user_list.push_back(makeUserInfo(*peer_proxy));
-        }
+    for(const auto& [user_id, entry] : it->second) {
+        user_list.push_back(entry.info);
     }
     co_return user_list;
 }
 
-drogon::Task<void> ChatRoomManager::registerConnection(int32_t user_id, const drogon::WebSocketConnectionPtr& conn) {
-    auto lock = co_await m_manager_mutex.lock_unique();
-    m_user_id_to_conns[user_id].insert(conn);
+drogon::Task<bool> ChatRoomManager::isUserPresent(int32_t room_id, int32_t user_id) const {
+    auto manager_lock = co_await m_manager_mutex.lock_shared();
+
+    auto it = m_room_presence.find(room_id);
+    co_return it != m_room_presence.end() && it->second.contains(user_id);
 }
 
-drogon::Task<void> ChatRoomManager::addConnectionToRoom(int32_t room_id, const drogon::WebSocketConnectionPtr& conn) {
-    auto lock = co_await m_manager_mutex.lock_unique();
-    m_room_to_conns[room_id].insert(conn);
+drogon::Task<std::vector<int32_t>> ChatRoomManager::getUserRooms(int32_t userId) const {
+    auto manager_lock = co_await m_manager_mutex.lock_shared();
+
+    std::vector<int32_t> rooms;
+    if(auto it = m_user_id_to_conns.find(userId); it != m_user_id_to_conns.end()) {
+        for(const auto& conn : it->second) {
+            auto data = conn->getContext<WsDataSnapshot>()->load();
+            if(data->room && std::ranges::find(rooms, data->room->id) == rooms.end()) {
+                rooms.push_back(data->room->id);
+            }
+        }
+    }
+    co_return rooms;
 }
 
-drogon::Task<void> ChatRoomManager::removeConnectionFromRoom(const drogon::WebSocketConnectionPtr& conn, const WsData& locked_data) {
-    auto lock = co_await m_manager_mutex.lock_unique();
-    
-    if (locked_data.user && locked_data.room) {
-        int32_t room_id = locked_data.room->id;
-        
-        chat::Envelope user_left_msg;
-        auto* user_info = user_left_msg.mutable_user_left()->mutable_user();
-        user_info->set_user_id(locked_data.user->id);
-        user_info->set_user_name(locked_data.user->name);
-        user_info->set_user_room_rights(locked_data.room->rights);
-        sendToRoom_unsafe(room_id, user_left_msg);
-        
-        if (auto it = m_room_to_conns.find(room_id); it != m_room_to_conns.end()) {
-            it->second.erase(conn);
-            if (it->second.empty()) {
-                m_room_to_conns.erase(it);
+drogon::Task<std::size_t> ChatRoomManager::getActiveRoomCount() const {
+    auto manager_lock = co_await m_manager_mutex.lock_shared();
+    co_return m_room_to_conns.size();
+}
+
+drogon::Task<WsDataView> ChatRoomManager::updateConnection(const drogon::WebSocketConnectionPtr& conn, const WsDataMutator& mutator) {
+    std::vector<chat::BusEvent> remote_events;
+    WsDataView published;
+    {
+        auto lock = co_await m_manager_mutex.lock_unique();
+
+        auto transition = conn->getContext<WsDataSnapshot>()->update(mutator);
+        if(!transition) {
+            co_return nullptr;
+        }
+        const WsData& before = *transition.before;
+        const WsData& after = *transition.after;
+
+        const auto user_before = registeredUserId(before);
+        const auto user_after = registeredUserId(after);
+        const bool user_changed = user_before != user_after;
+
+        const auto room_before = user_before && before.room ? std::optional{before.room->id} : std::nullopt;
+        const auto room_after = user_after && after.room ? std::optional{after.room->id} : std::nullopt;
+
+        if(room_before && (user_changed || room_before != room_after)) {
+            removeFromRoom_unsafe(conn, before, remote_events);
+        }
+
+        if(user_changed) {
+            if(user_before) {
+                if(auto it = m_user_id_to_conns.find(*user_before); it != m_user_id_to_conns.end()) {
+                    it->second.erase(conn);
+                    if(it->second.empty()) {
+                        m_user_id_to_conns.erase(it);
+                        UnreadTracker::instance().forget(*user_before);
+                    }
+                }
+                m_directory_watchers.erase(conn);
+            }
+            if(user_after) {
+                m_user_id_to_conns[*user_after].insert(conn);
+                m_directory_watchers.insert(conn);
             }
         }
+
+        if(room_after && (user_changed || room_before != room_after)) {
+            addToRoom_unsafe(conn, after);
+        }
+
+        published = std::move(transition.after);
+    }
+
+    // The bus may wait on another server, so the manager is not kept locked meanwhile
+    for(auto& event : remote_events) {
+        co_await publish(std::move(event));
     }
+    co_return published;
 }
 
-drogon::Task<void> ChatRoomManager::unregisterConnection(const drogon::WebSocketConnectionPtr& conn, const WsData& locked_data) {
-    // First, handle the room departure logic if the user was in a room.
-    if (locked_data.room) {
-        co_await removeConnectionFromRoom(conn, locked_data);
+void ChatRoomManager::removeFromRoom_unsafe(const drogon::WebSocketConnectionPtr& conn, const WsData& data,
+                                            std::vector<chat::BusEvent>& remote_events) {
+    int32_t room_id = data.room->id;
+
+    if(auto it = m_room_to_conns.find(room_id); it != m_room_to_conns.end()) {
+        it->second.erase(conn);
+        if(it->second.empty()) {
+            m_room_to_conns.erase(it);
+        }
+    }
+
+    auto roster_it = m_room_presence.find(room_id);
+    if(roster_it == m_room_presence.end()) {
+        return;
     }
-    
-    // Then, perform the final user cleanup.
-    auto lock = co_await m_manager_mutex.lock_unique();
-    if (locked_data.user) {
-        if (auto it = m_user_id_to_conns.find(locked_data.user->id); it != m_user_id_to_conns.end()) {
-            it->second.erase(conn);
-            if (it->second.empty()) {
-                m_user_id_to_conns.erase(it);
-            }
+    auto& roster = roster_it->second;
+    if(auto entry_it = roster.find(data.user->id); entry_it != roster.end() && --entry_it->second.connections == 0) {
+        roster.erase(entry_it);
+        if(roster.empty()) {
+            m_room_presence.erase(roster_it);
         }
+    } else {
+        // The user still has other connections in the room.
+        return;
     }
+
+    chat::Envelope user_left_msg;
+    auto* user_info = user_left_msg.mutable_user_left()->mutable_user();
+    user_info->set_user_id(data.user->id);
+    user_info->set_user_name(data.user->name);
+    user_info->set_user_room_rights(data.room->rights);
+    sendToRoom_unsafe(room_id, user_left_msg);
+
+    auto& event = remote_events.emplace_back();
+    event.mutable_room_broadcast()->set_room_id(room_id);
+    *event.mutable_room_broadcast()->mutable_envelope() = std::move(user_left_msg);
+}
+
+void ChatRoomManager::addToRoom_unsafe(const drogon::WebSocketConnectionPtr& conn, const WsData& data) {
+    m_room_to_conns[data.room->id].insert(conn);
+
+    auto& entry = m_room_presence[data.room->id][data.user->id];
+    entry.info.set_user_id(data.user->id);
+    entry.info.set_user_name(data.user->name);
+    entry.info.set_user_room_rights(data.room->rights);
+    ++entry.connections;
+}
+
+drogon::Task<void> ChatRoomManager::unregisterConnection(const drogon::WebSocketConnectionPtr& conn) {
+    co_await updateConnection(conn, [](WsData& data) {
+        data = WsData{};
+        return true;
+    });
 }
 
 drogon::Task<void> ChatRoomManager::onRoomDeleted(int32_t room_id) {
     auto lock = co_await m_manager_mutex.lock_unique();
     if (auto it = m_room_to_conns.find(room_id); it != m_room_to_conns.end()) {
+        for(const auto& conn : it->second) {
+            conn->getContext<WsDataSnapshot>()->update([room_id](WsData& data) {
+                if(!data.room || data.room->id != room_id) {
+                    return false;
+                }
+                data.room.reset();
+                return true;
+            });
+        }
         m_room_to_conns.erase(it);
     }
-    
+    m_room_presence.erase(room_id);
+    m_event_log.forget(room_id);
+
     chat::Envelope room_deleted_msg;
     room_deleted_msg.mutable_room_deleted()->set_room_id(room_id);
-    sendToAll_unsafe(room_deleted_msg);
+    sendToRoomDirectory_unsafe(room_deleted_msg);
 }
 
-drogon::Task<void> ChatRoomManager::updateUserRoomRights(int32_t userId, int32_t roomId, chat::UserRights newRights, WsData& locked_data) {
-    auto lock = co_await m_manager_mutex.lock_shared();
+drogon::Task<void> ChatRoomManager::updateUserRoomRights(int32_t userId, int32_t roomId, chat::UserRights newRights) {
+    // Unique, because we publish new versions of peers' state and must not race with `updateConnection`.
+    auto lock = co_await m_manager_mutex.lock_unique();
 
     auto it = m_user_id_to_conns.find(userId);
-    if(it == m_user_id_to_conns.end()) {
-        co_return;
+    if(it != m_user_id_to_conns.end()) {
+        for(const auto& conn : it->second) {
+            conn->getContext<WsDataSnapshot>()->update([roomId, newRights](WsData& data) {
+                if(!data.room || data.room->id != roomId) {
+                    return false;
+                }
+                data.room->rights = newRights;
+                return true;
+            });
+        }
     }
 
-    for(const auto& conn : it->second) {
-        auto peer_guarded = conn->getContext<WsDataGuarded>();
-
-        if(peer_guarded->isHolding(locked_data)) {
-            if(locked_data.room && locked_data.room->id == roomId) {
-                locked_data.room->rights = newRights;
-            }
-        } else {
-            auto peer_proxy = co_await peer_guarded->lock_unique();
-            if(peer_proxy->room && peer_proxy->room->id == roomId) {
-                peer_proxy->room->rights = newRights;
-            }
+    if(auto roster_it = m_room_presence.find(roomId); roster_it != m_room_presence.end()) {
+        if(auto entry_it = roster_it->second.find(userId); entry_it != roster_it->second.end()) {
+            entry_it->second.info.set_user_room_rights(newRights);
         }
     }
 
@@ -138,31 +269,132 @@ drogon::Task<void> ChatRoomManager::updateUserRoomRights(int32_t userId, int32_t
     sendToRoom_unsafe(roomId, env);
 }
 
+drogon::Task<void> ChatRoomManager::updateUsername(int32_t userId, const std::string& newName) {
+    auto lock = co_await m_manager_mutex.lock_unique();
+
+    auto it = m_user_id_to_conns.find(userId);
+    if(it == m_user_id_to_conns.end()) {
+        co_return;
+    }
+    for(const auto& conn : it->second) {
+        auto transition = conn->getContext<WsDataSnapshot>()->update([userId, &newName](WsData& data) {
+            if(registeredUserId(data) != userId) {
+                return false;
+            }
+            data.user->name = newName;
+            return true;
+        });
+        if(!transition || !transition.after->room) {
+            continue;
+        }
+        if(auto roster_it = m_room_presence.find(transition.after->room->id); roster_it != m_room_presence.end()) {
+            if(auto entry_it = roster_it->second.find(userId); entry_it != roster_it->second.end()) {
+                entry_it->second.info.set_user_name(newName);
+            }
+        }
+    }
+}
+
 drogon::Task<void> ChatRoomManager::sendToRoom(int32_t room_id, const chat::Envelope& message) const {
     auto lock = co_await m_manager_mutex.lock_shared();
     sendToRoom_unsafe(room_id, message);
+    if(message.has_room_message()) {
+        countUnread_unsafe(room_id, message.room_message().message().message_id());
+    }
+}
+
+void ChatRoomManager::countUnread_unsafe(int32_t room_id, int32_t message_id) const {
+    const auto roster_it = m_room_presence.find(room_id);
+    auto updates = UnreadTracker::instance().onRoomMessage(room_id, message_id, [&](int32_t user_id) {
+        return roster_it != m_room_presence.end() && roster_it->second.contains(user_id);
+    });
+
+    for(const auto& [user_id, unread_count] : updates) {
+        auto it = m_user_id_to_conns.find(user_id);
+        if(it == m_user_id_to_conns.end()) {
+            continue;
+        }
+        chat::Envelope env;
+        env.mutable_unread_count_update()->set_room_id(room_id);
+        env.mutable_unread_count_update()->set_unread_count(unread_count);
+        for(const auto& conn : it->second) {
+            common::sendEnvelope(conn, env);
+        }
+    }
+}
+
+void ChatRoomManager::startEventLogEviction(std::chrono::seconds idle_ttl) {
+    const auto interval = std::min<std::chrono::seconds>(idle_ttl, std::chrono::seconds(60));
+    drogon::app().getLoop()->runEvery(std::chrono::duration<double>(interval).count(), [this, idle_ttl]() {
+        if(auto evicted = m_event_log.evictIdle(idle_ttl)) {
+            LOG_DEBUG << "Dropped the event history of " << evicted << " idle rooms";
+        }
+    });
+}
+
+drogon::Task<int64_t> ChatRoomManager::roomEventSeq(int32_t room_id) const {
+    co_return m_event_log.seq(room_id);
+}
+
+drogon::Task<RoomEvents> ChatRoomManager::roomEventsSince(int32_t room_id, int64_t since_seq) const {
+    co_return m_event_log.since(room_id, since_seq);
+}
+
+// Typing notifications are only useful live, so they are neither numbered nor replayed.
+static bool isRoomEvent(const chat::Envelope& message) {
+    return !message.has_user_started_typing() && !message.has_user_stopped_typing();
 }
 
 void ChatRoomManager::sendToRoom_unsafe(int32_t room_id, const chat::Envelope& message) const {
-    if(auto it = m_room_to_conns.find(room_id); it != m_room_to_conns.end()) {
-        const auto& connections_in_room = it->second;
-        for (const auto& conn : connections_in_room) {
-            common::sendEnvelope(conn, message);
+    auto send = [this, room_id](const chat::Envelope& envelope) {
+        if(auto it = m_room_to_conns.find(room_id); it != m_room_to_conns.end()) {
+            const auto& connections_in_room = it->second;
+            for (const auto& conn : connections_in_room) {
+                common::sendEnvelope(conn, envelope);
+            }
         }
+    };
+    if(isRoomEvent(message)) {
+        // Kept even when nobody here is in the room: a client reconnecting needs what happened while it was away
+        m_event_log.publish(room_id, message, send);
+    } else {
+        send(message);
     }
 }
 
-drogon::Task<void> ChatRoomManager::sendToAll(const chat::Envelope& message) const {
+drogon::Task<void> ChatRoomManager::sendToRoomDirectory(const chat::Envelope& message) const {
     auto lock = co_await m_manager_mutex.lock_shared();
-    sendToAll_unsafe(message);
+    sendToRoomDirectory_unsafe(message);
 }
 
-void ChatRoomManager::sendToAll_unsafe(const chat::Envelope& message) const {
-    for (const auto& [user_id, conns] : m_user_id_to_conns) {
-        for (const auto& conn : conns) {
-            common::sendEnvelope(conn, message);
+void ChatRoomManager::sendToRoomDirectory_unsafe(const chat::Envelope& message) const {
+    for (const auto& conn : m_directory_watchers) {
+        common::sendEnvelope(conn, message);
+    }
+}
+
+drogon::Task<void> ChatRoomManager::sendToUserPeers(int32_t userId, const chat::Envelope& message, const std::vector<int32_t>& extra_rooms) const {
+    auto lock = co_await m_manager_mutex.lock_shared();
+
+    std::unordered_set<int32_t> rooms{extra_rooms.begin(), extra_rooms.end()};
+    std::unordered_set<drogon::WebSocketConnectionPtr> recipients;
+    if(auto it = m_user_id_to_conns.find(userId); it != m_user_id_to_conns.end()) {
+        recipients.insert(it->second.begin(), it->second.end());
+        for(const auto& conn : it->second) {
+            if(auto data = conn->getContext<WsDataSnapshot>()->load(); data->room) {
+                rooms.insert(data->room->id);
+            }
+        }
+    }
+    for(int32_t room_id : rooms) {
+        if(auto room_it = m_room_to_conns.find(room_id); room_it != m_room_to_conns.end()) {
+            recipients.insert(room_it->second.begin(), room_it->second.end());
         }
     }
+
+    for(const auto& conn : recipients) {
+        common::sendEnvelope(conn, message);
+    }
 }
 
 } // namespace server
@@ -1,49 +1,143 @@
 #include <server/chat/DrogonRoomService.h>
 #include <server/chat/ChatRoomManager.h>
+#include <server/limits/AdmissionControl.h>
 
 namespace server {
 
 DrogonRoomService::DrogonRoomService(const drogon::WebSocketConnectionPtr& conn)
     : m_conn(conn) {}
 
-drogon::Task<void> DrogonRoomService::login(const WsData& locked_data) {
-    if(locked_data.user) {
-        co_await ChatRoomManager::instance().registerConnection(locked_data.user->id, m_conn);
+drogon::Task<WsDataView> DrogonRoomService::login(const User& user) {
+    auto view = co_await ChatRoomManager::instance().updateConnection(m_conn, [&user](WsData& data) {
+        if(data.status != USER_STATUS::Authenticating || !data.user || data.user->name != user.name) {
+            return false;
+        }
+        data.user = user;
+        data.status = USER_STATUS::Authenticated;
+        return true;
+    });
+    if(view) {
+        AdmissionControl::instance().release(m_conn);
     }
+    co_return view;
 }
 
-drogon::Task<void> DrogonRoomService::logout(const WsData& locked_data) {
-    co_await ChatRoomManager::instance().unregisterConnection(m_conn, locked_data);
+drogon::Task<WsDataView> DrogonRoomService::logout() {
+    co_return co_await ChatRoomManager::instance().updateConnection(m_conn, [](WsData& data) {
+        if(data.status != USER_STATUS::Authenticated) {
+            return false;
+        }
+        data = WsData{};
+        return true;
+    });
 }
 
-drogon::Task<void> DrogonRoomService::joinRoom(const WsData& locked_data) {
-    if(locked_data.room) {
-        co_await ChatRoomManager::instance().addConnectionToRoom(locked_data.room->id, m_conn);
-    }
+drogon::Task<WsDataView> DrogonRoomService::joinRoom(const CurrentRoom& room) {
+    co_return co_await ChatRoomManager::instance().updateConnection(m_conn, [&room](WsData& data) {
+        if(data.status != USER_STATUS::Authenticated) {
+            return false;
+        }
+        data.room = room;
+        return true;
+    });
+}
+
+drogon::Task<WsDataView> DrogonRoomService::leaveCurrentRoom() {
+    co_return co_await ChatRoomManager::instance().updateConnection(m_conn, [](WsData& data) {
+        if(data.status != USER_STATUS::Authenticated || !data.room) {
+            return false;
+        }
+        data.room.reset();
+        return true;
+    });
 }
 
-drogon::Task<void> DrogonRoomService::leaveCurrentRoom(const WsData& locked_data) {
-    co_await ChatRoomManager::instance().removeConnectionFromRoom(m_conn, locked_data);
+drogon::Task<std::vector<chat::UserInfo>> DrogonRoomService::getUsersInRoom(int32_t room_id) const {
+    co_return co_await ChatRoomManager::instance().getUsersInRoom(room_id);
 }
 
-drogon::Task<std::vector<chat::UserInfo>> DrogonRoomService::getUsersInRoom(
-        int32_t room_id, const WsData& locked_data) const {
-    co_return co_await ChatRoomManager::instance().getUsersInRoom(room_id, locked_data);
+drogon::Task<bool> DrogonRoomService::isUserPresent(int32_t room_id, int32_t user_id) const {
+    co_return co_await ChatRoomManager::instance().isUserPresent(room_id, user_id);
 }
 
 drogon::Task<void> DrogonRoomService::sendToRoom(int32_t room_id, const chat::Envelope& message) const {
-    co_await ChatRoomManager::instance().sendToRoom(room_id, message);
+    auto& manager = ChatRoomManager::instance();
+    co_await manager.sendToRoom(room_id, message);
+
+    chat::BusEvent event;
+    event.mutable_room_broadcast()->set_room_id(room_id);
+    *event.mutable_room_broadcast()->mutable_envelope() = message;
+    co_await manager.publish(std::move(event));
 }
 
-drogon::Task<void> DrogonRoomService::sendToAll(const chat::Envelope& message) const {
-    co_await ChatRoomManager::instance().sendToAll(message);
+drogon::Task<void> DrogonRoomService::sendToRoomDirectory(const chat::Envelope& message) const {
+    auto& manager = ChatRoomManager::instance();
+    co_await manager.sendToRoomDirectory(message);
+
+    chat::BusEvent event;
+    *event.mutable_room_directory() = message;
+    co_await manager.publish(std::move(event));
+}
+
+drogon::Task<void> DrogonRoomService::sendToUserPeers(int32_t userId, const chat::Envelope& message, const std::vector<int32_t>& member_rooms) const {
+    auto& manager = ChatRoomManager::instance();
+    co_await manager.sendToUserPeers(userId, message, member_rooms);
+
+    chat::BusEvent event;
+    auto* peers = event.mutable_user_peers();
+    peers->set_user_id(userId);
+    for(int32_t room_id : member_rooms) {
+        peers->add_room_ids(room_id);
+    }
+    for(int32_t room_id : co_await manager.getUserRooms(userId)) {
+        if(std::ranges::find(member_rooms, room_id) == member_rooms.end()) {
+            peers->add_room_ids(room_id);
+        }
+    }
+    *peers->mutable_envelope() = message;
+    co_await manager.publish(std::move(event));
 }
 
 drogon::Task<void> DrogonRoomService::onRoomDeleted(int32_t room_id) {
-    co_await ChatRoomManager::instance().onRoomDeleted(room_id);
+    auto& manager = ChatRoomManager::instance();
+    co_await manager.onRoomDeleted(room_id);
+
+    chat::BusEvent event;
+    event.set_room_deleted(room_id);
+    co_await manager.publish(std::move(event));
+}
+
+drogon::Task<void> DrogonRoomService::updateUserRoomRights(int32_t userId, int32_t roomId, chat::UserRights newRights) {
+    auto& manager = ChatRoomManager::instance();
+    co_await manager.updateUserRoomRights(userId, roomId, newRights);
+
+    chat::BusEvent event;
+    auto* change = event.mutable_rights_changed();
+    change->set_user_id(userId);
+    change->set_room_id(roomId);
+    change->set_new_rights(newRights);
+    co_await manager.publish(std::move(event));
+}
+
+drogon::Task<void> DrogonRoomService::updateUsername(int32_t userId, const std::string& newName) {
+    auto& manager = ChatRoomManager::instance();
+    co_await manager.updateUsername(userId, newName);
+
+    chat::BusEvent event;
+    event.mutable_username_changed()->set_user_id(userId);
+    event.mutable_username_changed()->set_new_username(newName);
+    co_await manager.publish(std::move(event));
+}
+
+const std::string& DrogonRoomService::roomEventEpoch() const {
+    return ChatRoomManager::instance().eventEpoch();
+}
+
+drogon::Task<int64_t> DrogonRoomService::roomEventSeq(int32_t room_id) const {
+    co_return co_await ChatRoomManager::instance().roomEventSeq(room_id);
 }
 
-drogon::Task<void> DrogonRoomService::updateUserRoomRights(int32_t userId, int32_t roomId, chat::UserRights newRights, WsData& locked_data) {
-    co_await ChatRoomManager::instance().updateUserRoomRights(userId, roomId, newRights, locked_data);
+drogon::Task<RoomEvents> DrogonRoomService::roomEventsSince(int32_t room_id, int64_t since_seq) const {
+    co_return co_await ChatRoomManager::instance().roomEventsSince(room_id, since_seq);
 }
 } // namespace server
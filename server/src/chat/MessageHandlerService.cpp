@@ -1,5 +1,6 @@
 #include <server/chat/MessageHandlerService.h>
 #include <server/chat/MessageHandlers.h>
+#include <server/limits/RequestRateLimits.h>
 #include <common/utils/utils.h>
 
 namespace server {
@@ -9,8 +10,22 @@ MessageHandlerService::MessageHandlerService(std::unique_ptr<MessageHandlers> ha
 
 MessageHandlerService::~MessageHandlerService() = default;
 
-drogon::Task<chat::Envelope> MessageHandlerService::processMessage(const WsDataPtr& wsData, const chat::Envelope& env, IChatRoomService& room_service) const {
-    chat::Envelope respEnv;
+// Only the requests charged by RequestRateLimits can be rejected here.
+static void setRateLimitedResponse(chat::Envelope& respEnv, chat::Envelope::PayloadCase request, std::chrono::milliseconds retry) {
+    chat::Status* status = request == chat::Envelope::kSendMessageRequest
+                         ? respEnv.mutable_send_message_response()->mutable_status()
+                         : respEnv.mutable_user_typing_start_response()->mutable_status();
+    status->set_code(chat::STATUS_RATE_LIMITED);
+    status->set_message("Too many requests");
+    status->set_retry_after_ms(static_cast<int32_t>(std::min<int64_t>(retry.count(), std::numeric_limits<int32_t>::max())));
+}
+
+drogon::Task<void> MessageHandlerService::processMessage(const WsDataPtr& wsData, const chat::Envelope& env, IChatRoomService& room_service, chat::Envelope& respEnv) const {
+    if(auto retry = RequestRateLimits::instance().check(*wsData->load(), env.payload_case())) {
+        setRateLimitedResponse(respEnv, env.payload_case(), *retry);
+        co_return;
+    }
+
     switch(env.payload_case()) {
         case chat::Envelope::kInitialAuthRequest: {
             *respEnv.mutable_initial_auth_response() = co_await m_handlers->handleAuthInitial(wsData, env.initial_auth_request());
@@ -24,6 +39,10 @@ drogon::Task<chat::Envelope> MessageHandlerService::processMessage(const WsDataP
             *respEnv.mutable_auth_response() = co_await m_handlers->handleAuth(wsData, env.auth_request(), room_service);
             break;
         }
+        case chat::Envelope::kResumeSessionRequest: {
+            *respEnv.mutable_resume_session_response() = co_await m_handlers->handleResumeSession(wsData, env.resume_session_request(), room_service);
+            break;
+        }
         case chat::Envelope::kRegisterRequest: {
             *respEnv.mutable_register_response() = co_await m_handlers->handleRegister(wsData, env.register_request());
             break;
@@ -33,7 +52,7 @@ drogon::Task<chat::Envelope> MessageHandlerService::processMessage(const WsDataP
             break;
         }
         case chat::Envelope::kJoinRoomRequest: {
-            *respEnv.mutable_join_room_response() = co_await m_handlers->handleJoinRoom(wsData, env.join_room_request(), room_service);
+            co_await m_handlers->handleJoinRoom(wsData, env.join_room_request(), room_service, *respEnv.mutable_join_room_response());
             break;
         }
         case chat::Envelope::kLeaveRoomRequest: {
@@ -45,7 +64,15 @@ drogon::Task<chat::Envelope> MessageHandlerService::processMessage(const WsDataP
             break;
         }
         case chat::Envelope::kGetMessagesRequest: {
-            *respEnv.mutable_get_messages_response() = co_await m_handlers->handleGetMessages(wsData, env.get_messages_request());
+            co_await m_handlers->handleGetMessages(wsData, env.get_messages_request(), *respEnv.mutable_get_messages_response());
+            break;
+        }
+        case chat::Envelope::kSyncRoomRequest: {
+            co_await m_handlers->handleSyncRoom(wsData, env.sync_room_request(), room_service, *respEnv.mutable_sync_room_response());
+            break;
+        }
+        case chat::Envelope::kSearchMessagesRequest: {
+            co_await m_handlers->handleSearchMessages(wsData, env.search_messages_request(), *respEnv.mutable_search_messages_response());
             break;
         }
         case chat::Envelope::kLogoutRequest: {
@@ -97,7 +124,6 @@ drogon::Task<chat::Envelope> MessageHandlerService::processMessage(const WsDataP
             break;
         }
     }
-    co_return respEnv;
 }
 
 } // namespace server
@@ -1,32 +1,40 @@
 #include <server/chat/MessageHandlers.h>
 #include <server/chat/WsData.h>
 #include <server/chat/IChatRoomService.h>
+#include <server/chat/UnreadTracker.h>
 
-#include <server/models/Users.h>
-#include <server/models/Rooms.h>
-#include <server/models/Messages.h>
-#include <server/models/RoomMembership.h>
-#include <server/models/UserRoomData.h>
-
-#include <server/utils/switch_to_io_loop.h>
+#include <server/utils/worker_pool.h>
+#include <server/archive/MessageArchive.h>
+#include <server/auth/SessionTokens.h>
 #include <common/utils/utils.h>
 #include <common/utils/limits.h>
 
 #include <utf8.h>
 
-using namespace drogon::orm;
-namespace models = drogon_model::drogon_test;
-
 namespace server {
 
-MessageHandlers::MessageHandlers(DbClientPtr dbClient)
-    : m_dbClient{std::move(dbClient)} {}
+MessageHandlers::MessageHandlers(std::shared_ptr<IStorage> storage)
+    : m_storage{std::move(storage)} {}
+
+// Drops a connection back to `Unauthenticated` if it is still in the given handshake phase.
+static void abortHandshake(const WsDataPtr& wsDataGuarded, USER_STATUS phase) {
+    wsDataGuarded->update([phase](WsData& data) {
+        if(data.status != phase) {
+            return false;
+        }
+        data.status = USER_STATUS::Unauthenticated;
+        data.user.reset();
+        return true;
+    });
+}
 
 drogon::Task<chat::InitialAuthResponse> MessageHandlers::handleAuthInitial(const WsDataPtr& wsDataGuarded, const chat::InitialAuthRequest& req) const {
     chat::InitialAuthResponse resp;
 
-    auto wsData = co_await wsDataGuarded->lock_unique();
-
+    if(wsDataGuarded->load()->status == USER_STATUS::Authenticated) {
+        common::setStatus(resp, chat::STATUS_FAILURE, "Already authenticated.");
+        co_return resp;
+    }
     if(req.username().empty()) {
         common::setStatus(resp, chat::STATUS_FAILURE, "Empty username.");
         co_return resp;
@@ -36,15 +44,24 @@ drogon::Task<chat::InitialAuthResponse> MessageHandlers::handleAuthInitial(const
         co_return resp;
     }
     try {
-        auto users = co_await switch_to_io_loop(CoroMapper<models::Users>(m_dbClient)
-            .findBy(Criteria(models::Users::Cols::_username, CompareOperator::EQ, req.username())));
-        if(users.empty()) {
+        auto user = co_await m_storage->findUserByName(req.username(), true);
+        if(!user) {
             common::setStatus(resp, chat::STATUS_UNAUTHORIZED, "Invalid credentials.");
             co_return resp;
         }
-        wsData->status = USER_STATUS::Authenticating;
-        wsData->user = User{.id = 0, .name = req.username()};
-        if (!users.front().getValueOfSalt().empty()) resp.set_salt(users.front().getValueOfSalt());
+        auto started = wsDataGuarded->update([&req](WsData& data) {
+            if(data.status == USER_STATUS::Authenticated) {
+                return false;
+            }
+            data.status = USER_STATUS::Authenticating;
+            data.user = User{.id = 0, .name = req.username()};
+            return true;
+        });
+        if(!started) {
+            common::setStatus(resp, chat::STATUS_FAILURE, "Already authenticated.");
+            co_return resp;
+        }
+        if (!user->salt.empty()) resp.set_salt(user->salt);
 
         common::setStatus(resp, chat::STATUS_SUCCESS);
         co_return resp;
@@ -57,8 +74,10 @@ drogon::Task<chat::InitialAuthResponse> MessageHandlers::handleAuthInitial(const
 drogon::Task<chat::InitialRegisterResponse> MessageHandlers::handleRegisterInitial(const WsDataPtr& wsDataGuarded, const chat::InitialRegisterRequest& req) const {
     chat::InitialRegisterResponse resp;
 
-    auto wsData = co_await wsDataGuarded->lock_unique();
-
+    if(wsDataGuarded->load()->status == USER_STATUS::Authenticated) {
+        common::setStatus(resp, chat::STATUS_FAILURE, "Already authenticated.");
+        co_return resp;
+    }
     if(req.username().empty()) {
         common::setStatus(resp, chat::STATUS_FAILURE, "Empty username or password.");
         co_return resp;
@@ -68,14 +87,22 @@ drogon::Task<chat::InitialRegisterResponse> MessageHandlers::handleRegisterIniti
         co_return resp;
     }
     try {
-        auto users = co_await switch_to_io_loop(CoroMapper<models::Users>(m_dbClient)
-            .findBy(Criteria(models::Users::Cols::_username, CompareOperator::EQ, req.username())));
-        if(!users.empty()) {
+        if(co_await m_storage->findUserByName(req.username())) {
             common::setStatus(resp, chat::STATUS_FAILURE, "Username already exists.");
             co_return resp;
         }
-        wsData->status = USER_STATUS::Registering;
-        wsData->user = User{.id = 0, .name = req.username() };
+        auto started = wsDataGuarded->update([&req](WsData& data) {
+            if(data.status == USER_STATUS::Authenticated) {
+                return false;
+            }
+            data.status = USER_STATUS::Registering;
+            data.user = User{.id = 0, .name = req.username() };
+            return true;
+        });
+        if(!started) {
+            common::setStatus(resp, chat::STATUS_FAILURE, "Already authenticated.");
+            co_return resp;
+        }
         common::setStatus(resp, chat::STATUS_SUCCESS);
         co_return resp;
     } catch(const std::exception& e) {
@@ -87,7 +114,7 @@ drogon::Task<chat::InitialRegisterResponse> MessageHandlers::handleRegisterIniti
 drogon::Task<chat::AuthResponse> MessageHandlers::handleAuth(const WsDataPtr& wsDataGuarded, const chat::AuthRequest& req, IChatRoomService& room_service) const {
     chat::AuthResponse resp;
 
-    auto wsData = co_await wsDataGuarded->lock_unique();
+    auto wsData = wsDataGuarded->load();
 
     if (wsData->status != USER_STATUS::Authenticating) {
         common::setStatus(resp, chat::STATUS_FAILURE, "Not in authentication phase.");
@@ -100,75 +127,57 @@ drogon::Task<chat::AuthResponse> MessageHandlers::handleAuth(const WsDataPtr& ws
     }
 
     try {
-        auto users = co_await switch_to_io_loop(CoroMapper<models::Users>(m_dbClient)
-            .findBy(Criteria(models::Users::Cols::_username, CompareOperator::EQ, wsData->user->name)));
+        auto found = co_await m_storage->findUserByName(wsData->user->name);
 
-        if (users.empty()) {
-            wsData->status = USER_STATUS::Unauthenticated;
+        if (!found) {
+            abortHandshake(wsDataGuarded, USER_STATUS::Authenticating);
             common::setStatus(resp, chat::STATUS_UNAUTHORIZED, "User not found.");
             co_return resp;
         }
 
-        auto user = users.front();
+        auto user = std::move(*found);
         if (req.has_password() && req.has_salt()) {
-            if (user.getValueOfSalt().empty()) {
-                if (user.getValueOfHashPassword() != req.password()) {
+            if (user.salt.empty()) {
+                if (user.hash_password != req.password()) {
                     common::setStatus(resp, chat::STATUS_UNAUTHORIZED, "Incorrect password.");
                     co_return resp;
                 }
-                auto err = co_await WithTransaction(
-                    [&](const auto& tx) -> drogon::Task<ScopedTransactionResult> {
-                        try {
-                            user.setHashPassword(req.hash());
-                            user.setSalt(req.salt());
-                            co_await switch_to_io_loop(CoroMapper<models::Users>(tx).update(user));
-                            co_return std::nullopt;
-                        } catch (const DrogonDbException& e) {
-                            LOG_ERROR << "User update error: " << e.base().what();
-                            co_return "Database error during user update.";
-                        }
-                    });
+                auto err = co_await m_storage->setPassword(user.id, req.hash(), req.salt());
 
                 if (err) {
-                    wsData->status = USER_STATUS::Unauthenticated;
+                    abortHandshake(wsDataGuarded, USER_STATUS::Authenticating);
                     common::setStatus(resp, chat::STATUS_FAILURE, *err);
                     co_return resp;
                 }
+                user.hash_password = req.hash();
             } else {
                 common::setStatus(resp, chat::STATUS_FAILURE, "User already migrated. Non correct Auth");
                 co_return resp;
             }
         } else {
-            if (user.getValueOfSalt().empty()) {
+            if (user.salt.empty()) {
                 common::setStatus(resp, chat::STATUS_FAILURE, "Migration required.");
                 co_return resp;
             }
 
-            if (user.getValueOfHashPassword() != req.hash()) {
+            if (user.hash_password != req.hash()) {
                 common::setStatus(resp, chat::STATUS_UNAUTHORIZED, "Hash mismatch.");
                 co_return resp;
             }
         }
 
-        auto rooms = co_await switch_to_io_loop(CoroMapper<models::Rooms>(m_dbClient).findAll());
-        for(const auto& room : rooms) {
-            chat::RoomInfo* room_info = resp.add_rooms();
-            room_info->set_room_id(room.getValueOfRoomId());
-            room_info->set_room_name(room.getValueOfRoomName());
-            auto membership = co_await switch_to_io_loop(CoroMapper<models::RoomMembership>(m_dbClient)
-                .findBy(Criteria(models::RoomMembership::Cols::_user_id, CompareOperator::EQ, user.getValueOfUserId())
-                     && Criteria(models::RoomMembership::Cols::_room_id, CompareOperator::EQ, room.getValueOfRoomId())));
-            if(membership.size()) {
-                room_info->set_is_joined(membership[0].getValueOfMembershipStatus() == "JOINED");
-            }
-
+        *resp.mutable_rooms() = co_await m_storage->listRooms(user.id);
+        if(!co_await room_service.login(User{.id = user.id, .name = user.name})) {
+            common::setStatus(resp, chat::STATUS_FAILURE, "Authentication was interrupted.");
+            co_return resp;
         }
+        co_await UnreadTracker::instance().load(user.id, *resp.mutable_rooms());
         chat::UserInfo* user_info = resp.mutable_authenticated_user();
-        user_info->set_user_id(*user.getUserId());
-        user_info->set_user_name(*user.getUsername());
-        wsData->user->id = *user.getUserId();
-        wsData->status = USER_STATUS::Authenticated;
-        co_await room_service.login(*wsData);
+        user_info->set_user_id(user.id);
+        user_info->set_user_name(user.name);
+        if(auto token = SessionTokens::instance().issue(user.id, user.hash_password); !token.empty()) {
+            resp.set_session_token(std::move(token));
+        }
         common::setStatus(resp, chat::STATUS_SUCCESS);
         co_return resp;
     } catch (const std::exception& e) {
@@ -177,10 +186,80 @@ drogon::Task<chat::AuthResponse> MessageHandlers::handleAuth(const WsDataPtr& ws
     }
 }
 
+drogon::Task<chat::ResumeSessionResponse> MessageHandlers::handleResumeSession(const WsDataPtr& wsDataGuarded, const chat::ResumeSessionRequest& req, IChatRoomService& room_service) const {
+    chat::ResumeSessionResponse resp;
+
+    if(wsDataGuarded->load()->status == USER_STATUS::Authenticated) {
+        common::setStatus(resp, chat::STATUS_FAILURE, "Already authenticated.");
+        co_return resp;
+    }
+    auto claims = SessionTokens::instance().verify(req.session_token());
+    if(!claims) {
+        common::setStatus(resp, chat::STATUS_UNAUTHORIZED, "Invalid or expired session.");
+        co_return resp;
+    }
+
+    try {
+        // The single validation step: the user still exists and has not changed the password
+        auto user = co_await m_storage->findUserById(claims->user_id);
+        if(!user || SessionTokens::passwordTag(user->hash_password) != claims->password_tag) {
+            common::setStatus(resp, chat::STATUS_UNAUTHORIZED, "Invalid or expired session.");
+            co_return resp;
+        }
+        const User session_user{.id = user->id, .name = user->name};
+
+        auto started = wsDataGuarded->update([&session_user](WsData& data) {
+            if(data.status == USER_STATUS::Authenticated) {
+                return false;
+            }
+            data.status = USER_STATUS::Authenticating;
+            data.user = session_user;
+            return true;
+        });
+        if(!started || !co_await room_service.login(session_user)) {
+            abortHandshake(wsDataGuarded, USER_STATUS::Authenticating);
+            common::setStatus(resp, chat::STATUS_FAILURE, "Authentication was interrupted.");
+            co_return resp;
+        }
+
+        *resp.mutable_rooms() = co_await m_storage->listRooms(session_user.id);
+        co_await UnreadTracker::instance().load(session_user.id, *resp.mutable_rooms());
+        chat::UserInfo* user_info = resp.mutable_authenticated_user();
+        user_info->set_user_id(session_user.id);
+        user_info->set_user_name(session_user.name);
+        resp.set_session_token(SessionTokens::instance().issue(session_user.id, user->hash_password));
+
+        if(req.has_room_id()) {
+            chat::JoinRoomRequest join;
+            join.set_room_id(req.room_id());
+            co_await handleJoinRoom(wsDataGuarded, join, room_service, *resp.mutable_joined_room());
+
+            // Back within the same run, the client only needs what it missed, not the room's history
+            const auto& joined = resp.joined_room();
+            if(joined.status().code() == chat::STATUS_SUCCESS && !req.room_epoch().empty() && req.room_epoch() == joined.room_epoch()) {
+                auto missed = co_await room_service.roomEventsSince(req.room_id(), req.since_seq());
+                if(missed.complete) {
+                    auto* sync = resp.mutable_room_sync();
+                    sync->set_room_seq(missed.seq);
+                    sync->set_room_epoch(joined.room_epoch());
+                    *sync->mutable_events() = { std::make_move_iterator(missed.events.begin()),
+                                                std::make_move_iterator(missed.events.end()) };
+                    common::setStatus(*sync, chat::STATUS_SUCCESS);
+                }
+            }
+        }
+        common::setStatus(resp, chat::STATUS_SUCCESS);
+        co_return resp;
+    } catch(const std::exception& e) {
+        common::setStatus(resp, chat::STATUS_FAILURE, std::string("Resume failed: ") + e.what());
+        co_return resp;
+    }
+}
+
 drogon::Task<chat::RegisterResponse> MessageHandlers::handleRegister(const WsDataPtr& wsDataGuarded, const chat::RegisterRequest& req) const {
     chat::RegisterResponse resp;
 
-    auto wsData = co_await wsDataGuarded->lock_unique();
+    auto wsData = wsDataGuarded->load();
 
     if (wsData->status != USER_STATUS::Registering) {
         common::setStatus(resp, chat::STATUS_FAILURE, "Non-correct registering");
@@ -191,37 +270,18 @@ drogon::Task<chat::RegisterResponse> MessageHandlers::handleRegister(const WsDat
         co_return resp;
     }
     try {
-        // Use a transaction to guarantee atomicity and handle duplicate usernames gracefully
-        auto err = co_await WithTransaction(
-            [&](const auto& tx) -> drogon::Task<ScopedTransactionResult> {
-                try {
-                    models::Users u;
-                    u.setUsername(wsData->user->name);
-                    u.setHashPassword(req.hash());
-                    u.setSalt(req.salt());
-                    co_await switch_to_io_loop(CoroMapper<models::Users>(tx).insert(u));
-                    co_return std::nullopt;
-                } catch(const DrogonDbException& e) {
-                    const std::string w = e.base().what();
-                    LOG_ERROR << "User insert error: " << w;
-                    if(w.find("duplicate key") != std::string::npos || w.find("UNIQUE constraint failed") != std::string::npos) {
-                        co_return "Username already exists.";
-                    }
-                    co_return "Database error during user insertion.";
-                }
-            });
+        auto err = co_await m_storage->createUser(wsData->user->name, req.hash(), req.salt());
 
+        abortHandshake(wsDataGuarded, USER_STATUS::Registering);
         if(err) {
-            wsData->status = USER_STATUS::Unauthenticated;
             common::setStatus(resp, chat::STATUS_FAILURE, *err);
             co_return resp;
         }
-        wsData->status = USER_STATUS::Unauthenticated;
         common::setStatus(resp, chat::STATUS_SUCCESS);
         co_return resp;
     } catch(const std::exception& e) {
         LOG_ERROR << "Register error: " << e.what();
-        wsData->status = USER_STATUS::Unauthenticated;
+        abortHandshake(wsDataGuarded, USER_STATUS::Registering);
         common::setStatus(resp, chat::STATUS_FAILURE, std::string("Registration failed: ") + e.what());
         co_return resp;
     }
@@ -230,7 +290,7 @@ drogon::Task<chat::RegisterResponse> MessageHandlers::handleRegister(const WsDat
 drogon::Task<chat::SendMessageResponse> MessageHandlers::handleSendMessage(const WsDataPtr& wsDataGuarded, const chat::SendMessageRequest& req, IChatRoomService& room_service) const {
     chat::SendMessageResponse resp;
 
-    auto wsData = co_await wsDataGuarded->lock_shared();
+    auto wsData = wsDataGuarded->load();
 
     if(wsData->status != USER_STATUS::Authenticated) {
         common::setStatus(resp, chat::STATUS_UNAUTHORIZED, "User not authenticated.");
@@ -240,7 +300,7 @@ drogon::Task<chat::SendMessageResponse> MessageHandlers::handleSendMessage(const
         common::setStatus(resp, chat::STATUS_FAILURE, "User is not in any room.");
         co_return resp;
     }
-    if(req.message().empty()) {
+    if(req.message().empty() && req.attachment_ids().empty()) {
         common::setStatus(resp, chat::STATUS_FAILURE, "Empty 'message' field.");
         co_return resp;
     }
@@ -248,26 +308,25 @@ drogon::Task<chat::SendMessageResponse> MessageHandlers::handleSendMessage(const
         common::setStatus(resp, chat::STATUS_FAILURE, *error);
         co_return resp;
     }
+    if(req.attachment_ids_size() > common::limits::MAX_MESSAGE_ATTACHMENTS) {
+        common::setStatus(resp, chat::STATUS_FAILURE,
+            "Too many attachments. Max: " + std::to_string(common::limits::MAX_MESSAGE_ATTACHMENTS) + ".");
+        co_return resp;
+    }
+    std::vector<int32_t> attachment_ids(req.attachment_ids().begin(), req.attachment_ids().end());
+    std::ranges::sort(attachment_ids);
+    attachment_ids.erase(std::unique(attachment_ids.begin(), attachment_ids.end()), attachment_ids.end());
 
-    models::Messages inserted_message;
+    // Build the RoomMessage first, so the storage fills in the id, timestamp and attachments
+    chat::Envelope msgEnv;
+    auto* message_info = msgEnv.mutable_room_message()->mutable_message();
+    message_info->set_message(req.message());
+    message_info->mutable_from()->set_user_id(wsData->user->id);
+    message_info->mutable_from()->set_user_name(wsData->user->name);
 
     try {
-        auto err = co_await WithTransaction(
-            [&](const auto& tx) -> drogon::Task<ScopedTransactionResult> {
-                try {
-                    models::Messages m;
-                    m.setMessageText(req.message());
-                    m.setRoomId(wsData->room->id);
-                    m.setUserId(wsData->user->id);
-                    inserted_message = co_await switch_to_io_loop(CoroMapper<models::Messages>(tx).insert(m));
-                    co_return std::nullopt;
-                } catch(const DrogonDbException& e) {
-                    const std::string w = e.base().what();
-                    LOG_ERROR << "Message insert error: " << w;
-                    co_return "Database error during message insertion.";
-                }
-            });
-
+        auto err = co_await m_storage->insertMessage(wsData->room->id, wsData->user->id, req.message(),
+                                                     std::move(attachment_ids), *message_info);
         if(err) {
             common::setStatus(resp, chat::STATUS_FAILURE, *err);
             co_return resp;
@@ -278,114 +337,103 @@ drogon::Task<chat::SendMessageResponse> MessageHandlers::handleSendMessage(const
         co_return resp;
     }
 
-    // Build and broadcast RoomMessage
-    chat::Envelope msgEnv;
-    auto* msg = msgEnv.mutable_room_message();
-    auto* message_info = msg->mutable_message();
-    auto* user_info = message_info->mutable_from();
-
-    message_info->set_message(req.message());
-    message_info->set_timestamp(inserted_message.getValueOfCreatedAt());
-    message_info->set_message_id(inserted_message.getValueOfMessageId());
-
-    user_info->set_user_id(wsData->user->id);
-    user_info->set_user_name(wsData->user->name);
-
     co_await room_service.sendToRoom(wsData->room->id, msgEnv);
 
     common::setStatus(resp, chat::STATUS_SUCCESS);
     co_return resp;
 }
 
-drogon::Task<chat::JoinRoomResponse> MessageHandlers::handleJoinRoom(const WsDataPtr& wsDataGuarded, const chat::JoinRoomRequest& req, IChatRoomService& room_service) const {
-    chat::JoinRoomResponse resp;
-
-    auto wsData = co_await wsDataGuarded->lock_unique();
+drogon::Task<void> MessageHandlers::handleJoinRoom(const WsDataPtr& wsDataGuarded, const chat::JoinRoomRequest& req, IChatRoomService& room_service, chat::JoinRoomResponse& resp) const {
+    auto wsData = wsDataGuarded->load();
 
     if(wsData->status != USER_STATUS::Authenticated) {
         common::setStatus(resp, chat::STATUS_UNAUTHORIZED, "User not authenticated.");
-        co_return resp;
+        co_return;
     }
 
     try {
         
         if(wsData->room) {
-            co_await room_service.leaveCurrentRoom(*wsData);
-            wsData->room.reset();
+            co_await room_service.leaveCurrentRoom();
         }
 
-        auto rooms = co_await switch_to_io_loop(CoroMapper<models::Rooms>(m_dbClient)
-            .findBy(Criteria(models::Rooms::Cols::_room_id, CompareOperator::EQ, req.room_id())));
-        if(rooms.empty()) {
+        auto room = co_await m_storage->findRoom(req.room_id());
+        if(!room) {
             common::setStatus(resp, chat::STATUS_NOT_FOUND, "Room does not exist.");
-            co_return resp;
+            co_return;
         }
 
-        auto room = rooms.front();
-
-        auto membership_status = co_await getUserMembershipStatus(m_dbClient, wsData->user->id, req.room_id());
+        auto membership_status = co_await m_storage->membershipStatus(wsData->user->id, req.room_id());
 
-        if(room.getValueOfIsPrivate() && (!membership_status || *membership_status != chat::MembershipStatus::JOINED)) {
+        if(room->is_private && (!membership_status || *membership_status != chat::MembershipStatus::JOINED)) {
             common::setStatus(resp, chat::STATUS_UNAUTHORIZED, "Cannot join private room.");
-            co_return resp;
+            co_return;
         }
 
-        if(!room.getValueOfIsPrivate() && (!membership_status || *membership_status != chat::MembershipStatus::JOINED)) {
-            co_await setUserMembershipStatus(m_dbClient, wsData->user->id, req.room_id(), chat::MembershipStatus::JOINED);
+        if(!room->is_private && (!membership_status || *membership_status != chat::MembershipStatus::JOINED)) {
+            co_await m_storage->setMembershipStatus(wsData->user->id, req.room_id(), chat::MembershipStatus::JOINED);
         }
 
-        auto memberships = co_await switch_to_io_loop(CoroMapper<models::RoomMembership>(m_dbClient)
-            .findBy(Criteria(models::RoomMembership::Cols::_room_id, CompareOperator::EQ, req.room_id())));
-
-        for (const auto& membership : memberships) {
-            auto user_model = co_await switch_to_io_loop(CoroMapper<models::Users>(m_dbClient)
-                .findOne(Criteria(models::Users::Cols::_user_id, CompareOperator::EQ, membership.getValueOfUserId())));
-            if (user_model.getUserId()) {
-                auto* user_info = resp.add_all_users();
-                user_info->set_user_id(*user_model.getUserId());
-                user_info->set_user_name(user_model.getValueOfUsername());
-
-                auto rights = co_await getUserRights(m_dbClient, *user_model.getUserId(), req.room_id(), room);
-                if (rights) {
-                    user_info->set_user_room_rights(*rights);
+        // The user is normally among the members, which saves a separate lookup of their rights
+        std::optional<chat::UserRights> role;
+        bool listed = false;
+        for (auto& member : co_await m_storage->roomMembers(req.room_id())) {
+            if (member.user_id() == wsData->user->id) {
+                listed = true;
+                if (member.has_user_room_rights()) {
+                    role = member.user_room_rights();
                 }
             }
+            *resp.add_all_users() = std::move(member);
+        }
+        if (!listed) {
+            role = co_await m_storage->userRights(wsData->user->id, req.room_id());
         }
 
-        std::optional<chat::UserRights> role = co_await getUserRights(m_dbClient, wsData->user->id, req.room_id(), room);
-        wsData->room = CurrentRoom{ req.room_id(), role.value_or(chat::UserRights::REGULAR) };
+        const CurrentRoom current_room{ req.room_id(), role.value_or(chat::UserRights::REGULAR) };
 
-        chat::Envelope user_joined_msg;
-        auto* joined_payload = user_joined_msg.mutable_user_joined();
-        joined_payload->mutable_user()->set_user_id(wsData->user->id);
-        joined_payload->mutable_user()->set_user_name(wsData->user->name);
-        joined_payload->mutable_user()->set_user_room_rights(wsData->room->rights);
-        co_await room_service.sendToRoom(wsData->room->id, user_joined_msg);
-        
-        if(!membership_status) {
-            co_await room_service.sendToRoom(wsData->room->id, user_joined_msg);
+        // Peers only need to hear about the user's first connection in the room;
+        // checked before this connection is added to it.
+        const bool already_present = co_await room_service.isUserPresent(current_room.id, wsData->user->id);
+
+        if(!co_await room_service.joinRoom(current_room)) {
+            common::setStatus(resp, chat::STATUS_UNAUTHORIZED, "User not authenticated.");
+            co_return;
+        }
+
+        if(!already_present) {
+            chat::Envelope user_joined_msg;
+            auto* joined_payload = user_joined_msg.mutable_user_joined();
+            joined_payload->mutable_user()->set_user_id(wsData->user->id);
+            joined_payload->mutable_user()->set_user_name(wsData->user->name);
+            joined_payload->mutable_user()->set_user_room_rights(current_room.rights);
+            co_await room_service.sendToRoom(current_room.id, user_joined_msg);
         }
 
-        co_await room_service.joinRoom(*wsData);
+        co_await UnreadTracker::instance().markRead(wsData->user->id, current_room.id);
+
+        // Read before the presence, so an event racing with the join is delivered rather than lost
+        resp.set_room_seq(co_await room_service.roomEventSeq(current_room.id));
+        resp.set_room_epoch(room_service.roomEventEpoch());
 
-        auto active_users_list = co_await room_service.getUsersInRoom(req.room_id(), *wsData);
+        auto active_users_list = co_await room_service.getUsersInRoom(req.room_id());
 
         *resp.mutable_active_users() = { std::make_move_iterator(active_users_list.begin()),
                                         std::make_move_iterator(active_users_list.end()) };
 
         common::setStatus(resp, chat::STATUS_SUCCESS);
-        co_return resp;
+        co_return;
 
     } catch(const std::exception& e) {
         common::setStatus(resp, chat::STATUS_FAILURE, "Failed to join room: " + std::string(e.what()));
-        co_return resp;
+        co_return;
     }
 }
 
 drogon::Task<chat::LeaveRoomResponse> MessageHandlers::handleLeaveRoom(const WsDataPtr& wsDataGuarded, const chat::LeaveRoomRequest&, IChatRoomService& room_service) const {
     chat::LeaveRoomResponse resp;
 
-    auto wsData = co_await wsDataGuarded->lock_unique();
+    auto wsData = wsDataGuarded->load();
 
     if(wsData->status != USER_STATUS::Authenticated) {
         common::setStatus(resp, chat::STATUS_UNAUTHORIZED, "User not authenticated.");
@@ -396,8 +444,10 @@ drogon::Task<chat::LeaveRoomResponse> MessageHandlers::handleLeaveRoom(const WsD
         co_return resp;
     }
 
-    co_await room_service.leaveCurrentRoom(*wsData);
-    wsData->room.reset();
+    if(!co_await room_service.leaveCurrentRoom()) {
+        common::setStatus(resp, chat::STATUS_FAILURE, "User is not in any room.");
+        co_return resp;
+    }
 
     common::setStatus(resp, chat::STATUS_SUCCESS);
     co_return resp;
@@ -406,7 +456,7 @@ drogon::Task<chat::LeaveRoomResponse> MessageHandlers::handleLeaveRoom(const WsD
 drogon::Task<chat::CreateRoomResponse> MessageHandlers::handleCreateRoom(const WsDataPtr& wsDataGuarded, const chat::CreateRoomRequest& req, IChatRoomService& room_service) const {
     chat::CreateRoomResponse resp;
 
-    auto wsData = co_await wsDataGuarded->lock_shared();
+    auto wsData = wsDataGuarded->load();
 
     if(wsData->status != USER_STATUS::Authenticated) {
         common::setStatus(resp, chat::STATUS_UNAUTHORIZED, "Not authenticated");
@@ -422,27 +472,7 @@ drogon::Task<chat::CreateRoomResponse> MessageHandlers::handleCreateRoom(const W
     }
     int32_t room_id;
     try {
-        auto err = co_await WithTransaction(
-            [&](const auto& tx) -> drogon::Task<ScopedTransactionResult> {
-                try {
-                    models::Rooms r;
-                    r.setRoomName(req.room_name());
-                    r.setOwnerId(wsData->user->id);
-                    r = co_await switch_to_io_loop(CoroMapper<models::Rooms>(tx).insert(r));
-                    room_id = *r.getRoomId();
-
-                    models::RoomMembership m;
-                    m.setRoomId(room_id);
-                    m.setUserId(wsData->user->id);
-                    co_await switch_to_io_loop(CoroMapper<models::RoomMembership>(tx).insert(m));
-
-                    co_return std::nullopt;
-                } catch(const DrogonDbException& e) {
-                    const std::string w = e.base().what();
-                    LOG_ERROR << "Room insert error: " << w;
-                    co_return "Database error during room creation.";
-                }
-            });
+        auto err = co_await m_storage->createRoom(req.room_name(), wsData->user->id, room_id);
 
         if(err) {
             common::setStatus(resp, chat::STATUS_FAILURE, *err);
@@ -455,7 +485,7 @@ drogon::Task<chat::CreateRoomResponse> MessageHandlers::handleCreateRoom(const W
         new_room_resp->mutable_room()->set_room_name(req.room_name());
         new_room_resp->mutable_room()->mutable_owner()->set_user_id(wsData->user->id);
 
-        co_await room_service.sendToAll(new_room_msg);
+        co_await room_service.sendToRoomDirectory(new_room_msg);
         common::setStatus(resp, chat::STATUS_SUCCESS);
         co_return resp;
     } catch(const std::exception& e) {
@@ -465,18 +495,63 @@ drogon::Task<chat::CreateRoomResponse> MessageHandlers::handleCreateRoom(const W
     }
 }
 
-drogon::Task<chat::GetMessagesResponse> MessageHandlers::handleGetMessages(const WsDataPtr& wsDataGuarded, const chat::GetMessagesRequest& req) const {
-    chat::GetMessagesResponse resp;
+drogon::Task<void> MessageHandlers::handleSyncRoom(const WsDataPtr& wsDataGuarded, const chat::SyncRoomRequest& req, IChatRoomService& room_service, chat::SyncRoomResponse& resp) const {
+    auto wsData = wsDataGuarded->load();
+
+    if(wsData->status != USER_STATUS::Authenticated) {
+        common::setStatus(resp, chat::STATUS_UNAUTHORIZED, "User not authenticated.");
+        co_return;
+    }
+    if(!wsData->room) {
+        common::setStatus(resp, chat::STATUS_FAILURE, "User is not in any room.");
+        co_return;
+    }
+    const int32_t room_id = wsData->room->id;
+    resp.set_room_epoch(room_service.roomEventEpoch());
+
+    if(req.room_epoch() == resp.room_epoch()) {
+        auto missed = co_await room_service.roomEventsSince(room_id, req.since_seq());
+        if(missed.complete) {
+            resp.set_room_seq(missed.seq);
+            *resp.mutable_events() = { std::make_move_iterator(missed.events.begin()),
+                                       std::make_move_iterator(missed.events.end()) };
+            common::setStatus(resp, chat::STATUS_SUCCESS);
+            co_return;
+        }
+    }
+
+    // The events are no longer kept, or the numbers come from another process or an earlier run:
+    // send the room's users as on a join, and the client reloads the history itself
+    try {
+        resp.set_full_reload(true);
+        auto* room = resp.mutable_room();
+        room->set_room_seq(co_await room_service.roomEventSeq(room_id));
+        room->set_room_epoch(resp.room_epoch());
+        resp.set_room_seq(room->room_seq());
+
+        for(auto& member : co_await m_storage->roomMembers(room_id)) {
+            *room->add_all_users() = std::move(member);
+        }
+        auto active_users_list = co_await room_service.getUsersInRoom(room_id);
+        *room->mutable_active_users() = { std::make_move_iterator(active_users_list.begin()),
+                                          std::make_move_iterator(active_users_list.end()) };
+        common::setStatus(*room, chat::STATUS_SUCCESS);
+        common::setStatus(resp, chat::STATUS_SUCCESS);
+    } catch(const std::exception& e) {
+        common::setStatus(resp, chat::STATUS_FAILURE, "Failed to sync room: " + std::string(e.what()));
+    }
+}
 
-    auto wsData = co_await wsDataGuarded->lock_shared();
+drogon::Task<void> MessageHandlers::handleGetMessages(const WsDataPtr& wsDataGuarded, const chat::GetMessagesRequest& req, chat::GetMessagesResponse& resp) const {
+    auto wsData = wsDataGuarded->load();
 
     if(wsData->status != USER_STATUS::Authenticated) {
         common::setStatus(resp, chat::STATUS_UNAUTHORIZED, "User not authenticated.");
-        co_return resp;
+        co_return;
     }
     if(!wsData->room) {
         common::setStatus(resp, chat::STATUS_FAILURE, "User is not in any room.");
-        co_return resp;
+        co_return;
     }
     try {
         
@@ -485,52 +560,94 @@ drogon::Task<chat::GetMessagesResponse> MessageHandlers::handleGetMessages(const
         LOG_TRACE << "Limit: " + std::to_string(limit);
         LOG_TRACE << "Ts: " + std::to_string(req.offset_ts());
 
-        auto criteria = Criteria(models::Messages::Cols::_created_at, 
-                                limit > 0 ? CompareOperator::LT : CompareOperator::GT, 
-                                req.offset_ts());
-        auto order = limit > 0 ? SortOrder::DESC : SortOrder::ASC;
+        const bool older = limit > 0;
+        const int32_t room_id = wsData->room->id;
+        auto& archive = MessageArchive::instance();
+        auto offset_ts = req.offset_ts();
         limit = std::abs(limit);
 
-        auto messages = co_await switch_to_io_loop(CoroMapper<models::Messages>(m_dbClient)
-            .orderBy(models::Messages::Cols::_created_at, order)
-            .limit(limit)
-            .findBy(Criteria(models::Messages::Cols::_room_id, CompareOperator::EQ, wsData->room->id) && criteria));
-
-        for(const auto& message : messages) {
-            auto* message_info = resp.add_message();
-            message_info->set_message(message.getValueOfMessageText());
-            LOG_TRACE << std::string("Message text \"") + message.getValueOfMessageText() + "\"";
-            message_info->set_timestamp(message.getValueOfCreatedAt());
-            LOG_TRACE << std::string("Message timestamp \"") + std::to_string(message.getValueOfCreatedAt()) + "\"";
-            message_info->set_message_id(message.getValueOfMessageId());
-            LOG_TRACE << std::string("Message id \"") + std::to_string(message.getValueOfMessageId()) + "\"";
-            auto* user_info = message_info->mutable_from();
-            auto user = message.getUser(m_dbClient); //TODO this is blocking
-
-            user_info->set_user_id(user.getValueOfUserId());
-            user_info->set_user_name(user.getValueOfUsername());
+        // Archived messages are older than everything in the database, so a page
+        // of newer messages may start in the archive and continue in the database.
+        if(!older) {
+            if(auto newest = archive.newestTimestamp(room_id); newest && offset_ts < *newest) {
+                // Archived blocks are decompressed on the worker pool
+                co_await on_worker_pool();
+                auto archived = archive.readAfter(room_id, offset_ts, limit);
+                co_await back_to_io_loop();
+                for(auto& message : archived) {
+                    *resp.add_message() = std::move(message);
+                }
+                if(resp.message_size() > 0) {
+                    offset_ts = resp.message(resp.message_size() - 1).timestamp();
+                    limit -= resp.message_size();
+                }
+            }
+        }
+
+        // Messages are added straight to the response, which lives on the request's arena.
+        if(limit > 0) {
+            co_await m_storage->readMessages(room_id, offset_ts, limit, older, *resp.mutable_message());
         }
+
+        // A page of older messages that runs past the hot range continues in the archive
+        if(older && resp.message_size() < limit) {
+            const auto cursor = resp.message_size() > 0 ? resp.message(resp.message_size() - 1).timestamp() : offset_ts;
+            co_await on_worker_pool();
+            auto archived = archive.readBefore(room_id, cursor, limit - resp.message_size());
+            co_await back_to_io_loop();
+            for(auto& message : archived) {
+                *resp.add_message() = std::move(message);
+            }
+        }
+        co_await m_storage->loadAttachments({resp.mutable_message()->pointer_begin(), resp.mutable_message()->pointer_end()});
         common::setStatus(resp, chat::STATUS_SUCCESS);
-        co_return resp;
+        co_return;
     } catch(const std::exception& e) {
         common::setStatus(resp, chat::STATUS_FAILURE, "Failed to retrieve messages: " + std::string(e.what()));
-        co_return resp;
+        co_return;
+    }
+}
+
+drogon::Task<void> MessageHandlers::handleSearchMessages(const WsDataPtr& wsDataGuarded, const chat::SearchMessagesRequest& req, chat::SearchMessagesResponse& resp) const {
+    auto wsData = wsDataGuarded->load();
+
+    if(wsData->status != USER_STATUS::Authenticated) {
+        common::setStatus(resp, chat::STATUS_UNAUTHORIZED, "User not authenticated.");
+        co_return;
+    }
+    if(req.query().empty()) {
+        common::setStatus(resp, chat::STATUS_FAILURE, "Empty search query.");
+        co_return;
+    }
+    if (auto error = validateUtf8String(req.query(), common::limits::MAX_SEARCH_QUERY_LENGTH, "query")) {
+        common::setStatus(resp, chat::STATUS_FAILURE, *error);
+        co_return;
+    }
+    const int32_t limit = std::clamp(req.limit(), 1, common::limits::MAX_SEARCH_PAGE);
+    const int32_t offset = std::clamp(req.offset(), 0, IStorage::SEARCH_RANK_CANDIDATES);
+
+    try {
+        co_await m_storage->searchMessages(wsData->user->id, req, limit, offset, resp);
+        std::vector<chat::MessageInfo*> messages;
+        for(auto& hit : *resp.mutable_hits()) {
+            messages.push_back(hit.mutable_message());
+        }
+        co_await m_storage->loadAttachments(messages);
+        common::setStatus(resp, chat::STATUS_SUCCESS);
+        co_return;
+    } catch(const std::exception& e) {
+        common::setStatus(resp, chat::STATUS_FAILURE, "Search failed: " + std::string(e.what()));
+        co_return;
     }
 }
 
 drogon::Task<chat::LogoutResponse> MessageHandlers::handleLogoutUser(const WsDataPtr& wsDataGuarded, IChatRoomService& room_service) const {
     chat::LogoutResponse resp;
 
-    auto wsData = co_await wsDataGuarded->lock_unique();
-
-    if(wsData->status != USER_STATUS::Authenticated) {
+    if(wsDataGuarded->load()->status != USER_STATUS::Authenticated || !co_await room_service.logout()) {
         common::setStatus(resp, chat::STATUS_UNAUTHORIZED, "User not authenticated.");
         co_return resp;
     }
-    co_await room_service.logout(*wsData);
-    wsData->room.reset();
-    wsData->user.reset();
-    wsData->status = USER_STATUS::Unauthenticated;
     common::setStatus(resp, chat::STATUS_SUCCESS);
     co_return resp;
 }
@@ -538,7 +655,7 @@ drogon::Task<chat::LogoutResponse> MessageHandlers::handleLogoutUser(const WsDat
 drogon::Task<chat::RenameRoomResponse> MessageHandlers::handleRenameRoom(const WsDataPtr& wsDataGuarded, const chat::RenameRoomRequest& req, IChatRoomService& room_service) {
     chat::RenameRoomResponse resp;
 
-    auto wsData = co_await wsDataGuarded->lock_shared();
+    auto wsData = wsDataGuarded->load();
 
     if(wsData->status != USER_STATUS::Authenticated) {
         common::setStatus(resp, chat::STATUS_UNAUTHORIZED, "Not authenticated");
@@ -557,23 +674,7 @@ drogon::Task<chat::RenameRoomResponse> MessageHandlers::handleRenameRoom(const W
         co_return resp;
     }
     try {
-        auto err = co_await WithTransaction(
-            [&](const auto& tx) -> drogon::Task<ScopedTransactionResult> {
-                try {
-                    auto room = co_await switch_to_io_loop(CoroMapper<models::Rooms>(tx)
-                        .findOne(Criteria(models::Rooms::Cols::_room_id, CompareOperator::EQ, req.room_id())));
-                    if (!room.getRoomId()) {
-                        co_return "Room not found.";
-                    }
-                    room.setRoomName(req.name());
-                    co_await switch_to_io_loop(CoroMapper<models::Rooms>(tx).update(room));
-                    co_return std::nullopt;
-                } catch(const DrogonDbException& e) {
-                    const std::string w = e.base().what();
-                    LOG_ERROR << "Room rename error: " << w;
-                    co_return "Database error during room rename.";
-                }
-            });
+        auto err = co_await m_storage->renameRoom(req.room_id(), req.name());
 
         if(err) {
             common::setStatus(resp, chat::STATUS_FAILURE, *err);
@@ -584,7 +685,7 @@ drogon::Task<chat::RenameRoomResponse> MessageHandlers::handleRenameRoom(const W
         auto* new_name = env.mutable_new_room_name();
         new_name->set_room_id(wsData->room->id);
         new_name->set_name(req.name());
-        co_await room_service.sendToAll(env);
+        co_await room_service.sendToRoomDirectory(env);
         common::setStatus(resp, chat::STATUS_SUCCESS);
         co_return resp;
     } catch(const std::exception& e) {
@@ -597,7 +698,7 @@ drogon::Task<chat::RenameRoomResponse> MessageHandlers::handleRenameRoom(const W
 drogon::Task<chat::DeleteRoomResponse> MessageHandlers::handleDeleteRoom(const WsDataPtr& wsDataGuarded, const chat::DeleteRoomRequest& req, IChatRoomService& room_service) {
     chat::DeleteRoomResponse resp;
 
-    auto wsData = co_await wsDataGuarded->lock_shared();
+    auto wsData = wsDataGuarded->load();
 
     if(wsData->status != USER_STATUS::Authenticated) {
         common::setStatus(resp, chat::STATUS_UNAUTHORIZED, "Not authenticated.");
@@ -613,21 +714,7 @@ drogon::Task<chat::DeleteRoomResponse> MessageHandlers::handleDeleteRoom(const W
     }
     const auto room_id = req.room_id();
     try {
-        auto err = co_await WithTransaction(
-            [&](const auto& tx) -> drogon::Task<ScopedTransactionResult> {
-            try {
-                auto deleted_count = co_await switch_to_io_loop(CoroMapper<models::Rooms>(tx)
-                    .deleteBy(Criteria(models::Rooms::Cols::_room_id, CompareOperator::EQ, room_id)));
-                if (deleted_count == 0) {
-                    co_return "Room could not be deleted as it was not found.";
-                }
-                co_return std::nullopt;
-            } catch(const DrogonDbException& e) {
-                const std::string w = e.base().what();
-                LOG_ERROR << "Room deletion transaction failed: " << w;
-                co_return "Database error during room deletion.";
-            }
-        });
+        auto err = co_await m_storage->deleteRoom(room_id);
 
         if(err) {
             common::setStatus(resp, chat::STATUS_FAILURE, *err);
@@ -646,9 +733,9 @@ drogon::Task<chat::DeleteRoomResponse> MessageHandlers::handleDeleteRoom(const W
 drogon::Task<chat::AssignRoleResponse> MessageHandlers::handleAssignRole(const WsDataPtr& wsDataGuarded, const chat::AssignRoleRequest& req, IChatRoomService& room_service) {
     chat::AssignRoleResponse resp;
 
-    //unfortunately, we need unique lock here
-    //user can "demote" themselves from owning a room
-    auto wsData = co_await wsDataGuarded->lock_unique(); 
+    // the rights checked below come from this snapshot; if the user "demotes" themselves,
+    // ChatRoomManager publishes the new rights to every connection, including this one
+    auto wsData = wsDataGuarded->load();
 
     if(wsData->status != USER_STATUS::Authenticated) {
         common::setStatus(resp, chat::STATUS_UNAUTHORIZED, "Not authenticated.");
@@ -659,68 +746,22 @@ drogon::Task<chat::AssignRoleResponse> MessageHandlers::handleAssignRole(const W
         co_return resp;
     }
 
-    int32_t oldOwnerId = 0;
-    std::optional<chat::UserRights> oldOwnerNewRole_optional;
+    RoleChange change;
 
     try {
-        //do ALL db operations first, inside SINGLE transaction
-        auto err = co_await WithTransaction([&](const auto& tx) -> drogon::Task<ScopedTransactionResult> {
-            auto targetUserRightsOpt = co_await this->getUserRights(tx, req.user_id(), req.room_id());
-            auto targetUserRights = targetUserRightsOpt.value_or(chat::UserRights::REGULAR);
-
+        auto check = [&](chat::UserRights targetUserRights) -> ScopedTransactionResult {
             // first, check that target role is below ours. special case: room ownership transfer
             if (req.new_role() >= wsData->room->rights &&
                 !(wsData->room->rights >= chat::UserRights::OWNER && req.new_role() == chat::UserRights::OWNER)) {
-                co_return "Insufficient rights to change this user's role.";
+                return "Insufficient rights to change this user's role.";
             }
 
             if(targetUserRights >= wsData->room->rights) { //then check if target user's role is below ours
-                co_return "Insufficient rights to change this user's role.";
-            }
-
-            if(req.new_role() == chat::UserRights::OWNER) { //special case, changing owner
-                //step 1
-                //fetch room
-                auto room = co_await switch_to_io_loop(CoroMapper<models::Rooms>(tx)
-                .findOne(Criteria(models::Rooms::Cols::_room_id, CompareOperator::EQ, req.room_id())));
-
-                //step 2
-                //store old owner id, if there was any
-                oldOwnerId = room.getOwnerId() ? *room.getOwnerId() : 0;
-
-                //step 3
-                //update room with new owner id
-                room.setOwnerId(req.user_id());
-                co_await switch_to_io_loop(CoroMapper<models::Rooms>(tx).update(room));
-
-                if(oldOwnerId) {
-                    //step 4
-                    //if there was an old owner, then fetch their current role as per db
-                    oldOwnerNewRole_optional = co_await getUserRights(tx, oldOwnerId, req.room_id(), room);
-
-                    //step 5
-                    //if old owner is not a global admin, or had no explicit record for role, or if that role is below `MODERATOR`
-                    //then we need to either create new record or update existing one
-                    if(!oldOwnerNewRole_optional || *oldOwnerNewRole_optional < chat::UserRights::MODERATOR) {
-                        oldOwnerNewRole_optional = chat::UserRights::MODERATOR;
-                        auto inner_err = co_await updateUserRoleInDb(tx, oldOwnerId, req.room_id(), *oldOwnerNewRole_optional);
-                        if(inner_err) {
-                            co_return inner_err;
-                        }
-                    }
-
-                    // NOTE: we do not have to clean up new owner's explicit role, cuz `OWNER` is stored inside `rooms`
-                    // table directly and takes precedence, if user is demoted later then code above will make sure they are at least `MODERATOR`
-                }
-            } else { //much simpler regular case :з
-                auto inner_err = co_await updateUserRoleInDb(tx, req.user_id(), req.room_id(), req.new_role());
-                if(inner_err) {
-                    co_return inner_err;
-                }
+                return "Insufficient rights to change this user's role.";
             }
-
-            co_return std::nullopt;
-        });
+            return std::nullopt;
+        };
+        auto err = co_await m_storage->assignRole(req.user_id(), req.room_id(), req.new_role(), check, change);
 
         if(err) {
             common::setStatus(resp, chat::STATUS_FAILURE, *err);
@@ -730,10 +771,10 @@ drogon::Task<chat::AssignRoleResponse> MessageHandlers::handleAssignRole(const W
         //now we need to update our in memory cache
         //and send info to connected clients
 
-        if(oldOwnerId) { //special case, owner change
-            co_await room_service.updateUserRoomRights(oldOwnerId, req.room_id(), *oldOwnerNewRole_optional, *wsData);
+        if(change.old_owner_id) { //special case, owner change
+            co_await room_service.updateUserRoomRights(change.old_owner_id, req.room_id(), *change.old_owner_rights);
         }
-        co_await room_service.updateUserRoomRights(req.user_id(), req.room_id(), req.new_role(), *wsData);
+        co_await room_service.updateUserRoomRights(req.user_id(), req.room_id(), req.new_role());
 
         common::setStatus(resp, chat::STATUS_SUCCESS);
         co_return resp;
@@ -744,54 +785,10 @@ drogon::Task<chat::AssignRoleResponse> MessageHandlers::handleAssignRole(const W
     }
 }
 
-drogon::Task<std::optional<chat::UserRights>> MessageHandlers::getUserRights(const drogon::orm::DbClientPtr& db, int32_t user_id, int32_t room_id) const {
-    // 1. Fetch the room object.
-    auto room = co_await switch_to_io_loop(CoroMapper<models::Rooms>(db)
-        .findOne(Criteria(models::Rooms::Cols::_room_id, CompareOperator::EQ, room_id)));
-        
-    // 2. Delegate to the second overload, passing the fetched room.
-    co_return co_await getUserRights(db, user_id, room_id, room);
-}
-
-drogon::Task<std::optional<chat::UserRights>> MessageHandlers::getUserRights(const drogon::orm::DbClientPtr& db, int32_t user_id, int32_t room_id, const models::Rooms& room) const {
-    // Check if the user is a global admin first.
-    auto user = co_await switch_to_io_loop(CoroMapper<models::Users>(db)
-        .findBy(
-            Criteria(models::Users::Cols::_user_id, CompareOperator::EQ, user_id) &&
-            Criteria(models::Users::Cols::_is_admin, CompareOperator::EQ, true)));
-    if (!user.empty()){
-        co_return chat::UserRights::ADMIN;
-    }
-
-    // Then, check if they are the owner of this specific room.
-    if (room.getOwnerId() && *room.getOwnerId() == user_id) {
-        co_return chat::UserRights::OWNER;
-    }
-
-    // Finally, look for a specific role entry in the user_room_data table.
-    co_return co_await findStoredUserRole(db, user_id, room_id);
-}
-
-drogon::Task<std::optional<chat::UserRights>> MessageHandlers::findStoredUserRole(const drogon::orm::DbClientPtr& db, int32_t user_id, int32_t room_id) const {
-    auto data = co_await switch_to_io_loop(CoroMapper<models::UserRoomData>(db)
-        .findBy(
-            Criteria(models::UserRoomData::Cols::_user_id, CompareOperator::EQ, user_id) &&
-            Criteria(models::UserRoomData::Cols::_room_id, CompareOperator::EQ, room_id)));
-    if(data.empty()) {
-        co_return std::nullopt;
-    }
-
-    if(*data.front().getIsModerator()) {
-        co_return chat::UserRights::MODERATOR;
-    }
-
-    co_return std::nullopt;
-}
-
 drogon::Task<chat::DeleteMessageResponse> MessageHandlers::handleDeleteMessage(const WsDataPtr& wsDataGuarded, const chat::DeleteMessageRequest& req, IChatRoomService& room_service) {
     chat::DeleteMessageResponse resp;
 
-    auto wsData = co_await wsDataGuarded->lock_shared();
+    auto wsData = wsDataGuarded->load();
 
     if (wsData->status != USER_STATUS::Authenticated) {
         common::setStatus(resp, chat::STATUS_UNAUTHORIZED, "Not authenticated.");
@@ -809,26 +806,7 @@ drogon::Task<chat::DeleteMessageResponse> MessageHandlers::handleDeleteMessage(c
     const int32_t messageId = req.message_id();
     const int32_t roomId = wsData->room->id;
     try {
-        auto err = co_await WithTransaction([&](const auto& tx) -> drogon::Task<ScopedTransactionResult> {
-            try {
-                auto messages = co_await switch_to_io_loop(CoroMapper<models::Messages>(tx)
-                    .findBy(Criteria(models::Messages::Cols::_message_id, CompareOperator::EQ, messageId) &&
-                            Criteria(models::Messages::Cols::_room_id, CompareOperator::EQ, roomId)));
-                if (messages.empty()) {
-                    co_return "Message not found or does not belong to this room.";
-                }
-                size_t deletedCount = co_await switch_to_io_loop(CoroMapper<models::Messages>(tx)
-                    .deleteBy(Criteria(models::Messages::Cols::_message_id, CompareOperator::EQ, messageId)));
-
-                if (deletedCount == 0) {
-                    co_return "Message could not be deleted.";
-                }
-                co_return std::nullopt;
-            } catch (const DrogonDbException& e) {
-                LOG_ERROR << "Message deletion transaction failed: " << e.base().what();
-                co_return "Database error during message deletion.";
-            }
-        });
+        auto err = co_await m_storage->deleteMessage(roomId, messageId);
         if (err) {
             common::setStatus(resp, chat::STATUS_FAILURE, *err);
             co_return resp;
@@ -851,7 +829,7 @@ drogon::Task<chat::DeleteMessageResponse> MessageHandlers::handleDeleteMessage(c
 drogon::Task<chat::UserTypingStartResponse> MessageHandlers::handleUserTypingStart(const WsDataPtr& wsDataGuarded, IChatRoomService& room_service) const {
     chat::UserTypingStartResponse resp;
 
-    auto wsData = co_await wsDataGuarded->lock_shared();
+    auto wsData = wsDataGuarded->load();
 
     if (wsData->status != USER_STATUS::Authenticated) {
         common::setStatus(resp, chat::STATUS_UNAUTHORIZED, "Not authenticated.");
@@ -879,7 +857,7 @@ drogon::Task<chat::UserTypingStartResponse> MessageHandlers::handleUserTypingSta
 drogon::Task<chat::UserTypingStopResponse> MessageHandlers::handleUserTypingStop(const WsDataPtr& wsDataGuarded, IChatRoomService& room_service) const {
     chat::UserTypingStopResponse resp;
 
-    auto wsData = co_await wsDataGuarded->lock_shared();
+    auto wsData = wsDataGuarded->load();
 
     if (wsData->status != USER_STATUS::Authenticated) {
         common::setStatus(resp, chat::STATUS_UNAUTHORIZED, "Not authenticated.");
@@ -907,23 +885,26 @@ drogon::Task<chat::UserTypingStopResponse> MessageHandlers::handleUserTypingStop
 drogon::Task<chat::BecomeMemberResponse> MessageHandlers::handleBecomeMember(const WsDataPtr& wsDataGuarded, const chat::BecomeMemberRequest& req) {
     chat::BecomeMemberResponse resp;
     
-    auto wsData = co_await wsDataGuarded->lock_shared();
+    auto wsData = wsDataGuarded->load();
     if (wsData->status != USER_STATUS::Authenticated) {
         common::setStatus(resp, chat::STATUS_UNAUTHORIZED, "Not authenticated.");
         co_return resp;
     }
 
     try {
-        auto room = co_await switch_to_io_loop(CoroMapper<models::Rooms>(m_dbClient)
-            .findOne(Criteria(models::Rooms::Cols::_room_id, CompareOperator::EQ, req.room_id())));
-        auto curr_membership = co_await getUserMembershipStatus(m_dbClient, wsData->user->id, req.room_id());
+        auto room = co_await m_storage->findRoom(req.room_id());
+        if(!room) {
+            common::setStatus(resp, chat::STATUS_NOT_FOUND, "Room does not exist.");
+            co_return resp;
+        }
+        auto curr_membership = co_await m_storage->membershipStatus(wsData->user->id, req.room_id());
 
-        if(room.getValueOfIsPrivate() && !curr_membership) {
+        if(room->is_private && !curr_membership) {
             common::setStatus(resp, chat::STATUS_UNAUTHORIZED, "Not authorized to join this private room.");
             co_return resp;
         }
 
-        co_await setUserMembershipStatus(m_dbClient, wsData->user->id, req.room_id(), chat::MembershipStatus::JOINED);
+        co_await m_storage->setMembershipStatus(wsData->user->id, req.room_id(), chat::MembershipStatus::JOINED);
 
     } catch (const std::exception& e) {
         LOG_ERROR << "Become member error: " << e.what();
@@ -938,7 +919,7 @@ drogon::Task<chat::BecomeMemberResponse> MessageHandlers::handleBecomeMember(con
 drogon::Task<chat::ChangeUsernameResponse> MessageHandlers::handleChangeUsername(const WsDataPtr& wsDataGuarded, const chat::ChangeUsernameRequest& req, IChatRoomService& room_service) {
     chat::ChangeUsernameResponse resp;
 
-    auto wsData = co_await wsDataGuarded->lock_unique();
+    auto wsData = wsDataGuarded->load();
 
     if (wsData->status != USER_STATUS::Authenticated) {
         common::setStatus(resp, chat::STATUS_UNAUTHORIZED, "Not authenticated.");
@@ -950,41 +931,20 @@ drogon::Task<chat::ChangeUsernameResponse> MessageHandlers::handleChangeUsername
     }
     const std::string newUsername = req.new_username();
     try {
-        auto err = co_await WithTransaction(
-            [&](const auto& tx) -> drogon::Task<ScopedTransactionResult> {
-                try {
-                    auto existingUsers = co_await switch_to_io_loop(CoroMapper<models::Users>(tx)
-                        .findBy(Criteria(models::Users::Cols::_username, CompareOperator::EQ, newUsername)));
-                    if (!existingUsers.empty()) {
-                        co_return "This username is already taken.";
-                    }
-                    auto usersToUpdate = co_await switch_to_io_loop(CoroMapper<models::Users>(tx)
-                        .findBy(Criteria(models::Users::Cols::_user_id, CompareOperator::EQ, wsData->user->id)));
-
-                    if (usersToUpdate.empty()) {
-                        co_return "Current user not found in database.";
-                    }
-                    auto userToUpdate = usersToUpdate.front();
-                    userToUpdate.setUsername(newUsername);
-                    co_await switch_to_io_loop(CoroMapper<models::Users>(tx).update(userToUpdate));
-                    co_return std::nullopt;
-                }
-                catch (const DrogonDbException& e) {
-                    LOG_ERROR << "Username change transaction failed: " << e.base().what();
-                    co_return "Database error during username change.";
-                }
-            });
+        auto err = co_await m_storage->renameUser(wsData->user->id, newUsername);
         if (err) {
             common::setStatus(resp, chat::STATUS_FAILURE, *err);
             co_return resp;
         }
-        wsData->user->name = newUsername;
+        co_await room_service.updateUsername(wsData->user->id, newUsername);
 
         chat::Envelope broadcastEnv;
         auto* usernameChangedMsg = broadcastEnv.mutable_username_changed();
         usernameChangedMsg->set_user_id(wsData->user->id);
         usernameChangedMsg->set_new_username(newUsername);
-        co_await room_service.sendToAll(broadcastEnv);
+        // Every room listing the user as a member shows the name, not just those the user is in now
+        const auto member_rooms = co_await m_storage->memberRooms(wsData->user->id);
+        co_await room_service.sendToUserPeers(wsData->user->id, broadcastEnv, member_rooms);
 
         common::setStatus(resp, chat::STATUS_SUCCESS);
     }
@@ -998,7 +958,7 @@ drogon::Task<chat::ChangeUsernameResponse> MessageHandlers::handleChangeUsername
 drogon::Task<chat::GetMySaltResponse> MessageHandlers::handleGetSalt(const WsDataPtr& wsDataGuarded) {
     chat::GetMySaltResponse resp;
 
-    auto wsData = co_await wsDataGuarded->lock_shared();
+    auto wsData = wsDataGuarded->load();
 
     if (wsData->status != USER_STATUS::Authenticated) {
         common::setStatus(resp, chat::STATUS_UNAUTHORIZED, "Not authenticated.");
@@ -1006,24 +966,22 @@ drogon::Task<chat::GetMySaltResponse> MessageHandlers::handleGetSalt(const WsDat
     }
 
     try {
-        auto users = co_await switch_to_io_loop(CoroMapper<models::Users>(m_dbClient)
-            .findBy(Criteria(models::Users::Cols::_user_id, CompareOperator::EQ, wsData->user->id)));
+        auto user = co_await m_storage->findUserById(wsData->user->id);
 
-        if (users.empty()) {
+        if (!user) {
             common::setStatus(resp, chat::STATUS_NOT_FOUND, "User not found in database.");
             co_return resp;
         }
 
-        const auto& user = users.front();
-        if (user.getValueOfSalt().empty()) {
+        if (user->salt.empty()) {
             common::setStatus(resp, chat::STATUS_FAILURE, "User account is not migrated and has no salt.");
             co_return resp;
         }
-        resp.set_salt(user.getValueOfSalt());
+        resp.set_salt(user->salt);
         common::setStatus(resp, chat::STATUS_SUCCESS);
     }
-    catch (const DrogonDbException& e) {
-        LOG_ERROR << "Failed to get salt for user " << wsData->user->id << ": " << e.base().what();
+    catch (const std::exception& e) {
+        LOG_ERROR << "Failed to get salt for user " << wsData->user->id << ": " << e.what();
         common::setStatus(resp, chat::STATUS_FAILURE, "Database error while fetching user data.");
     }
     co_return resp;
@@ -1032,7 +990,7 @@ drogon::Task<chat::GetMySaltResponse> MessageHandlers::handleGetSalt(const WsDat
 drogon::Task<chat::ChangePasswordResponse> MessageHandlers::handleChangePassword(const WsDataPtr& wsDataGuarded, const chat::ChangePasswordRequest& req) {
     chat::ChangePasswordResponse resp;
 
-    auto wsData = co_await wsDataGuarded->lock_shared();
+    auto wsData = wsDataGuarded->load();
 
     if (wsData->status != USER_STATUS::Authenticated) {
         common::setStatus(resp, chat::STATUS_UNAUTHORIZED, "Not authenticated.");
@@ -1043,34 +1001,7 @@ drogon::Task<chat::ChangePasswordResponse> MessageHandlers::handleChangePassword
         co_return resp;
     }
     try {
-        auto err = co_await WithTransaction(
-            [&](const auto& tx) -> drogon::Task<ScopedTransactionResult> {
-                try {
-                    auto users = co_await switch_to_io_loop(CoroMapper<models::Users>(tx)
-                        .findBy(Criteria(models::Users::Cols::_user_id, CompareOperator::EQ, wsData->user->id)));
-                    if (users.empty()) {
-                        co_return "Current user not found in database.";
-                    }
-                    auto userToUpdate = users.front();
-
-                    if (userToUpdate.getValueOfSalt().empty()) {
-                        co_return "Cannot change password for a non-migrated account.";
-                    }
-
-                    if (userToUpdate.getValueOfHashPassword() != req.old_password_hash()) {
-                        co_return "Incorrect old password.";
-                    }
-
-                    userToUpdate.setHashPassword(req.new_password_hash());
-                    userToUpdate.setSalt(req.new_salt());
-                    co_await switch_to_io_loop(CoroMapper<models::Users>(tx).update(userToUpdate));
-                    co_return std::nullopt;
-                }
-                catch (const DrogonDbException& e) {
-                    LOG_ERROR << "Password change transaction failed: " << e.base().what();
-                    co_return "Database error during password change.";
-                }
-            });
+        auto err = co_await m_storage->changePassword(wsData->user->id, req.old_password_hash(), req.new_password_hash(), req.new_salt());
 
         if (err) {
             common::setStatus(resp, chat::STATUS_FAILURE, *err);
@@ -1096,6 +1027,10 @@ std::optional<std::string> MessageHandlers::validateUtf8String(
             return std::string("Field '") + std::string(fieldName) +
                    "' is too long. Max length: " + std::to_string(maxLength) + " chars.";
         }
+        // PostgreSQL text cannot hold NUL, so such a value could never be stored
+        if (textToValidate.find('\0') != std::string_view::npos) {
+            return std::string("Field '") + std::string(fieldName) + "' contains NUL characters.";
+        }
     }
     catch (const utf8::invalid_utf8&) {
         return std::string("Field '") + std::string(fieldName) + "' contains invalid UTF-8 characters.";
@@ -1108,79 +1043,4 @@ std::optional<std::string> MessageHandlers::validateUtf8String(
     return std::nullopt;
 }
 
-drogon::Task<ScopedTransactionResult> MessageHandlers::updateUserRoleInDb(const std::shared_ptr<drogon::orm::Transaction>& tx, int32_t userId, int32_t roomId, chat::UserRights newRole) {
-    try {
-
-        if(newRole != chat::UserRights::REGULAR && newRole != chat::UserRights::MODERATOR) {
-            co_return "For now this function can only toggle moderator status";
-        }
-
-        auto room_data = co_await switch_to_io_loop(CoroMapper<models::UserRoomData>(tx)
-            .findBy(Criteria(models::UserRoomData::Cols::_user_id, CompareOperator::EQ, userId) &&
-                    Criteria(models::UserRoomData::Cols::_room_id, CompareOperator::EQ, roomId)));
-
-        if (room_data.empty()) {
-            models::UserRoomData userRoomData;
-            userRoomData.setUserId(userId);
-            userRoomData.setRoomId(roomId);
-            userRoomData.setIsModerator(newRole == chat::UserRights::MODERATOR);
-            co_await switch_to_io_loop(CoroMapper<models::UserRoomData>(tx).insert(userRoomData));
-        } else {
-            auto dataToUpdate = room_data.front();
-            dataToUpdate.setIsModerator(newRole == chat::UserRights::MODERATOR);
-            co_await switch_to_io_loop(CoroMapper<models::UserRoomData>(tx).update(dataToUpdate));
-        }
-        co_return std::nullopt;
-    } catch (const DrogonDbException& e) {
-        LOG_ERROR << "Role update/insert failed: " << e.base().what();
-        co_return "Database error during role update.";
-    }
-}
-
-drogon::Task<std::optional<chat::MembershipStatus>> MessageHandlers::getUserMembershipStatus(const drogon::orm::DbClientPtr& db, int32_t user_id, int32_t room_id) {
-    auto room_membership = co_await switch_to_io_loop(CoroMapper<models::RoomMembership>(db)
-        .findBy(Criteria(models::RoomMembership::Cols::_user_id, CompareOperator::EQ, user_id) &&
-                Criteria(models::RoomMembership::Cols::_room_id, CompareOperator::EQ, room_id)));
-
-    if(room_membership.empty()) {
-        co_return std::nullopt;
-    }
-
-    chat::MembershipStatus status;
-
-    if(chat::MembershipStatus_Parse(*room_membership.front().getMembershipStatus(), &status)) {
-        co_return status;
-    }
-
-    co_return std::nullopt;
-}
-
-drogon::Task<ScopedTransactionResult> MessageHandlers::setUserMembershipStatus(const drogon::orm::DbClientPtr& db, int32_t user_id, int32_t room_id, chat::MembershipStatus status) {
-    try {
-        auto room_membership = co_await switch_to_io_loop(CoroMapper<models::RoomMembership>(db)
-            .findBy(Criteria(models::RoomMembership::Cols::_user_id, CompareOperator::EQ, user_id) &&
-                    Criteria(models::RoomMembership::Cols::_room_id, CompareOperator::EQ, room_id)));
-    
-        if(room_membership.empty()) {
-            models::RoomMembership membership;
-            membership.setUserId(user_id);
-            membership.setRoomId(room_id);
-            membership.setMembershipStatus(chat::MembershipStatus_Name(status));
-            co_await switch_to_io_loop(CoroMapper<models::RoomMembership>(db).insert(membership));
-            co_return std::nullopt;
-        } else {
-            auto membership = room_membership.front();
-            membership.setMembershipStatus(chat::MembershipStatus_Name(status));
-            co_await switch_to_io_loop(CoroMapper<models::RoomMembership>(db).update(membership));
-            co_return std::nullopt;
-        }
-    
-    } catch(const DrogonDbException& e) {
-        LOG_ERROR << "Membership status update/insert failed: " << e.base().what();
-        co_return "Database error during membership update.";
-    }
-}
-
-
-
 } // namespace server
@@ -0,0 +1,55 @@
+#include <server/chat/PgEventBus.h>
+#include <server/utils/switch_to_io_loop.h>
+
+namespace server {
+
+// NOTIFY payloads must be shorter than 8000 bytes.
+static constexpr std::size_t MAX_NOTIFY_PAYLOAD = 7999;
+
+PgEventBus::PgEventBus(drogon::orm::DbClientPtr dbClient, std::string channel)
+    : m_dbClient{std::move(dbClient)}
+    , m_channel{std::move(channel)}
+    , m_origin{drogon::utils::getUuid()} {}
+
+void PgEventBus::subscribe(EventHandler handler) {
+    m_listener = drogon::orm::DbListener::newPgListener(m_dbClient->connectionInfo());
+    if(!m_listener) {
+        LOG_ERROR << "Failed to create event bus listener on channel " << m_channel;
+        return;
+    }
+    m_listener->listen(m_channel, [origin = m_origin, handler = std::move(handler)](const std::string&, const std::string& payload) {
+        chat::BusEvent event;
+        if(!event.ParseFromString(drogon::utils::base64Decode(payload))) {
+            LOG_WARN << "Dropping malformed event bus payload";
+            return;
+        }
+        if(event.origin() == origin) {
+            return;
+        }
+        handler(std::move(event));
+    });
+    LOG_INFO << "Event bus listening on channel " << m_channel << " as " << m_origin;
+}
+
+drogon::Task<void> PgEventBus::publish(chat::BusEvent event) {
+    event.set_origin(m_origin);
+
+    std::string serialized;
+    if(!event.SerializeToString(&serialized)) {
+        LOG_ERROR << "Event bus serialization error";
+        co_return;
+    }
+    std::string payload = drogon::utils::base64Encode(serialized);
+    if(payload.size() > MAX_NOTIFY_PAYLOAD) {
+        LOG_ERROR << "Event bus payload of " << payload.size() << " bytes exceeds the NOTIFY limit, dropping";
+        co_return;
+    }
+
+    try {
+        co_await switch_to_io_loop(m_dbClient->execSqlCoro("SELECT pg_notify($1, $2)", m_channel, payload));
+    } catch(const drogon::orm::DrogonDbException& e) {
+        LOG_ERROR << "Event bus publish failed: " << e.base().what();
+    }
+}
+
+} // namespace server
@@ -0,0 +1,97 @@
+#include <server/chat/RoomEventLog.h>
+
+namespace server {
+
+RoomEventLog::RoomEventLog(std::size_t capacity)
+    : m_epoch{drogon::utils::getUuid()}
+    , m_capacity{std::max<std::size_t>(capacity, 1)} {}
+
+std::shared_ptr<RoomEventLog::Room> RoomEventLog::find(int32_t room_id, bool create, int64_t* idle_seq) const {
+    auto& s = shard(room_id);
+    std::lock_guard lock(s.mutex);
+    if(auto it = s.rooms.find(room_id); it != s.rooms.end()) {
+        return it->second;
+    }
+    auto idle = s.idle_seqs.find(room_id);
+    if(!create) {
+        if(idle_seq && idle != s.idle_seqs.end()) {
+            *idle_seq = idle->second;
+        }
+        return nullptr;
+    }
+    auto room = std::make_shared<Room>();
+    if(idle != s.idle_seqs.end()) {
+        room->seq = idle->second;
+        s.idle_seqs.erase(idle);
+    }
+    return s.rooms.emplace(room_id, std::move(room)).first->second;
+}
+
+int64_t RoomEventLog::seq(int32_t room_id) const {
+    int64_t idle_seq = 0;
+    auto room = find(room_id, false, &idle_seq);
+    if(!room) {
+        return idle_seq;
+    }
+    std::lock_guard lock(room->mutex);
+    return room->seq;
+}
+
+RoomEvents RoomEventLog::since(int32_t room_id, int64_t since_seq) const {
+    RoomEvents result;
+    int64_t idle_seq = 0;
+    auto room = find(room_id, false, &idle_seq);
+    if(!room) {
+        // An evicted room has had no events since its last one
+        result.seq = idle_seq;
+        result.complete = since_seq == idle_seq;
+        return result;
+    }
+
+    std::lock_guard lock(room->mutex);
+    result.seq = room->seq;
+    const auto oldest_kept = room->seq - static_cast<int64_t>(room->events.size()) + 1;
+    if(since_seq < oldest_kept - 1 || since_seq > room->seq) {
+        return result;
+    }
+    result.complete = true;
+    const auto skip = static_cast<std::size_t>(since_seq - oldest_kept + 1);
+    result.events.assign(room->events.begin() + static_cast<std::ptrdiff_t>(skip), room->events.end());
+    return result;
+}
+
+void RoomEventLog::forget(int32_t room_id) {
+    auto& s = shard(room_id);
+    std::lock_guard lock(s.mutex);
+    s.rooms.erase(room_id);
+    s.idle_seqs.erase(room_id);
+}
+
+std::size_t RoomEventLog::evictIdle(std::chrono::steady_clock::duration idle_ttl) {
+    const auto cutoff = std::chrono::steady_clock::now() - idle_ttl;
+    std::size_t evicted = 0;
+    for(auto& s : m_shards) {
+        std::lock_guard lock(s.mutex);
+        for(auto it = s.rooms.begin(); it != s.rooms.end();) {
+            // Only the map holds the room, and only find() could hand it out, under the shard lock:
+            // nobody can be stamping an event on it
+            auto& room = it->second;
+            if(room.use_count() != 1) {
+                ++it;
+                continue;
+            }
+            std::unique_lock room_lock(room->mutex);
+            if(room->last_event < cutoff) {
+                room_lock.unlock();
+                s.idle_seqs[it->first] = room->seq;
+                it = s.rooms.erase(it);
+                ++evicted;
+            } else {
+                ++it;
+            }
+        }
+    }
+    return evicted;
+}
+
+} // namespace server
@@ -0,0 +1,195 @@
+#include <server/chat/UnreadTracker.h>
+#include <server/utils/switch_to_io_loop.h>
+#include <server/utils/pg_array.h>
+#include <common/utils/limits.h>
+
+namespace server {
+
+// Counts are capped by the LIMIT inside the subquery, so a room with a huge
+// backlog costs no more than MAX_UNREAD_COUNT index entries.
+static constexpr auto LOAD_SQL =
+    "SELECT rm.room_id,"
+    "       COALESCE(mk.last_read_message_id, 0) AS last_read,"
+    "       (SELECT count(*) FROM (SELECT 1 FROM messages m"
+    "          WHERE m.room_id = rm.room_id AND m.message_id > COALESCE(mk.last_read_message_id, 0)"
+    "          LIMIT $2) AS capped) AS unread,"
+    "       (SELECT COALESCE(max(m.message_id), 0) FROM messages m WHERE m.room_id = rm.room_id) AS head"
+    " FROM room_membership rm"
+    " LEFT JOIN read_markers mk ON mk.user_id = rm.user_id AND mk.room_id = rm.room_id"
+    " WHERE rm.user_id = $1 AND rm.membership_status = 'JOINED'";
+
+// Rows of users or rooms deleted since the marker changed are skipped instead of
+// failing the whole batch on a foreign key.
+static constexpr auto FLUSH_SQL =
+    "INSERT INTO read_markers (user_id, room_id, last_read_message_id)"
+    " SELECT t.user_id, t.room_id, t.last_read"
+    " FROM unnest($1::int[], $2::int[], $3::int[]) AS t(user_id, room_id, last_read)"
+    " WHERE EXISTS (SELECT 1 FROM users u WHERE u.user_id = t.user_id)"
+    "   AND EXISTS (SELECT 1 FROM rooms r WHERE r.room_id = t.room_id)"
+    " ON CONFLICT (user_id, room_id) DO UPDATE"
+    " SET last_read_message_id = GREATEST(read_markers.last_read_message_id, EXCLUDED.last_read_message_id)";
+
+UnreadTracker& UnreadTracker::instance() {
+    static UnreadTracker inst;
+    return inst;
+}
+
+void UnreadTracker::start(drogon::orm::DbClientPtr db, std::chrono::milliseconds flush_interval) {
+    m_db = std::move(db);
+    drogon::app().getLoop()->runEvery(std::chrono::duration<double>(flush_interval).count(), [this]() {
+        drogon::async_run([this]() { return flush(); });
+    });
+}
+
+drogon::Task<void> UnreadTracker::load(int32_t user_id, google::protobuf::RepeatedPtrField<chat::RoomInfo>& rooms) {
+    if(!m_db) {
+        co_return;
+    }
+    auto rows = co_await switch_to_io_loop(m_db->execSqlCoro(LOAD_SQL, user_id, common::limits::MAX_UNREAD_COUNT));
+
+    std::unordered_map<int32_t, RoomCounter> counters;
+    {
+        std::lock_guard lock(m_mutex);
+        for(const auto& row : rows) {
+            const auto room_id = row["room_id"].as<int32_t>();
+            counters[room_id] = {row["last_read"].as<int32_t>(), static_cast<int32_t>(row["unread"].as<int64_t>())};
+            auto& head = m_heads[room_id];
+            head = std::max(head, row["head"].as<int32_t>());
+        }
+
+        // Another connection of the same user may already be tracked; the fresh counts replace it
+        if(auto it = m_users.find(user_id); it != m_users.end()) {
+            for(const auto& [room_id, counter] : it->second) {
+                m_room_users[room_id].erase(user_id);
+            }
+        }
+        for(const auto& [room_id, counter] : counters) {
+            m_room_users[room_id].insert(user_id);
+        }
+        m_users[user_id] = counters;
+    }
+
+    for(auto& room : rooms) {
+        if(auto it = counters.find(room.room_id()); it != counters.end()) {
+            room.set_unread_count(it->second.unread);
+        }
+    }
+}
+
+drogon::Task<void> UnreadTracker::markRead(int32_t user_id, int32_t room_id) {
+    if(!m_db) {
+        co_return;
+    }
+    std::optional<int32_t> head;
+    {
+        std::lock_guard lock(m_mutex);
+        if(auto it = m_heads.find(room_id); it != m_heads.end()) {
+            head = it->second;
+        }
+    }
+    if(!head) {
+        auto rows = co_await switch_to_io_loop(m_db->execSqlCoro(
+            "SELECT COALESCE(max(message_id), 0) AS head FROM messages WHERE room_id = $1", room_id));
+        head = rows.empty() ? 0 : rows.front()["head"].as<int32_t>();
+    }
+
+    std::lock_guard lock(m_mutex);
+    auto user_it = m_users.find(user_id);
+    if(user_it == m_users.end()) {
+        // Logged out while the head was being looked up
+        co_return;
+    }
+    auto& current_head = m_heads[room_id];
+    current_head = std::max(current_head, *head);
+    m_room_users[room_id].insert(user_id);
+    auto& counter = user_it->second[room_id];
+    advance_unsafe(user_id, room_id, counter, current_head);
+    counter.unread = 0;
+}
+
+std::vector<std::pair<int32_t, int32_t>> UnreadTracker::onRoomMessage(int32_t room_id, int32_t message_id, const std::function<bool(int32_t)>& is_viewing) {
+    std::vector<std::pair<int32_t, int32_t>> updates;
+
+    std::lock_guard lock(m_mutex);
+    auto& head = m_heads[room_id];
+    head = std::max(head, message_id);
+
+    auto it = m_room_users.find(room_id);
+    if(it == m_room_users.end()) {
+        return updates;
+    }
+    for(int32_t user_id : it->second) {
+        auto& counter = m_users[user_id][room_id];
+        if(message_id <= counter.last_read) {
+            continue;
+        }
+        if(is_viewing(user_id)) {
+            advance_unsafe(user_id, room_id, counter, message_id);
+            counter.unread = 0;
+        } else if(counter.unread < common::limits::MAX_UNREAD_COUNT) {
+            ++counter.unread;
+            updates.emplace_back(user_id, counter.unread);
+        }
+    }
+    return updates;
+}
+
+void UnreadTracker::forget(int32_t user_id) {
+    std::lock_guard lock(m_mutex);
+    auto it = m_users.find(user_id);
+    if(it == m_users.end()) {
+        return;
+    }
+    for(const auto& [room_id, counter] : it->second) {
+        if(auto room_it = m_room_users.find(room_id); room_it != m_room_users.end()) {
+            room_it->second.erase(user_id);
+            if(room_it->second.empty()) {
+                m_room_users.erase(room_it);
+            }
+        }
+    }
+    m_users.erase(it);
+}
+
+void UnreadTracker::advance_unsafe(int32_t user_id, int32_t room_id, RoomCounter& counter, int32_t message_id) {
+    if(message_id <= counter.last_read) {
+        return;
+    }
+    counter.last_read = message_id;
+    m_dirty[{user_id, room_id}] = message_id;
+}
+
+drogon::Task<> UnreadTracker::flush() {
+    std::map<std::pair<int32_t, int32_t>, int32_t> dirty;
+    {
+        std::lock_guard lock(m_mutex);
+        dirty.swap(m_dirty);
+    }
+    if(dirty.empty()) {
+        co_return;
+    }
+
+    std::vector<int32_t> user_ids, room_ids, last_reads;
+    user_ids.reserve(dirty.size());
+    room_ids.reserve(dirty.size());
+    last_reads.reserve(dirty.size());
+    for(const auto& [key, last_read] : dirty) {
+        user_ids.push_back(key.first);
+        room_ids.push_back(key.second);
+        last_reads.push_back(last_read);
+    }
+
+    try {
+        co_await switch_to_io_loop(m_db->execSqlCoro(FLUSH_SQL, toPgArray(user_ids), toPgArray(room_ids), toPgArray(last_reads)));
+    } catch(const drogon::orm::DrogonDbException& e) {
+        LOG_ERROR << "Failed to write " << dirty.size() << " read markers, retrying on the next flush: " << e.base().what();
+        // Newer progress recorded meanwhile wins over the failed batch
+        std::lock_guard lock(m_mutex);
+        for(const auto& [key, last_read] : dirty) {
+            auto& pending = m_dirty[key];
+            pending = std::max(pending, last_read);
+        }
+    }
+}
+
+} // namespace server
@@ -2,10 +2,17 @@
 #include <server/chat/WsData.h>
 #include <server/chat/MessageHandlerService.h>
 #include <server/chat/DrogonRoomService.h>
+#include <server/metrics/LoadMetrics.h>
+#include <server/utils/worker_pool.h>
 #include <common/utils/utils.h>
+#include <common/utils/arena.h>
+#include <common/utils/capture.h>
 
 namespace server {
 
+/// @brief Envelopes at least this large are parsed and serialized on the worker pool.
+static constexpr std::size_t OFFLOAD_ENVELOPE_BYTES = 64 * 1024;
+
 WsRequestProcessor::WsRequestProcessor(std::unique_ptr<MessageHandlerService> dispatcher)
     : m_dispatcher(std::move(dispatcher)) {}
 
@@ -14,14 +21,44 @@ WsRequestProcessor::~WsRequestProcessor() = default;
 drogon::Task<> WsRequestProcessor::handleIncomingMessage(drogon::WebSocketConnectionPtr conn, std::string bytes) const {
     try {
         auto initialThreadIdx = drogon::app().getCurrentThreadIndex();
+        const auto started = std::chrono::steady_clock::now();
 
-        chat::Envelope env;
-        if(!env.ParseFromString(bytes)) {
+        // The request and its response live on one arena, recycled by this IO loop
+        common::PooledArena arena;
+        auto* env = arena.create<chat::Envelope>();
+        const bool offload_parse = bytes.size() >= OFFLOAD_ENVELOPE_BYTES;
+        if(offload_parse) {
+            co_await on_worker_pool();
+        }
+        const bool parsed = env->ParseFromString(bytes);
+        if(offload_parse) {
+            co_await back_to_io_loop();
+        }
+        if(!parsed) {
             common::sendEnvelope(conn, common::makeGenericErrorEnvelope("Malformed protobuf message"));
             co_return;
         }
+        common::EnvelopeCapture::instance().recordEnvelope(conn, common::EnvelopeCapture::Event::Inbound, *env, bytes);
+        auto* respEnv = arena.create<chat::Envelope>();
         DrogonRoomService room_service{conn};
-        common::sendEnvelope(conn, co_await m_dispatcher->processMessage(conn->getContext<WsDataGuarded>(), env, room_service));
+        co_await m_dispatcher->processMessage(conn->getContext<WsDataSnapshot>(), *env, room_service, *respEnv);
+        // Large history pages and user lists are serialized off the IO loop and sent from it,
+        // so the connection and the capture are only touched by this loop
+        if(respEnv->ByteSizeLong() >= OFFLOAD_ENVELOPE_BYTES) {
+            std::string out;
+            co_await on_worker_pool();
+            const bool serialized = respEnv->SerializeToString(&out);
+            co_await back_to_io_loop();
+            if(serialized) {
+                common::sendSerialized(conn, *respEnv, out);
+            } else {
+                common::sendEnvelope(conn, common::makeGenericErrorEnvelope("Response serialization error"));
+            }
+        } else {
+            common::sendEnvelope(conn, *respEnv);
+        }
+        LoadMetrics::instance().recordHandlerLatency(
+            std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started));
         
         if(initialThreadIdx != drogon::app().getCurrentThreadIndex()) {
             throw std::runtime_error("thread idx mismatch! did you forget switch_to_io_loop?");
@@ -1,4 +1,17 @@
 #include <server/controller/HttpController.h>
+#include <server/metrics/LoadMetrics.h>
+#include <server/attachments/AttachmentStore.h>
+#include <server/auth/SessionTokens.h>
+#include <server/models/Users.h>
+#include <server/utils/switch_to_io_loop.h>
+#include <server/utils/worker_pool.h>
+#include <common/utils/limits.h>
+
+#include <utf8.h>
+#include <charconv>
+
+using namespace drogon::orm;
+namespace models = drogon_model::drogon_test;
 
 namespace server {
 
@@ -12,6 +25,375 @@ void HttpController::healthCheck([[maybe_unused]] const HttpRequestPtr& req, std
     callback(resp);
 }
 
+Task<HttpResponsePtr> HttpController::metrics([[maybe_unused]] HttpRequestPtr req) const {
+    const auto load = co_await LoadMetrics::instance().currentLoad();
+
+    std::ostringstream body;
+    body << "# TYPE chat_connections gauge\n"
+         << "chat_connections " << load.connections() << "\n"
+         << "# TYPE chat_active_rooms gauge\n"
+         << "chat_active_rooms " << load.active_rooms() << "\n"
+         << "# TYPE chat_loop_lag_ms gauge\n"
+         << "chat_loop_lag_ms " << load.loop_lag_ms() << "\n"
+         << "# TYPE chat_handler_latency_p99_ms gauge\n"
+         << "chat_handler_latency_p99_ms " << load.p99_handler_latency_ms() << "\n"
+         << "# TYPE chat_worker_queue_depth gauge\n"
+         << "chat_worker_queue_depth " << WorkerPool::instance().queueDepth() << "\n";
+
+    auto resp = HttpResponse::newHttpResponse();
+    resp->setStatusCode(k200OK);
+    resp->setContentTypeCode(CT_TEXT_PLAIN);
+    resp->setBody(body.str());
+    co_return resp;
+}
+
+static HttpResponsePtr errorResponse(HttpStatusCode code, const std::string& message) {
+    Json::Value body;
+    body["error"] = message;
+    auto resp = HttpResponse::newHttpJsonResponse(body);
+    resp->setStatusCode(code);
+    return resp;
+}
+
+static HttpResponsePtr receivedResponse(HttpStatusCode code, int64_t received) {
+    Json::Value body;
+    body["received"] = static_cast<Json::Int64>(received);
+    auto resp = HttpResponse::newHttpJsonResponse(body);
+    resp->setStatusCode(code);
+    return resp;
+}
+
+// Resolves the `Authorization: Bearer <session token>` header to a user, with
+// the same checks as ResumeSession: the user exists and kept the password.
+static Task<std::optional<int32_t>> authenticate(const HttpRequestPtr& req) {
+    static constexpr std::string_view BEARER = "Bearer ";
+    const std::string_view header = req->getHeader("authorization");
+    if(!header.starts_with(BEARER)) {
+        co_return std::nullopt;
+    }
+    auto claims = SessionTokens::instance().verify(header.substr(BEARER.size()));
+    if(!claims) {
+        co_return std::nullopt;
+    }
+    auto users = co_await switch_to_io_loop(CoroMapper<models::Users>(app().getDbClient())
+        .findBy(Criteria(models::Users::Cols::_user_id, CompareOperator::EQ, claims->user_id)));
+    if(users.empty() || SessionTokens::passwordTag(users.front().getValueOfHashPassword()) != claims->password_tag) {
+        co_return std::nullopt;
+    }
+    co_return claims->user_id;
+}
+
+// File names end up in Content-Disposition, so anything that could break out of the header is refused.
+static bool isValidFileName(std::string_view name) {
+    if(name.empty() || !utf8::is_valid(name.begin(), name.end())
+       || utf8::distance(name.begin(), name.end()) > static_cast<std::ptrdiff_t>(common::limits::MAX_ATTACHMENT_NAME_LENGTH)) {
+        return false;
+    }
+    return std::ranges::none_of(name, [](char c) {
+        return static_cast<unsigned char>(c) < 0x20 || c == 0x7f || c == '"' || c == '/' || c == '\\';
+    });
+}
+
+static bool isValidContentType(std::string_view type) {
+    return !type.empty() && type.size() <= 127 && type.find('/') != std::string_view::npos
+        && std::ranges::all_of(type, [](char c) { return c > 0x20 && c < 0x7f && c != '"'; });
+}
+
+static std::optional<int64_t> parseInt64(std::string_view text) {
+    int64_t value = 0;
+    auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+    if(ec != std::errc{} || end != text.data() + text.size()) {
+        return std::nullopt;
+    }
+    return value;
+}
+
+struct ByteRange {
+    bool satisfiable = true;
+    int64_t offset = 0;
+    int64_t length = 0; // 0 means up to the end of the file
+};
+
+// Parses a single `bytes=` range. A malformed header, or several ranges, get the whole file.
+static ByteRange parseRange(std::string_view header, int64_t size) {
+    static constexpr std::string_view PREFIX = "bytes=";
+    if(!header.starts_with(PREFIX) || header.find(',') != std::string_view::npos) {
+        return {};
+    }
+    header.remove_prefix(PREFIX.size());
+    const auto dash = header.find('-');
+    if(dash == std::string_view::npos) {
+        return {};
+    }
+    const auto first = header.substr(0, dash);
+    const auto last = header.substr(dash + 1);
+
+    if(first.empty()) {
+        // Suffix range: the last N bytes
+        auto suffix = parseInt64(last);
+        if(!suffix || *suffix < 0) {
+            return {};
+        }
+        if(*suffix == 0 || size == 0) {
+            return {.satisfiable = false};
+        }
+        const auto length = std::min(*suffix, size);
+        return {.offset = size - length, .length = length};
+    }
+
+    auto start = parseInt64(first);
+    if(!start || *start < 0) {
+        return {};
+    }
+    if(*start >= size) {
+        return {.satisfiable = false};
+    }
+    int64_t end = size - 1;
+    if(!last.empty()) {
+        auto parsed = parseInt64(last);
+        if(!parsed || *parsed < *start) {
+            return {};
+        }
+        end = std::min(*parsed, size - 1);
+    }
+    return {.offset = *start, .length = end - *start + 1};
+}
+
+Task<HttpResponsePtr> HttpController::beginUpload(HttpRequestPtr req) const {
+    auto& store = AttachmentStore::instance();
+    try {
+        auto user_id = co_await authenticate(req);
+        if(!user_id) {
+            co_return errorResponse(k401Unauthorized, "Invalid or expired session.");
+        }
+        auto json = req->getJsonObject();
+        if(!json || !(*json)["file_name"].isString() || !(*json)["size"].isIntegral()) {
+            co_return errorResponse(k400BadRequest, "Expected a JSON body with 'file_name', 'content_type' and 'size'.");
+        }
+        const auto file_name = (*json)["file_name"].asString();
+        const auto content_type = (*json).get("content_type", "application/octet-stream").asString();
+        const auto size = (*json)["size"].asInt64();
+        if(!isValidFileName(file_name)) {
+            co_return errorResponse(k400BadRequest, "Invalid file name.");
+        }
+        if(!isValidContentType(content_type)) {
+            co_return errorResponse(k400BadRequest, "Invalid content type.");
+        }
+        if(size <= 0 || size > store.config().max_file_size) {
+            co_return errorResponse(k413RequestEntityTooLarge,
+                "File size must be between 1 and " + std::to_string(store.config().max_file_size) + " bytes.");
+        }
+
+        const auto upload_id = AttachmentStore::newUploadId();
+        auto inserted = co_await switch_to_io_loop(app().getDbClient()->execSqlCoro(
+            "INSERT INTO attachment_uploads (upload_id, user_id, size_bytes, file_name, content_type)"
+            " SELECT $1, $2, $3, $4, $5"
+            " WHERE (SELECT count(*) FROM attachment_uploads WHERE user_id = $2) < $6"
+            " RETURNING upload_id",
+            upload_id, *user_id, size, file_name, content_type, store.config().max_open_uploads));
+        if(inserted.empty()) {
+            co_return errorResponse(k429TooManyRequests, "Too many unfinished uploads.");
+        }
+        if(!store.createPart(upload_id)) {
+            co_await switch_to_io_loop(app().getDbClient()->execSqlCoro(
+                "DELETE FROM attachment_uploads WHERE upload_id = $1", upload_id));
+            co_return errorResponse(k500InternalServerError, "Cannot store the upload.");
+        }
+
+        Json::Value body;
+        body["upload_id"] = upload_id;
+        body["chunk_size"] = static_cast<Json::UInt64>(store.config().max_chunk_size);
+        auto resp = HttpResponse::newHttpJsonResponse(body);
+        resp->setStatusCode(k201Created);
+        co_return resp;
+    } catch(const DrogonDbException& e) {
+        LOG_ERROR << "Failed to start an upload: " << e.base().what();
+        co_return errorResponse(k500InternalServerError, "Database error.");
+    }
+}
+
+Task<HttpResponsePtr> HttpController::uploadStatus(HttpRequestPtr req, std::string upload_id) const {
+    auto& store = AttachmentStore::instance();
+    try {
+        auto user_id = co_await authenticate(req);
+        if(!user_id) {
+            co_return errorResponse(k401Unauthorized, "Invalid or expired session.");
+        }
+        if(!AttachmentStore::isValidUploadId(upload_id)) {
+            co_return errorResponse(k404NotFound, "Unknown upload.");
+        }
+        auto rows = co_await switch_to_io_loop(app().getDbClient()->execSqlCoro(
+            "SELECT 1 FROM attachment_uploads WHERE upload_id = $1 AND user_id = $2", upload_id, *user_id));
+        auto received = rows.empty() ? std::nullopt : store.receivedBytes(upload_id);
+        if(!received) {
+            co_return errorResponse(k404NotFound, "Unknown upload.");
+        }
+        co_return receivedResponse(k200OK, *received);
+    } catch(const DrogonDbException& e) {
+        LOG_ERROR << "Failed to look up an upload: " << e.base().what();
+        co_return errorResponse(k500InternalServerError, "Database error.");
+    }
+}
+
+Task<HttpResponsePtr> HttpController::uploadChunk(HttpRequestPtr req, std::string upload_id) const {
+    auto& store = AttachmentStore::instance();
+    try {
+        auto user_id = co_await authenticate(req);
+        if(!user_id) {
+            co_return errorResponse(k401Unauthorized, "Invalid or expired session.");
+        }
+        if(!AttachmentStore::isValidUploadId(upload_id)) {
+            co_return errorResponse(k404NotFound, "Unknown upload.");
+        }
+        const auto offset = parseInt64(req->getParameter("offset"));
+        const auto chunk = req->body();
+        if(!offset || *offset < 0 || chunk.empty()) {
+            co_return errorResponse(k400BadRequest, "Expected a non-empty body and an 'offset' parameter.");
+        }
+        if(chunk.size() > store.config().max_chunk_size) {
+            co_return errorResponse(k413RequestEntityTooLarge,
+                "Chunks are limited to " + std::to_string(store.config().max_chunk_size) + " bytes.");
+        }
+
+        auto rows = co_await switch_to_io_loop(app().getDbClient()->execSqlCoro(
+            "SELECT size_bytes FROM attachment_uploads WHERE upload_id = $1 AND user_id = $2", upload_id, *user_id));
+        auto received = rows.empty() ? std::nullopt : store.receivedBytes(upload_id);
+        if(!received) {
+            co_return errorResponse(k404NotFound, "Unknown upload.");
+        }
+        const auto size = rows.front()["size_bytes"].as<int64_t>();
+        const auto end = *offset + static_cast<int64_t>(chunk.size());
+        if(*offset > *received || end > size) {
+            co_return receivedResponse(k409Conflict, *received);
+        }
+        if(!store.writeChunk(upload_id, *offset, chunk)) {
+            co_return errorResponse(k500InternalServerError, "Cannot store the chunk.");
+        }
+        co_return receivedResponse(k200OK, std::max(*received, end));
+    } catch(const DrogonDbException& e) {
+        LOG_ERROR << "Failed to store a chunk: " << e.base().what();
+        co_return errorResponse(k500InternalServerError, "Database error.");
+    }
+}
+
+Task<HttpResponsePtr> HttpController::completeUpload(HttpRequestPtr req, std::string upload_id) const {
+    auto& store = AttachmentStore::instance();
+    try {
+        auto user_id = co_await authenticate(req);
+        if(!user_id) {
+            co_return errorResponse(k401Unauthorized, "Invalid or expired session.");
+        }
+        if(!AttachmentStore::isValidUploadId(upload_id)) {
+            co_return errorResponse(k404NotFound, "Unknown upload.");
+        }
+        auto rows = co_await switch_to_io_loop(app().getDbClient()->execSqlCoro(
+            "SELECT size_bytes FROM attachment_uploads WHERE upload_id = $1 AND user_id = $2", upload_id, *user_id));
+        auto received = rows.empty() ? std::nullopt : store.receivedBytes(upload_id);
+        if(!received) {
+            co_return errorResponse(k404NotFound, "Unknown upload.");
+        }
+        if(*received != rows.front()["size_bytes"].as<int64_t>()) {
+            co_return receivedResponse(k409Conflict, *received);
+        }
+
+        // Hashing reads the whole file, so it runs on the worker pool
+        co_await on_worker_pool();
+        auto sha256 = store.commit(upload_id);
+        co_await back_to_io_loop();
+        if(!sha256) {
+            co_return errorResponse(k500InternalServerError, "Cannot store the file.");
+        }
+        // Ending the upload and recording the attachment is one statement, so a repeated request cannot record it twice
+        auto created = co_await switch_to_io_loop(app().getDbClient()->execSqlCoro(
+            "WITH done AS (DELETE FROM attachment_uploads WHERE upload_id = $1 AND user_id = $2"
+            "              RETURNING user_id, size_bytes, file_name, content_type)"
+            " INSERT INTO attachments (sha256, size_bytes, file_name, content_type, uploader_id)"
+            " SELECT $3, size_bytes, file_name, content_type, user_id FROM done"
+            " RETURNING attachment_id, size_bytes, file_name, content_type",
+            upload_id, *user_id, *sha256));
+        if(created.empty()) {
+            co_return errorResponse(k404NotFound, "Unknown upload.");
+        }
+
+        const auto& row = created.front();
+        Json::Value body;
+        body["attachment_id"] = row["attachment_id"].as<int32_t>();
+        body["file_name"] = row["file_name"].as<std::string>();
+        body["content_type"] = row["content_type"].as<std::string>();
+        body["size"] = static_cast<Json::Int64>(row["size_bytes"].as<int64_t>());
+        body["sha256"] = *sha256;
+        auto resp = HttpResponse::newHttpJsonResponse(body);
+        resp->setStatusCode(k201Created);
+        co_return resp;
+    } catch(const DrogonDbException& e) {
+        LOG_ERROR << "Failed to complete an upload: " << e.base().what();
+        co_return errorResponse(k500InternalServerError, "Database error.");
+    }
+}
+
+Task<HttpResponsePtr> HttpController::download(HttpRequestPtr req, int32_t attachment_id) const {
+    try {
+        auto user_id = co_await authenticate(req);
+        if(!user_id) {
+            co_return errorResponse(k401Unauthorized, "Invalid or expired session.");
+        }
+        // Readable by the uploader and by anyone who can read a room it was posted in
+        auto rows = co_await switch_to_io_loop(app().getDbClient()->execSqlCoro(
+            "SELECT a.sha256, a.size_bytes, a.file_name, a.content_type FROM attachments a"
+            " WHERE a.attachment_id = $1 AND (a.uploader_id = $2 OR EXISTS ("
+            "   SELECT 1 FROM message_attachments ma JOIN rooms r ON r.room_id = ma.room_id"
+            "   WHERE ma.attachment_id = a.attachment_id"
+            "     AND (NOT r.is_private OR EXISTS (SELECT 1 FROM room_membership rm"
+            "          WHERE rm.room_id = r.room_id AND rm.user_id = $2 AND rm.membership_status = 'JOINED'))))",
+            attachment_id, *user_id));
+        if(rows.empty()) {
+            co_return errorResponse(k404NotFound, "Unknown attachment.");
+        }
+        const auto& row = rows.front();
+        const auto sha256 = row["sha256"].as<std::string>();
+        const auto size = row["size_bytes"].as<int64_t>();
+        const auto etag = "\"" + sha256 + "\"";
+
+        if(req->getHeader("if-none-match") == etag) {
+            auto resp = HttpResponse::newHttpResponse();
+            resp->setStatusCode(k304NotModified);
+            resp->addHeader("ETag", etag);
+            co_return resp;
+        }
+
+        const auto path = AttachmentStore::instance().objectPath(sha256);
+        std::error_code ec;
+        if(!std::filesystem::exists(path, ec)) {
+            LOG_ERROR << "Attachment " << attachment_id << " is missing its file " << path;
+            co_return errorResponse(k404NotFound, "Unknown attachment.");
+        }
+
+        const auto range = parseRange(req->getHeader("range"), size);
+        if(!range.satisfiable) {
+            auto resp = HttpResponse::newHttpResponse();
+            resp->setStatusCode(k416RequestedRangeNotSatisfiable);
+            resp->addHeader("Content-Range", "bytes */" + std::to_string(size));
+            co_return resp;
+        }
+        // Drogon sends file responses with sendfile, so the content never passes through user space
+        auto resp = HttpResponse::newFileResponse(path.string(),
+                                                  static_cast<size_t>(range.offset),
+                                                  static_cast<size_t>(range.length),
+                                                  range.length > 0,
+                                                  row["file_name"].as<std::string>(),
+                                                  CT_CUSTOM,
+                                                  row["content_type"].as<std::string>());
+        resp->addHeader("Accept-Ranges", "bytes");
+        resp->addHeader("ETag", etag);
+        resp->addHeader("Cache-Control", "private, max-age=31536000, immutable");
+        resp->addHeader("X-Content-Type-Options", "nosniff");
+        co_return resp;
+    } catch(const DrogonDbException& e) {
+        LOG_ERROR << "Failed to look up an attachment: " << e.base().what();
+        co_return errorResponse(k500InternalServerError, "Database error.");
+    }
+}
+
 } // namespace http
 
 } // namespace server
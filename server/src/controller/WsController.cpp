@@ -4,7 +4,13 @@
 #include <server/chat/MessageHandlers.h>
 #include <server/chat/WsData.h>
 #include <server/chat/ChatRoomManager.h>
+#include <server/storage/PgStorage.h>
+#include <server/storage/MemoryStorage.h>
+#include <server/storage/WalStorage.h>
+#include <server/metrics/LoadMetrics.h>
+#include <server/limits/AdmissionControl.h>
 #include <common/utils/utils.h>
+#include <common/utils/capture.h>
 #include <common/version.h>
 
 namespace server {
@@ -19,7 +25,25 @@ WsController::WsController() {
         return;
     }
 
-    auto handlers = std::make_unique<MessageHandlers>(dbClient);
+    std::shared_ptr<IStorage> storage;
+    const auto backend = drogon::app().getCustomConfig()["storage"].get("backend", "postgres").asString();
+    if(backend == "memory") {
+        LOG_WARN << "Using the in-memory storage backend; users, rooms and messages are not persisted.";
+        storage = std::make_shared<MemoryStorage>();
+    } else {
+        if(backend != "postgres") {
+            LOG_ERROR << "Unknown storage backend '" << backend << "', using postgres.";
+        }
+        // Controllers are built before the beginning advice starts the log, so the config decides;
+        // WalStorage stores messages directly while the log is not running
+        if(drogon::app().getCustomConfig()["wal"].get("enabled", false).asBool()) {
+            storage = std::make_shared<WalStorage>(dbClient);
+        } else {
+            storage = std::make_shared<PgStorage>(dbClient);
+        }
+    }
+
+    auto handlers = std::make_unique<MessageHandlers>(std::move(storage));
     auto dispatcher = std::make_unique<MessageHandlerService>(std::move(handlers));
     m_requestProcessor = std::make_unique<WsRequestProcessor>(std::move(dispatcher));
 
@@ -30,10 +54,20 @@ WsController::~WsController() = default;
 
 void WsController::handleNewConnection([[maybe_unused]] const drogon::HttpRequestPtr& req, const drogon::WebSocketConnectionPtr& conn) {
     LOG_TRACE << "WS connect: " << conn->peerAddr().toIpPort();
-    conn->setContext(std::make_shared<WsDataGuarded>());
+    LoadMetrics::instance().connectionOpened();
     chat::Envelope helloEnv;
     helloEnv.mutable_server_hello()->set_type(chat::ServerType::TYPE_SERVER);
     helloEnv.mutable_server_hello()->set_protocol_version(common::version::PROTOCOL_VERSION);
+    // A refused connection gets no context, so nothing it sends before closing is processed.
+    if(auto retry = AdmissionControl::instance().admit(conn)) {
+        LOG_DEBUG << "Refusing " << conn->peerAddr().toIpPort() << ", retry in " << retry->count() << " ms";
+        helloEnv.mutable_server_hello()->set_retry_after_ms(static_cast<int32_t>(retry->count()));
+        common::sendEnvelope(conn, helloEnv);
+        conn->shutdown();
+        return;
+    }
+    conn->setContext(makeWsData());
+    common::EnvelopeCapture::instance().recordConnection(conn, common::EnvelopeCapture::Event::Open);
     common::sendEnvelope(conn, helloEnv);
 }
 
@@ -42,15 +76,23 @@ void WsController::handleNewMessage(const drogon::WebSocketConnectionPtr& conn,
         LOG_TRACE << "Non-binary WS message received from " << conn->peerAddr().toIpPort() << ". Ignoring.";
         return;
     }
+    if(!conn->hasContext()) {
+        return;
+    }
 
     drogon::async_run(std::bind(&WsRequestProcessor::handleIncomingMessage, m_requestProcessor.get(), conn, std::move(msg_str)));
 }
 
 void WsController::handleConnectionClosed(const drogon::WebSocketConnectionPtr& conn) {
     LOG_TRACE << "WS closed: " << conn->peerAddr().toIpPort();
+    LoadMetrics::instance().connectionClosed();
+    AdmissionControl::instance().release(conn);
+    if(!conn->hasContext()) {
+        return;
+    }
+    common::EnvelopeCapture::instance().recordConnection(conn, common::EnvelopeCapture::Event::Close);
     drogon::async_run([conn]() -> drogon::Task<> {
-        auto wsDataProxy = co_await conn->getContext<WsDataGuarded>()->lock_shared();
-        co_await ChatRoomManager::instance().unregisterConnection(conn, *wsDataProxy);
+        co_await ChatRoomManager::instance().unregisterConnection(conn);
     });
 }
 
@@ -0,0 +1,52 @@
+#include <server/db/DbRouter.h>
+#include <server/utils/switch_to_io_loop.h>
+
+namespace server {
+
+// Zero while the replica has replayed everything it received, so an idle
+// primary does not make the replica look stale.
+static constexpr auto REPLICA_LAG_SQL =
+    "SELECT CASE WHEN NOT pg_is_in_recovery() OR pg_last_wal_receive_lsn() = pg_last_wal_replay_lsn() THEN 0 "
+    "ELSE COALESCE(EXTRACT(EPOCH FROM now() - pg_last_xact_replay_timestamp()), 0) END::float8 AS lag_sec";
+
+DbRouter& DbRouter::instance() {
+    static DbRouter inst;
+    return inst;
+}
+
+void DbRouter::start(drogon::orm::DbClientPtr primary,
+                     drogon::orm::DbClientPtr replica,
+                     std::chrono::milliseconds max_lag,
+                     std::chrono::milliseconds check_interval) {
+    if(!replica || replica == primary) {
+        LOG_INFO << "No read replica configured, all queries go to the primary";
+        return;
+    }
+    m_replica = std::move(replica);
+    m_max_lag = max_lag;
+
+    drogon::app().getLoop()->runEvery(std::chrono::duration<double>(check_interval).count(), [this]() {
+        drogon::async_run([this]() { return checkReplica(); });
+    });
+    drogon::async_run([this]() { return checkReplica(); });
+}
+
+drogon::Task<> DbRouter::checkReplica() {
+    bool healthy = false;
+    try {
+        auto result = co_await switch_to_io_loop(m_replica->execSqlCoro(REPLICA_LAG_SQL));
+        const auto lag = std::chrono::duration<double>(result[0]["lag_sec"].as<double>());
+        healthy = lag <= m_max_lag;
+        if(!healthy) {
+            LOG_WARN << "Read replica is " << lag.count() << " s behind, using the primary";
+        }
+    } catch(const drogon::orm::DrogonDbException& e) {
+        LOG_WARN << "Read replica health check failed: " << e.base().what();
+    }
+
+    if(m_replica_healthy.exchange(healthy, std::memory_order_acq_rel) != healthy && healthy) {
+        LOG_INFO << "Read replica is healthy, routing reads to it";
+    }
+}
+
+} // namespace server
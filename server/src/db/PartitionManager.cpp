@@ -0,0 +1,138 @@
+#include <server/db/PartitionManager.h>
+#include <server/utils/switch_to_io_loop.h>
+#include <format>
+
+namespace server {
+
+// Every attached range partition of messages with its upper bound, parsed out of
+// "FOR VALUES FROM (...) TO ('...')". The default partition has no bound and is skipped.
+static constexpr auto LIST_PARTITIONS_SQL =
+    "SELECT c.relname AS name, "
+    "(regexp_match(pg_get_expr(c.relpartbound, c.oid), 'TO \\(''?(-?[0-9]+)''?\\)'))[1]::bigint AS upper_bound "
+    "FROM pg_inherits i JOIN pg_class c ON c.oid = i.inhrelid "
+    "WHERE i.inhparent = 'messages'::regclass "
+    "AND pg_get_expr(c.relpartbound, c.oid) <> 'DEFAULT'";
+
+struct Partition {
+    std::string name;
+    int64_t upper_bound;
+};
+
+static int64_t toMicros(std::chrono::sys_days day) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(day.time_since_epoch()).count();
+}
+
+static std::chrono::year_month monthOf(int64_t micros) {
+    const auto day = std::chrono::floor<std::chrono::days>(std::chrono::sys_time<std::chrono::microseconds>(std::chrono::microseconds(micros)));
+    const std::chrono::year_month_day ymd{day};
+    return ymd.year() / ymd.month();
+}
+
+static std::string partitionName(std::chrono::year_month month) {
+    return std::format("messages_p{:04}{:02}", static_cast<int>(month.year()), static_cast<unsigned>(month.month()));
+}
+
+PartitionManager& PartitionManager::instance() {
+    static PartitionManager inst;
+    return inst;
+}
+
+void PartitionManager::start(drogon::orm::DbClientPtr db, Policy policy) {
+    m_db = std::move(db);
+    m_policy = policy;
+
+    drogon::app().getLoop()->runEvery(std::chrono::duration<double>(m_policy.check_interval).count(), [this]() {
+        drogon::async_run([this]() { return maintain(); });
+    });
+    drogon::async_run([this]() { return maintain(); });
+}
+
+drogon::Task<> PartitionManager::maintain() {
+    if(m_running.exchange(true)) {
+        co_return;
+    }
+
+    try {
+        std::vector<Partition> partitions;
+        auto rows = co_await switch_to_io_loop(m_db->execSqlCoro(LIST_PARTITIONS_SQL));
+        for(const auto& row : rows) {
+            partitions.push_back({row["name"].as<std::string>(), row["upper_bound"].as<int64_t>()});
+        }
+
+        const auto today = std::chrono::floor<std::chrono::days>(std::chrono::system_clock::now());
+        const std::chrono::year_month_day ymd{today};
+        const auto current_month = ymd.year() / ymd.month();
+
+        // Create monthly partitions from where the existing ranges end. The first
+        // one may start mid-month, right after the legacy partition.
+        int64_t from = 0;
+        for(const auto& p : partitions) {
+            from = std::max(from, p.upper_bound);
+        }
+        const auto horizon = toMicros(std::chrono::sys_days{(current_month + std::chrono::months(m_policy.months_ahead + 1)) / 1});
+        while(from < horizon) {
+            const auto month = monthOf(from);
+            const auto to = toMicros(std::chrono::sys_days{(month + std::chrono::months(1)) / 1});
+            const auto name = partitionName(month);
+            if(auto err = co_await createPartition(name, from, to)) {
+                LOG_ERROR << "Failed to create partition " << name << ": " << *err;
+                break;
+            }
+            LOG_INFO << "Created partition " << name;
+            partitions.push_back({name, to});
+            from = to;
+        }
+
+        if(m_policy.retention_months > 0) {
+            const auto cutoff = toMicros(std::chrono::sys_days{(current_month - std::chrono::months(m_policy.retention_months)) / 1});
+            for(const auto& p : partitions) {
+                if(p.upper_bound > cutoff) {
+                    continue;
+                }
+                co_await switch_to_io_loop(m_db->execSqlCoro(std::format("ALTER TABLE messages DETACH PARTITION {}", p.name)));
+                if(m_policy.retention_action == RetentionAction::Drop) {
+                    co_await switch_to_io_loop(m_db->execSqlCoro(std::format("DROP TABLE {}", p.name)));
+                    LOG_INFO << "Dropped expired partition " << p.name;
+                } else {
+                    LOG_INFO << "Detached expired partition " << p.name;
+                }
+            }
+        }
+    } catch(const drogon::orm::DrogonDbException& e) {
+        LOG_ERROR << "Partition maintenance failed: " << e.base().what();
+    }
+
+    m_running.store(false);
+}
+
+drogon::Task<ScopedTransactionResult> PartitionManager::createPartition(const std::string& name, int64_t from, int64_t to) {
+    const auto create_sql = std::format("CREATE TABLE IF NOT EXISTS {} PARTITION OF messages FOR VALUES FROM ({}) TO ({})", name, from, to);
+
+    auto stray = co_await switch_to_io_loop(m_db->execSqlCoro(
+        "SELECT EXISTS (SELECT 1 FROM messages_default WHERE created_at >= $1 AND created_at < $2) AS stray", from, to));
+    if(!stray.front()["stray"].as<bool>()) {
+        // A row racing into the default partition makes this fail; the next pass moves it
+        co_await switch_to_io_loop(m_db->execSqlCoro(create_sql));
+        co_return std::nullopt;
+    }
+
+    // A new partition cannot be created while the default one holds rows of its range, so the default
+    // one is detached, emptied of them into the new partition and attached again. The transaction
+    // holds messages locked throughout, so inserts wait instead of finding no partition.
+    LOG_WARN << "Moving rows of partition " << name << " out of the default partition";
+    co_return co_await WithTransaction(
+        [&](const auto& tx) -> drogon::Task<ScopedTransactionResult> {
+            co_await switch_to_io_loop(tx->execSqlCoro("ALTER TABLE messages DETACH PARTITION messages_default"));
+            co_await switch_to_io_loop(tx->execSqlCoro(create_sql));
+            // search_vector is generated, so it is left out and computed again on insert
+            co_await switch_to_io_loop(tx->execSqlCoro(
+                "WITH moved AS (DELETE FROM messages_default WHERE created_at >= $1 AND created_at < $2"
+                " RETURNING message_id, room_id, user_id, message_text, created_at)"
+                " INSERT INTO messages (message_id, room_id, user_id, message_text, created_at)"
+                " SELECT message_id, room_id, user_id, message_text, created_at FROM moved", from, to));
+            co_await switch_to_io_loop(tx->execSqlCoro("ALTER TABLE messages ATTACH PARTITION messages_default DEFAULT"));
+            co_return std::nullopt;
+        });
+}
+
+} // namespace server
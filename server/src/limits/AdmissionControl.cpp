@@ -0,0 +1,76 @@
+#include <server/limits/AdmissionControl.h>
+
+namespace server {
+
+// Full buckets are forgotten once there are this many, so the map stays small.
+static constexpr std::size_t MAX_TRACKED_IPS = 65536;
+
+AdmissionControl& AdmissionControl::instance() {
+    static AdmissionControl inst;
+    return inst;
+}
+
+void AdmissionControl::configure(Config config) {
+    std::lock_guard lock(m_mutex);
+    m_config = config;
+}
+
+std::optional<std::chrono::milliseconds> AdmissionControl::takeToken(const std::string& ip) {
+    const auto now = std::chrono::steady_clock::now();
+
+    if(m_buckets.size() >= MAX_TRACKED_IPS) {
+        std::erase_if(m_buckets, [&](const auto& entry) {
+            const std::chrono::duration<double> idle = now - entry.second.updated;
+            return entry.second.tokens + idle.count() * m_config.per_ip_rate >= m_config.per_ip_burst;
+        });
+    }
+
+    auto [it, inserted] = m_buckets.try_emplace(ip, Bucket{m_config.per_ip_burst, now});
+    auto& bucket = it->second;
+    const std::chrono::duration<double> elapsed = now - bucket.updated;
+    bucket.tokens = std::min(m_config.per_ip_burst, bucket.tokens + elapsed.count() * m_config.per_ip_rate);
+    bucket.updated = now;
+
+    if(bucket.tokens >= 1.0) {
+        bucket.tokens -= 1.0;
+        return std::nullopt;
+    }
+    return std::chrono::ceil<std::chrono::milliseconds>(std::chrono::duration<double>((1.0 - bucket.tokens) / m_config.per_ip_rate));
+}
+
+std::optional<std::chrono::milliseconds> AdmissionControl::admit(const drogon::WebSocketConnectionPtr& conn) {
+    std::chrono::seconds timeout;
+    {
+        std::lock_guard lock(m_mutex);
+        if(auto wait = takeToken(conn->peerAddr().toIp())) {
+            return wait;
+        }
+        if(m_handshaking.size() >= m_config.max_handshakes) {
+            return m_config.busy_retry;
+        }
+        m_handshaking.insert(conn);
+        timeout = m_config.handshake_timeout;
+    }
+
+    // A user may sit on the login screen for long, so the connection is kept and only stops
+    // counting against the limit; a slot held by a stuck client must not block others forever
+    drogon::app().getLoop()->runAfter(std::chrono::duration<double>(timeout).count(), [weak = std::weak_ptr(conn)]() {
+        auto conn = weak.lock();
+        if(!conn) {
+            return;
+        }
+        auto& self = instance();
+        std::lock_guard lock(self.m_mutex);
+        if(self.m_handshaking.erase(conn)) {
+            LOG_DEBUG << "Handshake of " << conn->peerAddr().toIpPort() << " timed out, releasing its slot";
+        }
+    });
+    return std::nullopt;
+}
+
+void AdmissionControl::release(const drogon::WebSocketConnectionPtr& conn) {
+    std::lock_guard lock(m_mutex);
+    m_handshaking.erase(conn);
+}
+
+} // namespace server
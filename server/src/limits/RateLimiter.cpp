@@ -0,0 +1,118 @@
+#include <server/limits/RateLimiter.h>
+#include <bit>
+
+namespace server {
+
+static int64_t nowUs() noexcept {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// splitmix64 finalizer, so that sequential ids spread over the table.
+static std::size_t mix(int64_t key) noexcept {
+    auto x = static_cast<uint64_t>(key);
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return static_cast<std::size_t>(x ^ (x >> 31));
+}
+
+RateLimiter::RateLimiter(std::size_t capacity)
+    : m_slots{std::make_unique<Slot[]>(std::bit_ceil(std::max(capacity, MAX_PROBES)))}
+    , m_mask{std::bit_ceil(std::max(capacity, MAX_PROBES)) - 1} {}
+
+void RateLimiter::configure(double rate, double burst) {
+    if(rate <= 0.0) {
+        m_interval = 0;
+        m_tolerance = 0;
+        return;
+    }
+    m_interval = std::max<int64_t>(static_cast<int64_t>(1e6 / rate), 1);
+    m_tolerance = static_cast<int64_t>((std::max(burst, 1.0) - 1.0) * static_cast<double>(m_interval));
+}
+
+RateLimiter::Slot* RateLimiter::find(int64_t key, int64_t now) noexcept {
+    const std::size_t home = mix(key);
+    Slot* expired = nullptr;
+    int64_t expired_key = EMPTY_KEY;
+
+    // Slots never become empty again, so a key cannot sit past the first empty slot
+    // of its probe sequence. Expired slots are only taken over once the whole
+    // sequence has been searched, so a live bucket is not duplicated.
+    for(std::size_t i = 0; i < MAX_PROBES; ++i) {
+        Slot& slot = m_slots[(home + i) & m_mask];
+        int64_t current = slot.key.load(std::memory_order_acquire);
+        if(current == key) {
+            return &slot;
+        }
+        if(current == EMPTY_KEY) {
+            if(slot.key.compare_exchange_strong(current, key, std::memory_order_acq_rel) || current == key) {
+                return &slot;
+            }
+            continue;
+        }
+        if(!expired && slot.tat.load(std::memory_order_relaxed) <= now) {
+            expired = &slot;
+            expired_key = current;
+        }
+    }
+
+    // An expired TAT means a full bucket, exactly what a new key starts with.
+    if(expired && (expired->key.compare_exchange_strong(expired_key, key, std::memory_order_acq_rel) || expired_key == key)) {
+        return expired;
+    }
+    return nullptr;
+}
+
+std::optional<std::chrono::microseconds> RateLimiter::acquire(int64_t key) noexcept {
+    if(m_interval == 0) {
+        return std::nullopt;
+    }
+    const int64_t now = nowUs();
+    Slot* slot = find(key, now);
+    if(!slot) {
+        return std::nullopt;
+    }
+
+    int64_t tat = slot->tat.load(std::memory_order_relaxed);
+    while(true) {
+        const int64_t start = std::max(tat, now);
+        if(start - now > m_tolerance) {
+            return std::chrono::microseconds(start - now - m_tolerance);
+        }
+        if(slot->tat.compare_exchange_weak(tat, start + m_interval, std::memory_order_relaxed)) {
+            return std::nullopt;
+        }
+    }
+}
+
+std::optional<std::chrono::microseconds> RateLimiter::peek(int64_t key) noexcept {
+    if(m_interval == 0) {
+        return std::nullopt;
+    }
+    const int64_t now = nowUs();
+    Slot* slot = find(key, now);
+    if(!slot) {
+        return std::nullopt;
+    }
+    const int64_t start = std::max(slot->tat.load(std::memory_order_relaxed), now);
+    if(start - now > m_tolerance) {
+        return std::chrono::microseconds(start - now - m_tolerance);
+    }
+    return std::nullopt;
+}
+
+void RateLimiter::refund(int64_t key) noexcept {
+    if(m_interval == 0) {
+        return;
+    }
+    const int64_t now = nowUs();
+    Slot* slot = find(key, now);
+    if(!slot) {
+        return;
+    }
+    // Past TATs all mean a full bucket, so a refund never has to go below the current time
+    int64_t tat = slot->tat.load(std::memory_order_relaxed);
+    while(tat > now && !slot->tat.compare_exchange_weak(tat, std::max(tat - m_interval, now), std::memory_order_relaxed)) {
+    }
+}
+
+} // namespace server
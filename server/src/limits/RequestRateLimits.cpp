@@ -0,0 +1,56 @@
+#include <server/limits/RequestRateLimits.h>
+
+namespace server {
+
+RequestRateLimits& RequestRateLimits::instance() {
+    static RequestRateLimits inst;
+    return inst;
+}
+
+void RequestRateLimits::configure(const Config& config) {
+    m_user_messages.configure(config.user_messages_per_sec, config.user_messages_burst);
+    m_room_messages.configure(config.room_messages_per_sec, config.room_messages_burst);
+    m_user_typing.configure(config.user_typing_per_sec, config.user_typing_burst);
+}
+
+std::optional<std::chrono::milliseconds> RequestRateLimits::check(const WsData& data, chat::Envelope::PayloadCase request) noexcept {
+    if(data.status != USER_STATUS::Authenticated || !data.user || !data.room) {
+        return std::nullopt;
+    }
+
+    std::optional<std::chrono::microseconds> wait;
+    switch(request) {
+        case chat::Envelope::kSendMessageRequest: {
+            // A message rejected by one limit must not use up a token of the other
+            auto user_wait = m_user_messages.peek(data.user->id);
+            auto room_wait = m_room_messages.peek(data.room->id);
+            if(user_wait || room_wait) {
+                wait = std::max(user_wait.value_or(std::chrono::microseconds{0}), room_wait.value_or(std::chrono::microseconds{0}));
+                break;
+            }
+            wait = m_user_messages.acquire(data.user->id);
+            if(!wait) {
+                // The room's last token may have gone to another sender since the peek
+                wait = m_room_messages.acquire(data.room->id);
+                if(wait) {
+                    m_user_messages.refund(data.user->id);
+                }
+            }
+            break;
+        }
+        case chat::Envelope::kUserTypingStartRequest: {
+            wait = m_user_typing.acquire(data.user->id);
+            break;
+        }
+        default: {
+            break;
+        }
+    }
+
+    if(!wait) {
+        return std::nullopt;
+    }
+    return std::chrono::ceil<std::chrono::milliseconds>(*wait);
+}
+
+} // namespace server
@@ -1,7 +1,21 @@
 
 #include <server/controller/WsController.h>
 #include <server/db/migrations.h>
+#include <server/db/DbRouter.h>
+#include <server/db/PartitionManager.h>
+#include <server/archive/MessageArchive.h>
+#include <server/attachments/AttachmentStore.h>
+#include <server/auth/SessionTokens.h>
 #include <server/aggregator/WsClient.h>
+#include <server/chat/ChatRoomManager.h>
+#include <server/chat/PgEventBus.h>
+#include <server/chat/UnreadTracker.h>
+#include <server/metrics/LoadMetrics.h>
+#include <server/limits/AdmissionControl.h>
+#include <server/limits/RequestRateLimits.h>
+#include <server/utils/worker_pool.h>
+#include <server/storage/MessageLog.h>
+#include <common/utils/capture.h>
 
 int main() {
     server::WsClient aggregator_client{};
@@ -42,6 +56,117 @@ int main() {
             drogon::app().quit();
         }
 
+        const auto& bus_config = drogon::app().getCustomConfig()["event_bus"];
+        const auto bus_backend = bus_config.get("backend", "none").asString();
+        if(bus_backend == "postgres") {
+            server::ChatRoomManager::instance().setEventBus(
+                std::make_shared<server::PgEventBus>(dbClient, bus_config.get("channel", "chat_events").asString()));
+        } else if(bus_backend != "none") {
+            LOG_ERROR << "Unknown event bus backend '" << bus_backend << "', running as a single process.";
+        }
+
+        const auto& partitions_config = drogon::app().getCustomConfig()["partitions"];
+        const auto retention_action = partitions_config.get("retention_action", "detach").asString();
+        if(retention_action != "detach" && retention_action != "drop") {
+            LOG_ERROR << "Unknown partition retention action '" << retention_action << "', detaching instead.";
+        }
+        server::PartitionManager::instance().start(dbClient, {
+            .months_ahead = std::max(partitions_config.get("months_ahead", 3).asInt(), 1),
+            .retention_months = std::max(partitions_config.get("retention_months", 0).asInt(), 0),
+            .retention_action = retention_action == "drop" ? server::PartitionManager::RetentionAction::Drop
+                                                           : server::PartitionManager::RetentionAction::Detach,
+            .check_interval = std::chrono::seconds(std::max(partitions_config.get("check_interval_sec", 3600).asUInt(), 60u)),
+        });
+
+        const auto& room_events_config = drogon::app().getCustomConfig()["room_events"];
+        server::ChatRoomManager::instance().setEventLogSize(std::max(room_events_config.get("log_size", 1024).asUInt(), 1u));
+        server::ChatRoomManager::instance().startEventLogEviction(
+            std::chrono::seconds(std::max(room_events_config.get("idle_ttl_sec", 600).asUInt(), 10u)));
+
+        // Read markers refer to the stored messages, which the in-memory backend keeps out of PostgreSQL
+        if(drogon::app().getCustomConfig()["storage"].get("backend", "postgres").asString() == "memory") {
+            LOG_INFO << "Unread counts are not tracked with the in-memory storage backend";
+        } else {
+            const auto flush_ms = drogon::app().getCustomConfig()["unread"].get("flush_interval_ms", 2000).asUInt();
+            server::UnreadTracker::instance().start(dbClient, std::chrono::milliseconds(std::max(flush_ms, 100u)));
+        }
+
+        const auto& sessions_config = drogon::app().getCustomConfig()["sessions"];
+        server::SessionTokens::instance().configure(
+            sessions_config.get("key_file", "session.key").asString(),
+            std::chrono::hours(std::max(sessions_config.get("ttl_hours", 168).asInt(), 1)));
+
+        const auto& archive_config = drogon::app().getCustomConfig()["archive"];
+        server::MessageArchive::instance().start(dbClient, {
+            .dir = archive_config.get("dir", "archive").asString(),
+            .max_age = std::chrono::days(std::max(archive_config.get("max_age_days", 365).asInt(), 1)),
+            .interval = std::chrono::seconds(std::max(archive_config.get("interval_sec", 86400).asUInt(), 60u)),
+            .cache_blocks = archive_config.get("cache_blocks", 256).asUInt(),
+            .archiving = archive_config.get("enabled", false).asBool(),
+        });
+
+        const auto& attachments_config = drogon::app().getCustomConfig()["attachments"];
+        server::AttachmentStore::instance().start(dbClient, {
+            .dir = attachments_config.get("dir", "attachments").asString(),
+            .max_file_size = std::max<int64_t>(attachments_config.get("max_file_size_mb", 25).asInt64(), 1) * 1024 * 1024,
+            .max_chunk_size = std::max(attachments_config.get("max_chunk_kb", 512).asUInt(), 16u) * 1024,
+            .max_open_uploads = std::max(attachments_config.get("max_open_uploads", 8).asInt(), 1),
+            .upload_ttl = std::chrono::seconds(std::max(attachments_config.get("upload_ttl_sec", 3600).asUInt(), 60u)),
+        });
+
+        server::WorkerPool::instance().start(drogon::app().getCustomConfig()["worker_pool"].get("threads", 0).asUInt());
+
+        const auto& wal_config = drogon::app().getCustomConfig()["wal"];
+        if(wal_config.get("enabled", false).asBool()) {
+            server::MessageLog::instance().start(dbClient, {
+                .dir = wal_config.get("dir", "wal").asString(),
+                .sync_interval = std::chrono::milliseconds(std::max(wal_config.get("sync_interval_ms", 5).asUInt(), 1u)),
+                .flush_interval = std::chrono::milliseconds(std::max(wal_config.get("flush_interval_ms", 50).asUInt(), 1u)),
+                .segment_size = std::max<std::size_t>(wal_config.get("segment_mb", 64).asUInt(), 1) * 1024 * 1024,
+                .reserve_ids = std::max(wal_config.get("reserve_ids", 1000).asInt(), 1),
+            });
+        }
+
+        const auto& replica_config = drogon::app().getCustomConfig()["read_replica"];
+        const auto replica_name = replica_config.get("client", "").asString();
+        drogon::orm::DbClientPtr replica;
+        if(!replica_name.empty()) {
+            replica = drogon::app().getDbClient(replica_name);
+            if(!replica) {
+                LOG_ERROR << "Read replica db client '" << replica_name << "' is not configured in db_clients.";
+            }
+        }
+        server::DbRouter::instance().start(dbClient, replica,
+            std::chrono::milliseconds(replica_config.get("max_lag_ms", 5000).asUInt()),
+            std::chrono::milliseconds(std::max(replica_config.get("check_interval_ms", 1000).asUInt(), 100u)));
+
+        const auto& admission_config = drogon::app().getCustomConfig()["admission"];
+        server::AdmissionControl::instance().configure({
+            .max_handshakes = std::max(admission_config.get("max_handshakes", 256).asUInt(), 1u),
+            .handshake_timeout = std::chrono::seconds(std::max(admission_config.get("handshake_timeout_sec", 30).asUInt(), 1u)),
+            .per_ip_rate = std::max(admission_config.get("per_ip_rate", 2.0).asDouble(), 0.01),
+            .per_ip_burst = std::max(admission_config.get("per_ip_burst", 10.0).asDouble(), 1.0),
+            .busy_retry = std::chrono::milliseconds(std::max(admission_config.get("busy_retry_ms", 1000).asUInt(), 100u)),
+        });
+
+        const auto& rate_config = drogon::app().getCustomConfig()["rate_limits"];
+        server::RequestRateLimits::instance().configure({
+            .user_messages_per_sec = rate_config.get("user_messages_per_sec", 2.0).asDouble(),
+            .user_messages_burst = rate_config.get("user_messages_burst", 10.0).asDouble(),
+            .room_messages_per_sec = rate_config.get("room_messages_per_sec", 50.0).asDouble(),
+            .room_messages_burst = rate_config.get("room_messages_burst", 200.0).asDouble(),
+            .user_typing_per_sec = rate_config.get("user_typing_per_sec", 1.0).asDouble(),
+            .user_typing_burst = rate_config.get("user_typing_burst", 5.0).asDouble(),
+        });
+
+        const auto capture_file = drogon::app().getCustomConfig()["capture"].get("file", "").asString();
+        if(!capture_file.empty()) {
+            common::EnvelopeCapture::instance().open(capture_file);
+        }
+
+        const auto window_sec = drogon::app().getCustomConfig()["metrics"].get("window_sec", 5).asUInt();
+        server::LoadMetrics::instance().start(std::chrono::seconds(std::max(window_sec, 1u)));
+
         aggregator_client.start(common::getEnvVar("AGGREGATOR_ADDR"));
     });
 
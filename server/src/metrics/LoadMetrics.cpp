@@ -0,0 +1,90 @@
+#include <server/metrics/LoadMetrics.h>
+#include <server/chat/ChatRoomManager.h>
+#include <bit>
+
+namespace server {
+
+// How often each IO loop is probed for lag.
+static constexpr auto LAG_PROBE_INTERVAL = std::chrono::milliseconds(100);
+
+LoadMetrics& LoadMetrics::instance() {
+    static LoadMetrics inst;
+    return inst;
+}
+
+void LoadMetrics::start(std::chrono::milliseconds window) {
+    m_window = window;
+
+    for(size_t i = 0; i < drogon::app().getThreadNum(); ++i) {
+        auto* loop = drogon::app().getIOLoop(i);
+        // Only ever touched from `loop`, so it needs no synchronization.
+        auto last_tick = std::make_shared<std::chrono::steady_clock::time_point>(std::chrono::steady_clock::now());
+        loop->runEvery(std::chrono::duration<double>(LAG_PROBE_INTERVAL).count(), [this, last_tick]() {
+            const auto now = std::chrono::steady_clock::now();
+            const auto lag = now - *last_tick - LAG_PROBE_INTERVAL;
+            *last_tick = now;
+            recordLoopLag(std::chrono::duration_cast<std::chrono::microseconds>(std::max(lag, decltype(lag)::zero())));
+        });
+    }
+
+    drogon::app().getLoop()->runEvery(std::chrono::duration<double>(m_window).count(), [this]() {
+        rollWindow();
+    });
+}
+
+void LoadMetrics::connectionOpened() noexcept {
+    m_connections.fetch_add(1, std::memory_order_relaxed);
+}
+
+void LoadMetrics::connectionClosed() noexcept {
+    m_connections.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void LoadMetrics::recordHandlerLatency(std::chrono::microseconds latency) noexcept {
+    const auto us = static_cast<uint64_t>(std::max<int64_t>(latency.count(), 1));
+    const auto bucket = std::min<std::size_t>(std::bit_width(us) - 1, LATENCY_BUCKETS - 1);
+    m_latency_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+void LoadMetrics::recordLoopLag(std::chrono::microseconds lag) noexcept {
+    int64_t current = m_max_lag_us.load(std::memory_order_relaxed);
+    while(lag.count() > current && !m_max_lag_us.compare_exchange_weak(current, lag.count(), std::memory_order_relaxed)) {}
+}
+
+void LoadMetrics::rollWindow() {
+    std::array<uint64_t, LATENCY_BUCKETS> counts{};
+    uint64_t total = 0;
+    for(std::size_t i = 0; i < LATENCY_BUCKETS; ++i) {
+        counts[i] = m_latency_buckets[i].exchange(0, std::memory_order_relaxed);
+        total += counts[i];
+    }
+
+    double p99_ms = 0.0;
+    if(total > 0) {
+        // The smallest bucket whose cumulative count reaches 99% of the samples;
+        // report its upper bound.
+        const uint64_t rank = (total * 99 + 99) / 100;
+        uint64_t cumulative = 0;
+        for(std::size_t i = 0; i < LATENCY_BUCKETS; ++i) {
+            cumulative += counts[i];
+            if(cumulative >= rank) {
+                p99_ms = static_cast<double>(uint64_t{1} << (i + 1)) / 1000.0;
+                break;
+            }
+        }
+    }
+
+    m_last_p99_ms.store(p99_ms, std::memory_order_relaxed);
+    m_last_lag_ms.store(static_cast<double>(m_max_lag_us.exchange(0, std::memory_order_relaxed)) / 1000.0, std::memory_order_relaxed);
+}
+
+drogon::Task<chat::ServerLoad> LoadMetrics::currentLoad() const {
+    chat::ServerLoad load;
+    load.set_connections(m_connections.load(std::memory_order_relaxed));
+    load.set_active_rooms(static_cast<int32_t>(co_await ChatRoomManager::instance().getActiveRoomCount()));
+    load.set_loop_lag_ms(m_last_lag_ms.load(std::memory_order_relaxed));
+    load.set_p99_handler_latency_ms(m_last_p99_ms.load(std::memory_order_relaxed));
+    co_return load;
+}
+
+} // namespace server
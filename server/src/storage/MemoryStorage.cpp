@@ -0,0 +1,421 @@
+#include <server/storage/MemoryStorage.h>
+#include <algorithm>
+#include <cctype>
+
+namespace server {
+
+static int64_t nowMicros() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static bool containsIgnoringCase(std::string_view text, std::string_view query) {
+    auto lower_equal = [](char a, char b) {
+        return std::tolower(static_cast<unsigned char>(a)) == std::tolower(static_cast<unsigned char>(b));
+    };
+    return !std::ranges::search(text, query, lower_equal).empty();
+}
+
+// ---- Users ----
+
+drogon::Task<std::optional<UserRecord>> MemoryStorage::findUserByName(std::string name, [[maybe_unused]] bool may_be_stale) {
+    std::shared_lock lock(m_users_mutex);
+    auto it = m_user_ids.find(name);
+    if(it == m_user_ids.end()) {
+        co_return std::nullopt;
+    }
+    co_return m_users.at(it->second);
+}
+
+drogon::Task<std::optional<UserRecord>> MemoryStorage::findUserById(int32_t user_id) {
+    std::shared_lock lock(m_users_mutex);
+    auto it = m_users.find(user_id);
+    if(it == m_users.end()) {
+        co_return std::nullopt;
+    }
+    co_return it->second;
+}
+
+drogon::Task<ScopedTransactionResult> MemoryStorage::createUser(std::string name, std::string hash, std::string salt) {
+    std::unique_lock lock(m_users_mutex);
+    if(m_user_ids.contains(name)) {
+        co_return "Username already exists.";
+    }
+    const int32_t user_id = m_next_user_id++;
+    m_user_ids.emplace(name, user_id);
+    m_users.emplace(user_id, UserRecord{
+        .id = user_id,
+        .name = std::move(name),
+        .hash_password = std::move(hash),
+        .salt = std::move(salt),
+    });
+    co_return std::nullopt;
+}
+
+drogon::Task<ScopedTransactionResult> MemoryStorage::setPassword(int32_t user_id, std::string hash, std::string salt) {
+    std::unique_lock lock(m_users_mutex);
+    auto it = m_users.find(user_id);
+    if(it == m_users.end()) {
+        co_return "Database error during user update.";
+    }
+    it->second.hash_password = std::move(hash);
+    it->second.salt = std::move(salt);
+    co_return std::nullopt;
+}
+
+drogon::Task<ScopedTransactionResult> MemoryStorage::changePassword(int32_t user_id, std::string old_hash, std::string new_hash, std::string new_salt) {
+    std::unique_lock lock(m_users_mutex);
+    auto it = m_users.find(user_id);
+    if(it == m_users.end()) {
+        co_return "Current user not found in database.";
+    }
+    if(it->second.salt.empty()) {
+        co_return "Cannot change password for a non-migrated account.";
+    }
+    if(it->second.hash_password != old_hash) {
+        co_return "Incorrect old password.";
+    }
+    it->second.hash_password = std::move(new_hash);
+    it->second.salt = std::move(new_salt);
+    co_return std::nullopt;
+}
+
+drogon::Task<ScopedTransactionResult> MemoryStorage::renameUser(int32_t user_id, std::string new_name) {
+    std::unique_lock lock(m_users_mutex);
+    if(m_user_ids.contains(new_name)) {
+        co_return "This username is already taken.";
+    }
+    auto it = m_users.find(user_id);
+    if(it == m_users.end()) {
+        co_return "Current user not found in database.";
+    }
+    m_user_ids.erase(it->second.name);
+    m_user_ids.emplace(new_name, user_id);
+    it->second.name = std::move(new_name);
+    co_return std::nullopt;
+}
+
+std::string MemoryStorage::userName(int32_t user_id) const {
+    std::shared_lock lock(m_users_mutex);
+    auto it = m_users.find(user_id);
+    return it == m_users.end() ? std::string() : it->second.name;
+}
+
+// ---- Rooms ----
+
+drogon::Task<IStorage::RoomInfos> MemoryStorage::listRooms(int32_t user_id) {
+    std::vector<chat::RoomInfo> rooms;
+    for(auto& s : m_stripes) {
+        std::shared_lock lock(s.mutex);
+        for(const auto& [room_id, room] : s.rooms) {
+            auto& info = rooms.emplace_back();
+            info.set_room_id(room_id);
+            info.set_room_name(room.record.name);
+            if(auto it = room.members.find(user_id); it != room.members.end()) {
+                info.set_is_joined(it->second == chat::MembershipStatus::JOINED);
+            }
+        }
+    }
+    std::ranges::sort(rooms, {}, &chat::RoomInfo::room_id);
+
+    RoomInfos room_infos;
+    room_infos.Reserve(static_cast<int>(rooms.size()));
+    for(auto& info : rooms) {
+        *room_infos.Add() = std::move(info);
+    }
+    co_return room_infos;
+}
+
+drogon::Task<std::optional<RoomRecord>> MemoryStorage::findRoom(int32_t room_id) {
+    auto& s = stripe(room_id);
+    std::shared_lock lock(s.mutex);
+    auto it = s.rooms.find(room_id);
+    if(it == s.rooms.end()) {
+        co_return std::nullopt;
+    }
+    co_return it->second.record;
+}
+
+drogon::Task<ScopedTransactionResult> MemoryStorage::createRoom(std::string name, int32_t owner_id, int32_t& room_id) {
+    room_id = m_next_room_id.fetch_add(1, std::memory_order_relaxed);
+    auto& s = stripe(room_id);
+    std::unique_lock lock(s.mutex);
+    auto& room = s.rooms[room_id];
+    room.record = RoomRecord{.id = room_id, .name = std::move(name), .owner_id = owner_id};
+    // Like the `room_membership` default, the owner starts out invited
+    room.members.emplace(owner_id, chat::MembershipStatus::INVITED);
+    co_return std::nullopt;
+}
+
+drogon::Task<ScopedTransactionResult> MemoryStorage::renameRoom(int32_t room_id, std::string name) {
+    auto& s = stripe(room_id);
+    std::unique_lock lock(s.mutex);
+    auto it = s.rooms.find(room_id);
+    if(it == s.rooms.end()) {
+        co_return "Room not found.";
+    }
+    it->second.record.name = std::move(name);
+    co_return std::nullopt;
+}
+
+drogon::Task<ScopedTransactionResult> MemoryStorage::deleteRoom(int32_t room_id) {
+    auto& s = stripe(room_id);
+    std::unique_lock lock(s.mutex);
+    if(s.rooms.erase(room_id) == 0) {
+        co_return "Room could not be deleted as it was not found.";
+    }
+    co_return std::nullopt;
+}
+
+// ---- Membership and roles ----
+
+drogon::Task<std::optional<chat::MembershipStatus>> MemoryStorage::membershipStatus(int32_t user_id, int32_t room_id) {
+    auto& s = stripe(room_id);
+    std::shared_lock lock(s.mutex);
+    auto room = s.rooms.find(room_id);
+    if(room == s.rooms.end()) {
+        co_return std::nullopt;
+    }
+    auto it = room->second.members.find(user_id);
+    if(it == room->second.members.end()) {
+        co_return std::nullopt;
+    }
+    co_return it->second;
+}
+
+drogon::Task<ScopedTransactionResult> MemoryStorage::setMembershipStatus(int32_t user_id, int32_t room_id, chat::MembershipStatus status) {
+    auto& s = stripe(room_id);
+    std::unique_lock lock(s.mutex);
+    auto room = s.rooms.find(room_id);
+    if(room == s.rooms.end()) {
+        co_return "Database error during membership update.";
+    }
+    room->second.members[user_id] = status;
+    co_return std::nullopt;
+}
+
+std::optional<chat::UserRights> MemoryStorage::rightsIn(const Room& room, int32_t user_id) const {
+    {
+        std::shared_lock lock(m_users_mutex);
+        if(auto it = m_users.find(user_id); it != m_users.end() && it->second.is_admin) {
+            return chat::UserRights::ADMIN;
+        }
+    }
+    if(room.record.owner_id == user_id) {
+        return chat::UserRights::OWNER;
+    }
+    if(room.moderators.contains(user_id)) {
+        return chat::UserRights::MODERATOR;
+    }
+    return std::nullopt;
+}
+
+drogon::Task<std::vector<chat::UserInfo>> MemoryStorage::roomMembers(int32_t room_id) {
+    std::vector<chat::UserInfo> members;
+    auto& s = stripe(room_id);
+    std::shared_lock lock(s.mutex);
+    auto room = s.rooms.find(room_id);
+    if(room == s.rooms.end()) {
+        co_return members;
+    }
+    members.reserve(room->second.members.size());
+    for(const auto& [user_id, status] : room->second.members) {
+        auto name = userName(user_id);
+        if(name.empty()) {
+            continue;
+        }
+        auto& user_info = members.emplace_back();
+        user_info.set_user_id(user_id);
+        user_info.set_user_name(std::move(name));
+        if(auto rights = rightsIn(room->second, user_id)) {
+            user_info.set_user_room_rights(*rights);
+        }
+    }
+    co_return members;
+}
+
+drogon::Task<std::vector<int32_t>> MemoryStorage::memberRooms(int32_t user_id) {
+    std::vector<int32_t> rooms;
+    for(auto& s : m_stripes) {
+        std::shared_lock lock(s.mutex);
+        for(const auto& [room_id, room] : s.rooms) {
+            if(room.members.contains(user_id)) {
+                rooms.push_back(room_id);
+            }
+        }
+    }
+    co_return rooms;
+}
+
+drogon::Task<std::optional<chat::UserRights>> MemoryStorage::userRights(int32_t user_id, int32_t room_id) {
+    auto& s = stripe(room_id);
+    std::shared_lock lock(s.mutex);
+    auto room = s.rooms.find(room_id);
+    if(room == s.rooms.end()) {
+        co_return std::nullopt;
+    }
+    co_return rightsIn(room->second, user_id);
+}
+
+drogon::Task<ScopedTransactionResult> MemoryStorage::assignRole(int32_t user_id, int32_t room_id, chat::UserRights new_role, RoleCheck check, RoleChange& change) {
+    auto& s = stripe(room_id);
+    std::unique_lock lock(s.mutex);
+    auto it = s.rooms.find(room_id);
+    if(it == s.rooms.end()) {
+        co_return "Room not found.";
+    }
+    auto& room = it->second;
+    if(auto err = check(rightsIn(room, user_id).value_or(chat::UserRights::REGULAR))) {
+        co_return err;
+    }
+
+    if(new_role == chat::UserRights::OWNER) {
+        const int32_t old_owner_id = room.record.owner_id;
+        room.record.owner_id = user_id;
+        if(old_owner_id) {
+            change.old_owner_id = old_owner_id;
+            change.old_owner_rights = rightsIn(room, old_owner_id);
+            if(!change.old_owner_rights || *change.old_owner_rights < chat::UserRights::MODERATOR) {
+                change.old_owner_rights = chat::UserRights::MODERATOR;
+                room.moderators.insert(old_owner_id);
+            }
+        }
+        co_return std::nullopt;
+    }
+    if(new_role != chat::UserRights::REGULAR && new_role != chat::UserRights::MODERATOR) {
+        co_return "For now this function can only toggle moderator status";
+    }
+    if(new_role == chat::UserRights::MODERATOR) {
+        room.moderators.insert(user_id);
+    } else {
+        room.moderators.erase(user_id);
+    }
+    co_return std::nullopt;
+}
+
+// ---- Messages ----
+
+drogon::Task<ScopedTransactionResult> MemoryStorage::insertMessage(int32_t room_id, int32_t user_id, std::string text,
+                                                                  std::vector<int32_t> attachment_ids, chat::MessageInfo& message) {
+    if(!attachment_ids.empty()) {
+        co_return "Unknown attachment.";
+    }
+    auto& s = stripe(room_id);
+    std::unique_lock lock(s.mutex);
+    auto it = s.rooms.find(room_id);
+    if(it == s.rooms.end()) {
+        co_return "Database error during message insertion.";
+    }
+    auto& messages = it->second.messages;
+    // Pages are cut by timestamp, so timestamps within a room must be unique and increasing
+    const int64_t created_at = messages.empty() ? nowMicros() : std::max(nowMicros(), messages.back().created_at + 1);
+    const int32_t message_id = m_next_message_id.fetch_add(1, std::memory_order_relaxed);
+    messages.push_back(StoredMessage{.message_id = message_id, .created_at = created_at, .user_id = user_id, .text = std::move(text)});
+
+    message.set_message_id(message_id);
+    message.set_timestamp(created_at);
+    co_return std::nullopt;
+}
+
+drogon::Task<void> MemoryStorage::readMessages(int32_t room_id, int64_t offset_ts, int32_t limit, bool older, Messages& out) {
+    auto& s = stripe(room_id);
+    std::shared_lock lock(s.mutex);
+    auto room = s.rooms.find(room_id);
+    if(room == s.rooms.end() || limit <= 0) {
+        co_return;
+    }
+    const auto& messages = room->second.messages;
+    auto add = [&](const StoredMessage& stored) {
+        auto* message_info = out.Add();
+        message_info->set_message_id(stored.message_id);
+        message_info->set_timestamp(stored.created_at);
+        message_info->set_message(stored.text);
+        message_info->mutable_from()->set_user_id(stored.user_id);
+        message_info->mutable_from()->set_user_name(userName(stored.user_id));
+    };
+    if(older) {
+        auto end = std::ranges::lower_bound(messages, offset_ts, {}, &StoredMessage::created_at);
+        for(int32_t n = 0; end != messages.begin() && n < limit; ++n) {
+            add(*--end);
+        }
+    } else {
+        auto begin = std::ranges::upper_bound(messages, offset_ts, {}, &StoredMessage::created_at);
+        for(int32_t n = 0; begin != messages.end() && n < limit; ++n) {
+            add(*begin++);
+        }
+    }
+}
+
+drogon::Task<ScopedTransactionResult> MemoryStorage::deleteMessage(int32_t room_id, int32_t message_id) {
+    auto& s = stripe(room_id);
+    std::unique_lock lock(s.mutex);
+    auto room = s.rooms.find(room_id);
+    if(room == s.rooms.end()) {
+        co_return "Message not found or does not belong to this room.";
+    }
+    auto& messages = room->second.messages;
+    auto it = std::ranges::lower_bound(messages, message_id, {}, &StoredMessage::message_id);
+    if(it == messages.end() || it->message_id != message_id) {
+        co_return "Message not found or does not belong to this room.";
+    }
+    messages.erase(it);
+    co_return std::nullopt;
+}
+
+drogon::Task<void> MemoryStorage::loadAttachments([[maybe_unused]] const std::vector<chat::MessageInfo*>& messages) {
+    co_return;
+}
+
+drogon::Task<void> MemoryStorage::searchMessages(int32_t user_id, const chat::SearchMessagesRequest& req, int32_t limit, int32_t offset,
+                                                 chat::SearchMessagesResponse& resp) {
+    struct Match {
+        int32_t room_id;
+        StoredMessage message;
+    };
+    std::vector<Match> matches;
+    for(auto& s : m_stripes) {
+        std::shared_lock lock(s.mutex);
+        for(const auto& [room_id, room] : s.rooms) {
+            if(req.has_room_id() && req.room_id() != room_id) {
+                continue;
+            }
+            if(room.record.is_private) {
+                auto member = room.members.find(user_id);
+                if(member == room.members.end() || member->second != chat::MembershipStatus::JOINED) {
+                    continue;
+                }
+            }
+            for(const auto& message : room.messages) {
+                if((req.has_author_id() && message.user_id != req.author_id())
+                    || (req.has_from_ts() && message.created_at < req.from_ts())
+                    || (req.has_to_ts() && message.created_at >= req.to_ts())
+                    || !containsIgnoringCase(message.text, req.query())) {
+                    continue;
+                }
+                matches.push_back(Match{room_id, message});
+            }
+        }
+    }
+
+    // Every match ranks the same, so the newest come first
+    std::ranges::sort(matches, std::ranges::greater{}, [](const Match& match) { return match.message.created_at; });
+    matches.resize(std::min<std::size_t>(matches.size(), SEARCH_RANK_CANDIDATES));
+    for(std::size_t i = static_cast<std::size_t>(offset); i < matches.size(); ++i) {
+        if(resp.hits_size() == limit) {
+            resp.set_has_more(true);
+            break;
+        }
+        const auto& match = matches[i];
+        auto* hit = resp.add_hits();
+        hit->set_room_id(match.room_id);
+        hit->set_rank(1.0);
+        auto* message_info = hit->mutable_message();
+        message_info->set_message_id(match.message.message_id);
+        message_info->set_message(match.message.text);
+        message_info->set_timestamp(match.message.created_at);
+        message_info->mutable_from()->set_user_id(match.message.user_id);
+        message_info->mutable_from()->set_user_name(userName(match.message.user_id));
+    }
+    co_return;
+}
+
+} // namespace server
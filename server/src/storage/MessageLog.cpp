@@ -0,0 +1,439 @@
+#include <server/storage/MessageLog.h>
+#include <server/utils/switch_to_io_loop.h>
+#include <server/utils/pg_array.h>
+#include <server/utils/file_sync.h>
+#include <array>
+#include <cstdio>
+
+namespace server {
+
+namespace {
+
+/// @brief The CRC-32 (IEEE) of a record payload.
+uint32_t crc32(std::string_view data) {
+    static const auto table = [] {
+        std::array<uint32_t, 256> t{};
+        for(uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for(int k = 0; k < 8; ++k) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            t[i] = c;
+        }
+        return t;
+    }();
+    uint32_t crc = 0xFFFFFFFFu;
+    for(unsigned char byte : data) {
+        crc = table[(crc ^ byte) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+void putUint32(std::string& out, uint32_t value) {
+    for(int i = 0; i < 4; ++i) {
+        out += static_cast<char>((value >> (8 * i)) & 0xFF);
+    }
+}
+
+uint32_t getUint32(const char* in) {
+    uint32_t value = 0;
+    for(int i = 0; i < 4; ++i) {
+        value |= static_cast<uint32_t>(static_cast<unsigned char>(in[i])) << (8 * i);
+    }
+    return value;
+}
+
+/// @brief Whether an SQLSTATE rejects the data itself (classes 22 and 23), so retrying it cannot help.
+bool isDataError(std::string_view sql_state) {
+    return sql_state.starts_with("22") || sql_state.starts_with("23");
+}
+
+int64_t nowMicros() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+} // namespace
+
+MessageLog& MessageLog::instance() {
+    static MessageLog inst;
+    return inst;
+}
+
+MessageLog::~MessageLog() {
+    if(m_sync_thread.joinable()) {
+        m_sync_thread.request_stop();
+        m_sync_thread.join();
+    }
+    for(auto* file : m_retired) {
+        std::fclose(file);
+    }
+    if(m_file) {
+        std::fclose(m_file);
+    }
+}
+
+std::filesystem::path MessageLog::segmentPath(uint32_t segment) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "wal-%08u.log", segment);
+    return m_config.dir / name;
+}
+
+bool MessageLog::start(drogon::orm::DbClientPtr db, Config config) {
+    m_db = std::move(db);
+    m_config = std::move(config);
+
+    std::error_code ec;
+    std::filesystem::create_directories(m_config.dir, ec);
+    if(ec) {
+        LOG_ERROR << "Cannot create write-ahead log directory " << m_config.dir << ": " << ec.message() << ". Messages are stored directly.";
+        return false;
+    }
+
+    // Segments are numbered in write order, so replaying them in order keeps the messages in order
+    std::vector<uint32_t> segments;
+    for(const auto& entry : std::filesystem::directory_iterator(m_config.dir, ec)) {
+        unsigned segment = 0;
+        const auto name = entry.path().filename().string();
+        if(std::sscanf(name.c_str(), "wal-%08u.log", &segment) == 1 && segment > 0) {
+            segments.push_back(segment);
+        }
+    }
+    std::ranges::sort(segments);
+    for(auto segment : segments) {
+        replaySegment(segment);
+    }
+    if(!segments.empty()) {
+        m_first_segment = segments.front();
+        LOG_INFO << "Replaying " << m_pending.size() << " messages from " << segments.size() << " write-ahead log segments";
+    }
+
+    {
+        std::lock_guard lock(m_mutex);
+        if(!openSegment(segments.empty() ? 1 : segments.back() + 1)) {
+            return false;
+        }
+        if(segments.empty()) {
+            m_first_segment = m_segment;
+        }
+    }
+
+    try {
+        drogon::sync_wait(flush());
+        drogon::sync_wait(reserveIds());
+    } catch(const std::exception& e) {
+        LOG_ERROR << "Write-ahead log startup failed: " << e.what();
+    }
+    if(hasPending()) {
+        LOG_ERROR << "Not all replayed messages could be stored yet; they are retried in the background.";
+    }
+
+    m_sync_thread = std::jthread([this](std::stop_token stop) { syncLoop(std::move(stop)); });
+    drogon::app().getLoop()->runEvery(std::chrono::duration<double>(m_config.flush_interval).count(), [this]() {
+        if(!hasPending() || m_flushing.exchange(true)) {
+            return;
+        }
+        drogon::async_run([this]() -> drogon::Task<> {
+            co_await flush();
+            m_flushing.store(false);
+        });
+    });
+
+    m_running.store(true, std::memory_order_release);
+    LOG_INFO << "Logging sent messages to " << m_config.dir << " before storing them";
+    return true;
+}
+
+void MessageLog::replaySegment(uint32_t segment) {
+    std::ifstream in(segmentPath(segment), std::ios::binary);
+    std::string header(8, '\0');
+    std::string payload;
+    std::size_t records = 0;
+    while(in.read(header.data(), static_cast<std::streamsize>(header.size()))) {
+        const auto size = getUint32(header.data());
+        const auto crc = getUint32(header.data() + 4);
+        payload.resize(size);
+        if(size == 0 || !in.read(payload.data(), size) || crc32(payload) != crc) {
+            LOG_WARN << "Write-ahead log segment " << segment << " ends with a torn record after " << records << " records";
+            break;
+        }
+        chat::WalRecord record;
+        if(!record.ParseFromString(payload)) {
+            LOG_WARN << "Skipping an unreadable record in write-ahead log segment " << segment;
+            continue;
+        }
+        m_last_ts = std::max(m_last_ts, record.message().timestamp());
+        m_pending.push_back(Pending{record.room_id(), segment, std::move(*record.mutable_message())});
+        ++records;
+    }
+}
+
+bool MessageLog::openSegment(uint32_t segment) {
+    auto* file = std::fopen(segmentPath(segment).string().c_str(), "ab");
+    if(!file) {
+        LOG_ERROR << "Cannot open write-ahead log segment " << segmentPath(segment) << ". Messages are stored directly.";
+        return false;
+    }
+    if(m_file) {
+        m_retired.push_back(m_file);
+    }
+    m_file = file;
+    m_segment = segment;
+    m_segment_bytes = 0;
+    return true;
+}
+
+bool MessageLog::append(int32_t room_id, chat::MessageInfo& message) {
+    // Acknowledging a message the flush would reject loses it; stored directly, the sender sees the error
+    if(message.message().find('\0') != std::string::npos) {
+        return false;
+    }
+    bool logged = false;
+    bool reserve = false;
+    {
+        std::lock_guard lock(m_mutex);
+        if(m_ids.empty()) {
+            reserve = true;
+        } else {
+            // Timestamps stay increasing even if the clock steps back, so the log order is the history order
+            m_last_ts = std::max(nowMicros(), m_last_ts + 1);
+            message.set_message_id(m_ids.front());
+            message.set_timestamp(m_last_ts);
+
+            chat::WalRecord record;
+            record.set_room_id(room_id);
+            *record.mutable_message() = message;
+            const auto payload = record.SerializeAsString();
+            std::string buffer;
+            buffer.reserve(payload.size() + 8);
+            putUint32(buffer, static_cast<uint32_t>(payload.size()));
+            putUint32(buffer, crc32(payload));
+            buffer += payload;
+
+            if(m_segment_bytes >= m_config.segment_size) {
+                openSegment(m_segment + 1);
+            }
+            if(std::fwrite(buffer.data(), 1, buffer.size(), m_file) != buffer.size() || std::fflush(m_file) != 0) {
+                LOG_ERROR << "Failed to append to write-ahead log segment " << m_segment;
+                return false;
+            }
+            m_ids.pop_front();
+            m_segment_bytes += buffer.size();
+            m_dirty = true;
+            m_pending.push_back(Pending{room_id, m_segment, message});
+            logged = true;
+            reserve = m_ids.size() < static_cast<std::size_t>(m_config.reserve_ids / 2);
+        }
+    }
+    if(reserve) {
+        drogon::async_run([this]() { return reserveIds(); });
+    }
+    return logged;
+}
+
+std::vector<chat::MessageInfo> MessageLog::pending(int32_t room_id, int64_t offset_ts, bool older) const {
+    std::vector<chat::MessageInfo> out;
+    std::lock_guard lock(m_mutex);
+    for(const auto& entry : m_pending) {
+        const auto ts = entry.message.timestamp();
+        if(entry.room_id == room_id && (older ? ts < offset_ts : ts > offset_ts)) {
+            out.push_back(entry.message);
+        }
+    }
+    return out;
+}
+
+bool MessageLog::hasPending() const {
+    std::lock_guard lock(m_mutex);
+    return !m_pending.empty();
+}
+
+drogon::Task<bool> MessageLog::flush() {
+    int32_t last_id = 0;
+    {
+        std::lock_guard lock(m_mutex);
+        if(m_pending.empty()) {
+            co_return true;
+        }
+        last_id = m_pending.back().message.message_id();
+    }
+    while(true) {
+        {
+            std::lock_guard lock(m_mutex);
+            const bool done = std::ranges::none_of(m_pending, [last_id](const Pending& entry) {
+                return entry.message.message_id() == last_id;
+            });
+            if(done) {
+                co_return true;
+            }
+        }
+        if(!co_await flushBatch()) {
+            co_return false;
+        }
+    }
+}
+
+drogon::Task<> MessageLog::insertRows(const std::vector<Row>& rows) {
+    std::vector<int32_t> message_ids, room_ids, user_ids;
+    std::vector<int64_t> created_at;
+    std::vector<std::string> texts;
+    for(const auto& row : rows) {
+        message_ids.push_back(row.message_id);
+        room_ids.push_back(row.room_id);
+        user_ids.push_back(row.user_id);
+        texts.push_back(row.text);
+        created_at.push_back(row.created_at);
+    }
+    // Ids already present were stored before a crash. Messages of rooms or users deleted in the
+    // meantime have nowhere to go and are dropped instead of failing the batch forever.
+    co_await switch_to_io_loop(m_db->execSqlCoro(
+        "INSERT INTO messages (message_id, room_id, user_id, message_text, created_at)"
+        " SELECT t.message_id, t.room_id, t.user_id, t.message_text, t.created_at"
+        " FROM unnest($1::int[], $2::int[], $3::int[], $4::text[], $5::bigint[])"
+        " AS t(message_id, room_id, user_id, message_text, created_at)"
+        " WHERE EXISTS (SELECT 1 FROM rooms r WHERE r.room_id = t.room_id)"
+        " AND EXISTS (SELECT 1 FROM users u WHERE u.user_id = t.user_id)"
+        " ON CONFLICT DO NOTHING",
+        toPgArray(message_ids), toPgArray(room_ids), toPgArray(user_ids), toPgArray(texts), toPgArray(created_at)));
+}
+
+void MessageLog::quarantine(const Row& row, std::string_view error) {
+    LOG_ERROR << "Message " << row.message_id << " of room " << row.room_id << " cannot be stored and is moved to "
+              << (m_config.dir / QUARANTINE_FILE) << ": " << error;
+    chat::WalRecord record;
+    record.set_room_id(row.room_id);
+    auto* message = record.mutable_message();
+    message->set_message_id(row.message_id);
+    message->mutable_from()->set_user_id(row.user_id);
+    message->set_message(row.text);
+    message->set_timestamp(row.created_at);
+    const auto payload = record.SerializeAsString();
+    std::string buffer;
+    putUint32(buffer, static_cast<uint32_t>(payload.size()));
+    putUint32(buffer, crc32(payload));
+    buffer += payload;
+    std::ofstream out(m_config.dir / QUARANTINE_FILE, std::ios::binary | std::ios::app);
+    if(!out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()))) {
+        LOG_ERROR << "Failed to write message " << row.message_id << " to the quarantine file; it is lost";
+    }
+}
+
+drogon::Task<bool> MessageLog::flushBatch() {
+    std::vector<Row> rows;
+    {
+        std::lock_guard lock(m_mutex);
+        const auto count = std::min(m_pending.size(), FLUSH_BATCH);
+        rows.reserve(count);
+        for(std::size_t i = 0; i < count; ++i) {
+            const auto& entry = m_pending[i];
+            rows.push_back(Row{
+                .message_id = entry.message.message_id(),
+                .room_id = entry.room_id,
+                .user_id = entry.message.from().user_id(),
+                .created_at = entry.message.timestamp(),
+                .text = entry.message.message(),
+            });
+        }
+    }
+    if(rows.empty()) {
+        co_return true;
+    }
+
+    bool stored = false;
+    try {
+        co_await insertRows(rows);
+        stored = true;
+    } catch(const drogon::orm::DrogonDbException& e) {
+        LOG_WARN << "Failed to store " << rows.size() << " logged messages, retrying one by one: " << e.base().what();
+    }
+    if(!stored) {
+        // One record the database rejects must not hold back the ones after it: the rows it rejects
+        // for their data are set aside, anything else (the database is down) is retried later
+        for(const auto& row : rows) {
+            try {
+                co_await insertRows({row});
+            } catch(const drogon::orm::DrogonDbException& e) {
+                const auto* sql_error = dynamic_cast<const drogon::orm::SqlError*>(&e.base());
+                if(!sql_error || !isDataError(sql_error->sqlState())) {
+                    LOG_ERROR << "Failed to store logged message " << row.message_id << ": " << e.base().what();
+                    co_return false;
+                }
+                quarantine(row, e.base().what());
+            }
+        }
+    }
+
+    std::vector<std::filesystem::path> removable;
+    {
+        std::lock_guard lock(m_mutex);
+        // A concurrent flush may have stored and removed a prefix of this batch already
+        for(const auto& row : rows) {
+            if(!m_pending.empty() && m_pending.front().message.message_id() == row.message_id) {
+                m_pending.pop_front();
+            }
+        }
+        const auto oldest_needed = m_pending.empty() ? m_segment : m_pending.front().segment;
+        for(; m_first_segment < oldest_needed; ++m_first_segment) {
+            removable.push_back(segmentPath(m_first_segment));
+        }
+    }
+    for(const auto& path : removable) {
+        // A segment that cannot be removed is replayed again on the next start, which is harmless
+        std::error_code ec;
+        std::filesystem::remove(path, ec);
+    }
+    co_return true;
+}
+
+drogon::Task<> MessageLog::reserveIds() {
+    {
+        std::lock_guard lock(m_mutex);
+        if(m_ids.size() >= static_cast<std::size_t>(m_config.reserve_ids / 2)) {
+            co_return;
+        }
+    }
+    if(m_reserving.exchange(true)) {
+        co_return;
+    }
+    try {
+        auto rows = co_await switch_to_io_loop(m_db->execSqlCoro(
+            "SELECT nextval('messages_message_id_seq') AS id FROM generate_series(1, $1)",
+            std::max(m_config.reserve_ids, 1)));
+        std::lock_guard lock(m_mutex);
+        for(const auto& row : rows) {
+            m_ids.push_back(row["id"].as<int32_t>());
+        }
+    } catch(const drogon::orm::DrogonDbException& e) {
+        LOG_ERROR << "Failed to reserve message ids: " << e.base().what();
+    }
+    m_reserving.store(false);
+}
+
+void MessageLog::syncLoop(std::stop_token stop) {
+    while(!stop.stop_requested()) {
+        std::this_thread::sleep_for(m_config.sync_interval);
+
+        std::FILE* current = nullptr;
+        std::vector<std::FILE*> retired;
+        {
+            std::lock_guard lock(m_mutex);
+            if(!m_dirty) {
+                continue;
+            }
+            m_dirty = false;
+            current = m_file;
+            retired.swap(m_retired);
+        }
+        // Only this thread closes segments, so `current` stays open while it is synced,
+        // even if an append moves on to the next segment meanwhile
+        for(auto* file : retired) {
+            syncFile(file);
+            std::fclose(file);
+        }
+        if(!syncFile(current)) {
+            LOG_ERROR << "Failed to sync write-ahead log segment to disk";
+        }
+    }
+}
+
+} // namespace server
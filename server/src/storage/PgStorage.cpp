@@ -0,0 +1,655 @@
+#include <server/storage/PgStorage.h>
+#include <server/models/Users.h>
+#include <server/models/Rooms.h>
+#include <server/models/Messages.h>
+#include <server/models/RoomMembership.h>
+#include <server/models/UserRoomData.h>
+#include <server/utils/switch_to_io_loop.h>
+#include <server/utils/pg_array.h>
+#include <server/db/DbRouter.h>
+#include <server/attachments/AttachmentStore.h>
+#include <format>
+
+using namespace drogon::orm;
+namespace models = drogon_model::drogon_test;
+
+namespace server {
+
+PgStorage::PgStorage(DbClientPtr dbClient)
+    : m_dbClient{std::move(dbClient)} {}
+
+static UserRecord toRecord(const models::Users& user) {
+    return UserRecord{
+        .id = user.getValueOfUserId(),
+        .name = user.getValueOfUsername(),
+        .hash_password = user.getValueOfHashPassword(),
+        .salt = user.getValueOfSalt(),
+        .is_admin = user.getValueOfIsAdmin(),
+    };
+}
+
+static void fillAttachment(chat::AttachmentInfo& info, const Row& row) {
+    info.set_attachment_id(row["attachment_id"].as<int32_t>());
+    info.set_file_name(row["file_name"].as<std::string>());
+    info.set_content_type(row["content_type"].as<std::string>());
+    info.set_size(row["size_bytes"].as<int64_t>());
+}
+
+// ---- Users ----
+
+drogon::Task<std::optional<UserRecord>> PgStorage::findUserByName(std::string name, bool may_be_stale) {
+    auto find_user = [&name](DbClientPtr db) -> drogon::Task<std::vector<models::Users>> {
+        co_return co_await switch_to_io_loop(CoroMapper<models::Users>(db)
+            .findBy(Criteria(models::Users::Cols::_username, CompareOperator::EQ, name)));
+    };
+    std::vector<models::Users> users;
+    if(may_be_stale) {
+        users = co_await DbRouter::instance().read(m_dbClient, find_user);
+        if(users.empty() && DbRouter::instance().replicaHealthy()) {
+            // The user may have registered moments ago and not be replicated yet
+            users = co_await find_user(m_dbClient);
+        }
+    } else {
+        users = co_await find_user(m_dbClient);
+    }
+    if(users.empty()) {
+        co_return std::nullopt;
+    }
+    co_return toRecord(users.front());
+}
+
+drogon::Task<std::optional<UserRecord>> PgStorage::findUserById(int32_t user_id) {
+    auto users = co_await switch_to_io_loop(CoroMapper<models::Users>(m_dbClient)
+        .findBy(Criteria(models::Users::Cols::_user_id, CompareOperator::EQ, user_id)));
+    if(users.empty()) {
+        co_return std::nullopt;
+    }
+    co_return toRecord(users.front());
+}
+
+drogon::Task<ScopedTransactionResult> PgStorage::createUser(std::string name, std::string hash, std::string salt) {
+    // Use a transaction to guarantee atomicity and handle duplicate usernames gracefully
+    co_return co_await WithTransaction(
+        [&](const auto& tx) -> drogon::Task<ScopedTransactionResult> {
+            try {
+                models::Users u;
+                u.setUsername(name);
+                u.setHashPassword(hash);
+                u.setSalt(salt);
+                co_await switch_to_io_loop(CoroMapper<models::Users>(tx).insert(u));
+                co_return std::nullopt;
+            } catch(const DrogonDbException& e) {
+                const std::string w = e.base().what();
+                LOG_ERROR << "User insert error: " << w;
+                if(w.find("duplicate key") != std::string::npos || w.find("UNIQUE constraint failed") != std::string::npos) {
+                    co_return "Username already exists.";
+                }
+                co_return "Database error during user insertion.";
+            }
+        });
+}
+
+drogon::Task<ScopedTransactionResult> PgStorage::setPassword(int32_t user_id, std::string hash, std::string salt) {
+    co_return co_await WithTransaction(
+        [&](const auto& tx) -> drogon::Task<ScopedTransactionResult> {
+            try {
+                auto user = co_await switch_to_io_loop(CoroMapper<models::Users>(tx)
+                    .findOne(Criteria(models::Users::Cols::_user_id, CompareOperator::EQ, user_id)));
+                user.setHashPassword(hash);
+                user.setSalt(salt);
+                co_await switch_to_io_loop(CoroMapper<models::Users>(tx).update(user));
+                co_return std::nullopt;
+            } catch (const DrogonDbException& e) {
+                LOG_ERROR << "User update error: " << e.base().what();
+                co_return "Database error during user update.";
+            }
+        });
+}
+
+drogon::Task<ScopedTransactionResult> PgStorage::changePassword(int32_t user_id, std::string old_hash, std::string new_hash, std::string new_salt) {
+    co_return co_await WithTransaction(
+        [&](const auto& tx) -> drogon::Task<ScopedTransactionResult> {
+            try {
+                auto users = co_await switch_to_io_loop(CoroMapper<models::Users>(tx)
+                    .findBy(Criteria(models::Users::Cols::_user_id, CompareOperator::EQ, user_id)));
+                if (users.empty()) {
+                    co_return "Current user not found in database.";
+                }
+                auto userToUpdate = users.front();
+
+                if (userToUpdate.getValueOfSalt().empty()) {
+                    co_return "Cannot change password for a non-migrated account.";
+                }
+
+                if (userToUpdate.getValueOfHashPassword() != old_hash) {
+                    co_return "Incorrect old password.";
+                }
+
+                userToUpdate.setHashPassword(new_hash);
+                userToUpdate.setSalt(new_salt);
+                co_await switch_to_io_loop(CoroMapper<models::Users>(tx).update(userToUpdate));
+                co_return std::nullopt;
+            }
+            catch (const DrogonDbException& e) {
+                LOG_ERROR << "Password change transaction failed: " << e.base().what();
+                co_return "Database error during password change.";
+            }
+        });
+}
+
+drogon::Task<ScopedTransactionResult> PgStorage::renameUser(int32_t user_id, std::string new_name) {
+    co_return co_await WithTransaction(
+        [&](const auto& tx) -> drogon::Task<ScopedTransactionResult> {
+            try {
+                auto existingUsers = co_await switch_to_io_loop(CoroMapper<models::Users>(tx)
+                    .findBy(Criteria(models::Users::Cols::_username, CompareOperator::EQ, new_name)));
+                if (!existingUsers.empty()) {
+                    co_return "This username is already taken.";
+                }
+                auto usersToUpdate = co_await switch_to_io_loop(CoroMapper<models::Users>(tx)
+                    .findBy(Criteria(models::Users::Cols::_user_id, CompareOperator::EQ, user_id)));
+
+                if (usersToUpdate.empty()) {
+                    co_return "Current user not found in database.";
+                }
+                auto userToUpdate = usersToUpdate.front();
+                userToUpdate.setUsername(new_name);
+                co_await switch_to_io_loop(CoroMapper<models::Users>(tx).update(userToUpdate));
+                co_return std::nullopt;
+            }
+            catch (const DrogonDbException& e) {
+                LOG_ERROR << "Username change transaction failed: " << e.base().what();
+                co_return "Database error during username change.";
+            }
+        });
+}
+
+// ---- Rooms ----
+
+drogon::Task<IStorage::RoomInfos> PgStorage::listRooms(int32_t user_id) {
+    co_return co_await DbRouter::instance().read(m_dbClient, [user_id](DbClientPtr db) -> drogon::Task<RoomInfos> {
+        RoomInfos room_infos;
+        auto rooms = co_await switch_to_io_loop(CoroMapper<models::Rooms>(db).findAll());
+        for(const auto& room : rooms) {
+            chat::RoomInfo* room_info = room_infos.Add();
+            room_info->set_room_id(room.getValueOfRoomId());
+            room_info->set_room_name(room.getValueOfRoomName());
+            auto membership = co_await switch_to_io_loop(CoroMapper<models::RoomMembership>(db)
+                .findBy(Criteria(models::RoomMembership::Cols::_user_id, CompareOperator::EQ, user_id)
+                     && Criteria(models::RoomMembership::Cols::_room_id, CompareOperator::EQ, room.getValueOfRoomId())));
+            if(membership.size()) {
+                room_info->set_is_joined(membership[0].getValueOfMembershipStatus() == "JOINED");
+            }
+        }
+        co_return room_infos;
+    });
+}
+
+drogon::Task<std::optional<RoomRecord>> PgStorage::findRoom(int32_t room_id) {
+    auto rooms = co_await switch_to_io_loop(CoroMapper<models::Rooms>(m_dbClient)
+        .findBy(Criteria(models::Rooms::Cols::_room_id, CompareOperator::EQ, room_id)));
+    if(rooms.empty()) {
+        co_return std::nullopt;
+    }
+    const auto& room = rooms.front();
+    co_return RoomRecord{
+        .id = room.getValueOfRoomId(),
+        .name = room.getValueOfRoomName(),
+        .owner_id = room.getValueOfOwnerId(),
+        .is_private = room.getValueOfIsPrivate(),
+    };
+}
+
+drogon::Task<ScopedTransactionResult> PgStorage::createRoom(std::string name, int32_t owner_id, int32_t& room_id) {
+    co_return co_await WithTransaction(
+        [&](const auto& tx) -> drogon::Task<ScopedTransactionResult> {
+            try {
+                models::Rooms r;
+                r.setRoomName(name);
+                r.setOwnerId(owner_id);
+                r = co_await switch_to_io_loop(CoroMapper<models::Rooms>(tx).insert(r));
+                room_id = *r.getRoomId();
+
+                models::RoomMembership m;
+                m.setRoomId(room_id);
+                m.setUserId(owner_id);
+                co_await switch_to_io_loop(CoroMapper<models::RoomMembership>(tx).insert(m));
+
+                co_return std::nullopt;
+            } catch(const DrogonDbException& e) {
+                const std::string w = e.base().what();
+                LOG_ERROR << "Room insert error: " << w;
+                co_return "Database error during room creation.";
+            }
+        });
+}
+
+drogon::Task<ScopedTransactionResult> PgStorage::renameRoom(int32_t room_id, std::string name) {
+    co_return co_await WithTransaction(
+        [&](const auto& tx) -> drogon::Task<ScopedTransactionResult> {
+            try {
+                auto room = co_await switch_to_io_loop(CoroMapper<models::Rooms>(tx)
+                    .findOne(Criteria(models::Rooms::Cols::_room_id, CompareOperator::EQ, room_id)));
+                if (!room.getRoomId()) {
+                    co_return "Room not found.";
+                }
+                room.setRoomName(name);
+                co_await switch_to_io_loop(CoroMapper<models::Rooms>(tx).update(room));
+                co_return std::nullopt;
+            } catch(const DrogonDbException& e) {
+                const std::string w = e.base().what();
+                LOG_ERROR << "Room rename error: " << w;
+                co_return "Database error during room rename.";
+            }
+        });
+}
+
+drogon::Task<ScopedTransactionResult> PgStorage::deleteRoom(int32_t room_id) {
+    co_return co_await WithTransaction(
+        [&](const auto& tx) -> drogon::Task<ScopedTransactionResult> {
+        try {
+            auto deleted_count = co_await switch_to_io_loop(CoroMapper<models::Rooms>(tx)
+                .deleteBy(Criteria(models::Rooms::Cols::_room_id, CompareOperator::EQ, room_id)));
+            if (deleted_count == 0) {
+                co_return "Room could not be deleted as it was not found.";
+            }
+            co_return std::nullopt;
+        } catch(const DrogonDbException& e) {
+            const std::string w = e.base().what();
+            LOG_ERROR << "Room deletion transaction failed: " << w;
+            co_return "Database error during room deletion.";
+        }
+    });
+}
+
+// ---- Membership and roles ----
+
+drogon::Task<std::optional<chat::MembershipStatus>> PgStorage::membershipStatus(int32_t user_id, int32_t room_id) {
+    auto room_membership = co_await switch_to_io_loop(CoroMapper<models::RoomMembership>(m_dbClient)
+        .findBy(Criteria(models::RoomMembership::Cols::_user_id, CompareOperator::EQ, user_id) &&
+                Criteria(models::RoomMembership::Cols::_room_id, CompareOperator::EQ, room_id)));
+
+    if(room_membership.empty()) {
+        co_return std::nullopt;
+    }
+
+    chat::MembershipStatus status;
+
+    if(chat::MembershipStatus_Parse(*room_membership.front().getMembershipStatus(), &status)) {
+        co_return status;
+    }
+
+    co_return std::nullopt;
+}
+
+drogon::Task<ScopedTransactionResult> PgStorage::setMembershipStatus(int32_t user_id, int32_t room_id, chat::MembershipStatus status) {
+    try {
+        auto room_membership = co_await switch_to_io_loop(CoroMapper<models::RoomMembership>(m_dbClient)
+            .findBy(Criteria(models::RoomMembership::Cols::_user_id, CompareOperator::EQ, user_id) &&
+                    Criteria(models::RoomMembership::Cols::_room_id, CompareOperator::EQ, room_id)));
+
+        if(room_membership.empty()) {
+            models::RoomMembership membership;
+            membership.setUserId(user_id);
+            membership.setRoomId(room_id);
+            membership.setMembershipStatus(chat::MembershipStatus_Name(status));
+            co_await switch_to_io_loop(CoroMapper<models::RoomMembership>(m_dbClient).insert(membership));
+            co_return std::nullopt;
+        } else {
+            auto membership = room_membership.front();
+            membership.setMembershipStatus(chat::MembershipStatus_Name(status));
+            co_await switch_to_io_loop(CoroMapper<models::RoomMembership>(m_dbClient).update(membership));
+            co_return std::nullopt;
+        }
+
+    } catch(const DrogonDbException& e) {
+        LOG_ERROR << "Membership status update/insert failed: " << e.base().what();
+        co_return "Database error during membership update.";
+    }
+}
+
+drogon::Task<std::vector<chat::UserInfo>> PgStorage::roomMembers(int32_t room_id) {
+    // One query for the whole list, with the same precedence as userRights()
+    auto rows = co_await switch_to_io_loop(m_dbClient->execSqlCoro(
+        "SELECT u.user_id, u.username, u.is_admin, r.owner_id = u.user_id AS is_owner,"
+        "       COALESCE(d.is_moderator, false) AS is_moderator"
+        " FROM room_membership rm"
+        " JOIN users u ON u.user_id = rm.user_id"
+        " JOIN rooms r ON r.room_id = rm.room_id"
+        " LEFT JOIN user_room_data d ON d.user_id = rm.user_id AND d.room_id = rm.room_id"
+        " WHERE rm.room_id = $1",
+        room_id));
+    std::vector<chat::UserInfo> members;
+    members.reserve(rows.size());
+    for(const auto& row : rows) {
+        auto& user_info = members.emplace_back();
+        user_info.set_user_id(row["user_id"].as<int32_t>());
+        user_info.set_user_name(row["username"].as<std::string>());
+        if(row["is_admin"].as<bool>()) {
+            user_info.set_user_room_rights(chat::UserRights::ADMIN);
+        } else if(!row["is_owner"].isNull() && row["is_owner"].as<bool>()) {
+            user_info.set_user_room_rights(chat::UserRights::OWNER);
+        } else if(row["is_moderator"].as<bool>()) {
+            user_info.set_user_room_rights(chat::UserRights::MODERATOR);
+        }
+    }
+    co_return members;
+}
+
+drogon::Task<std::vector<int32_t>> PgStorage::memberRooms(int32_t user_id) {
+    auto rows = co_await switch_to_io_loop(m_dbClient->execSqlCoro(
+        "SELECT room_id FROM room_membership WHERE user_id = $1", user_id));
+    std::vector<int32_t> rooms;
+    rooms.reserve(rows.size());
+    for(const auto& row : rows) {
+        rooms.push_back(row["room_id"].as<int32_t>());
+    }
+    co_return rooms;
+}
+
+drogon::Task<std::optional<chat::UserRights>> PgStorage::userRights(int32_t user_id, int32_t room_id) {
+    auto room = co_await switch_to_io_loop(CoroMapper<models::Rooms>(m_dbClient)
+        .findOne(Criteria(models::Rooms::Cols::_room_id, CompareOperator::EQ, room_id)));
+    co_return co_await userRights(m_dbClient, user_id, room_id, room.getValueOfOwnerId());
+}
+
+drogon::Task<std::optional<chat::UserRights>> PgStorage::userRights(const DbClientPtr& db, int32_t user_id, int32_t room_id, int32_t owner_id) {
+    // Check if the user is a global admin first.
+    auto user = co_await switch_to_io_loop(CoroMapper<models::Users>(db)
+        .findBy(
+            Criteria(models::Users::Cols::_user_id, CompareOperator::EQ, user_id) &&
+            Criteria(models::Users::Cols::_is_admin, CompareOperator::EQ, true)));
+    if (!user.empty()){
+        co_return chat::UserRights::ADMIN;
+    }
+
+    // Then, check if they are the owner of this specific room.
+    if (owner_id == user_id) {
+        co_return chat::UserRights::OWNER;
+    }
+
+    // Finally, look for a specific role entry in the user_room_data table.
+    auto data = co_await switch_to_io_loop(CoroMapper<models::UserRoomData>(db)
+        .findBy(
+            Criteria(models::UserRoomData::Cols::_user_id, CompareOperator::EQ, user_id) &&
+            Criteria(models::UserRoomData::Cols::_room_id, CompareOperator::EQ, room_id)));
+    if(!data.empty() && *data.front().getIsModerator()) {
+        co_return chat::UserRights::MODERATOR;
+    }
+    co_return std::nullopt;
+}
+
+drogon::Task<ScopedTransactionResult> PgStorage::assignRole(int32_t user_id, int32_t room_id, chat::UserRights new_role, RoleCheck check, RoleChange& change) {
+    //do ALL db operations first, inside SINGLE transaction
+    co_return co_await WithTransaction([&](const auto& tx) -> drogon::Task<ScopedTransactionResult> {
+        auto room = co_await switch_to_io_loop(CoroMapper<models::Rooms>(tx)
+            .findOne(Criteria(models::Rooms::Cols::_room_id, CompareOperator::EQ, room_id)));
+
+        auto targetUserRights = co_await userRights(tx, user_id, room_id, room.getValueOfOwnerId());
+        if(auto err = check(targetUserRights.value_or(chat::UserRights::REGULAR))) {
+            co_return err;
+        }
+
+        if(new_role == chat::UserRights::OWNER) { //special case, changing owner
+            //store old owner id, if there was any
+            const int32_t oldOwnerId = room.getOwnerId() ? *room.getOwnerId() : 0;
+
+            //update room with new owner id
+            room.setOwnerId(user_id);
+            co_await switch_to_io_loop(CoroMapper<models::Rooms>(tx).update(room));
+
+            if(oldOwnerId) {
+                change.old_owner_id = oldOwnerId;
+                //if there was an old owner, then fetch their current role as per db
+                change.old_owner_rights = co_await userRights(tx, oldOwnerId, room_id, user_id);
+
+                //if old owner is not a global admin, or had no explicit record for role, or if that role is below `MODERATOR`
+                //then we need to either create new record or update existing one
+                if(!change.old_owner_rights || *change.old_owner_rights < chat::UserRights::MODERATOR) {
+                    change.old_owner_rights = chat::UserRights::MODERATOR;
+                    if(auto inner_err = co_await updateUserRole(tx, oldOwnerId, room_id, *change.old_owner_rights)) {
+                        co_return inner_err;
+                    }
+                }
+
+                // NOTE: we do not have to clean up new owner's explicit role, cuz `OWNER` is stored inside `rooms`
+                // table directly and takes precedence, if user is demoted later then code above will make sure they are at least `MODERATOR`
+            }
+        } else { //much simpler regular case :з
+            if(auto inner_err = co_await updateUserRole(tx, user_id, room_id, new_role)) {
+                co_return inner_err;
+            }
+        }
+
+        co_return std::nullopt;
+    });
+}
+
+drogon::Task<ScopedTransactionResult> PgStorage::updateUserRole(const std::shared_ptr<drogon::orm::Transaction>& tx, int32_t user_id, int32_t room_id, chat::UserRights new_role) {
+    try {
+
+        if(new_role != chat::UserRights::REGULAR && new_role != chat::UserRights::MODERATOR) {
+            co_return "For now this function can only toggle moderator status";
+        }
+
+        auto room_data = co_await switch_to_io_loop(CoroMapper<models::UserRoomData>(tx)
+            .findBy(Criteria(models::UserRoomData::Cols::_user_id, CompareOperator::EQ, user_id) &&
+                    Criteria(models::UserRoomData::Cols::_room_id, CompareOperator::EQ, room_id)));
+
+        if (room_data.empty()) {
+            models::UserRoomData userRoomData;
+            userRoomData.setUserId(user_id);
+            userRoomData.setRoomId(room_id);
+            userRoomData.setIsModerator(new_role == chat::UserRights::MODERATOR);
+            co_await switch_to_io_loop(CoroMapper<models::UserRoomData>(tx).insert(userRoomData));
+        } else {
+            auto dataToUpdate = room_data.front();
+            dataToUpdate.setIsModerator(new_role == chat::UserRights::MODERATOR);
+            co_await switch_to_io_loop(CoroMapper<models::UserRoomData>(tx).update(dataToUpdate));
+        }
+        co_return std::nullopt;
+    } catch (const DrogonDbException& e) {
+        LOG_ERROR << "Role update/insert failed: " << e.base().what();
+        co_return "Database error during role update.";
+    }
+}
+
+// ---- Messages ----
+
+drogon::Task<ScopedTransactionResult> PgStorage::insertMessage(int32_t room_id, int32_t user_id, std::string text,
+                                                              std::vector<int32_t> attachment_ids, chat::MessageInfo& message) {
+    co_return co_await WithTransaction(
+        [&](const auto& tx) -> drogon::Task<ScopedTransactionResult> {
+            try {
+                Result attachments;
+                if(!attachment_ids.empty()) {
+                    // Only the sender's own uploads can be attached
+                    attachments = co_await switch_to_io_loop(tx->execSqlCoro(
+                        "SELECT attachment_id, file_name, content_type, size_bytes FROM attachments"
+                        " WHERE attachment_id = ANY($1::int[]) AND uploader_id = $2 ORDER BY attachment_id",
+                        toPgArray(attachment_ids), user_id));
+                    if(attachments.size() != attachment_ids.size()) {
+                        co_return "Unknown attachment.";
+                    }
+                }
+                models::Messages m;
+                m.setMessageText(text);
+                m.setRoomId(room_id);
+                m.setUserId(user_id);
+                auto inserted = co_await switch_to_io_loop(CoroMapper<models::Messages>(tx).insert(m));
+                if(!attachment_ids.empty()) {
+                    co_await switch_to_io_loop(tx->execSqlCoro(
+                        "INSERT INTO message_attachments (message_id, room_id, attachment_id)"
+                        " SELECT $1, $2, unnest($3::int[])",
+                        inserted.getValueOfMessageId(), room_id, toPgArray(attachment_ids)));
+                }
+                message.set_message_id(inserted.getValueOfMessageId());
+                message.set_timestamp(inserted.getValueOfCreatedAt());
+                for(const auto& row : attachments) {
+                    fillAttachment(*message.add_attachments(), row);
+                }
+                co_return std::nullopt;
+            } catch(const DrogonDbException& e) {
+                const std::string w = e.base().what();
+                LOG_ERROR << "Message insert error: " << w;
+                co_return "Database error during message insertion.";
+            }
+        });
+}
+
+drogon::Task<void> PgStorage::readMessages(int32_t room_id, int64_t offset_ts, int32_t limit, bool older, Messages& out) {
+    // The authors' names come with the page, rather than from a lookup per message
+    const auto sql = std::format(
+        "SELECT m.message_id, m.message_text, m.created_at, m.user_id, u.username"
+        " FROM messages m JOIN users u ON u.user_id = m.user_id"
+        " WHERE m.room_id = $1 AND m.created_at {} $2"
+        " ORDER BY m.created_at {} LIMIT $3",
+        older ? "<" : ">", older ? "DESC" : "ASC");
+
+    // History scrolling is the bulk of read traffic, so it goes to the replica when there is one.
+    const int start = out.size();
+    co_await DbRouter::instance().read(m_dbClient, [&](DbClientPtr db) -> drogon::Task<void> {
+        // A retry on the primary starts over
+        out.DeleteSubrange(start, out.size() - start);
+        auto rows = co_await switch_to_io_loop(db->execSqlCoro(sql, room_id, offset_ts, limit));
+
+        out.Reserve(start + static_cast<int>(rows.size()));
+        for(const auto& row : rows) {
+            auto* message_info = out.Add();
+            message_info->set_message(row["message_text"].as<std::string>());
+            message_info->set_timestamp(row["created_at"].as<int64_t>());
+            message_info->set_message_id(row["message_id"].as<int32_t>());
+            auto* user_info = message_info->mutable_from();
+            user_info->set_user_id(row["user_id"].as<int32_t>());
+            user_info->set_user_name(row["username"].as<std::string>());
+        }
+    });
+}
+
+drogon::Task<ScopedTransactionResult> PgStorage::deleteMessage(int32_t room_id, int32_t message_id) {
+    std::vector<std::string> orphaned_files;
+    auto result = co_await WithTransaction([&](const auto& tx) -> drogon::Task<ScopedTransactionResult> {
+        try {
+            auto messages = co_await switch_to_io_loop(CoroMapper<models::Messages>(tx)
+                .findBy(Criteria(models::Messages::Cols::_message_id, CompareOperator::EQ, message_id) &&
+                        Criteria(models::Messages::Cols::_room_id, CompareOperator::EQ, room_id)));
+            if (messages.empty()) {
+                co_return "Message not found or does not belong to this room.";
+            }
+            size_t deletedCount = co_await switch_to_io_loop(CoroMapper<models::Messages>(tx)
+                .deleteBy(Criteria(models::Messages::Cols::_message_id, CompareOperator::EQ, message_id)));
+
+            if (deletedCount == 0) {
+                co_return "Message could not be deleted.";
+            }
+
+            // The attachments are only reachable through the message; one posted again elsewhere stays.
+            // The CTE's delete is not visible to the NOT EXISTS, hence the message_id filter there.
+            auto removed = co_await switch_to_io_loop(tx->execSqlCoro(
+                "WITH unlinked AS (DELETE FROM message_attachments WHERE message_id = $1 AND room_id = $2"
+                "                  RETURNING attachment_id)"
+                " DELETE FROM attachments a USING unlinked u WHERE a.attachment_id = u.attachment_id"
+                "   AND NOT EXISTS (SELECT 1 FROM message_attachments ma"
+                "                   WHERE ma.attachment_id = a.attachment_id AND ma.message_id <> $1)"
+                " RETURNING a.sha256",
+                message_id, room_id));
+            for (const auto& row : removed) {
+                orphaned_files.push_back(row["sha256"].as<std::string>());
+            }
+            co_return std::nullopt;
+        } catch (const DrogonDbException& e) {
+            LOG_ERROR << "Message deletion transaction failed: " << e.base().what();
+            co_return "Database error during message deletion.";
+        }
+    });
+    if (!result && !orphaned_files.empty()) {
+        co_await AttachmentStore::instance().removeUnreferenced(std::move(orphaned_files));
+    }
+    co_return result;
+}
+
+drogon::Task<void> PgStorage::loadAttachments(const std::vector<chat::MessageInfo*>& messages) {
+    if(messages.empty()) {
+        co_return;
+    }
+    std::unordered_map<int32_t, chat::MessageInfo*> by_id;
+    std::vector<int32_t> message_ids;
+    message_ids.reserve(messages.size());
+    for(auto* message : messages) {
+        by_id.emplace(message->message_id(), message);
+        message_ids.push_back(message->message_id());
+    }
+
+    // One query per page, whether the messages came from the database or the archive
+    auto rows = co_await DbRouter::instance().read(m_dbClient, [&](DbClientPtr db) -> drogon::Task<Result> {
+        co_return co_await switch_to_io_loop(db->execSqlCoro(
+            "SELECT ma.message_id, a.attachment_id, a.file_name, a.content_type, a.size_bytes"
+            " FROM message_attachments ma JOIN attachments a ON a.attachment_id = ma.attachment_id"
+            " WHERE ma.message_id = ANY($1::int[])"
+            " ORDER BY ma.message_id, a.attachment_id",
+            toPgArray(message_ids)));
+    });
+    for(const auto& row : rows) {
+        if(auto it = by_id.find(row["message_id"].as<int32_t>()); it != by_id.end()) {
+            fillAttachment(*it->second->add_attachments(), row);
+        }
+    }
+}
+
+drogon::Task<void> PgStorage::searchMessages(int32_t user_id, const chat::SearchMessagesRequest& req, int32_t limit, int32_t offset,
+                                             chat::SearchMessagesResponse& resp) {
+    auto optional_field = [](bool has, auto value) {
+        return has ? std::optional{value} : std::nullopt;
+    };
+
+    // Private rooms are only searched if the user is a member
+    auto rows = co_await DbRouter::instance().read(m_dbClient, [&](DbClientPtr db) -> drogon::Task<Result> {
+        co_return co_await switch_to_io_loop(db->execSqlCoro(
+            "WITH matches AS ("
+            "  SELECT m.message_id, m.room_id, m.user_id, m.message_text, m.created_at,"
+            "         ts_rank(m.search_vector, q.query) AS rank"
+            "  FROM messages m"
+            "  CROSS JOIN websearch_to_tsquery('simple', $1) AS q(query)"
+            "  JOIN rooms r ON r.room_id = m.room_id"
+            "  WHERE m.search_vector @@ q.query"
+            "    AND (NOT r.is_private OR EXISTS (SELECT 1 FROM room_membership rm"
+            "         WHERE rm.room_id = m.room_id AND rm.user_id = $2 AND rm.membership_status = 'JOINED'))"
+            "    AND ($3::int IS NULL OR m.room_id = $3)"
+            "    AND ($4::int IS NULL OR m.user_id = $4)"
+            "    AND ($5::bigint IS NULL OR m.created_at >= $5)"
+            "    AND ($6::bigint IS NULL OR m.created_at < $6)"
+            "  ORDER BY m.created_at DESC"
+            "  LIMIT $7"
+            ")"
+            " SELECT matches.*, u.username FROM matches JOIN users u ON u.user_id = matches.user_id"
+            " ORDER BY matches.rank DESC, matches.created_at DESC"
+            " LIMIT $8 OFFSET $9",
+            req.query(),
+            user_id,
+            optional_field(req.has_room_id(), req.room_id()),
+            optional_field(req.has_author_id(), req.author_id()),
+            optional_field(req.has_from_ts(), req.from_ts()),
+            optional_field(req.has_to_ts(), req.to_ts()),
+            SEARCH_RANK_CANDIDATES,
+            limit + 1,
+            offset));
+    });
+
+    for(const auto& row : rows) {
+        if(resp.hits_size() == limit) {
+            resp.set_has_more(true);
+            break;
+        }
+        auto* hit = resp.add_hits();
+        hit->set_room_id(row["room_id"].as<int32_t>());
+        hit->set_rank(row["rank"].as<double>());
+        auto* message_info = hit->mutable_message();
+        message_info->set_message_id(row["message_id"].as<int32_t>());
+        message_info->set_message(row["message_text"].as<std::string>());
+        message_info->set_timestamp(row["created_at"].as<int64_t>());
+        message_info->mutable_from()->set_user_id(row["user_id"].as<int32_t>());
+        message_info->mutable_from()->set_user_name(row["username"].as<std::string>());
+    }
+}
+
+} // namespace server
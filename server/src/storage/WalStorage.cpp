@@ -0,0 +1,54 @@
+#include <server/storage/WalStorage.h>
+#include <server/storage/MessageLog.h>
+
+namespace server {
+
+drogon::Task<ScopedTransactionResult> WalStorage::insertMessage(int32_t room_id, int32_t user_id, std::string text,
+                                                               std::vector<int32_t> attachment_ids, chat::MessageInfo& message) {
+    auto& log = MessageLog::instance();
+    if(attachment_ids.empty() && log.running() && log.append(room_id, message)) {
+        co_return std::nullopt;
+    }
+    co_return co_await PgStorage::insertMessage(room_id, user_id, std::move(text), std::move(attachment_ids), message);
+}
+
+drogon::Task<void> WalStorage::readMessages(int32_t room_id, int64_t offset_ts, int32_t limit, bool older, Messages& out) {
+    const int start = out.size();
+    co_await PgStorage::readMessages(room_id, offset_ts, limit, older, out);
+
+    auto& log = MessageLog::instance();
+    if(!log.running()) {
+        co_return;
+    }
+    auto pending = log.pending(room_id, offset_ts, older);
+    if(pending.empty()) {
+        co_return;
+    }
+
+    // A message may have been flushed between the read and now, so it is in both
+    std::unordered_set<int32_t> stored;
+    for(int i = start; i < out.size(); ++i) {
+        stored.insert(out.Get(i).message_id());
+    }
+    for(auto& message : pending) {
+        if(!stored.contains(message.message_id())) {
+            *out.Add() = std::move(message);
+        }
+    }
+    std::sort(out.pointer_begin() + start, out.pointer_end(), [older](const chat::MessageInfo* a, const chat::MessageInfo* b) {
+        return older ? a->timestamp() > b->timestamp() : a->timestamp() < b->timestamp();
+    });
+    if(out.size() - start > limit) {
+        out.DeleteSubrange(start + limit, out.size() - start - limit);
+    }
+}
+
+drogon::Task<ScopedTransactionResult> WalStorage::deleteMessage(int32_t room_id, int32_t message_id) {
+    auto& log = MessageLog::instance();
+    if(log.running() && log.hasPending() && !co_await log.flush()) {
+        co_return "Database error during message deletion.";
+    }
+    co_return co_await PgStorage::deleteMessage(room_id, message_id);
+}
+
+} // namespace server
@@ -0,0 +1,194 @@
+// Counts the heap allocations of handling one request, with the request and
+// response envelopes on the heap and on a PooledArena (see common/utils/arena.h),
+// and the memory an idle connection's state takes.
+//
+// Usage: alloc_count [--messages 50] [--text 120] [--requests 10000] [--connections 100000]
+//
+// Each request parses a GetMessagesRequest, builds a GetMessagesResponse page of
+// --messages messages of --text bytes each and serializes it, as the history
+// handler does. Every operator new of the process is counted, including those
+// of protobuf, so the difference between the rows is what the arena saves.
+//
+// Then --connections connection states are created and kept alive, once as
+// makeWsData() does and once with a heap-allocated snapshot owning its own
+// initial version. The heap row is the snapshot layout without pooling, not
+// the earlier Guarded<WsData> whose mutex lived in its own shared_ptr; that
+// type no longer exists and cannot be built here. Bytes are the sizes
+// requested from operator new, without the malloc overhead.
+
+#include <common/proto/chat.pb.h>
+#include <common/utils/arena.h>
+#include <server/chat/WsData.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+std::atomic<std::size_t> g_allocations{0};
+std::atomic<std::size_t> g_bytes{0};
+
+struct Options {
+    int messages = 50;
+    std::size_t text = 120;
+    int requests = 10000;
+    std::size_t connections = 100000;
+};
+
+/// Parses a request and serializes its response, as WsRequestProcessor does
+void handle(const Options& options, const std::string& bytes, chat::Envelope& request, chat::Envelope& response,
+            std::string& out) {
+    if(!request.ParseFromString(bytes)) {
+        std::abort();
+    }
+    auto* page = response.mutable_get_messages_response();
+    page->mutable_status()->set_code(chat::STATUS_SUCCESS);
+    // Copied into every message, as the handlers copy the texts of the storage rows
+    static const std::string text(options.text, 'x');
+    const auto limit = std::min(options.messages, request.get_messages_request().limit());
+    for(int i = 0; i < limit; ++i) {
+        auto* message = page->add_message();
+        message->set_message_id(i + 1);
+        message->set_timestamp(request.get_messages_request().offset_ts() - i);
+        message->set_message(text);
+        message->mutable_from()->set_user_id(i % 7 + 1);
+        message->mutable_from()->set_user_name("user_" + std::to_string(i % 7 + 1));
+    }
+    out.clear();
+    response.SerializeToString(&out);
+}
+
+/// Runs the requests and returns the allocations per request
+template<typename Request>
+double measure(const Options& options, const std::string& bytes, Request&& request) {
+    std::string out;
+    out.reserve(1 << 20);
+    // Warms up the arena pool and protobuf's own lazily built state
+    for(int i = 0; i < 100; ++i) {
+        request(bytes, out);
+    }
+    const auto before = g_allocations.load(std::memory_order_relaxed);
+    for(int i = 0; i < options.requests; ++i) {
+        request(bytes, out);
+    }
+    const auto allocations = g_allocations.load(std::memory_order_relaxed) - before;
+    return static_cast<double>(allocations) / options.requests;
+}
+
+/// Allocations and bytes per connection of keeping the states `make` creates
+struct PerConnection {
+    double allocations;
+    double bytes;
+};
+
+template<typename Make>
+PerConnection measureConnections(std::size_t connections, Make&& make) {
+    std::vector<decltype(make())> states;
+    states.reserve(connections);
+    const auto allocations = g_allocations.load(std::memory_order_relaxed);
+    const auto bytes = g_bytes.load(std::memory_order_relaxed);
+    for(std::size_t i = 0; i < connections; ++i) {
+        states.push_back(make());
+    }
+    const auto count = static_cast<double>(connections);
+    return {static_cast<double>(g_allocations.load(std::memory_order_relaxed) - allocations) / count,
+            static_cast<double>(g_bytes.load(std::memory_order_relaxed) - bytes) / count};
+}
+
+std::optional<Options> parseOptions(int argc, char** argv) {
+    Options options;
+    for(int i = 1; i < argc; ++i) {
+        const std::string_view arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if(arg == "--messages" && has_value) {
+            options.messages = std::atoi(argv[++i]);
+        } else if(arg == "--text" && has_value) {
+            options.text = std::strtoul(argv[++i], nullptr, 10);
+        } else if(arg == "--requests" && has_value) {
+            options.requests = std::atoi(argv[++i]);
+        } else if(arg == "--connections" && has_value) {
+            options.connections = std::strtoul(argv[++i], nullptr, 10);
+        } else {
+            return std::nullopt;
+        }
+    }
+    if(options.messages < 0 || options.requests <= 0 || options.connections == 0) {
+        return std::nullopt;
+    }
+    return options;
+}
+
+} // namespace
+
+void* operator new(std::size_t size) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    g_bytes.fetch_add(size, std::memory_order_relaxed);
+    if(void* ptr = std::malloc(size == 0 ? 1 : size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+// GCC sees the inlined std::free of a pointer from a new expression, not the replaced operator new
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+int main(int argc, char** argv) {
+    auto options = parseOptions(argc, argv);
+    if(!options) {
+        std::fprintf(stderr, "Usage: %s [--messages 50] [--text 120] [--requests 10000] [--connections 100000]\n",
+                     argv[0]);
+        return 1;
+    }
+
+    chat::Envelope request;
+    request.mutable_get_messages_request()->set_limit(options->messages);
+    request.mutable_get_messages_request()->set_offset_ts(1'700'000'000'000'000);
+    const auto bytes = request.SerializeAsString();
+
+    const auto heap = measure(*options, bytes, [&options](const std::string& bytes, std::string& out) {
+        chat::Envelope request;
+        chat::Envelope response;
+        handle(*options, bytes, request, response, out);
+    });
+    const auto arena = measure(*options, bytes, [&options](const std::string& bytes, std::string& out) {
+        common::PooledArena arena;
+        handle(*options, bytes, *arena.create<chat::Envelope>(), *arena.create<chat::Envelope>(), out);
+    });
+
+    std::printf("%d messages of %zu bytes, %d requests\n", options->messages, options->text, options->requests);
+    std::printf("%-8s %14s\n", "envelope", "allocs/request");
+    std::printf("%-8s %14.1f\n", "heap", heap);
+    std::printf("%-8s %14.1f\n", "arena", arena);
+
+    const auto unpooled = measureConnections(options->connections, []() {
+        return std::make_shared<common::Snapshot<server::WsData>>();
+    });
+    const auto pooled = measureConnections(options->connections, []() { return server::makeWsData(); });
+
+    std::printf("\n%zu idle connection states\n", options->connections);
+    std::printf("%-8s %14s %14s\n", "state", "allocs/conn", "bytes/conn");
+    std::printf("%-8s %14.1f %14.1f\n", "heap", unpooled.allocations, unpooled.bytes);
+    std::printf("%-8s %14.1f %14.1f\n", "pooled", pooled.allocations, pooled.bytes);
+    return 0;
+}
@@ -0,0 +1,765 @@
+// Replays the inbound envelopes of a capture (see common/utils/capture.h) against a
+// server and reports how long each request took to be answered, and how long a
+// sent message took to reach the other connections in its room.
+//
+// Usage: replay_tool <capture> [--url ws://127.0.0.1:8849/ws] [--speed 1] [--password secret] [--threads 4] [--seed]
+//                    [--metrics http://127.0.0.1:8849/metrics]
+//
+// Every recorded connection is opened again at its recorded time, divided by the
+// speed, and sends its requests on the same schedule. Redacted credentials are
+// filled in from --password, so the users of the capture must exist on the target
+// server with that password.
+//
+// --seed first registers the users of the capture and creates its rooms, for an
+// empty server such as one with the in-memory storage backend.
+//
+// --metrics polls the server's /metrics every second during the replay and
+// reports the distribution of its event-loop lag, to compare server builds or
+// settings under the same load.
+
+#include <common/utils/capture.h>
+#include <common/utils/password.h>
+#include <common/utils/utils.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+
+using Clock = std::chrono::steady_clock;
+using common::EnvelopeCapture;
+
+namespace {
+
+struct Options {
+    std::string capture;
+    std::string url = "ws://127.0.0.1:8849/ws";
+    double speed = 1.0;
+    std::string password;
+    std::size_t threads = 4;
+    bool seed = false;
+    std::string metrics;
+};
+
+struct Request {
+    int64_t at_us;
+    chat::Envelope env;
+    /// The recorded user of a ResumeSessionRequest, whose live token replaces the redacted one
+    std::string resume_user;
+};
+
+struct RecordedSession {
+    int64_t open_us = 0;
+    std::optional<int64_t> close_us;
+    std::vector<Request> requests;
+};
+
+/// Latencies of one request type, in microseconds
+struct Samples {
+    std::vector<int64_t> latencies;
+    std::size_t unanswered = 0;
+};
+
+class Replay;
+
+class Session : public std::enable_shared_from_this<Session> {
+public:
+    Session(Replay& replay, RecordedSession recorded, trantor::EventLoop* loop)
+        : m_replay(replay), m_recorded(std::move(recorded)), m_loop(loop) {}
+
+    void start();
+
+private:
+    void onConnected(const drogon::WebSocketConnectionPtr& conn);
+    void onMessage(const std::string& bytes);
+    void pump();
+    bool prepare(chat::Envelope& env);
+    void close();
+
+    Replay& m_replay;
+    RecordedSession m_recorded;
+    trantor::EventLoop* m_loop;
+    drogon::WebSocketClientPtr m_client;
+    drogon::WebSocketConnectionPtr m_conn;
+    std::size_t m_next = 0;
+    bool m_timer_armed = false;
+    bool m_closed = false;
+    /// The user this connection is logged in as
+    std::string m_user;
+    /// The live salt of the user logging in, once InitialAuthResponse arrived
+    std::optional<std::string> m_salt;
+    bool m_awaiting_salt = false;
+    /// Send times of unanswered requests, by the payload case of the expected response
+    std::map<int, std::deque<Clock::time_point>> m_pending;
+};
+
+class Replay {
+public:
+    explicit Replay(Options options) : m_options(std::move(options)) {}
+
+    bool load();
+    void start();
+
+    const Options& options() const { return m_options; }
+    Clock::time_point due(int64_t at_us) const {
+        return m_start + std::chrono::microseconds(static_cast<int64_t>(static_cast<double>(at_us) / m_options.speed));
+    }
+
+    void recordLatency(int request_case, Clock::duration latency);
+    void recordUnanswered(int request_case, std::size_t count);
+    void recordSent(const std::string& user, const std::string& text, Clock::time_point at);
+    void recordDelivered(const std::string& user, const std::string& text, Clock::time_point at);
+    void recordLag(Clock::duration lag);
+    void recordRefused();
+    void recordSkipped();
+    void sessionFinished();
+
+    std::string hashFor(const std::string& salt);
+    void setToken(const std::string& user, const std::string& token);
+    std::optional<std::string> token(const std::string& user);
+
+    /// The users logging in or resuming in the capture
+    const std::set<std::string>& users() const { return m_users; }
+    /// The largest room id joined in the capture
+    int32_t maxRoomId() const { return m_max_room_id; }
+
+private:
+    void report();
+    /// Samples the server's `chat_loop_lag_ms` gauge
+    void pollMetrics();
+
+    Options m_options;
+    std::vector<RecordedSession> m_sessions;
+    int64_t m_last_us = 0;
+    std::set<std::string> m_users;
+    int32_t m_max_room_id = 0;
+    Clock::time_point m_start;
+    std::size_t m_running = 0;
+    bool m_reported = false;
+
+    std::mutex m_mutex;
+    std::map<int, Samples> m_samples;
+    /// Send times of messages by sender and text; a repeated text counts from its latest send
+    std::map<std::pair<std::string, std::string>, Clock::time_point> m_sent;
+    /// Send-to-receive latencies of messages on the other connections of their room
+    std::vector<int64_t> m_deliveries;
+    Clock::duration m_max_lag{};
+    std::size_t m_refused = 0;
+    drogon::HttpClientPtr m_metrics_client;
+    /// Samples of the server's loop lag, in milliseconds
+    std::vector<double> m_loop_lags;
+    std::size_t m_skipped = 0;
+    std::unordered_map<std::string, std::string> m_hashes;
+    std::unordered_map<std::string, std::string> m_tokens;
+};
+
+bool Replay::load() {
+    std::ifstream in(m_options.capture, std::ios::binary);
+    std::string magic(EnvelopeCapture::MAGIC.size(), '\0');
+    if(!in.read(magic.data(), static_cast<std::streamsize>(magic.size())) || magic != EnvelopeCapture::MAGIC) {
+        std::cerr << "Not a capture file: " << m_options.capture << "\n";
+        return false;
+    }
+
+    // Connection ids are reused after Close, so each Open starts a new session
+    std::unordered_map<uint64_t, std::size_t> open;
+    while(auto record = EnvelopeCapture::read(in)) {
+        m_last_us = std::max(m_last_us, record->timestamp_us);
+        if(record->event == EnvelopeCapture::Event::Open) {
+            open[record->connection] = m_sessions.size();
+            m_sessions.push_back({.open_us = record->timestamp_us});
+            continue;
+        }
+        auto it = open.find(record->connection);
+        if(it == open.end()) {
+            // Not a client connection, e.g. the link to the aggregator
+            continue;
+        }
+        auto& session = m_sessions[it->second];
+        if(record->event == EnvelopeCapture::Event::Close) {
+            session.close_us = record->timestamp_us;
+            open.erase(it);
+            continue;
+        }
+
+        chat::Envelope env;
+        if(!env.ParseFromString(record->payload)) {
+            continue;
+        }
+        if(record->event == EnvelopeCapture::Event::Inbound) {
+            if(env.has_initial_auth_request()) {
+                m_users.insert(env.initial_auth_request().username());
+            } else if(env.has_join_room_request()) {
+                m_max_room_id = std::max(m_max_room_id, env.join_room_request().room_id());
+            } else if(env.has_resume_session_request() && env.resume_session_request().has_room_id()) {
+                m_max_room_id = std::max(m_max_room_id, env.resume_session_request().room_id());
+            }
+            session.requests.push_back({.at_us = record->timestamp_us, .env = std::move(env)});
+        } else if(env.has_resume_session_response() && env.resume_session_response().has_authenticated_user()) {
+            // Remember who resumed, to use their live token on replay
+            for(auto req = session.requests.rbegin(); req != session.requests.rend(); ++req) {
+                if(req->env.has_resume_session_request()) {
+                    req->resume_user = env.resume_session_response().authenticated_user().user_name();
+                    m_users.insert(req->resume_user);
+                    break;
+                }
+            }
+        }
+    }
+    std::cout << "Loaded " << m_sessions.size() << " connections spanning "
+              << static_cast<double>(m_last_us) / 1e6 << " s\n";
+    return true;
+}
+
+void Replay::start() {
+    m_start = Clock::now() + std::chrono::seconds(1);
+    m_running = m_sessions.size();
+    std::size_t index = 0;
+    for(auto& recorded : m_sessions) {
+        auto* loop = drogon::app().getIOLoop(index++ % drogon::app().getThreadNum());
+        auto session = std::make_shared<Session>(*this, std::move(recorded), loop);
+        loop->queueInLoop([session]() { session->start(); });
+    }
+
+    // Whatever is still unanswered shortly after the last recorded event is reported as such
+    const auto deadline = due(m_last_us) + std::chrono::seconds(10) - Clock::now();
+    drogon::app().getLoop()->runAfter(std::chrono::duration<double>(deadline).count(), [this]() { report(); });
+
+    if(!m_options.metrics.empty()) {
+        const auto [server, path] = common::splitUrl(m_options.metrics);
+        m_metrics_client = drogon::HttpClient::newHttpClient(server, drogon::app().getLoop());
+        drogon::app().getLoop()->runEvery(1.0, [this]() { pollMetrics(); });
+    }
+}
+
+void Replay::pollMetrics() {
+    const auto [server, path] = common::splitUrl(m_options.metrics);
+    auto req = drogon::HttpRequest::newHttpRequest();
+    req->setPath(path);
+    m_metrics_client->sendRequest(req, [this](drogon::ReqResult result, const drogon::HttpResponsePtr& resp) {
+        if(result != drogon::ReqResult::Ok || resp->statusCode() != drogon::k200OK) {
+            return;
+        }
+        static constexpr std::string_view gauge = "chat_loop_lag_ms ";
+        const std::string_view body = resp->body();
+        for(std::size_t pos = 0; pos < body.size();) {
+            auto end = body.find('\n', pos);
+            if(end == std::string_view::npos) {
+                end = body.size();
+            }
+            const auto line = body.substr(pos, end - pos);
+            if(line.starts_with(gauge)) {
+                std::lock_guard lock(m_mutex);
+                m_loop_lags.push_back(std::strtod(std::string(line.substr(gauge.size())).c_str(), nullptr));
+                return;
+            }
+            pos = end + 1;
+        }
+    });
+}
+
+void Replay::recordLatency(int request_case, Clock::duration latency) {
+    std::lock_guard lock(m_mutex);
+    m_samples[request_case].latencies.push_back(std::chrono::duration_cast<std::chrono::microseconds>(latency).count());
+}
+
+void Replay::recordUnanswered(int request_case, std::size_t count) {
+    std::lock_guard lock(m_mutex);
+    m_samples[request_case].unanswered += count;
+}
+
+void Replay::recordSent(const std::string& user, const std::string& text, Clock::time_point at) {
+    std::lock_guard lock(m_mutex);
+    m_sent[{user, text}] = at;
+}
+
+void Replay::recordDelivered(const std::string& user, const std::string& text, Clock::time_point at) {
+    std::lock_guard lock(m_mutex);
+    if(auto it = m_sent.find({user, text}); it != m_sent.end()) {
+        m_deliveries.push_back(std::chrono::duration_cast<std::chrono::microseconds>(at - it->second).count());
+    }
+}
+
+void Replay::recordLag(Clock::duration lag) {
+    std::lock_guard lock(m_mutex);
+    m_max_lag = std::max(m_max_lag, lag);
+}
+
+void Replay::recordRefused() {
+    std::lock_guard lock(m_mutex);
+    ++m_refused;
+}
+
+void Replay::recordSkipped() {
+    std::lock_guard lock(m_mutex);
+    ++m_skipped;
+}
+
+void Replay::sessionFinished() {
+    drogon::app().getLoop()->queueInLoop([this]() {
+        if(--m_running == 0) {
+            report();
+        }
+    });
+}
+
+std::string Replay::hashFor(const std::string& salt) {
+    // Argon2 is deliberately slow, and users log in many times
+    {
+        std::lock_guard lock(m_mutex);
+        if(auto it = m_hashes.find(salt); it != m_hashes.end()) {
+            return it->second;
+        }
+    }
+    auto hash = common::password::hash_password(m_options.password, salt);
+    std::lock_guard lock(m_mutex);
+    m_hashes.emplace(salt, hash);
+    return hash;
+}
+
+void Replay::setToken(const std::string& user, const std::string& token) {
+    std::lock_guard lock(m_mutex);
+    m_tokens[user] = token;
+}
+
+std::optional<std::string> Replay::token(const std::string& user) {
+    std::lock_guard lock(m_mutex);
+    if(auto it = m_tokens.find(user); it != m_tokens.end()) {
+        return it->second;
+    }
+    return std::nullopt;
+}
+
+static int64_t percentile(const std::vector<int64_t>& sorted, double p) {
+    if(sorted.empty()) {
+        return 0;
+    }
+    const auto index = static_cast<std::size_t>(p * static_cast<double>(sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+static void printRow(const std::string& name, std::vector<int64_t> latencies, std::size_t unanswered) {
+    std::ranges::sort(latencies);
+    auto ms = [](int64_t us) { return static_cast<double>(us) / 1000.0; };
+    std::printf("%-12s %8zu %8zu %9.2f %9.2f %9.2f %9.2f %9.2f\n", name.c_str(), latencies.size(), unanswered,
+                ms(percentile(latencies, 0.5)), ms(percentile(latencies, 0.9)), ms(percentile(latencies, 0.99)),
+                ms(percentile(latencies, 0.999)), ms(latencies.empty() ? 0 : latencies.back()));
+}
+
+void Replay::report() {
+    std::lock_guard lock(m_mutex);
+    if(m_reported) {
+        return;
+    }
+    m_reported = true;
+
+    // Payload cases are the Envelope field numbers in chat.proto; the lite runtime has no names
+    std::printf("%-12s %8s %8s %9s %9s %9s %9s %9s\n", "request", "answered", "missing", "p50 ms", "p90 ms", "p99 ms", "p99.9 ms", "max ms");
+    std::vector<int64_t> all;
+    std::size_t all_unanswered = 0;
+    for(const auto& [request_case, samples] : m_samples) {
+        printRow("payload " + std::to_string(request_case), samples.latencies, samples.unanswered);
+        all.insert(all.end(), samples.latencies.begin(), samples.latencies.end());
+        all_unanswered += samples.unanswered;
+    }
+    printRow("all", std::move(all), all_unanswered);
+    // Counts every receiving connection, so a message to a busy room adds many samples
+    printRow("delivery", m_deliveries, 0);
+    std::printf("refused connections: %zu, skipped requests: %zu, max send lag: %.2f ms\n", m_refused, m_skipped,
+                std::chrono::duration<double, std::milli>(m_max_lag).count());
+    if(!m_options.metrics.empty()) {
+        // Each sample is the worst lag of the server's last metrics window
+        auto lags = m_loop_lags;
+        std::ranges::sort(lags);
+        auto at = [&lags](double p) {
+            return lags.empty() ? 0.0 : lags[static_cast<std::size_t>(p * static_cast<double>(lags.size() - 1) + 0.5)];
+        };
+        std::printf("server loop lag: %zu samples, p50 %.2f ms, p99 %.2f ms, max %.2f ms\n", lags.size(), at(0.5),
+                    at(0.99), lags.empty() ? 0.0 : lags.back());
+    }
+    drogon::app().quit();
+}
+
+void Session::start() {
+    const auto delay = m_replay.due(m_recorded.open_us) - Clock::now();
+    m_loop->runAfter(std::max(std::chrono::duration<double>(delay).count(), 0.0), [self = shared_from_this()]() {
+        const auto [server, path] = common::splitUrl(self->m_replay.options().url);
+        self->m_client = drogon::WebSocketClient::newWebSocketClient(server, self->m_loop);
+        auto req = drogon::HttpRequest::newHttpRequest();
+        req->setPath(path);
+
+        self->m_client->setMessageHandler([weak = std::weak_ptr(self)](const std::string& message,
+                                                                       const drogon::WebSocketClientPtr&,
+                                                                       const drogon::WebSocketMessageType& type) {
+            if(auto session = weak.lock(); session && type == drogon::WebSocketMessageType::Binary) {
+                session->onMessage(message);
+            }
+        });
+        self->m_client->setConnectionClosedHandler([weak = std::weak_ptr(self)](const drogon::WebSocketClientPtr&) {
+            if(auto session = weak.lock()) {
+                session->close();
+            }
+        });
+        self->m_client->connectToServer(req, [self](drogon::ReqResult result,
+                                                     const drogon::HttpResponsePtr&,
+                                                     const drogon::WebSocketClientPtr& client) {
+            if(result != drogon::ReqResult::Ok) {
+                self->m_replay.recordRefused();
+                self->close();
+                return;
+            }
+            self->onConnected(client->getConnection());
+        });
+    });
+}
+
+void Session::onConnected(const drogon::WebSocketConnectionPtr& conn) {
+    m_conn = conn;
+    if(m_recorded.close_us) {
+        const auto delay = m_replay.due(*m_recorded.close_us) - Clock::now();
+        m_loop->runAfter(std::max(std::chrono::duration<double>(delay).count(), 0.0), [self = shared_from_this()]() {
+            self->close();
+        });
+    }
+    pump();
+}
+
+void Session::onMessage(const std::string& bytes) {
+    chat::Envelope env;
+    if(!env.ParseFromString(bytes)) {
+        return;
+    }
+    const auto now = Clock::now();
+    const int response_case = env.payload_case();
+
+    if(env.has_server_hello() && env.server_hello().has_retry_after_ms()) {
+        m_replay.recordRefused();
+        close();
+        return;
+    }
+    if(env.has_initial_auth_response()) {
+        m_salt = env.initial_auth_response().salt();
+    }
+    if(env.has_auth_response() && env.auth_response().has_session_token()) {
+        m_user = env.auth_response().authenticated_user().user_name();
+        m_replay.setToken(m_user, env.auth_response().session_token());
+    }
+    if(env.has_resume_session_response() && env.resume_session_response().has_session_token()) {
+        m_user = env.resume_session_response().authenticated_user().user_name();
+        m_replay.setToken(m_user, env.resume_session_response().session_token());
+    }
+    if(env.has_room_message()) {
+        // The sender's own copy would only repeat the acknowledgement
+        const auto& message = env.room_message().message();
+        if(message.from().user_name() != m_user) {
+            m_replay.recordDelivered(message.from().user_name(), message.message(), now);
+        }
+    }
+
+    // Every request is answered by the envelope field that follows it
+    if(auto it = m_pending.find(response_case); it != m_pending.end() && !it->second.empty()) {
+        m_replay.recordLatency(response_case - 1, now - it->second.front());
+        it->second.pop_front();
+    }
+    if(m_awaiting_salt && m_salt) {
+        m_awaiting_salt = false;
+        pump();
+    }
+}
+
+bool Session::prepare(chat::Envelope& env) {
+    const auto& password = m_replay.options().password;
+    switch(env.payload_case()) {
+        case chat::Envelope::kInitialAuthRequest: {
+            m_salt.reset();
+            return true;
+        }
+        case chat::Envelope::kAuthRequest: {
+            auto* req = env.mutable_auth_request();
+            if(m_salt->empty()) {
+                // A user without a salt logs in with the plain password and gets one
+                const auto salt = common::password::generate_salt();
+                req->set_password(password);
+                req->set_salt(salt);
+                req->set_hash(m_replay.hashFor(salt));
+            } else {
+                req->set_hash(m_replay.hashFor(*m_salt));
+            }
+            return true;
+        }
+        case chat::Envelope::kRegisterRequest: {
+            const auto salt = common::password::generate_salt();
+            env.mutable_register_request()->set_salt(salt);
+            env.mutable_register_request()->set_hash(m_replay.hashFor(salt));
+            return true;
+        }
+        case chat::Envelope::kResumeSessionRequest: {
+            auto& recorded = m_recorded.requests[m_next].resume_user;
+            if(auto token = m_replay.token(recorded)) {
+                env.mutable_resume_session_request()->set_session_token(*token);
+            }
+            return true;
+        }
+        case chat::Envelope::kChangePasswordRequest: {
+            // Would lock the replayed user out of later sessions
+            return false;
+        }
+        default: {
+            return true;
+        }
+    }
+}
+
+void Session::pump() {
+    while(!m_closed && m_next < m_recorded.requests.size()) {
+        auto& request = m_recorded.requests[m_next];
+        const auto due = m_replay.due(request.at_us);
+        const auto now = Clock::now();
+        if(now < due) {
+            if(!m_timer_armed) {
+                m_timer_armed = true;
+                m_loop->runAfter(std::chrono::duration<double>(due - now).count(), [self = shared_from_this()]() {
+                    self->m_timer_armed = false;
+                    self->pump();
+                });
+            }
+            return;
+        }
+        if(request.env.has_auth_request() && !m_salt) {
+            // The hash depends on the salt the server is about to send
+            m_awaiting_salt = true;
+            return;
+        }
+
+        if(!prepare(request.env)) {
+            m_replay.recordSkipped();
+            ++m_next;
+            continue;
+        }
+        m_replay.recordLag(now - due);
+        m_pending[request.env.payload_case() + 1].push_back(now);
+        if(request.env.has_send_message_request()) {
+            m_replay.recordSent(m_user, request.env.send_message_request().message(), now);
+        }
+        m_conn->send(request.env.SerializeAsString(), drogon::WebSocketMessageType::Binary);
+        ++m_next;
+    }
+}
+
+void Session::close() {
+    if(m_closed) {
+        return;
+    }
+    m_closed = true;
+    for(const auto& [response_case, sent] : m_pending) {
+        if(!sent.empty()) {
+            m_replay.recordUnanswered(response_case - 1, sent.size());
+        }
+    }
+    m_pending.clear();
+    if(m_client) {
+        m_client->stop();
+    }
+    m_replay.sessionFinished();
+}
+
+// Registers the users of a capture and creates its rooms over one connection, one request
+// at a time. Room ids are handed out in creation order, so on a server without rooms the
+// capture's ids exist once as many rooms as the largest of them have been created.
+class Seeder : public std::enable_shared_from_this<Seeder> {
+public:
+    Seeder(Replay& replay, std::function<void()> done) : m_replay(replay), m_done(std::move(done)) {}
+
+    void start();
+
+private:
+    void onMessage(const std::string& bytes);
+    void next();
+    void finish(const std::string& error = {});
+
+    Replay& m_replay;
+    std::function<void()> m_done;
+    drogon::WebSocketClientPtr m_client;
+    std::deque<chat::Envelope> m_steps;
+    std::size_t m_failed = 0;
+    bool m_finished = false;
+};
+
+void Seeder::start() {
+    for(const auto& user : m_replay.users()) {
+        chat::Envelope initial;
+        initial.mutable_initial_register_request()->set_username(user);
+        m_steps.push_back(std::move(initial));
+        const auto salt = common::password::generate_salt();
+        chat::Envelope reg;
+        reg.mutable_register_request()->set_salt(salt);
+        reg.mutable_register_request()->set_hash(m_replay.hashFor(salt));
+        m_steps.push_back(std::move(reg));
+    }
+    if(m_replay.maxRoomId() > 0 && !m_replay.users().empty()) {
+        // Rooms are created by the first user; the auth hash is filled in once the salt arrives
+        chat::Envelope initial;
+        initial.mutable_initial_auth_request()->set_username(*m_replay.users().begin());
+        m_steps.push_back(std::move(initial));
+        chat::Envelope auth;
+        auth.mutable_auth_request();
+        m_steps.push_back(std::move(auth));
+        for(int32_t i = 1; i <= m_replay.maxRoomId(); ++i) {
+            chat::Envelope create;
+            create.mutable_create_room_request()->set_room_name("replay room " + std::to_string(i));
+            m_steps.push_back(std::move(create));
+        }
+    }
+    std::cout << "Seeding " << m_replay.users().size() << " users and " << m_replay.maxRoomId() << " rooms\n";
+
+    const auto [server, path] = common::splitUrl(m_replay.options().url);
+    m_client = drogon::WebSocketClient::newWebSocketClient(server, drogon::app().getLoop());
+    auto req = drogon::HttpRequest::newHttpRequest();
+    req->setPath(path);
+    m_client->setMessageHandler([weak = weak_from_this()](const std::string& message,
+                                                         const drogon::WebSocketClientPtr&,
+                                                         const drogon::WebSocketMessageType& type) {
+        if(auto seeder = weak.lock(); seeder && type == drogon::WebSocketMessageType::Binary) {
+            seeder->onMessage(message);
+        }
+    });
+    m_client->setConnectionClosedHandler([weak = weak_from_this()](const drogon::WebSocketClientPtr&) {
+        if(auto seeder = weak.lock()) {
+            seeder->finish("the connection was closed");
+        }
+    });
+    // The requests start with the ServerHello
+    m_client->connectToServer(req, [self = shared_from_this()](drogon::ReqResult result,
+                                                               const drogon::HttpResponsePtr&,
+                                                               const drogon::WebSocketClientPtr&) {
+        if(result != drogon::ReqResult::Ok) {
+            self->finish("cannot connect");
+        }
+    });
+}
+
+void Seeder::onMessage(const std::string& bytes) {
+    chat::Envelope env;
+    if(!env.ParseFromString(bytes)) {
+        return;
+    }
+    const chat::Status* status = nullptr;
+    switch(env.payload_case()) {
+        case chat::Envelope::kServerHello: {
+            if(env.server_hello().has_retry_after_ms()) {
+                finish("the server refused the connection");
+            } else {
+                next();
+            }
+            return;
+        }
+        case chat::Envelope::kInitialRegisterResponse: status = &env.initial_register_response().status(); break;
+        case chat::Envelope::kRegisterResponse: status = &env.register_response().status(); break;
+        case chat::Envelope::kAuthResponse: status = &env.auth_response().status(); break;
+        case chat::Envelope::kCreateRoomResponse: status = &env.create_room_response().status(); break;
+        case chat::Envelope::kInitialAuthResponse: {
+            status = &env.initial_auth_response().status();
+            if(!m_steps.empty() && m_steps.front().has_auth_request()) {
+                m_steps.front().mutable_auth_request()->set_hash(m_replay.hashFor(env.initial_auth_response().salt()));
+            }
+            break;
+        }
+        default: {
+            // Broadcasts such as NewRoomCreated
+            return;
+        }
+    }
+    if(status->code() != chat::STATUS_SUCCESS) {
+        // Users that already exist fail to register, which is fine
+        ++m_failed;
+    }
+    next();
+}
+
+void Seeder::next() {
+    if(m_steps.empty()) {
+        finish();
+        return;
+    }
+    m_client->getConnection()->send(m_steps.front().SerializeAsString(), drogon::WebSocketMessageType::Binary);
+    m_steps.pop_front();
+}
+
+void Seeder::finish(const std::string& error) {
+    if(m_finished) {
+        return;
+    }
+    m_finished = true;
+    if(!error.empty()) {
+        std::cerr << "Seeding stopped: " << error << "\n";
+    }
+    std::cout << "Seeded with " << m_failed << " failed requests\n";
+    if(m_client) {
+        m_client->stop();
+    }
+    drogon::app().getLoop()->queueInLoop(m_done);
+}
+
+std::optional<Options> parseOptions(int argc, char** argv) {
+    Options options;
+    for(int i = 1; i < argc; ++i) {
+        const std::string_view arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if(arg == "--url" && has_value) {
+            options.url = argv[++i];
+        } else if(arg == "--speed" && has_value) {
+            options.speed = std::strtod(argv[++i], nullptr);
+        } else if(arg == "--password" && has_value) {
+            options.password = argv[++i];
+        } else if(arg == "--threads" && has_value) {
+            options.threads = std::strtoul(argv[++i], nullptr, 10);
+        } else if(arg == "--seed") {
+            options.seed = true;
+        } else if(arg == "--metrics" && has_value) {
+            options.metrics = argv[++i];
+        } else if(!arg.starts_with("--") && options.capture.empty()) {
+            options.capture = arg;
+        } else {
+            return std::nullopt;
+        }
+    }
+    if(options.capture.empty() || options.speed <= 0 || options.threads == 0) {
+        return std::nullopt;
+    }
+    return options;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    auto options = parseOptions(argc, argv);
+    if(!options) {
+        std::cerr << "Usage: " << argv[0]
+                  << " <capture> [--url ws://127.0.0.1:8849/ws] [--speed 1] [--password secret] [--threads 4] [--seed]"
+                  << " [--metrics http://127.0.0.1:8849/metrics]\n";
+        return 1;
+    }
+
+    Replay replay(std::move(*options));
+    if(!replay.load()) {
+        return 1;
+    }
+
+    drogon::app().setThreadNum(replay.options().threads);
+    drogon::app().setLogLevel(trantor::Logger::kWarn);
+    std::shared_ptr<Seeder> seeder;
+    drogon::app().registerBeginningAdvice([&replay, &seeder]() {
+        if(!replay.options().seed) {
+            replay.start();
+            return;
+        }
+        seeder = std::make_shared<Seeder>(replay, [&replay]() { replay.start(); });
+        seeder->start();
+    });
+    drogon::app().run();
+    return 0;
+}